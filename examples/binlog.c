@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012 Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <taningia/error.h>
+#include <taningia/log.h>
+#include <taningia/binlog.h>
+
+/* Usage:
+ *
+ *   binlog FILE       Logs some messages in FILE and decodes them
+ *   binlog -d FILE    Only decodes FILE
+ */
+
+static int
+decode (const char *path)
+{
+  /* The decoder doesn't need the program that wrote the file, only
+   * the file itself. */
+  if (ta_binlog_decode_file (path, stdout) == TA_ERROR)
+    {
+      fprintf (stderr, "%s\n", ta_error_last ()->message);
+      return 1;
+    }
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  ta_binlog_t *binlog;
+  ta_log_t *log;
+  int i;
+
+  if (argc == 3 && strcmp (argv[1], "-d") == 0)
+    return decode (argv[2]);
+  if (argc != 2)
+    {
+      fprintf (stderr, "Usage: %s [-d] FILE\n", argv[0]);
+      return 1;
+    }
+
+  /* The file keeps the last 1024 records. Since it is mapped in
+   * memory, they are there even if the program crashes. */
+  if ((binlog = ta_binlog_new_file (argv[1], 1024)) == NULL)
+    {
+      fprintf (stderr, "%s\n", ta_error_last ()->message);
+      return 1;
+    }
+
+  /* From now on the messages of this log are not formatted, their
+   * arguments are copied to the binary log. The log holds a reference
+   * to it. */
+  log = ta_log_new ("binlog-example");
+  ta_log_set_level (log, TA_LOG_DEBUG);
+  ta_log_set_binlog (log, binlog);
+  ta_object_unref (binlog);
+
+  for (i = 0; i < 5; i++)
+    ta_log_debug (log, "Received stanza %d from %s (%.2f ms)", i,
+                  "someone@localhost", i * 0.25);
+  ta_log_warn (log, "%s", "That's all");
+
+  ta_object_unref (log);
+  return decode (argv[1]);
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Load generator for pubsub workloads. It subscribes to a node,
+ * publishes items through a pipelined publisher and keeps listening
+ * for events for a while. In the end it reports the publish
+ * throughput, the time taken by each publish request and the delivery
+ * latency of the events.
+ *
+ * It is meant to be used with `pubsub-server', which runs in the same
+ * host, so the latency can be measured with the monotonic clock
+ * carried by the items. Events without a timestamp are only counted.
+ *
+ *   $ ./pubsub-server -r 1000 &
+ *   $ ./pubsub-bench bench@localhost secret -n 100000 -w 64 -s 5
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <iksemel.h>
+#include <taningia/common.h>
+#include <taningia/xmpp.h>
+#include <taningia/pubsub.h>
+#include <taningia/publisher.h>
+
+#define BENCH_NS "urn:taningia:bench"
+
+struct samples {
+  double *values;
+  int len;
+  int cap;
+};
+
+static const char *service = "pubsub.localhost", *node = "/bench";
+static ta_pubsub_publisher_t *publisher;
+static struct samples publish_lat, event_lat;
+static unsigned long long *sent_at;
+static unsigned long long publish_start, publish_end;
+static int items = 10000, window = 32, payload_size = 64;
+static int published = 0, failed = 0, events = 0, subscribed = 0;
+static char *payload_text;
+
+static unsigned long long
+_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+_samples_add (struct samples *s, double value)
+{
+  if (s->len == s->cap)
+    {
+      s->cap = s->cap ? s->cap * 2 : 1024;
+      s->values = realloc (s->values, s->cap * sizeof (double));
+    }
+  s->values[s->len++] = value;
+}
+
+static int
+_compare (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+_samples_report (const char *name, struct samples *s)
+{
+  if (s->len == 0)
+    {
+      printf ("%s: no samples\n", name);
+      return;
+    }
+  qsort (s->values, s->len, sizeof (double), _compare);
+  printf ("%s (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+          name,
+          s->values[(int) (0.5 * (s->len - 1))],
+          s->values[(int) (0.9 * (s->len - 1))],
+          s->values[(int) (0.99 * (s->len - 1))],
+          s->values[(int) (0.999 * (s->len - 1))],
+          s->values[s->len - 1]);
+}
+
+static void
+_published_cb (ta_pubsub_publisher_t *TA_UNUSED(pub),
+               const char *TA_UNUSED(id), int status,
+               iks *TA_UNUSED(answer), void *data)
+{
+  long i = (long) data;
+  if (status == TA_OK)
+    _samples_add (&publish_lat, (_now_ns () - sent_at[i]) / 1000.0);
+  else
+    failed++;
+  if (++published == items)
+    publish_end = _now_ns ();
+}
+
+static void
+_publish_all (void)
+{
+  iks *payload;
+  char id[32], num[32];
+  long i;
+
+  publish_start = _now_ns ();
+  for (i = 0; i < items; i++)
+    {
+      snprintf (id, sizeof (id), "b%ld", i);
+      payload = iks_new ("blob");
+      iks_insert_attrib (payload, "xmlns", BENCH_NS);
+      sent_at[i] = _now_ns ();
+      snprintf (num, sizeof (num), "%llu", sent_at[i]);
+      iks_insert_attrib (payload, "sent", num);
+      iks_insert_cdata (payload, payload_text, payload_size);
+      ta_pubsub_publisher_publish (publisher, node, id, payload,
+                                   _published_cb, (void *) i);
+    }
+}
+
+static void
+_subscribed_cb (ta_xmpp_client_t *TA_UNUSED(client), iks *answer,
+                void *TA_UNUSED(data))
+{
+  if (answer == NULL || iks_strcmp (iks_find_attrib (answer, "type"),
+                                    "result") != 0)
+    fprintf (stderr, "Subscription failed, events won't be measured\n");
+  subscribed = 1;
+  _publish_all ();
+}
+
+static int
+_event_cb (const ta_pubsub_event_t *event, void *TA_UNUSED(data))
+{
+  const char *sent;
+  events++;
+  if (event->payload &&
+      (sent = iks_find_attrib (event->payload, "sent")) != NULL)
+    _samples_add (&event_lat, (_now_ns () - strtoull (sent, NULL, 10)) /
+                  1000.0);
+  return 0;
+}
+
+static int
+_message_cb (ta_xmpp_client_t *TA_UNUSED(client), void *data,
+             void *TA_UNUSED(hdata))
+{
+  ikspak *pak = (ikspak *) data;
+  ta_pubsub_parse_event (pak->x, 0, _event_cb, NULL);
+  return 0;
+}
+
+static int
+_auth_cb (ta_xmpp_client_t *client, void *TA_UNUSED(data),
+          void *TA_UNUSED(hdata))
+{
+  const char *jid = ta_xmpp_client_get_jid (client);
+  iks *iq;
+
+  publisher = ta_pubsub_publisher_new (client, jid, service, window);
+  iq = ta_pubsub_node_subscribe (jid, service, node, jid);
+  ta_xmpp_client_send_and_filter (client, iq, _subscribed_cb, NULL, NULL);
+  iks_delete (iq);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  ta_xmpp_client_t *client;
+  const char *host = "127.0.0.1";
+  unsigned long long listen_end = 0;
+  int opt, port = 5222, seconds = 2;
+  double elapsed;
+
+  while ((opt = getopt (argc, argv, "H:p:n:w:s:N:S:P:")) != -1)
+    switch (opt)
+      {
+      case 'H': host = optarg; break;
+      case 'p': port = atoi (optarg); break;
+      case 'n': items = atoi (optarg); break;
+      case 'w': window = atoi (optarg); break;
+      case 's': seconds = atoi (optarg); break;
+      case 'N': node = optarg; break;
+      case 'S': service = optarg; break;
+      case 'P': payload_size = atoi (optarg); break;
+      default:
+        goto usage;
+      }
+  if (argc - optind < 2 || items < 1 || payload_size < 1)
+    goto usage;
+
+  sent_at = calloc (items, sizeof (unsigned long long));
+  payload_text = malloc (payload_size);
+  memset (payload_text, 'x', payload_size);
+
+  client = ta_xmpp_client_new (argv[optind], argv[optind + 1], host, port);
+  ta_xmpp_client_event_connect (client, "authenticated",
+                                (ta_xmpp_client_hook_t) _auth_cb, NULL);
+  ta_xmpp_client_event_connect (client, "message-received",
+                                (ta_xmpp_client_hook_t) _message_cb, NULL);
+  if (ta_xmpp_client_connect (client) != TA_OK)
+    {
+      const ta_error_t *error = ta_error_last ();
+      fprintf (stderr, "(%d) %s\n", error->code, error->message);
+      ta_object_unref (client);
+      return 1;
+    }
+
+  /* Publishing everything and then listening to events for a while */
+  while (ta_xmpp_client_is_running (client) == TA_OK)
+    {
+      ta_xmpp_client_process (client, 50);
+      if (publish_end && !listen_end)
+        listen_end = publish_end + seconds * 1000000000ULL;
+      if (listen_end && _now_ns () >= listen_end)
+        break;
+    }
+
+  if (!subscribed || !publish_end)
+    fprintf (stderr, "Connection closed before the end of the run\n");
+  else
+    {
+      elapsed = (publish_end - publish_start) / 1e9;
+      printf ("published %d items (%d failed) in %.3fs: %.0f items/s\n",
+              items, failed, elapsed, items / elapsed);
+      _samples_report ("publish round trip", &publish_lat);
+      printf ("received %d events\n", events);
+      _samples_report ("event latency", &event_lat);
+    }
+
+  ta_xmpp_client_disconnect (client);
+  if (publisher)
+    ta_object_unref (publisher);
+  ta_object_unref (client);
+  free (publish_lat.values);
+  free (event_lat.values);
+  free (sent_at);
+  free (payload_text);
+  return 0;
+
+ usage:
+  fprintf (stderr, "Usage: %s: [-H <host>] [-p <port>] [-n <items>] "
+           "[-w <window>] [-s <seconds>] [-N <node>] [-S <service>] "
+           "[-P <payload size>] <jid> <passwd>\n", argv[0]);
+  return 1;
+}
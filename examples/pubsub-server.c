@@ -0,0 +1,723 @@
+/*
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A tiny XMPP server that speaks just enough of the stream, SASL
+ * PLAIN, resource binding and XEP-0060 to answer the requests built
+ * by the pubsub module. It is meant to stand in for a real server
+ * when benchmarking pubsub workloads (see `pubsub-bench.c'), so it
+ * keeps everything in memory, accepts any password and doesn't check
+ * permissions.
+ *
+ * Besides relaying published items to the subscribers of a node, it
+ * can push `<tick/>' items to a node at a fixed rate. Each tick carries
+ * the monotonic time when it was sent, so clients in the same host
+ * can measure the delivery latency.
+ *
+ * It is a standalone program run next to the benchmark, not a part of
+ * the check suite: the suites fake the server side of single
+ * exchanges over the socket fixtures of `tests/fixtures.c'. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <iksemel.h>
+#include <taningia/common.h>
+#include <taningia/pubsub.h>
+
+#define MAX_CONNS      256
+#define MAX_ITEMS      1024     /* Items kept by each node */
+#define MAX_SUBS       256      /* Subscribers of each node */
+#define MAX_RATE       1000000  /* Ticks per second */
+#define BENCH_NS       "urn:taningia:bench"
+#define STANZAS_NS     "urn:ietf:params:xml:ns:xmpp-stanzas"
+#define PS_OWNER_NS    "http://jabber.org/protocol/pubsub#owner"
+
+struct conn {
+  int fd;
+  iksparser *parser;
+  int authenticated;
+  int closing;
+  char user[64];
+  char domain[64];
+  char jid[256];
+};
+
+struct item {
+  char *id;
+  iks *payload;               /* Lives in its own stack */
+};
+
+struct node {
+  struct node *next;
+  char *name;
+  struct item items[MAX_ITEMS];
+  int first;                  /* Ring of the last MAX_ITEMS items */
+  int count;
+  struct conn *subs[MAX_SUBS];
+  int nsubs;
+};
+
+static struct conn *conns[MAX_CONNS];
+static struct node *nodes;
+static unsigned long next_item = 0, next_stream = 0;
+static unsigned long published = 0, delivered = 0;
+static volatile sig_atomic_t stop = 0;
+
+static unsigned long long
+_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Nodes */
+
+static struct node *
+_node_find (const char *name, int create)
+{
+  struct node *node;
+  for (node = nodes; node; node = node->next)
+    if (strcmp (node->name, name) == 0)
+      return node;
+  if (!create)
+    return NULL;
+  node = calloc (1, sizeof (struct node));
+  node->name = strdup (name);
+  node->next = nodes;
+  nodes = node;
+  return node;
+}
+
+static void
+_node_free (struct node *node)
+{
+  int i;
+  for (i = 0; i < node->count; i++)
+    {
+      struct item *item = &node->items[(node->first + i) % MAX_ITEMS];
+      free (item->id);
+      iks_delete (item->payload);
+    }
+  free (node->name);
+  free (node);
+}
+
+static void
+_node_delete (const char *name)
+{
+  struct node **prev, *node;
+  for (prev = &nodes; (node = *prev) != NULL; prev = &node->next)
+    if (strcmp (node->name, name) == 0)
+      {
+        *prev = node->next;
+        _node_free (node);
+        return;
+      }
+}
+
+static void
+_node_add_item (struct node *node, const char *id, iks *payload)
+{
+  struct item *item;
+  if (node->count == MAX_ITEMS)
+    {
+      item = &node->items[node->first];
+      free (item->id);
+      iks_delete (item->payload);
+      node->first = (node->first + 1) % MAX_ITEMS;
+      node->count--;
+    }
+  item = &node->items[(node->first + node->count) % MAX_ITEMS];
+  item->id = strdup (id);
+  item->payload = payload ? iks_copy (payload) : NULL;
+  node->count++;
+}
+
+static void
+_node_subscribe (struct node *node, struct conn *conn)
+{
+  int i;
+  for (i = 0; i < node->nsubs; i++)
+    if (node->subs[i] == conn)
+      return;
+  if (node->nsubs < MAX_SUBS)
+    node->subs[node->nsubs++] = conn;
+}
+
+static void
+_node_unsubscribe (struct node *node, struct conn *conn)
+{
+  int i;
+  for (i = 0; i < node->nsubs; i++)
+    if (node->subs[i] == conn)
+      {
+        node->subs[i] = node->subs[--node->nsubs];
+        return;
+      }
+}
+
+/* Sends an event with `item' to all the subscribers of `node' */
+static void
+_node_notify (struct node *node, const char *id, iks *payload)
+{
+  iks *msg, *item;
+  int i;
+
+  if (node->nsubs == 0)
+    return;
+  msg = iks_new ("message");
+  iks_insert_attrib (msg, "from", "pubsub.localhost");
+  item = iks_insert (iks_insert (msg, "event"), "items");
+  iks_insert_attrib (iks_parent (item), "xmlns", TA_PUBSUB_EVENT_NS);
+  iks_insert_attrib (item, "node", node->name);
+  item = iks_insert (item, "item");
+  iks_insert_attrib (item, "id", id);
+  if (payload)
+    iks_insert_node (item, iks_copy_within (payload, iks_stack (msg)));
+
+  for (i = 0; i < node->nsubs; i++)
+    {
+      iks_insert_attrib (msg, "to", node->subs[i]->jid);
+      if (iks_send (node->subs[i]->parser, msg) == IKS_OK)
+        delivered++;
+    }
+  iks_delete (msg);
+}
+
+/* Answers */
+
+static iks *
+_make_answer (iks *iq, const char *type)
+{
+  iks *answer = iks_new ("iq");
+  iks_insert_attrib (answer, "type", type);
+  if (iks_find_attrib (iq, "id"))
+    iks_insert_attrib (answer, "id", iks_find_attrib (iq, "id"));
+  if (iks_find_attrib (iq, "to"))
+    iks_insert_attrib (answer, "from", iks_find_attrib (iq, "to"));
+  if (iks_find_attrib (iq, "from"))
+    iks_insert_attrib (answer, "to", iks_find_attrib (iq, "from"));
+  return answer;
+}
+
+static void
+_send_error (struct conn *conn, iks *iq, const char *type,
+             const char *condition)
+{
+  iks *answer, *error;
+  answer = _make_answer (iq, "error");
+  error = iks_insert (answer, "error");
+  iks_insert_attrib (error, "type", type);
+  iks_insert_attrib (iks_insert (error, condition), "xmlns", STANZAS_NS);
+  iks_send (conn->parser, answer);
+  iks_delete (answer);
+}
+
+static void
+_send_result (struct conn *conn, iks *iq)
+{
+  iks *answer = _make_answer (iq, "result");
+  iks_send (conn->parser, answer);
+  iks_delete (answer);
+}
+
+static void
+_handle_publish (struct conn *conn, iks *iq, iks *publish)
+{
+  struct node *node;
+  iks *answer, *item, *child, *done;
+  const char *name = iks_find_attrib (publish, "node");
+  char sid[32];
+
+  if (name == NULL)
+    {
+      _send_error (conn, iq, "modify", "bad-request");
+      return;
+    }
+
+  /* Nodes are created on the first publish */
+  node = _node_find (name, 1);
+  answer = _make_answer (iq, "result");
+  child = iks_insert (iks_insert (answer, "pubsub"), "publish");
+  iks_insert_attrib (iks_parent (child), "xmlns", TA_PUBSUB_NS);
+  iks_insert_attrib (child, "node", name);
+
+  for (item = iks_first_tag (publish); item; item = iks_next_tag (item))
+    {
+      const char *id = iks_find_attrib (item, "id");
+      if (id == NULL)
+        {
+          snprintf (sid, sizeof (sid), "item%lu", next_item++);
+          id = sid;
+        }
+      _node_add_item (node, id, iks_first_tag (item));
+      iks_insert_attrib (iks_insert (child, "item"), "id", id);
+      published++;
+    }
+  iks_send (conn->parser, answer);
+
+  /* The items of the answer hold the ids, in the same order */
+  for (item = iks_first_tag (publish), done = iks_first_tag (child); item;
+       item = iks_next_tag (item), done = iks_next_tag (done))
+    _node_notify (node, iks_find_attrib (done, "id"), iks_first_tag (item));
+  iks_delete (answer);
+}
+
+static void
+_handle_subscribe (struct conn *conn, iks *iq, iks *subscribe, int on)
+{
+  struct node *node;
+  iks *answer, *sub;
+  const char *name = iks_find_attrib (subscribe, "node");
+
+  if (name == NULL || (node = _node_find (name, on)) == NULL)
+    {
+      _send_error (conn, iq, "cancel", "item-not-found");
+      return;
+    }
+  if (!on)
+    {
+      _node_unsubscribe (node, conn);
+      _send_result (conn, iq);
+      return;
+    }
+
+  _node_subscribe (node, conn);
+  answer = _make_answer (iq, "result");
+  sub = iks_insert (iks_insert (answer, "pubsub"), "subscription");
+  iks_insert_attrib (iks_parent (sub), "xmlns", TA_PUBSUB_NS);
+  iks_insert_attrib (sub, "node", name);
+  iks_insert_attrib (sub, "jid", conn->jid);
+  iks_insert_attrib (sub, "subscription", "subscribed");
+  iks_send (conn->parser, answer);
+  iks_delete (answer);
+}
+
+/* Answers item queries, honoring the result set (XEP-0059) of the
+ * request if there is one */
+static void
+_handle_items (struct conn *conn, iks *iq, iks *pubsub, iks *items)
+{
+  struct node *node;
+  struct item *item;
+  iks *answer, *list, *set, *child;
+  const char *name = iks_find_attrib (items, "node"), *after;
+  char num[32];
+  int max, start = 0, i, n;
+
+  if (name == NULL || (node = _node_find (name, 0)) == NULL)
+    {
+      _send_error (conn, iq, "cancel", "item-not-found");
+      return;
+    }
+
+  set = iks_find (pubsub, "set");
+  max = node->count;
+  if (iks_find_cdata (set, "max"))
+    max = atoi (iks_find_cdata (set, "max"));
+  else if (iks_find_attrib (items, "max_items"))
+    max = atoi (iks_find_attrib (items, "max_items"));
+  if ((after = iks_find_cdata (set, "after")) != NULL)
+    for (i = 0; i < node->count; i++)
+      if (strcmp (node->items[(node->first + i) % MAX_ITEMS].id, after) == 0)
+        {
+          start = i + 1;
+          break;
+        }
+
+  answer = _make_answer (iq, "result");
+  list = iks_insert (iks_insert (answer, "pubsub"), "items");
+  iks_insert_attrib (iks_parent (list), "xmlns", TA_PUBSUB_NS);
+  iks_insert_attrib (list, "node", name);
+  for (i = start, n = 0; i < node->count && n < max; i++, n++)
+    {
+      item = &node->items[(node->first + i) % MAX_ITEMS];
+      child = iks_insert (list, "item");
+      iks_insert_attrib (child, "id", item->id);
+      if (item->payload)
+        iks_insert_node (child, iks_copy_within (item->payload,
+                                                 iks_stack (answer)));
+    }
+
+  if (set)
+    {
+      set = iks_insert (iks_parent (list), "set");
+      iks_insert_attrib (set, "xmlns", TA_RSM_NS);
+      if (n > 0)
+        {
+          item = &node->items[(node->first + start) % MAX_ITEMS];
+          iks_insert_cdata (iks_insert (set, "first"), item->id, 0);
+          item = &node->items[(node->first + start + n - 1) % MAX_ITEMS];
+          iks_insert_cdata (iks_insert (set, "last"), item->id, 0);
+        }
+      snprintf (num, sizeof (num), "%d", node->count);
+      iks_insert_cdata (iks_insert (set, "count"), num, 0);
+    }
+  iks_send (conn->parser, answer);
+  iks_delete (answer);
+}
+
+static void
+_handle_pubsub (struct conn *conn, iks *iq, iks *pubsub)
+{
+  iks *op = iks_first_tag (pubsub);
+  const char *name = op ? iks_name (op) : "", *node;
+
+  if (strcmp (name, "publish") == 0)
+    _handle_publish (conn, iq, op);
+  else if (strcmp (name, "subscribe") == 0)
+    _handle_subscribe (conn, iq, op, 1);
+  else if (strcmp (name, "unsubscribe") == 0)
+    _handle_subscribe (conn, iq, op, 0);
+  else if (strcmp (name, "items") == 0)
+    _handle_items (conn, iq, pubsub, op);
+  else if (strcmp (name, "create") == 0)
+    {
+      if ((node = iks_find_attrib (op, "node")) == NULL)
+        _send_error (conn, iq, "modify", "bad-request");
+      else if (_node_find (node, 0) != NULL)
+        _send_error (conn, iq, "cancel", "conflict");
+      else
+        {
+          _node_find (node, 1);
+          _send_result (conn, iq);
+        }
+    }
+  else if (strcmp (name, "delete") == 0)
+    {
+      if ((node = iks_find_attrib (op, "node")) != NULL)
+        _node_delete (node);
+      _send_result (conn, iq);
+    }
+  else
+    /* Everything else is accepted and ignored */
+    _send_result (conn, iq);
+}
+
+static void
+_handle_iq (struct conn *conn, iks *iq)
+{
+  iks *child, *answer, *bind;
+  const char *resource;
+
+  if ((child = iks_find (iq, "pubsub")) != NULL)
+    _handle_pubsub (conn, iq, child);
+  else if ((child = iks_find (iq, "bind")) != NULL)
+    {
+      resource = iks_find_cdata (child, "resource");
+      snprintf (conn->jid, sizeof (conn->jid), "%s@%s/%s", conn->user,
+                conn->domain, resource ? resource : "bench");
+      answer = _make_answer (iq, "result");
+      bind = iks_insert (answer, "bind");
+      iks_insert_attrib (bind, "xmlns", IKS_NS_XMPP_BIND);
+      iks_insert_cdata (iks_insert (bind, "jid"), conn->jid, 0);
+      iks_send (conn->parser, answer);
+      iks_delete (answer);
+    }
+  else if (iks_find (iq, "session") != NULL)
+    _send_result (conn, iq);
+  else if (iks_strcmp (iks_find_attrib (iq, "type"), "get") == 0)
+    _send_error (conn, iq, "cancel", "service-unavailable");
+  else
+    _send_result (conn, iq);
+}
+
+/* Size of the data encoded in `data', the decoder doesn't tell it */
+static size_t
+_base64_length (const char *data)
+{
+  size_t chars = 0;
+  for (; *data && *data != '='; data++)
+    if (!isspace ((unsigned char) *data))
+      chars++;
+  return chars * 6 / 8;
+}
+
+/* SASL PLAIN: `authzid \0 authcid \0 password', any password is
+ * accepted */
+static void
+_handle_auth (struct conn *conn, iks *auth)
+{
+  char *plain;
+  const char *data = iks_cdata (iks_child (auth));
+  size_t len, skip;
+
+  if (iks_strcmp (iks_find_attrib (auth, "mechanism"), "PLAIN") != 0 ||
+      data == NULL || (plain = iks_base64_decode (data)) == NULL)
+    {
+      iks_send_raw (conn->parser, "<failure xmlns='" IKS_NS_XMPP_SASL "'>"
+                    "<invalid-mechanism/></failure>");
+      return;
+    }
+
+  /* The authcid comes after the first NUL, payloads without it are
+   * refused instead of reading past the decoded data */
+  len = _base64_length (data);
+  if ((skip = strlen (plain) + 1) >= len)
+    {
+      iks_free (plain);
+      iks_send_raw (conn->parser, "<failure xmlns='" IKS_NS_XMPP_SASL "'>"
+                    "<malformed-request/></failure>");
+      return;
+    }
+  snprintf (conn->user, sizeof (conn->user), "%.*s",
+            (int) (len - skip), plain + skip);
+  iks_free (plain);
+  conn->authenticated = 1;
+  iks_send_raw (conn->parser, "<success xmlns='" IKS_NS_XMPP_SASL "'/>");
+}
+
+static void
+_send_header (struct conn *conn, iks *stream)
+{
+  char header[512];
+  const char *to = iks_find_attrib (stream, "to");
+
+  snprintf (conn->domain, sizeof (conn->domain), "%s",
+            to ? to : "localhost");
+  snprintf (header, sizeof (header),
+            "<?xml version='1.0'?><stream:stream xmlns='" IKS_NS_CLIENT "' "
+            "xmlns:stream='http://etherx.jabber.org/streams' from='%s' "
+            "id='s%lu' version='1.0'>", conn->domain, next_stream++);
+  iks_send_raw (conn->parser, header);
+
+  /* Clients restart the stream after authenticating */
+  if (conn->authenticated)
+    iks_send_raw (conn->parser, "<stream:features>"
+                  "<bind xmlns='" IKS_NS_XMPP_BIND "'/>"
+                  "<session xmlns='" IKS_NS_XMPP_SESSION "'/>"
+                  "</stream:features>");
+  else
+    iks_send_raw (conn->parser, "<stream:features>"
+                  "<mechanisms xmlns='" IKS_NS_XMPP_SASL "'>"
+                  "<mechanism>PLAIN</mechanism></mechanisms>"
+                  "</stream:features>");
+}
+
+static int
+_stream_hook (void *data, int type, iks *node)
+{
+  struct conn *conn = (struct conn *) data;
+  const char *name;
+
+  switch (type)
+    {
+    case IKS_NODE_START:
+      _send_header (conn, node);
+      break;
+    case IKS_NODE_NORMAL:
+      name = iks_name (node);
+      if (strcmp (name, "auth") == 0)
+        _handle_auth (conn, node);
+      else if (!conn->authenticated)
+        conn->closing = 1;
+      else if (strcmp (name, "iq") == 0)
+        _handle_iq (conn, node);
+      break;
+    case IKS_NODE_STOP:
+    case IKS_NODE_ERROR:
+      conn->closing = 1;
+      break;
+    }
+  if (node)
+    iks_delete (node);
+  return IKS_OK;
+}
+
+/* Connections */
+
+static void
+_conn_accept (int lfd)
+{
+  struct conn *conn;
+  int fd, i;
+
+  if ((fd = accept (lfd, NULL, NULL)) < 0)
+    return;
+  for (i = 0; i < MAX_CONNS && conns[i]; i++)
+    ;
+  if (i == MAX_CONNS)
+    {
+      close (fd);
+      return;
+    }
+  conn = calloc (1, sizeof (struct conn));
+  conn->fd = fd;
+  conn->parser = iks_stream_new (IKS_NS_CLIENT, conn, _stream_hook);
+  iks_connect_fd (conn->parser, fd);
+  conns[i] = conn;
+}
+
+static void
+_conn_close (int i)
+{
+  struct conn *conn = conns[i];
+  struct node *node;
+  for (node = nodes; node; node = node->next)
+    _node_unsubscribe (node, conn);
+  iks_send_raw (conn->parser, "</stream:stream>");
+  iks_disconnect (conn->parser);
+  iks_parser_delete (conn->parser);
+  free (conn);
+  conns[i] = NULL;
+}
+
+static void
+_stop (int TA_UNUSED(sig))
+{
+  stop = 1;
+}
+
+/* Pushes a `<tick/>' to `node' */
+static void
+_tick (const char *name, unsigned long seq)
+{
+  struct node *node = _node_find (name, 1);
+  iks *tick;
+  char num[64], id[32];
+
+  tick = iks_new ("tick");
+  iks_insert_attrib (tick, "xmlns", BENCH_NS);
+  snprintf (num, sizeof (num), "%llu", _now_ns ());
+  iks_insert_attrib (tick, "sent", num);
+  snprintf (id, sizeof (id), "tick%lu", seq);
+  _node_notify (node, id, tick);
+  iks_delete (tick);
+}
+
+int
+main (int argc, char **argv)
+{
+  struct pollfd pfds[MAX_CONNS + 1];
+  int idx[MAX_CONNS + 1];
+  struct sockaddr_in addr;
+  struct node *node;
+  const char *tick_node = "/bench";
+  unsigned long long start, now, last_report;
+  unsigned long ticks = 0, due;
+  int lfd, opt, port = 5222, rate = 0, one = 1, i, n, timeout;
+
+  while ((opt = getopt (argc, argv, "p:r:n:")) != -1)
+    switch (opt)
+      {
+      case 'p': port = atoi (optarg); break;
+      case 'r': rate = atoi (optarg); break;
+      case 'n': tick_node = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s: [-p <port>] [-r <ticks/s>] "
+                 "[-n <tick node>]\n", argv[0]);
+        return 1;
+      }
+
+  /* The interval between ticks is computed in nanoseconds, it can't
+   * get to zero */
+  if (rate > MAX_RATE)
+    {
+      fprintf (stderr, "Rate limited to %d ticks/s\n", MAX_RATE);
+      rate = MAX_RATE;
+    }
+
+  if ((lfd = socket (AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+      perror ("socket");
+      return 1;
+    }
+  setsockopt (lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (port);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (lfd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (lfd, 64) < 0)
+    {
+      perror ("bind");
+      return 1;
+    }
+  printf ("Listening on 127.0.0.1:%d\n", port);
+  signal (SIGINT, _stop);
+  signal (SIGTERM, _stop);
+  signal (SIGPIPE, SIG_IGN);
+
+  start = last_report = _now_ns ();
+  while (!stop)
+    {
+      /* Ticks are sent in bursts when the loop falls behind, so the
+       * average rate is kept */
+      timeout = rate > 0 ? 1 : 1000;
+      pfds[0].fd = lfd;
+      pfds[0].events = POLLIN;
+      for (i = 0, n = 1; i < MAX_CONNS; i++)
+        if (conns[i])
+          {
+            pfds[n].fd = conns[i]->fd;
+            pfds[n].events = POLLIN;
+            idx[n] = i;
+            n++;
+          }
+      if (poll (pfds, n, timeout) < 0 && errno != EINTR)
+        {
+          perror ("poll");
+          break;
+        }
+
+      for (i = 1; i < n; i++)
+        if (pfds[i].revents && iks_recv (conns[idx[i]]->parser, 0) != IKS_OK)
+          conns[idx[i]]->closing = 1;
+      for (i = 0; i < MAX_CONNS; i++)
+        if (conns[i] && conns[i]->closing)
+          _conn_close (i);
+      if (pfds[0].revents & POLLIN)
+        _conn_accept (lfd);
+
+      now = _now_ns ();
+      if (rate > 0)
+        {
+          due = (unsigned long) ((now - start) / (1000000000ULL / rate));
+          while (ticks < due)
+            _tick (tick_node, ticks++);
+        }
+      if (now - last_report >= 1000000000ULL)
+        {
+          printf ("published: %lu, delivered: %lu\n", published, delivered);
+          last_report = now;
+        }
+    }
+
+  for (i = 0; i < MAX_CONNS; i++)
+    if (conns[i])
+      _conn_close (i);
+  while ((node = nodes) != NULL)
+    {
+      nodes = node->next;
+      _node_free (node);
+    }
+  close (lfd);
+  return 0;
+}
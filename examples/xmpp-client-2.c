@@ -34,8 +34,11 @@
 static void
 stanza_answered (ta_xmpp_client_t *client, iks *node, void *TA_UNUSED(data))
 {
-  printf ("Answer received from the server: %s\n",
-          iks_string (iks_stack (node), node));
+  if (node == NULL)
+    printf ("No answer from the server: %s\n", ta_error_last ()->message);
+  else
+    printf ("Answer received from the server: %s\n",
+            iks_string (iks_stack (node), node));
   printf ("Disconnecting\n");
   ta_xmpp_client_disconnect (client);
 }
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* This example connects many clients with the same account (but
+ * different resources) and drive all of them from a reactor with a
+ * couple threads, instead of running one thread per client. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iksemel.h>
+#include <taningia/common.h>
+#include <taningia/xmpp.h>
+#include <taningia/reactor.h>
+
+static ta_xmpp_reactor_t *reactor;
+static int total, finished;
+
+static int
+auth_cb (ta_xmpp_client_t *client, void *TA_UNUSED(data), void *TA_UNUSED(hdata))
+{
+  printf ("%s authenticated\n", ta_xmpp_client_get_jid (client));
+  ta_xmpp_client_send_presence (client, IKS_SHOW_AVAILABLE, "Hi!");
+
+  /* The reactor notices that the client is not running anymore and
+   * drops it */
+  ta_xmpp_client_disconnect (client);
+  if (__sync_add_and_fetch (&finished, 1) == total)
+    ta_xmpp_reactor_stop (reactor);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  ta_xmpp_client_t *client;
+  char jid[256];
+  int i, nthreads;
+
+  if (argc < 4)
+    {
+      fprintf (stderr, "Usage: %s: <jid> <passwd> <clients> [<threads>]\n",
+               argv[0]);
+      return 1;
+    }
+
+  total = atoi (argv[3]);
+  nthreads = argc > 4 ? atoi (argv[4]) : 2;
+  reactor = ta_xmpp_reactor_new (nthreads);
+
+  for (i = 0; i < total; i++)
+    {
+      snprintf (jid, sizeof (jid), "%s/reactor%d", argv[1], i);
+      client = ta_xmpp_client_new (jid, argv[2], NULL, 0);
+      ta_xmpp_client_event_connect (client, "authenticated",
+                                    (ta_xmpp_client_hook_t) auth_cb, NULL);
+      if (ta_xmpp_client_connect (client) != TA_OK ||
+          ta_xmpp_reactor_add (reactor, client) != TA_OK)
+        {
+          const ta_error_t *error = ta_error_last ();
+          fprintf (stderr, "(%d) %s\n", error->code, error->message);
+          ta_object_unref (client);
+          ta_object_unref (reactor);
+          return 1;
+        }
+
+      /* The reactor holds its own reference */
+      ta_object_unref (client);
+    }
+
+  ta_xmpp_reactor_run (reactor);
+  ta_object_unref (reactor);
+  return 0;
+}
@@ -0,0 +1,125 @@
+/* binlog.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_BINLOG_H_
+#define _TANINGIA_BINLOG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <taningia/log.h>
+
+/* Size of each record. Arguments that don't fit are truncated, long
+ * strings first. */
+#define TA_BINLOG_RECORD_SIZE 256
+
+/* Room for the names of the logs and the format strings */
+#define TA_BINLOG_DICT_SIZE (64 * 1024)
+
+/**
+ * @name: ta_binlog::new
+ * @type: constructor
+ * @param records: How many records are kept. When it is full, the
+ * oldest records are overwritten.
+ *
+ * Creates a binary log in memory. Logs using it (see
+ * `ta_log_set_binlog') don't format their messages, the level, the
+ * time, the address of the format string and the arguments are copied
+ * to a fixed size record instead. Each format string and log name is
+ * copied only once, to a dictionary, and the text is rendered later by
+ * `ta_binlog_decode'.
+ *
+ * Many threads can write to the same binary log without locks.
+ */
+ta_binlog_t *ta_binlog_new (int records);
+
+/**
+ * @name: ta_binlog::new_file
+ * @type: constructor
+ * @param path: File that will hold the records. It is created or
+ * truncated.
+ * @param records: See `ta_binlog_new'.
+ * @raise: TA_LOG_BINLOG_ERROR
+ *
+ * Creates a binary log mapped to a file, so the records survive a
+ * crash of the process. Returns NULL if the file can't be mapped.
+ */
+ta_binlog_t *ta_binlog_new_file (const char *path, int records);
+
+/**
+ * @name: ta_binlog::vwrite
+ * @type: method
+ *
+ * Writes a record. This is what logs call when they have a binary
+ * log, it is not usually called directly.
+ */
+void ta_binlog_vwrite (ta_binlog_t *binlog, ta_log_t *log,
+                       ta_log_level_t level, const char *fmt, va_list args);
+
+/**
+ * @name: ta_binlog::get_written
+ * @type: getter
+ *
+ * Returns how many records were written so far, including the
+ * overwritten ones.
+ */
+unsigned long ta_binlog_get_written (ta_binlog_t *binlog);
+
+/**
+ * @name: ta_binlog::dump
+ * @type: method
+ * @param fd: Where to write.
+ * @raise: TA_LOG_BINLOG_ERROR
+ *
+ * Writes the whole binary log to `fd' in the format read by
+ * `ta_binlog_decode'.
+ */
+int ta_binlog_dump (ta_binlog_t *binlog, int fd);
+
+/**
+ * @name: ta_binlog::decode
+ * @type: function
+ * @param data: Contents of a binary log file or dump.
+ * @param size: Size of `data'.
+ * @param out: Where the text is written.
+ * @raise: TA_LOG_BINLOG_ERROR
+ *
+ * Renders the records in the order they were written, one per line,
+ * like the messages of a text log. Returns how many records were
+ * found. Binary logs can only be decoded on the kind of machine that
+ * wrote them.
+ */
+int ta_binlog_decode (const void *data, size_t size, FILE *out);
+
+/**
+ * @name: ta_binlog::decode_file
+ * @type: function
+ * @raise: TA_LOG_BINLOG_ERROR
+ *
+ * Same as `ta_binlog_decode' for the contents of `path'.
+ */
+int ta_binlog_decode_file (const char *path, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_BINLOG_H_ */
@@ -33,10 +33,12 @@ typedef struct {
 void ta_buf_alloc (ta_buf_t *b, int initial_size);
 void ta_buf_dealloc (ta_buf_t *b);
 int ta_buf_cat (ta_buf_t *b, const char *s);
+int ta_buf_ncat (ta_buf_t *b, const char *s, int len);
 int ta_buf_catf (ta_buf_t *b, const char *s, ...);
 int ta_buf_vcatf (ta_buf_t *b, const char *s, va_list args);
 const char *ta_buf_cstr (ta_buf_t *b);
 char *ta_buf_dump (ta_buf_t *b);
+void ta_buf_reset (ta_buf_t *b);
 
 
 #endif  /* _TANINGIA_BUF_H_ */
@@ -50,12 +50,39 @@ enum {
   XMPP_SEND_ERROR = 302,
   TA_XMPP_NETWORK_ERROR = 303,
   TA_XMPP_TLS_ERROR = 304,
-  TA_XMPP_IO_ERROR = 305
+  TA_XMPP_IO_ERROR = 305,
+  TA_XMPP_TIMEOUT_ERROR = 306,
+  TA_XMPP_REACTOR_ERROR = 307,
+  TA_XMPP_QUEUE_FULL_ERROR = 308,
+  TA_XMPP_POOL_ERROR = 309,
+  TA_XMPP_COMPRESS_ERROR = 310,
+
+  TA_PUBSUB_PUBLISH_ERROR = 400,
+  TA_PUBSUB_PARSING_ERROR = 401,
+  TA_PUBSUB_FETCH_ERROR = 402,
+  TA_PUBSUB_CONFIG_ERROR = 403,
+
+  TA_LOG_SINK_ERROR = 500,
+  TA_LOG_BINLOG_ERROR = 501,
+
+  TA_SRV_QUERY_ERROR = 600,
+  TA_SRV_TIMEOUT_ERROR = 601
 };
 
 
+/* Returns the last error set in the calling thread or NULL. Its
+ * message is formatted here, the first time it is read. */
 const ta_error_t *ta_error_last (void);
+
+/* Returns the code of the last error or TA_OK, without formatting its
+ * message */
+int ta_error_last_code (void);
+
 void ta_error_clear (void);
+
+/* Sets the last error of the calling thread. The arguments are copied
+ * and `message' is only formatted if the error is read, so it must be
+ * a string literal or live as long as the error. */
 void ta_error_set (int errcode, const char *message, ...);
 
 #ifdef __cplusplus
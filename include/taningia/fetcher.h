@@ -0,0 +1,134 @@
+/* fetcher.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _TANINGIA_FETCHER_H_
+#define _TANINGIA_FETCHER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/xmpp.h>
+#include <taningia/pubsub.h>
+
+typedef struct _ta_pubsub_fetcher_t ta_pubsub_fetcher_t;
+
+/**
+ * Called when the fetcher is done, after the last item was
+ * reported. `status' is TA_OK when all the items were fetched and
+ * TA_ERROR when a page could not be fetched, in that case the error is
+ * also set. Cancelled fetchers don't call it.
+ */
+typedef void (*ta_pubsub_fetcher_done_cb_t) (ta_pubsub_fetcher_t *fetcher,
+                                             int status,
+                                             void *data);
+
+/**
+ * @name: ta_pubsub_fetcher::new
+ * @type: constructor
+ * @param client: Client used to send the requests.
+ * @param from: The JID that is sending the stanzas.
+ * @param to: JID of the pubsub service.
+ * @param node: Node that will have its items fetched.
+ * @param page_size: Number of items asked in each request.
+ *
+ * Creates an iterator over the items of a node that fetches them one
+ * page at a time. As soon as a page arrives, the request for the next
+ * one is sent and only then the items of the current page are
+ * reported, so the round trip overlaps with the processing and no more
+ * than two pages are held at the same time.
+ *
+ * Like `ta_pubsub_publisher_t', it must only be used from the thread
+ * running the client loop and the request waiting for an answer holds
+ * a reference to the fetcher.
+ */
+ta_pubsub_fetcher_t *ta_pubsub_fetcher_new (ta_xmpp_client_t *client,
+                                            const char *from,
+                                            const char *to,
+                                            const char *node,
+                                            int page_size);
+
+/**
+ * @name: ta_pubsub_fetcher::init
+ * @type: initializer
+ */
+void ta_pubsub_fetcher_init (ta_pubsub_fetcher_t *fetcher,
+                             ta_xmpp_client_t *client,
+                             const char *from,
+                             const char *to,
+                             const char *node,
+                             int page_size);
+
+/**
+ * @name: ta_pubsub_fetcher::get_logger
+ * @type: getter
+ */
+ta_log_t *ta_pubsub_fetcher_get_logger (ta_pubsub_fetcher_t *fetcher);
+
+/**
+ * @name: ta_pubsub_fetcher::get_fetched
+ * @type: getter
+ *
+ * Returns the number of items reported so far.
+ */
+int ta_pubsub_fetcher_get_fetched (ta_pubsub_fetcher_t *fetcher);
+
+/**
+ * @name: ta_pubsub_fetcher::get_count
+ * @type: getter
+ *
+ * Returns the number of items of the node informed by the server, or
+ * -1 if it is still unknown.
+ */
+int ta_pubsub_fetcher_get_count (ta_pubsub_fetcher_t *fetcher);
+
+/**
+ * @name: ta_pubsub_fetcher::start
+ * @type: method
+ * @raise: TA_PUBSUB_FETCH_ERROR, XMPP_SEND_ERROR
+ * @param flags: Flags passed to `ta_pubsub_parse_items'.
+ * @param item_cb: Called once for each item. Returning something
+ * different from 0 cancels the fetcher.
+ * @param done_cb (optional): Called when there are no more items.
+ * @param data: Parameter passed to both callbacks.
+ *
+ * Sends the request for the first page. Returns TA_ERROR if the
+ * fetcher is already running, still waiting for the answer of a
+ * cancelled run or if the request can't be sent.
+ */
+int ta_pubsub_fetcher_start (ta_pubsub_fetcher_t *fetcher,
+                             int flags,
+                             ta_pubsub_event_cb_t item_cb,
+                             ta_pubsub_fetcher_done_cb_t done_cb,
+                             void *data);
+
+/**
+ * @name: ta_pubsub_fetcher::cancel
+ * @type: method
+ *
+ * Stops reporting items. The answer of a page already requested is
+ * ignored when it arrives.
+ */
+void ta_pubsub_fetcher_cancel (ta_pubsub_fetcher_t *fetcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_FETCHER_H_ */
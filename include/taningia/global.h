@@ -19,12 +19,36 @@
 #ifndef _TANINGIA_GLOBAL_H_
 #define _TANINGIA_GLOBAL_H_
 
+#include <stddef.h>
+#include <time.h>
 #include <taningia/error.h>
+#include <taningia/log.h>
 
 
+/* Room for the arguments of the last error, see `ta_error_set' */
+#define TA_ERROR_ARGS_SIZE 512
+
 typedef struct {
   ta_error_t *last_error;
   ta_error_t error_t;
+
+  /* Errors are only formatted when they are read. Until then the
+   * format is kept here, with its arguments. The message buffer is
+   * reused by the next errors. */
+  const char *error_fmt;
+  size_t error_args_size;
+  unsigned char error_args[TA_ERROR_ARGS_SIZE];
+  size_t error_message_size;
+
+  /* Reused by the log functions, so they don't allocate on each
+   * call. The formatted date is refreshed once per second. */
+  char *log_buf;
+  size_t log_buf_size;
+  int log_busy;
+  time_t log_time;
+  size_t log_date_len;
+  char log_date[MAX_DATE_SIZE];
+  char log_date_format[MAX_DATE_SIZE];
 } ta_global_state_t;
 
 
@@ -0,0 +1,83 @@
+/* idgen.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_IDGEN_H_
+#define _TANINGIA_IDGEN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/object.h>
+
+/* Size of the random prefix and of the buffers that receive ids */
+#define TA_IDGEN_PREFIX_SIZE    8
+#define TA_IDGEN_ID_SIZE        32
+
+typedef struct _ta_idgen_t ta_idgen_t;
+
+/**
+ * @name: ta_idgen::new
+ * @type: constructor
+ *
+ * Creates a stanza id generator. Ids are made of a random prefix,
+ * chosen when the generator is created, and a counter, so they don't
+ * collide with the ones of other generators, processes or
+ * connections.
+ */
+ta_idgen_t *ta_idgen_new (void);
+
+/**
+ * @name: ta_idgen::init
+ * @type: initializer
+ */
+void ta_idgen_init (ta_idgen_t *gen);
+
+/**
+ * @name: ta_idgen::get_default
+ * @type: function
+ *
+ * Returns the generator shared by the whole process. It is used by
+ * the stanza builders that don't receive a client, like the ones in
+ * the pubsub module. It must not be released.
+ */
+ta_idgen_t *ta_idgen_get_default (void);
+
+/**
+ * @name: ta_idgen::get_prefix
+ * @type: getter
+ */
+const char *ta_idgen_get_prefix (ta_idgen_t *gen);
+
+/**
+ * @name: ta_idgen::next
+ * @type: method
+ * @param buf: Buffer with at least TA_IDGEN_ID_SIZE bytes that will
+ * receive the new id.
+ *
+ * Writes a new id in `buf' and returns its length. It is safe to call
+ * this method from many threads at once and it never allocates
+ * memory.
+ */
+int ta_idgen_next (ta_idgen_t *gen, char *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_IDGEN_H_ */
@@ -32,6 +32,9 @@ extern "C" {
 
 typedef struct _ta_log ta_log_t;
 
+/* Defined in taningia/binlog.h */
+typedef struct _ta_binlog_t ta_binlog_t;
+
 typedef enum {
   TA_LOG_DEBUG,
   TA_LOG_INFO,
@@ -51,6 +54,7 @@ struct _ta_log
   int use_colors;
   void *handler_data;
   char *date_format;
+  ta_binlog_t *binlog;
 };
 
 /**
@@ -89,6 +93,20 @@ void ta_log_set_level (ta_log_t *log, ta_log_level_t level);
  */
 ta_log_level_t ta_log_get_level (ta_log_t *log);
 
+/**
+ * @name: ta_log::set_date_format
+ * @type: setter
+ * @param date_format: A strftime format. An empty string leaves the
+ * date out of the messages.
+ */
+void ta_log_set_date_format (ta_log_t *log, const char *date_format);
+
+/**
+ * @name: ta_log::get_date_format
+ * @type: getter
+ */
+const char *ta_log_get_date_format (ta_log_t *log);
+
 /**
  * @name: ta_log::set_handler
  * @type: method
@@ -101,6 +119,55 @@ ta_log_level_t ta_log_get_level (ta_log_t *log);
 void ta_log_set_handler (ta_log_t *log, ta_log_handler_func_t handler,
                          void *user_data);
 
+/**
+ * @name: ta_log::set_binlog
+ * @type: setter
+ * @param binlog (nullable): Binary log that will receive the messages,
+ * NULL goes back to text messages.
+ *
+ * Messages of a log with a binary log are not formatted, their
+ * arguments are copied to `binlog' and the handler is not called. See
+ * `ta_binlog_new'.
+ */
+void ta_log_set_binlog (ta_log_t *log, ta_binlog_t *binlog);
+
+/**
+ * @name: ta_log::is_enabled
+ * @type: method
+ *
+ * Tells if messages of `lvl' would be logged. It is a macro, so
+ * checking the level never costs a function call.
+ */
+#define ta_log_is_enabled(log, lvl) ((lvl) >= (log)->level)
+
+/**
+ * @name: ta_log::write
+ * @type: method
+ *
+ * Logs a message with the given level. All the other log methods end
+ * up here. Messages and dates are formatted in buffers reused by each
+ * thread and dates are formatted at most once per second, so nothing
+ * is allocated in the common case.
+ */
+void ta_log_write (ta_log_t *log, ta_log_level_t level, const char *fmt,
+                   ...);
+
+/* Messages below this level are removed at compile time by `TA_LOG',
+ * define it before including this header to change it */
+#ifndef TA_LOG_COMPILE_LEVEL
+# define TA_LOG_COMPILE_LEVEL TA_LOG_DEBUG
+#endif
+
+/* Logs a message only if `lvl' is enabled both at compile time and
+ * in `log'. Arguments are not evaluated when it is not, so they can be
+ * expensive. */
+#define TA_LOG(log, lvl, ...)                                   \
+  do {                                                          \
+    if ((lvl) >= TA_LOG_COMPILE_LEVEL &&                        \
+        ta_log_is_enabled ((log), (lvl)))                       \
+      ta_log_write ((log), (lvl), __VA_ARGS__);                 \
+  } while (0)
+
 /**
  * @name: ta_log::info
  * @type: method
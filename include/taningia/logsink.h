@@ -0,0 +1,143 @@
+/* logsink.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_LOGSINK_H_
+#define _TANINGIA_LOGSINK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/common.h>
+#include <taningia/log.h>
+
+/* Longest line written for a single message, longer ones are
+ * truncated */
+#define TA_LOG_SINK_RECORD_SIZE 512
+
+typedef struct _ta_log_sink_t ta_log_sink_t;
+
+/* What happens to a message logged when the ring is full */
+typedef enum {
+  TA_LOG_SINK_DROP,             /* It is discarded */
+  TA_LOG_SINK_BLOCK,            /* The caller waits for room */
+  TA_LOG_SINK_SAMPLE            /* Only some are kept once the ring is
+                                 * filling up, the rest is discarded */
+} ta_log_sink_policy_t;
+
+/* Counters of a sink, see `ta_log_sink_get_stats' */
+typedef struct {
+  unsigned long accepted;       /* Messages put in the ring */
+  unsigned long written;        /* Messages written to the file */
+  unsigned long dropped;        /* Messages discarded */
+  unsigned long blocked;        /* Times a caller waited for room */
+  unsigned long writes;         /* Write calls used to write them */
+  unsigned long failed;         /* Messages lost to write errors */
+} ta_log_sink_stats_t;
+
+/**
+ * @name: ta_log_sink::new
+ * @type: constructor
+ * @param fd: File descriptor that receives the messages. It is not
+ * closed by the sink.
+ * @param capacity: How many messages the ring holds. It is rounded up
+ * to a power of two.
+ * @param policy: What to do with messages that don't fit in the ring.
+ *
+ * Creates a sink that moves the writes of log messages out of the
+ * thread logging them. Messages are copied to a ring that doesn't
+ * take locks and a background thread writes them in batches, so
+ * logging from the network thread never waits for the disk.
+ */
+ta_log_sink_t *ta_log_sink_new (int fd, int capacity,
+                                ta_log_sink_policy_t policy);
+
+/**
+ * @name: ta_log_sink::init
+ * @type: initializer
+ */
+void ta_log_sink_init (ta_log_sink_t *sink, int fd, int capacity,
+                       ta_log_sink_policy_t policy);
+
+/**
+ * @name: ta_log_sink::set_sample_rate
+ * @type: setter
+ * @param rate: With the `TA_LOG_SINK_SAMPLE' policy, one out of `rate'
+ * messages is kept while the ring is more than three quarters full.
+ */
+void ta_log_sink_set_sample_rate (ta_log_sink_t *sink, int rate);
+
+/**
+ * @name: ta_log_sink::set_interval
+ * @type: setter
+ * @param msecs: How long the writer thread waits for more messages
+ * before writing what it already has.
+ */
+void ta_log_sink_set_interval (ta_log_sink_t *sink, int msecs);
+
+/**
+ * @name: ta_log_sink::attach
+ * @type: method
+ * @param log: Log whose messages will go to the sink.
+ *
+ * Replaces the handler of `log' by the sink. The sink must live
+ * longer than the log or be detached with `ta_log_set_handler'.
+ */
+void ta_log_sink_attach (ta_log_sink_t *sink, ta_log_t *log);
+
+/**
+ * @name: ta_log_sink::handler
+ * @type: method
+ *
+ * The log handler used by `ta_log_sink_attach', `data' is the
+ * sink. It can be called from handlers of other logs too.
+ */
+int ta_log_sink_handler (ta_log_t *log, ta_log_level_t level,
+                         const char *message, void *data);
+
+/**
+ * @name: ta_log_sink::start
+ * @type: method
+ * @raise: TA_LOG_SINK_ERROR
+ *
+ * Starts the writer thread. Messages logged before it starts wait in
+ * the ring.
+ */
+int ta_log_sink_start (ta_log_sink_t *sink);
+
+/**
+ * @name: ta_log_sink::stop
+ * @type: method
+ *
+ * Writes all the messages in the ring and stops the writer thread. It
+ * is also called when the sink is released.
+ */
+void ta_log_sink_stop (ta_log_sink_t *sink);
+
+/**
+ * @name: ta_log_sink::get_stats
+ * @type: getter
+ * @param stats: Struct that will be filled with the counters.
+ */
+void ta_log_sink_get_stats (ta_log_sink_t *sink, ta_log_sink_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_LOGSINK_H_ */
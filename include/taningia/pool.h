@@ -0,0 +1,157 @@
+/* pool.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_POOL_H_
+#define _TANINGIA_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/object.h>
+
+typedef struct _ta_xmpp_pool_t ta_xmpp_pool_t;
+
+/* Counters of a pool, see `ta_xmpp_pool_get_stats' */
+typedef struct {
+  unsigned long connected;      /* Connections established */
+  unsigned long failed;         /* Rounds where no address answered */
+  unsigned long attempts;       /* Connect calls made */
+  unsigned long taken;          /* Connections given to clients */
+  unsigned long expired;        /* Idle or closed connections dropped */
+} ta_xmpp_pool_stats_t;
+
+/**
+ * @name: ta_xmpp_pool::new
+ * @type: constructor
+ * @param domain: Domain of the XMPP service.
+ * @param warm: How many connections are kept ready.
+ *
+ * Creates a pool that keeps connections to the XMPP server of
+ * `domain' ready to be used by `ta_xmpp_client_connect_fd'. A
+ * background thread finds the servers through the SRV records of the
+ * domain and connects to them in parallel, starting a new attempt to
+ * the next address, alternating IPv6 and IPv4, each time the previous
+ * one takes too long. The first one to answer wins.
+ *
+ * Clients given a pool with `ta_xmpp_client_set_pool' take a warm
+ * connection when theirs breaks, so they don't wait for DNS and TCP
+ * handshakes to reconnect.
+ */
+ta_xmpp_pool_t *ta_xmpp_pool_new (const char *domain, int warm);
+
+/**
+ * @name: ta_xmpp_pool::init
+ * @type: initializer
+ */
+void ta_xmpp_pool_init (ta_xmpp_pool_t *pool, const char *domain, int warm);
+
+/**
+ * @name: ta_xmpp_pool::set_host
+ * @type: setter
+ * @param host: Host to connect to instead of the SRV targets.
+ * @param port: Port of the host. It is also the port used with the
+ * domain when it has no SRV records. The default is 5222.
+ */
+void ta_xmpp_pool_set_host (ta_xmpp_pool_t *pool, const char *host,
+                            int port);
+
+/**
+ * @name: ta_xmpp_pool::set_delay
+ * @type: setter
+ * @param msecs: How long an attempt runs alone before the next
+ * address is tried too. The default is 250 milliseconds.
+ */
+void ta_xmpp_pool_set_delay (ta_xmpp_pool_t *pool, int msecs);
+
+/**
+ * @name: ta_xmpp_pool::set_timeout
+ * @type: setter
+ * @param msecs: How long a round of attempts may take.
+ */
+void ta_xmpp_pool_set_timeout (ta_xmpp_pool_t *pool, int msecs);
+
+/**
+ * @name: ta_xmpp_pool::set_max_idle
+ * @type: setter
+ * @param msecs: Warm connections older than this are replaced, before
+ * the server gets tired of waiting for the stream header.
+ */
+void ta_xmpp_pool_set_max_idle (ta_xmpp_pool_t *pool, int msecs);
+
+/**
+ * @name: ta_xmpp_pool::start
+ * @type: method
+ * @raise: TA_XMPP_POOL_ERROR
+ *
+ * Starts the thread that keeps the connections warm.
+ */
+int ta_xmpp_pool_start (ta_xmpp_pool_t *pool);
+
+/**
+ * @name: ta_xmpp_pool::stop
+ * @type: method
+ *
+ * Stops the thread and closes the warm connections. It is also called
+ * when the pool is released.
+ */
+void ta_xmpp_pool_stop (ta_xmpp_pool_t *pool);
+
+/**
+ * @name: ta_xmpp_pool::take
+ * @type: method
+ * @raise: TA_XMPP_POOL_ERROR
+ *
+ * Returns a connected socket or -1 if none is ready. It never
+ * blocks. The socket belongs to the caller and the pool starts
+ * connecting another one.
+ */
+int ta_xmpp_pool_take (ta_xmpp_pool_t *pool);
+
+/**
+ * @name: ta_xmpp_pool::take_wait
+ * @type: method
+ * @param msecs: How long to wait for a connection, -1 waits forever.
+ * @raise: TA_XMPP_POOL_ERROR
+ *
+ * Same as `ta_xmpp_pool_take' but waits for a connection when none is
+ * ready.
+ */
+int ta_xmpp_pool_take_wait (ta_xmpp_pool_t *pool, int msecs);
+
+/**
+ * @name: ta_xmpp_pool::get_ready
+ * @type: getter
+ *
+ * Returns how many connections are ready to be taken.
+ */
+int ta_xmpp_pool_get_ready (ta_xmpp_pool_t *pool);
+
+/**
+ * @name: ta_xmpp_pool::get_stats
+ * @type: getter
+ * @param stats: Struct that will be filled with the counters.
+ */
+void ta_xmpp_pool_get_stats (ta_xmpp_pool_t *pool,
+                             ta_xmpp_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_POOL_H_ */
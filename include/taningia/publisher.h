@@ -0,0 +1,191 @@
+/* publisher.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_PUBLISHER_H_
+#define _TANINGIA_PUBLISHER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/xmpp.h>
+#include <taningia/pubsub.h>
+
+typedef struct _ta_pubsub_publisher_t ta_pubsub_publisher_t;
+
+/**
+ * Called once for each published item (or created node), when the
+ * server accepts it or when the publisher gives up. `id' is the id of
+ * the item or the name of the node. `status' is TA_OK for accepted items
+ * and TA_ERROR otherwise, in that case the error is also set. The
+ * `answer' node is the stanza sent by the server (NULL if none
+ * arrived) and is only valid during the call.
+ */
+typedef void (*ta_pubsub_publisher_cb_t) (ta_pubsub_publisher_t *publisher,
+                                          const char *id,
+                                          int status,
+                                          iks *answer,
+                                          void *data);
+
+/**
+ * @name: ta_pubsub_publisher::new
+ * @type: constructor
+ * @param client: Client used to send the items.
+ * @param from: The JID that is sending the stanzas.
+ * @param to: JID of the pubsub service.
+ * @param window: Maximum number of publish requests waiting for an
+ * answer at the same time. Values smaller than 1 mean 1.
+ *
+ * Creates a publisher that pipelines publish requests instead of
+ * waiting for each answer before sending the next item, so the
+ * throughput is not bound to the round trip time.
+ *
+ * The publisher must only be used from the thread running the client
+ * loop, all the callbacks are called from there too. Each request
+ * waiting for an answer holds a reference to the publisher, so it is
+ * safe to release it before all the items are answered. Requests that
+ * are never answered, when the client has no request timeout, keep
+ * the publisher and the client alive until `ta_pubsub_publisher_close'
+ * is called.
+ */
+ta_pubsub_publisher_t *ta_pubsub_publisher_new (ta_xmpp_client_t *client,
+                                                const char *from,
+                                                const char *to,
+                                                int window);
+
+/**
+ * @name: ta_pubsub_publisher::init
+ * @type: initializer
+ */
+void ta_pubsub_publisher_init (ta_pubsub_publisher_t *publisher,
+                               ta_xmpp_client_t *client,
+                               const char *from,
+                               const char *to,
+                               int window);
+
+/**
+ * @name: ta_pubsub_publisher::get_logger
+ * @type: getter
+ */
+ta_log_t *ta_pubsub_publisher_get_logger (ta_pubsub_publisher_t *publisher);
+
+/**
+ * @name: ta_pubsub_publisher::get_window
+ * @type: getter
+ */
+int ta_pubsub_publisher_get_window (ta_pubsub_publisher_t *publisher);
+
+/**
+ * @name: ta_pubsub_publisher::set_window
+ * @type: setter
+ *
+ * Changes the window size. Requests already sent are not affected.
+ */
+void ta_pubsub_publisher_set_window (ta_pubsub_publisher_t *publisher,
+                                     int window);
+
+/**
+ * @name: ta_pubsub_publisher::get_max_retries
+ * @type: getter
+ */
+int ta_pubsub_publisher_get_max_retries (ta_pubsub_publisher_t *publisher);
+
+/**
+ * @name: ta_pubsub_publisher::set_max_retries
+ * @type: setter
+ * @param retries: How many times an item is published again after a
+ * transient error. Requests that time out and errors of the `wait'
+ * type are considered transient.
+ */
+void ta_pubsub_publisher_set_max_retries (ta_pubsub_publisher_t *publisher,
+                                          int retries);
+
+/**
+ * @name: ta_pubsub_publisher::get_in_flight
+ * @type: getter
+ *
+ * Returns the number of requests waiting for an answer.
+ */
+int ta_pubsub_publisher_get_in_flight (ta_pubsub_publisher_t *publisher);
+
+/**
+ * @name: ta_pubsub_publisher::get_pending
+ * @type: getter
+ *
+ * Returns the number of items waiting for room in the window.
+ */
+int ta_pubsub_publisher_get_pending (ta_pubsub_publisher_t *publisher);
+
+/**
+ * @name: ta_pubsub_publisher::publish
+ * @type: method
+ * @param node: Node that will receive the item.
+ * @param id (nullable): The id of the item.
+ * @param payload: The iks object to be published. The publisher takes
+ * care of freeing it.
+ * @param cb (optional): Called when the item is done.
+ * @param data: Parameter passed to `cb'.
+ *
+ * Publishes an item in a node. The request is sent right away if
+ * there is room in the window, otherwise it waits for the requests
+ * already sent to be answered. Returns TA_ERROR without calling `cb'
+ * if the publisher was closed.
+ */
+int ta_pubsub_publisher_publish (ta_pubsub_publisher_t *publisher,
+                                 const char *node,
+                                 const char *id,
+                                 iks *payload,
+                                 ta_pubsub_publisher_cb_t cb,
+                                 void *data);
+
+/**
+ * @name: ta_pubsub_publisher::create_node
+ * @type: method
+ * @param node: Name of the new node.
+ * @param config (nullable): Configuration of the node. It is copied
+ * right away, so it can be released after the call.
+ * @param cb (optional): Called when the node is created or when the
+ * publisher gives up.
+ * @param data: Parameter passed to `cb'.
+ *
+ * Creates a node sharing the window and the retries with the
+ * published items. Provisioning many nodes this way doesn't wait for
+ * the answer of each request before sending the next one.
+ */
+int ta_pubsub_publisher_create_node (ta_pubsub_publisher_t *publisher,
+                                     const char *node,
+                                     ta_pubsub_node_config_t *config,
+                                     ta_pubsub_publisher_cb_t cb,
+                                     void *data);
+
+/**
+ * @name: ta_pubsub_publisher::close
+ * @type: method
+ *
+ * Gives up on all the items that were not answered yet, calling their
+ * callbacks with TA_ERROR, and releases the references held by the
+ * requests waiting for an answer. Items published after that are
+ * refused.
+ */
+void ta_pubsub_publisher_close (ta_pubsub_publisher_t *publisher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_PUBLISHER_H_ */
@@ -25,8 +25,71 @@ extern "C" {
 #endif
 
 #include <iksemel.h>
+#include <taningia/atom.h>
+#include <taningia/buf.h>
 
 #define TA_PUBSUB_NS "http://jabber.org/protocol/pubsub"
+#define TA_PUBSUB_EVENT_NS "http://jabber.org/protocol/pubsub#event"
+#define TA_RSM_NS "http://jabber.org/protocol/rsm"
+
+/* An item to be published with `ta_pubsub_node_publish_items' */
+typedef struct {
+  const char *id;
+  iks *payload;
+} ta_pubsub_item_t;
+
+/* Compiled node configuration, see `ta_pubsub_node_config_new' */
+typedef struct _ta_pubsub_node_config_t ta_pubsub_node_config_t;
+
+/* -- Parsed answers --
+ *
+ * The structs filled by the parsers don't own anything. Their strings
+ * and nodes point to the parsed stanza, so they are only valid while
+ * it is alive. Copy what must outlive the stanza. */
+
+/* Flags of `ta_pubsub_parse_items' and `ta_pubsub_parse_event' */
+enum {
+  TA_PUBSUB_PARSE_ENTRIES = 1 << 0
+};
+
+typedef enum {
+  TA_PUBSUB_ITEM_PUBLISHED,
+  TA_PUBSUB_ITEM_RETRACTED,
+  TA_PUBSUB_NODE_PURGED,
+  TA_PUBSUB_NODE_DELETED,
+  TA_PUBSUB_NODE_CONFIGURED
+} ta_pubsub_event_type_t;
+
+typedef struct {
+  ta_pubsub_event_type_t type;
+  const char *node;
+  const char *id;
+  const char *publisher;
+  iks *payload;
+  ta_atom_entry_t *entry;
+} ta_pubsub_event_t;
+
+typedef struct {
+  const char *node;
+  const char *jid;
+  const char *subid;
+  const char *subscription;
+} ta_pubsub_subscription_t;
+
+typedef struct {
+  const char *node;
+  const char *jid;
+  const char *affiliation;
+} ta_pubsub_affiliation_t;
+
+/* Callbacks called once for each parsed element. Returning something
+ * different from 0 stops the parser. */
+typedef int (*ta_pubsub_event_cb_t) (const ta_pubsub_event_t *event,
+                                     void *data);
+typedef int (*ta_pubsub_subscription_cb_t)
+     (const ta_pubsub_subscription_t *subscription, void *data);
+typedef int (*ta_pubsub_affiliation_cb_t)
+     (const ta_pubsub_affiliation_t *affiliation, void *data);
 
 /* -- Pubsub -- */
 
@@ -132,6 +195,23 @@ iks *ta_pubsub_node_items (const char *from,
                            const char *node,
                            int max_items);
 
+/**
+ * @name: ta_pubsub_node_items_page
+ * @type: function
+ * @param max: Maximum number of items in the page.
+ * @param after (nullable): Id returned by `ta_pubsub_parse_page' for
+ * the previous page. Pass NULL to get the first page.
+ *
+ * Build a stanza to get a page of the items of a node using Result
+ * Set Management (XEP-0059). Servers that don't support it answer with
+ * all the items at once.
+ */
+iks *ta_pubsub_node_items_page (const char *from,
+                                const char *to,
+                                const char *node,
+                                int max,
+                                const char *after);
+
 /**
  * @name: ta_pubsub_node_publish_text
  * @type: method function
@@ -162,6 +242,84 @@ iks *ta_pubsub_node_publish_iks (const char *from,
                                  const char *id,
                                  iks *child);
 
+/**
+ * @name: ta_pubsub_node_publish_items
+ * @type: function
+ * @param items: Array of items to be published. Both the id and the
+ * payload of each item are optional.
+ * @param count: Number of items in the array.
+ *
+ * Build a single stanza that publishes many items in the node at
+ * once. Like in `ta_pubsub_node_publish_iks', payloads are linked to
+ * the stanza, so they must be freed by the caller after the stanza is
+ * sent.
+ */
+iks *ta_pubsub_node_publish_items (const char *from,
+                                   const char *to,
+                                   const char *node,
+                                   const ta_pubsub_item_t *items,
+                                   int count);
+
+/**
+ * @name: ta_pubsub_node_publish_feed
+ * @type: function
+ * @param feed: Feed whose entries will be published.
+ *
+ * Build a single stanza that publishes all the entries of an atom
+ * feed in the node, using the entry ids as item ids. Entries without
+ * an id are skipped. The stanza does not reference the feed, so both
+ * can be freed independently.
+ */
+iks *ta_pubsub_node_publish_feed (const char *from,
+                                  const char *to,
+                                  const char *node,
+                                  ta_atom_feed_t *feed);
+
+/**
+ * @name: ta_pubsub_node_publish_text_buf
+ * @type: function
+ * @param buf: Buffer that receives the stanza. It is appended to, so
+ * it can be reused (after `ta_buf_reset') to avoid allocations.
+ * @param sid: Id of the stanza, used to match the answer. Use
+ * `ta_idgen_next' to get one that doesn't collide with the ids of the
+ * other builders.
+ * @param id (nullable): The id of published entry.
+ * @param body: The text body to be published. It is escaped.
+ * @param len (optional): The length of the text body.
+ *
+ * Same of `ta_pubsub_node_publish_text' but the stanza is written
+ * directly in a buffer, without building an iks tree. Send it with
+ * `ta_xmpp_client_send_raw' or `ta_xmpp_client_send_raw_and_filter'.
+ */
+int ta_pubsub_node_publish_text_buf (ta_buf_t *buf,
+                                     const char *sid,
+                                     const char *from,
+                                     const char *to,
+                                     const char *node,
+                                     const char *id,
+                                     const char *body,
+                                     int len);
+
+/**
+ * @name: ta_pubsub_node_publish_xml_buf
+ * @type: function
+ * @param payload: Serialized XML to be published. It is copied as is,
+ * so it must be well formed.
+ * @param len (optional): The length of the payload.
+ * @see: ta_pubsub_node_publish_text_buf
+ *
+ * Writes a stanza that publishes an already serialized XML payload
+ * directly in a buffer.
+ */
+int ta_pubsub_node_publish_xml_buf (ta_buf_t *buf,
+                                    const char *sid,
+                                    const char *from,
+                                    const char *to,
+                                    const char *node,
+                                    const char *id,
+                                    const char *payload,
+                                    int len);
+
 /**
  * @name: ta_pubsub_node_delete
  * @type: function
@@ -188,6 +346,7 @@ iks *ta_pubsub_node_delete_item (const char *from,
 /**
  * @name: ta_pubsub_node_create
  * @type: function
+ * @raise: TA_PUBSUB_CONFIG_ERROR
  *
  * Build a stanza to create a node. This function allows to create
  * <strong>and</strong> configure a ndoe at once. To do it, pass the
@@ -198,16 +357,87 @@ iks *ta_pubsub_node_delete_item (const char *from,
  * ta_pubsub_node_create ("test@blah", "pubsub.blah", "/mynode",
  *                        "type", "leaf", NULL);
  * </pre>
+ *
+ * Returns NULL if a name has no value or is too long.
  */
 iks *ta_pubsub_node_create (const char *from,
                             const char *to,
                             const char *node,
                             ...);
 
+/**
+ * @name: ta_pubsub_node_config::new
+ * @type: constructor
+ *
+ * Creates an empty node configuration. Fields are validated and
+ * turned into a data form when they are added, so creating nodes with
+ * it only costs a copy of the form, no matter how many fields it has.
+ *
+ * The builders only read the configuration, so once all the fields
+ * are added it can be used by many threads at once. References must
+ * still be taken and released by a single thread.
+ */
+ta_pubsub_node_config_t *ta_pubsub_node_config_new (void);
+
+/**
+ * @name: ta_pubsub_node_config::init
+ * @type: initializer
+ */
+void ta_pubsub_node_config_init (ta_pubsub_node_config_t *config);
+
+/**
+ * @name: ta_pubsub_node_config::get_size
+ * @type: getter
+ *
+ * Returns the number of fields in the configuration.
+ */
+int ta_pubsub_node_config_get_size (ta_pubsub_node_config_t *config);
+
+/**
+ * @name: ta_pubsub_node_config::add
+ * @type: method
+ * @param name: Name of the field without the `pubsub#' prefix, like
+ * `max_items'.
+ * @param value: Value of the field.
+ * @raise: TA_PUBSUB_CONFIG_ERROR
+ *
+ * Adds a field to the configuration.
+ */
+int ta_pubsub_node_config_add (ta_pubsub_node_config_t *config,
+                               const char *name,
+                               const char *value);
+
+/**
+ * @name: ta_pubsub_node_config::add_params
+ * @type: method
+ * @param params: NULL terminated list of names and values, in the
+ * format accepted by `ta_pubsub_node_createv'.
+ * @raise: TA_PUBSUB_CONFIG_ERROR
+ *
+ * Adds many fields at once. Nothing is added if a name has no value.
+ */
+int ta_pubsub_node_config_add_params (ta_pubsub_node_config_t *config,
+                                      const char **params);
+
+/**
+ * @name: ta_pubsub_node_create_with_config
+ * @type: function
+ * @param config (nullable): Configuration of the new node.
+ * @see: ta_pubsub_node_create
+ *
+ * Build a stanza to create and configure a node with a configuration
+ * built beforehand.
+ */
+iks *ta_pubsub_node_create_with_config (const char *from,
+                                        const char *to,
+                                        const char *node,
+                                        ta_pubsub_node_config_t *config);
+
 /**
  * @name: ta_pubsub_node_createv
  * @type: method ta_pubsub_node
  * @param conf_params: Configuration parameters.
+ * @raise: TA_PUBSUB_CONFIG_ERROR
  * @see: ta_pubsub_node_create
  *
  * Same of `ta_pubsub_node_create' but without using var args to receive
@@ -223,6 +453,86 @@ iks *ta_pubsub_node_createv (const char *from,
                              const char *node,
                              const char **conf_params);
 
+/**
+ * @name: ta_pubsub_parse_items
+ * @type: function
+ * @param answer: Answer of a `ta_pubsub_node_items' request.
+ * @param flags: When TA_PUBSUB_PARSE_ENTRIES is set, payloads that are
+ * atom entries are also parsed into the `entry' field. The entry is
+ * released after the callback returns, reference it to keep it.
+ * @param cb: Called once for each item, with the TA_PUBSUB_ITEM_PUBLISHED
+ * type.
+ * @param data: Parameter passed to `cb'.
+ * @raise: TA_PUBSUB_PARSING_ERROR
+ *
+ * Walks the items of an answer only once, without copying any
+ * string. Returns the number of items reported or TA_ERROR if the
+ * server answered with an error or the answer is not an items result.
+ */
+int ta_pubsub_parse_items (iks *answer,
+                           int flags,
+                           ta_pubsub_event_cb_t cb,
+                           void *data);
+
+/**
+ * @name: ta_pubsub_parse_page
+ * @type: function
+ * @param answer: Answer of a `ta_pubsub_node_items_page' request.
+ * @param last: Receives the id to be used as `after' when asking for
+ * the next page, or NULL if the server didn't inform it. It points to
+ * the answer.
+ * @param count (optional): Receives the total number of items in the
+ * node, or -1 if the server didn't inform it.
+ *
+ * Reads the result set of a page without looking at its items.
+ * Returns TA_ERROR if the answer holds no result set.
+ */
+int ta_pubsub_parse_page (iks *answer, const char **last, int *count);
+
+/**
+ * @name: ta_pubsub_parse_event
+ * @type: function
+ * @param message: A message received from the pubsub service.
+ * @see: ta_pubsub_parse_items
+ *
+ * Same of `ta_pubsub_parse_items' for `<event/>' notifications. The
+ * callback is called once for each published or retracted item and
+ * once for purge, delete and configuration notifications. Returns
+ * TA_ERROR if the message holds no pubsub event.
+ */
+int ta_pubsub_parse_event (iks *message,
+                           int flags,
+                           ta_pubsub_event_cb_t cb,
+                           void *data);
+
+/**
+ * @name: ta_pubsub_parse_subscriptions
+ * @type: function
+ * @param answer: Answer of a `ta_pubsub_node_query_subscriptions'
+ * request or of a query for all the subscriptions of an entity.
+ * @raise: TA_PUBSUB_PARSING_ERROR
+ *
+ * Calls `cb' once for each subscription of the answer. Subscriptions
+ * without a node attribute get the one of the `<subscriptions/>'
+ * element. Returns the number of subscriptions or TA_ERROR.
+ */
+int ta_pubsub_parse_subscriptions (iks *answer,
+                                   ta_pubsub_subscription_cb_t cb,
+                                   void *data);
+
+/**
+ * @name: ta_pubsub_parse_affiliations
+ * @type: function
+ * @param answer: Answer of a `ta_pubsub_query_affiliations' or
+ * `ta_pubsub_node_query_affiliations' request.
+ * @see: ta_pubsub_parse_subscriptions
+ *
+ * Calls `cb' once for each affiliation of the answer.
+ */
+int ta_pubsub_parse_affiliations (iks *answer,
+                                  ta_pubsub_affiliation_cb_t cb,
+                                  void *data);
+
 #ifdef __cplusplus
 }
 #endif
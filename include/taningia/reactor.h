@@ -0,0 +1,124 @@
+/* reactor.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_REACTOR_H_
+#define _TANINGIA_REACTOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/xmpp.h>
+
+typedef struct _ta_xmpp_reactor_t ta_xmpp_reactor_t;
+
+/**
+ * @name: ta_xmpp_reactor::new
+ * @type: constructor
+ * @param nthreads: Number of event loops (and threads) used to drive
+ * the registered clients. Values smaller than 1 mean 1.
+ *
+ * Creates a reactor that drives many xmpp clients from a small fixed
+ * number of threads. Each event loop owns an epoll set and clients
+ * are spread among them when they are added.
+ */
+ta_xmpp_reactor_t *ta_xmpp_reactor_new (int nthreads);
+
+/**
+ * @name: ta_xmpp_reactor::init
+ * @type: initializer
+ */
+void ta_xmpp_reactor_init (ta_xmpp_reactor_t *reactor, int nthreads);
+
+/**
+ * @name: ta_xmpp_reactor::get_logger
+ * @type: getter
+ */
+ta_log_t *ta_xmpp_reactor_get_logger (ta_xmpp_reactor_t *reactor);
+
+/**
+ * @name: ta_xmpp_reactor::add
+ * @type: method
+ * @param client: An already connected client.
+ * @raise: TA_XMPP_REACTOR_ERROR
+ *
+ * Registers a client in the event loop with less clients. The
+ * reactor holds a reference to the client until it is removed or the
+ * connection is closed. All hooks and callbacks of the client will be
+ * called from the thread running that event loop. Clients using TLS
+ * are refused, see `ta_xmpp_client_process'.
+ *
+ * It is safe to call this method from any thread, including from
+ * client hooks. Clients added from hooks are driven by the same loop
+ * running the hook.
+ *
+ * The reactor installs its own queue notifier in the client, so
+ * stanzas passed to `ta_xmpp_client_enqueue' from any thread are
+ * written by the loop driving the client.
+ */
+int ta_xmpp_reactor_add (ta_xmpp_reactor_t *reactor,
+                         ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_reactor::remove
+ * @type: method
+ * @raise: TA_XMPP_REACTOR_ERROR
+ *
+ * Stops driving a client and releases the reference taken by
+ * `ta_xmpp_reactor_add'. The client is not disconnected.
+ *
+ * It is safe to call this method from any thread, including from
+ * client hooks. When a hook removes a client driven by another loop
+ * that is busy, the removal is done by that loop when it wakes up, so
+ * the client might still be driven for a moment after this method
+ * returns.
+ */
+int ta_xmpp_reactor_remove (ta_xmpp_reactor_t *reactor,
+                            ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_reactor::get_count
+ * @type: getter
+ *
+ * Returns the number of clients being driven by the reactor.
+ */
+int ta_xmpp_reactor_get_count (ta_xmpp_reactor_t *reactor);
+
+/**
+ * @name: ta_xmpp_reactor::run
+ * @type: method
+ *
+ * Runs all event loops until `ta_xmpp_reactor_stop' is called. The
+ * first loop runs in the calling thread and one new thread is started
+ * for each other loop.
+ */
+int ta_xmpp_reactor_run (ta_xmpp_reactor_t *reactor);
+
+/**
+ * @name: ta_xmpp_reactor::stop
+ * @type: method
+ *
+ * Asks all event loops to return. It can be called from any thread.
+ */
+void ta_xmpp_reactor_stop (ta_xmpp_reactor_t *reactor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_REACTOR_H_ */
@@ -39,9 +39,168 @@ typedef struct
   char *host;
 } ta_srv_target_t;
 
+typedef struct _ta_srv_resolver_t ta_srv_resolver_t;
+
+/* Receives the answer of `ta_srv_resolver_query_async'. `error' is
+ * TA_OK or the code of the error that made the query fail. `targets'
+ * is NULL when the name has no targets or when the query failed, the
+ * list and its targets belong to the callback. */
+typedef void (*ta_srv_callback_t) (ta_srv_resolver_t *resolver,
+                                   int error,
+                                   ta_list_t *targets,
+                                   void *data);
+
 int ta_srv_init (void);
+
+/**
+ * @name: ta_srv_query_domain
+ * @type: function
+ * @param name: Service and protocol, like `_xmpp-client._tcp'.
+ * @param domain: Domain that provides the service.
+ *
+ * Returns the targets of the service in the order they should be
+ * tried. The list and its targets must be released by the caller. The
+ * answers are kept in a resolver shared by the whole process, so this
+ * function only blocks when the answer is not cached yet. Threads
+ * asking at the same time don't wait for each other's queries, only
+ * for their own answers.
+ */
 ta_list_t *ta_srv_query_domain (const char *name, const char *domain);
 
+/**
+ * @name: ta_srv_resolver::new
+ * @type: constructor
+ *
+ * Creates a resolver that keeps the SRV answers it gets for as long
+ * as the smallest ttl of their records. Names without targets are
+ * kept for a while too, see `ta_srv_resolver_set_negative_ttl'.
+ * Queries sent while the same name is being asked wait for the same
+ * answer. The name servers, search list, timeout, attempts and
+ * rotate option of resolv.conf are used by default. Names given
+ * without a domain are searched like res_search(3) does.
+ *
+ * Resolvers are not thread safe.
+ */
+ta_srv_resolver_t *ta_srv_resolver_new (void);
+
+/**
+ * @name: ta_srv_resolver::init
+ * @type: initializer
+ */
+void ta_srv_resolver_init (ta_srv_resolver_t *resolver);
+
+/**
+ * @name: ta_srv_resolver::set_nameserver
+ * @type: setter
+ * @param address: IPv4 or IPv6 address of the server.
+ * @param port: Port of the server, 0 for the default one.
+ * @raise: TA_SRV_QUERY_ERROR
+ *
+ * Makes this server the only one asked.
+ */
+int ta_srv_resolver_set_nameserver (ta_srv_resolver_t *resolver,
+                                    const char *address, int port);
+
+/**
+ * @name: ta_srv_resolver::add_nameserver
+ * @type: method
+ * @param address: IPv4 or IPv6 address of the server.
+ * @param port: Port of the server, 0 for the default one.
+ * @raise: TA_SRV_QUERY_ERROR
+ *
+ * Adds a server to ask when the ones before it don't answer in
+ * time. Up to MAXNS servers are kept.
+ */
+int ta_srv_resolver_add_nameserver (ta_srv_resolver_t *resolver,
+                                    const char *address, int port);
+
+/**
+ * @name: ta_srv_resolver::set_timeout
+ * @type: setter
+ * @param msecs: How long to wait for each answer.
+ * @param attempts: How many times a query is sent to each server
+ * before giving up. Each try goes to the next server.
+ */
+void ta_srv_resolver_set_timeout (ta_srv_resolver_t *resolver, int msecs,
+                                  int attempts);
+
+/**
+ * @name: ta_srv_resolver::set_negative_ttl
+ * @type: setter
+ * @param secs: How long names without targets are cached.
+ */
+void ta_srv_resolver_set_negative_ttl (ta_srv_resolver_t *resolver,
+                                      int secs);
+
+/**
+ * @name: ta_srv_resolver::clear_cache
+ * @type: method
+ */
+void ta_srv_resolver_clear_cache (ta_srv_resolver_t *resolver);
+
+/**
+ * @name: ta_srv_resolver::query
+ * @type: method
+ *
+ * Same as `ta_srv_query_domain' but using this resolver. It blocks
+ * until the answer arrives or the query times out.
+ */
+ta_list_t *ta_srv_resolver_query (ta_srv_resolver_t *resolver,
+                                  const char *name, const char *domain);
+
+/**
+ * @name: ta_srv_resolver::query_async
+ * @type: method
+ * @param callback: Called with the answer.
+ * @param data: User defined value passed to the callback.
+ * @raise: TA_SRV_QUERY_ERROR
+ *
+ * Sends a query without waiting for the answer. Cached answers are
+ * given to the callback before this function returns, the other ones
+ * are given by `ta_srv_resolver_process'. Answers too big for a
+ * datagram are read again over TCP in that call, which may block up
+ * to the timeout.
+ */
+int ta_srv_resolver_query_async (ta_srv_resolver_t *resolver,
+                                 const char *name, const char *domain,
+                                 ta_srv_callback_t callback, void *data);
+
+/**
+ * @name: ta_srv_resolver::get_fd
+ * @type: getter
+ *
+ * Returns the socket that receives the answers, to be watched for
+ * reading by event loops, or -1 if no query was sent yet.
+ */
+int ta_srv_resolver_get_fd (ta_srv_resolver_t *resolver);
+
+/**
+ * @name: ta_srv_resolver::get_pending
+ * @type: getter
+ *
+ * Returns how many queries are waiting for answers.
+ */
+int ta_srv_resolver_get_pending (ta_srv_resolver_t *resolver);
+
+/**
+ * @name: ta_srv_resolver::next_timeout
+ * @type: method
+ *
+ * Returns how many milliseconds the event loop can wait before
+ * calling `ta_srv_resolver_process' or -1 if no query is waiting.
+ */
+long ta_srv_resolver_next_timeout (ta_srv_resolver_t *resolver);
+
+/**
+ * @name: ta_srv_resolver::process
+ * @type: method
+ *
+ * Reads the answers that arrived, sends again the queries that timed
+ * out and calls the callbacks of the finished ones. It never waits
+ * for the socket. Returns how many answers were read.
+ */
+int ta_srv_resolver_process (ta_srv_resolver_t *resolver);
+
 const char *ta_srv_target_get_host (ta_srv_target_t *target);
 u_int16_t ta_srv_target_get_port (ta_srv_target_t *target);
 u_int16_t ta_srv_target_get_weight (ta_srv_target_t *target);
@@ -49,6 +208,66 @@ u_int16_t ta_srv_target_get_class (ta_srv_target_t *target);
 u_int16_t ta_srv_target_get_priority (ta_srv_target_t *target);
 u_int32_t ta_srv_target_get_ttl (ta_srv_target_t *target);
 
+typedef struct _ta_srv_target_set_t ta_srv_target_set_t;
+
+/**
+ * @name: ta_srv_target_set::new
+ * @type: constructor
+ * @param targets: List of targets, like the one returned by
+ * `ta_srv_query_domain'. The set takes a reference to each target, the
+ * list is still owned by the caller.
+ *
+ * Creates a set that puts the targets in the order they should be
+ * tried, as the RFC 2782 describes. The set is shuffled once when it
+ * is created and can be shuffled again on each connection attempt
+ * without asking the name server again. Each set has its own random
+ * number generator, so sets used by different threads don't share
+ * any state.
+ */
+ta_srv_target_set_t *ta_srv_target_set_new (ta_list_t *targets);
+
+/**
+ * @name: ta_srv_target_set::init
+ * @type: initializer
+ */
+void ta_srv_target_set_init (ta_srv_target_set_t *set, ta_list_t *targets);
+
+/**
+ * @name: ta_srv_target_set::set_seed
+ * @type: setter
+ * @param seed: Seed of the random number generator used by the next
+ * shuffles.
+ */
+void ta_srv_target_set_set_seed (ta_srv_target_set_t *set,
+                                 unsigned int seed);
+
+/**
+ * @name: ta_srv_target_set::shuffle
+ * @type: method
+ *
+ * Orders the targets again. Targets are sorted by priority and, inside
+ * each priority, picked at random giving precedence to the ones with
+ * higher weight. It takes O(n log n) and doesn't allocate memory.
+ */
+void ta_srv_target_set_shuffle (ta_srv_target_set_t *set);
+
+/**
+ * @name: ta_srv_target_set::get_size
+ * @type: getter
+ */
+int ta_srv_target_set_get_size (ta_srv_target_set_t *set);
+
+/**
+ * @name: ta_srv_target_set::get
+ * @type: getter
+ * @param index: Position of the target in the current order.
+ *
+ * Returns the target or NULL if `index' is out of bounds. The target
+ * is owned by the set.
+ */
+ta_srv_target_t *ta_srv_target_set_get (ta_srv_target_set_t *set,
+                                        int index);
+
 #ifdef __cplusplus
 }
 #endif
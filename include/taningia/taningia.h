@@ -32,5 +32,10 @@
 #include "xmpp.h"
 #include "global.h"
 #include "buf.h"
+#include "timer.h"
+#include "idgen.h"
+#include "logsink.h"
+#include "binlog.h"
+#include "pool.h"
 
 #endif /* _TANINGIA_H_ */
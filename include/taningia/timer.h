@@ -0,0 +1,171 @@
+/* timer.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _TANINGIA_TIMER_H_
+#define _TANINGIA_TIMER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <taningia/object.h>
+
+/* Number of levels in the wheel and the amount of bits used to index
+ * the slots of each level. The first level has 256 slots of one tick
+ * (millisecond) each, the other ones have 64 slots each. It is enough
+ * to hold a bit more than 18 hours without clamping. */
+#define TA_TIMER_WHEEL_LEVELS   4
+#define TA_TIMER_ROOT_BITS      8
+#define TA_TIMER_LEVEL_BITS     6
+#define TA_TIMER_ROOT_SIZE      (1 << TA_TIMER_ROOT_BITS)
+#define TA_TIMER_LEVEL_SIZE     (1 << TA_TIMER_LEVEL_BITS)
+
+#define TA_TIMER_INIT { NULL, NULL, 0, 0, NULL, NULL }
+
+typedef struct _ta_timer_t ta_timer_t;
+
+typedef void (*ta_timer_func_t) (ta_timer_t *, void *);
+
+/* Timers are meant to be embedded in the structures that need a
+ * deadline, so scheduling them never allocates memory. */
+struct _ta_timer_t
+{
+  ta_timer_t *next;
+  ta_timer_t **pprev;
+  unsigned long expires;
+  int level;
+  ta_timer_func_t callback;
+  void *data;
+};
+
+typedef struct
+{
+  ta_object_t parent;
+  unsigned long current;
+  int count;
+  int level_count[TA_TIMER_WHEEL_LEVELS];
+  ta_timer_t *root[TA_TIMER_ROOT_SIZE];
+  ta_timer_t *levels[TA_TIMER_WHEEL_LEVELS - 1][TA_TIMER_LEVEL_SIZE];
+} ta_timer_wheel_t;
+
+/**
+ * @name: ta_timer_now
+ * @type: function
+ *
+ * Returns the value of a monotonic clock in milliseconds. This is the
+ * time base expected by all the `ta_timer_wheel' methods.
+ */
+unsigned long ta_timer_now (void);
+
+/**
+ * @name: ta_timer::init
+ * @type: initializer
+ * @param callback: Function called when the timer expires.
+ * @param data: User defined value passed to the callback.
+ */
+void ta_timer_init (ta_timer_t *timer, ta_timer_func_t callback, void *data);
+
+/**
+ * @name: ta_timer::is_pending
+ * @type: method
+ * @return: bool
+ *
+ * Returns true if the timer is scheduled in a wheel.
+ */
+int ta_timer_is_pending (ta_timer_t *timer);
+
+/**
+ * @name: ta_timer_wheel::new
+ * @type: constructor
+ * @param now: The current time in milliseconds.
+ *
+ * Creates a new hierarchical timer wheel. Adding, cancelling and
+ * expiring timers are all O(1) operations.
+ */
+ta_timer_wheel_t *ta_timer_wheel_new (unsigned long now);
+
+/**
+ * @name: ta_timer_wheel::init
+ * @type: initializer
+ */
+void ta_timer_wheel_init (ta_timer_wheel_t *wheel, unsigned long now);
+
+/**
+ * @name: ta_timer_wheel::add
+ * @type: method
+ * @param timer: An initialized timer that is not pending.
+ * @param expires: Absolute expiration time in milliseconds.
+ *
+ * Schedules a timer. Timers already expired will be fired in the next
+ * call to `ta_timer_wheel_advance'.
+ */
+void ta_timer_wheel_add (ta_timer_wheel_t *wheel, ta_timer_t *timer,
+                         unsigned long expires);
+
+/**
+ * @name: ta_timer_wheel::cancel
+ * @type: method
+ *
+ * Removes a timer from the wheel without calling its callback. It is
+ * safe to call it with timers that are not pending.
+ */
+void ta_timer_wheel_cancel (ta_timer_wheel_t *wheel, ta_timer_t *timer);
+
+/**
+ * @name: ta_timer_wheel::advance
+ * @type: method
+ * @param now: The current time in milliseconds.
+ * @return: The number of timers fired.
+ *
+ * Moves the wheel clock to `now' calling the callback of all timers
+ * that expired in the meanwhile. Callbacks are allowed to add or cancel
+ * timers.
+ */
+int ta_timer_wheel_advance (ta_timer_wheel_t *wheel, unsigned long now);
+
+/**
+ * @name: ta_timer_wheel::next_timeout
+ * @type: method
+ * @param now: The current time in milliseconds.
+ *
+ * Returns how many milliseconds the caller can sleep before calling
+ * `ta_timer_wheel_advance' again or -1 if there are no pending
+ * timers. The value may be shorter than the real deadline of timers
+ * that are far away in the future, but never longer.
+ */
+long ta_timer_wheel_next_timeout (ta_timer_wheel_t *wheel, unsigned long now);
+
+/**
+ * @name: ta_timer_wheel::flush
+ * @type: method
+ *
+ * Fires all pending timers no matter their deadline.
+ */
+void ta_timer_wheel_flush (ta_timer_wheel_t *wheel);
+
+/**
+ * @name: ta_timer_wheel::get_count
+ * @type: getter
+ */
+int ta_timer_wheel_get_count (ta_timer_wheel_t *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TANINGIA_TIMER_H_ */
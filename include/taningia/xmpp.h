@@ -26,13 +26,74 @@ extern "C" {
 
 #include <iksemel.h>
 #include <taningia/taningia.h>
+#include <taningia/idgen.h>
+#include <taningia/pool.h>
 
 typedef struct _ta_xmpp_client_t ta_xmpp_client_t;
 
+/* Readiness hints returned by `ta_xmpp_client_get_io_events' */
+enum {
+  TA_XMPP_CLIENT_WANT_READ = 1 << 0,
+  TA_XMPP_CLIENT_WANT_WRITE = 1 << 1
+};
+
+/* Events of the client. Their names, used by
+ * `ta_xmpp_client_event_connect', are given in the comments. */
+typedef enum {
+  TA_XMPP_CLIENT_EVENT_CONNECTED,           /* connected */
+  TA_XMPP_CLIENT_EVENT_AUTHENTICATED,       /* authenticated */
+  TA_XMPP_CLIENT_EVENT_AUTH_FAILED,         /* authentication-failed */
+  TA_XMPP_CLIENT_EVENT_MESSAGE_RECEIVED,    /* message-received */
+  TA_XMPP_CLIENT_EVENT_PRESENCE_NOTICED,    /* presence-noticed */
+  TA_XMPP_CLIENT_EVENT_RESUMED,             /* resumed */
+  TA_XMPP_CLIENT_EVENT_ACKED,               /* acked */
+  TA_XMPP_CLIENT_EVENT_LAST
+} ta_xmpp_client_event_t;
+
 typedef int (*ta_xmpp_client_hook_t) (ta_xmpp_client_t *, void *, void *);
 
 typedef void (*ta_xmpp_client_answer_cb_t) (ta_xmpp_client_t *, iks *, void *);
 
+typedef void (*ta_xmpp_client_notify_func_t) (ta_xmpp_client_t *, void *);
+
+/* Counters of the outbound queue, see `ta_xmpp_client_get_queue_stats' */
+typedef struct {
+  int depth;                    /* Stanzas waiting to be written */
+  int max_depth;                /* Highest depth seen so far */
+  unsigned long enqueued;       /* Stanzas accepted by the queue */
+  unsigned long rejected;       /* Stanzas refused because of the limit */
+  unsigned long written;        /* Stanzas written to the connection */
+  unsigned long writes;         /* Write calls used to send them */
+} ta_xmpp_client_queue_stats_t;
+
+/* Counters of stream management, see `ta_xmpp_client_get_sm_stats' */
+typedef struct {
+  unsigned long sent;           /* Stanzas sent with stream management */
+  unsigned long acked;          /* Stanzas acknowledged by the server */
+  unsigned long unacked;        /* Stanzas waiting for acknowledgement */
+  unsigned long kept;           /* Stanzas in the replay buffer */
+  unsigned long replayed;       /* Stanzas sent again */
+  unsigned long overwritten;    /* Stanzas dropped from the full buffer */
+  unsigned long requests;       /* Acknowledgements requested */
+} ta_xmpp_client_sm_stats_t;
+
+/* When compressed data is flushed to the network, see
+ * `ta_xmpp_client_set_compression' */
+typedef enum {
+  TA_XMPP_COMPRESS_FLUSH_SYNC,    /* Every write ends on a byte boundary */
+  TA_XMPP_COMPRESS_FLUSH_PARTIAL, /* Like sync but may save a few bytes */
+  TA_XMPP_COMPRESS_FLUSH_FULL     /* Also resets the dictionary */
+} ta_xmpp_compress_flush_t;
+
+/* Counters of stream compression, see
+ * `ta_xmpp_client_get_compress_stats' */
+typedef struct {
+  unsigned long raw_out;        /* Bytes given to the compressor */
+  unsigned long compressed_out; /* Bytes written to the connection */
+  unsigned long raw_in;         /* Bytes given to the parser */
+  unsigned long compressed_in;  /* Bytes read from the connection */
+} ta_xmpp_client_compress_stats_t;
+
 /**
  * @name: ta_xmpp_client::new
  * @type: constructor
@@ -118,6 +179,33 @@ ta_log_t *ta_xmpp_client_get_logger (ta_xmpp_client_t *ctx);
  */
 iksfilter *ta_xmpp_client_get_filter (ta_xmpp_client_t *client);
 
+/**
+ * @name: ta_xmpp_client::get_idgen
+ * @type: getter
+ *
+ * Returns the id generator of the client. Ids taken from it never
+ * collide with the ones of other clients, so they are safe to be used
+ * with `ta_xmpp_client_send_raw_and_filter'.
+ */
+ta_idgen_t *ta_xmpp_client_get_idgen (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::get_request_timeout
+ * @type: getter
+ */
+int ta_xmpp_client_get_request_timeout (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::set_request_timeout
+ * @type: setter
+ * @param timeout: Time in milliseconds. Use 0 to wait forever.
+ *
+ * Sets how long requests sent with `ta_xmpp_client_send_and_filter'
+ * wait for an answer. The default value is 30 seconds.
+ */
+void ta_xmpp_client_set_request_timeout (ta_xmpp_client_t *client,
+                                         int timeout);
+
 /**
  * @name: ta_xmpp_client::connect
  * @type: method
@@ -128,6 +216,161 @@ iksfilter *ta_xmpp_client_get_filter (ta_xmpp_client_t *client);
  */
 int ta_xmpp_client_connect (ta_xmpp_client_t *client);
 
+/**
+ * @name: ta_xmpp_client::connect_fd
+ * @type: method
+ * @param fd: A socket already connected to the server.
+ * @raise: XMPP_CONNECTION_ERROR
+ *
+ * Opens the XMPP stream over `fd', like the ones given by
+ * `ta_xmpp_pool_take'. The client owns the socket from now on, it is
+ * closed by `ta_xmpp_client_disconnect'.
+ */
+int ta_xmpp_client_connect_fd (ta_xmpp_client_t *client, int fd);
+
+/**
+ * @name: ta_xmpp_client::get_pool
+ * @type: getter
+ */
+ta_xmpp_pool_t *ta_xmpp_client_get_pool (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::set_pool
+ * @type: setter
+ * @param pool: Pool of warm connections or NULL.
+ *
+ * When the connection breaks with a network error, the client takes a
+ * connection of `pool' and opens a new stream on it instead of
+ * stopping. If no connection is ready, the client keeps running and
+ * asks the pool again every 50 milliseconds without blocking,
+ * `ta_xmpp_client_process' and reactor loops keep returning in time
+ * meanwhile. After 5 seconds it reconnects by itself if
+ * `ta_xmpp_client_set_reconnect' enabled it, or stops otherwise.
+ */
+void ta_xmpp_client_set_pool (ta_xmpp_client_t *client,
+                              ta_xmpp_pool_t *pool);
+
+/**
+ * @name: ta_xmpp_client::set_reconnect
+ * @type: setter
+ * @param min_delay: Delay before the first attempt in milliseconds. 0
+ * disables reconnection, which is the default.
+ * @param max_delay: Longest delay between two attempts.
+ * @param attempts: How many attempts are made before giving up, 0
+ * tries forever.
+ *
+ * Makes the client connect again when the connection breaks instead
+ * of stopping. The delay doubles after each failed attempt until it
+ * reaches `max_delay' and a random part of it is added, so clients
+ * that lost the same server don't come back all at once. The counter
+ * is reset once the client authenticates again.
+ *
+ * Each attempt takes a warm connection of the pool set with
+ * `ta_xmpp_client_set_pool' when one is ready. Otherwise the name
+ * lookup and the connection are made in a thread of their own and
+ * `ta_xmpp_client_process' keeps returning in time meanwhile. The
+ * queue notifier is called when the new connection is ready.
+ *
+ * Requests sent with `ta_xmpp_client_send_and_filter' keep waiting for
+ * their answers while the client reconnects.
+ */
+void ta_xmpp_client_set_reconnect (ta_xmpp_client_t *client, int min_delay,
+                                   int max_delay, int attempts);
+
+/**
+ * @name: ta_xmpp_client::set_stream_management
+ * @type: setter
+ * @param enabled: Non zero to enable XEP-0198.
+ *
+ * Enables Stream Management when the server supports it. The server
+ * acknowledges the stanzas it receives and the ones it did not
+ * acknowledge when the connection breaks are sent again. If the server
+ * allows it, a reconnected client resumes the previous stream instead
+ * of binding a new resource, so presences and subscriptions are not
+ * lost and the <em>resumed</em> event is called instead of
+ * <em>authenticated</em>.
+ *
+ * Each call to the send functions counts as one stanza. Stanzas are
+ * numbered from 1 in the order they are sent, the <em>acked</em> event
+ * receives a pointer to an unsigned long with the number of stanzas
+ * acknowledged so far, so all stanzas up to that number were
+ * delivered.
+ */
+void ta_xmpp_client_set_stream_management (ta_xmpp_client_t *client,
+                                           int enabled);
+
+/**
+ * @name: ta_xmpp_client::get_unacked
+ * @type: getter
+ *
+ * Returns how many stanzas were sent and not acknowledged by the
+ * server yet.
+ */
+int ta_xmpp_client_get_unacked (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::set_ack_batch
+ * @type: setter
+ * @param stanzas: Acknowledgements are requested after this many
+ * stanzas are sent, 0 disables it. The default is 16.
+ * @param msecs: Acknowledgements are requested this long after the
+ * first stanza of a batch is sent, even if the batch is not complete.
+ * 0 disables it. The default is 1 second.
+ *
+ * Sets how often the server is asked to acknowledge the stanzas it
+ * received. Bigger batches save bandwidth but keep more stanzas
+ * waiting. A batch is never bigger than half of the replay buffer.
+ */
+void ta_xmpp_client_set_ack_batch (ta_xmpp_client_t *client, int stanzas,
+                                   int msecs);
+
+/**
+ * @name: ta_xmpp_client::set_replay_limit
+ * @type: setter
+ * @param stanzas: How many unacknowledged stanzas are kept, rounded up
+ * to a power of two. The default is 1024.
+ *
+ * Sets the size of the ring that keeps the sent stanzas until the
+ * server acknowledges them. When it is full, the oldest stanzas are
+ * dropped and are not sent again if the connection breaks.
+ */
+void ta_xmpp_client_set_replay_limit (ta_xmpp_client_t *client,
+                                      int stanzas);
+
+/**
+ * @name: ta_xmpp_client::get_sm_stats
+ * @type: getter
+ * @param stats: Struct that will be filled with the counters.
+ */
+void ta_xmpp_client_get_sm_stats (ta_xmpp_client_t *client,
+                                  ta_xmpp_client_sm_stats_t *stats);
+
+/**
+ * @name: ta_xmpp_client::set_compression
+ * @type: setter
+ * @param level: zlib compression level, from 1 (fastest) to 9
+ * (smallest). 0 disables compression, which is the default.
+ * @param flush: When compressed data is sent to the network.
+ * @raise: TA_XMPP_COMPRESS_ERROR
+ *
+ * Asks the server for zlib stream compression (XEP-0138) after the
+ * client is authenticated. It is never used when the stream is
+ * already encrypted. Takes effect on the next connection. Returns
+ * TA_ERROR if the library was built without zlib.
+ */
+int ta_xmpp_client_set_compression (ta_xmpp_client_t *client, int level,
+                                    ta_xmpp_compress_flush_t flush);
+
+/**
+ * @name: ta_xmpp_client::get_compress_stats
+ * @type: getter
+ * @param stats: Struct that will be filled with the counters.
+ *
+ * The counters only cover data sent while the stream was compressed.
+ */
+void ta_xmpp_client_get_compress_stats (ta_xmpp_client_t *client,
+                                        ta_xmpp_client_compress_stats_t *stats);
+
 /**
  * @name: ta_xmpp_client::disconnect
  * @type: method
@@ -176,12 +419,121 @@ int ta_xmpp_client_send_presence (ta_xmpp_client_t *ctx,
  * Sends iks nodes to the XMPP server. Only call this function after
  * making sure that client is running properly. To do it, use the
  * `ta_xmpp_client_is_running' function.
+ *
+ * Stanzas without an id get one from the client id generator, since
+ * the answer is matched by it.
+ *
+ * If no answer arrives before the request timeout or the client is
+ * disconnected, `cb' is called with a NULL node and the error
+ * TA_XMPP_TIMEOUT_ERROR is set.
  */
 int
 ta_xmpp_client_send_and_filter (ta_xmpp_client_t *client, iks *node,
                                 ta_xmpp_client_answer_cb_t cb, void *data,
                                 ta_free_func_t free_cb);
 
+/**
+ * @name: ta_xmpp_client::send_raw
+ * @type: method
+ * @param xml: Serialized stanza to be sent.
+ *
+ * Sends bytes that were already serialized, like the ones written by
+ * `ta_pubsub_node_publish_text_buf'. No validation is done, so `xml'
+ * must hold complete and well formed stanzas.
+ */
+int ta_xmpp_client_send_raw (ta_xmpp_client_t *client, const char *xml);
+
+/**
+ * @name: ta_xmpp_client::send_raw_and_filter
+ * @type: method
+ * @param id: Id of the serialized stanza.
+ * @param xml: Serialized stanza to be sent.
+ * @see: ta_xmpp_client_send_and_filter
+ *
+ * Same of `ta_xmpp_client_send_and_filter' for stanzas that were
+ * already serialized. The id can't be read from the stanza, so it
+ * must be informed.
+ */
+int ta_xmpp_client_send_raw_and_filter (ta_xmpp_client_t *client,
+                                        const char *id, const char *xml,
+                                        ta_xmpp_client_answer_cb_t cb,
+                                        void *data, ta_free_func_t free_cb);
+
+/**
+ * @name: ta_xmpp_client::enqueue
+ * @type: method
+ * @param node: The iks node to be sent to the XMPP server. It is
+ * serialized before returning, so the caller still owns it.
+ * @raise: TA_XMPP_QUEUE_FULL_ERROR
+ *
+ * Puts a stanza in the outbound queue of the client. Unlike
+ * `ta_xmpp_client_send', this method can be called from any thread
+ * and never touches the connection. The queue is drained by the
+ * thread running the client loop, that writes all the queued stanzas
+ * at once in the next call to `ta_xmpp_client_process' or
+ * `ta_xmpp_client_flush'.
+ *
+ * If the queue already holds as many stanzas as its limit, the stanza
+ * is refused and TA_ERROR is returned. Stanzas sent directly with
+ * `ta_xmpp_client_send' might be written before the queued ones.
+ */
+int ta_xmpp_client_enqueue (ta_xmpp_client_t *client, iks *node);
+
+/**
+ * @name: ta_xmpp_client::flush
+ * @type: method
+ * @raise: TA_XMPP_NETWORK_ERROR
+ *
+ * Writes all the stanzas in the outbound queue, coalescing them in as
+ * few writes as possible. Must only be called from the thread running
+ * the client loop.
+ */
+int ta_xmpp_client_flush (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::get_queue_limit
+ * @type: getter
+ */
+int ta_xmpp_client_get_queue_limit (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::set_queue_limit
+ * @type: setter
+ * @param limit: Maximum number of stanzas waiting in the outbound
+ * queue. Zero means no limit.
+ */
+void ta_xmpp_client_set_queue_limit (ta_xmpp_client_t *client, int limit);
+
+/**
+ * @name: ta_xmpp_client::get_queue_stats
+ * @type: getter
+ * @param stats: Struct that will be filled with the counters.
+ *
+ * Reads the counters of the outbound queue. They are updated without
+ * locks, so each value is exact but they might not be consistent with
+ * each other.
+ */
+void ta_xmpp_client_get_queue_stats (ta_xmpp_client_t *client,
+                                     ta_xmpp_client_queue_stats_t *stats);
+
+/**
+ * @name: ta_xmpp_client::set_queue_notify
+ * @type: setter
+ * @param func: Function called when a stanza is put in an empty
+ * queue, from the thread that called `ta_xmpp_client_enqueue'. Pass
+ * NULL to restore the default behaviour.
+ * @param data: Parameter passed to `func'.
+ *
+ * By default, the client wakes up `ta_xmpp_client_process' when there
+ * is something to write. External event loops should install a
+ * function that wakes them up and then call `ta_xmpp_client_flush'
+ * (or `ta_xmpp_client_process') from the loop thread. Must be set
+ * before other threads start to enqueue stanzas.
+ */
+void ta_xmpp_client_set_queue_notify (ta_xmpp_client_t *client,
+                                      ta_xmpp_client_notify_func_t func,
+                                      void *data);
+
 /**
  * @name: ta_xmpp_client::run
  * @type: method
@@ -191,6 +543,66 @@ ta_xmpp_client_send_and_filter (ta_xmpp_client_t *client, iks *node,
  */
 int ta_xmpp_client_run (ta_xmpp_client_t *ctx);
 
+/**
+ * @name: ta_xmpp_client::process
+ * @type: method
+ * @param timeout: Maximum time to wait for data, in milliseconds. Use
+ * -1 to wait until something happens and 0 to not wait at all.
+ *
+ * Runs a single step of the client main loop: waits for the socket to
+ * become readable, parses what arrived (calling all the hooks and
+ * callbacks that it triggers), writes the outbound queue and expires
+ * the requests that were not answered in time. The wait never exceeds
+ * the next request deadline and is interrupted by stanzas enqueued
+ * from other threads.
+ *
+ * This is the building block for driving clients from an external
+ * event loop. Register the descriptor returned by
+ * `ta_xmpp_client_get_fd' with the events returned by
+ * `ta_xmpp_client_get_io_events' and call this function with a 0
+ * timeout when it is ready, or when the time returned by
+ * `ta_xmpp_client_get_timeout' expires. The socket is only read when
+ * it is readable, so calling this function with a 0 timeout never
+ * blocks.
+ *
+ * Secure streams are refused with TA_XMPP_TLS_ERROR: once the socket
+ * is readable, the TLS layer of iksemel keeps reading until the
+ * connection drops, so a single step would never return. They must be
+ * driven by `ta_xmpp_client_run'.
+ */
+int ta_xmpp_client_process (ta_xmpp_client_t *client, int timeout);
+
+/**
+ * @name: ta_xmpp_client::get_fd
+ * @type: getter
+ *
+ * Returns the socket descriptor of the connection or -1 if the client
+ * is not connected.
+ */
+int ta_xmpp_client_get_fd (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::get_io_events
+ * @type: getter
+ *
+ * Returns a mask of `TA_XMPP_CLIENT_WANT_READ' and
+ * `TA_XMPP_CLIENT_WANT_WRITE' saying which events the client is
+ * interested in. `TA_XMPP_CLIENT_WANT_WRITE' is set while there are
+ * stanzas in the outbound queue, except while they are held for a
+ * stream that is being resumed.
+ */
+int ta_xmpp_client_get_io_events (ta_xmpp_client_t *client);
+
+/**
+ * @name: ta_xmpp_client::get_timeout
+ * @type: getter
+ *
+ * Returns how many milliseconds can pass before
+ * `ta_xmpp_client_process' must be called even without network
+ * activity, or -1 if there is no deadline.
+ */
+long ta_xmpp_client_get_timeout (ta_xmpp_client_t *client);
+
 /**
  * @name: ta_xmpp_client::is_running
  * @type: method
@@ -200,6 +612,16 @@ int ta_xmpp_client_run (ta_xmpp_client_t *ctx);
  */
 int ta_xmpp_client_is_running (ta_xmpp_client_t *ctx);
 
+/**
+ * @name: ta_xmpp_client::is_secure
+ * @type: method
+ * @return: bool
+ *
+ * Returns true if the stream is (or is going to be) encrypted with
+ * TLS. Such clients can't be driven by `ta_xmpp_client_process'.
+ */
+int ta_xmpp_client_is_secure (ta_xmpp_client_t *client);
+
 /**
  * @name: ta_xmpp_client::event_connect
  * @type: method
@@ -255,6 +677,48 @@ int ta_xmpp_client_event_disconnect (ta_xmpp_client_t *client,
                                      const char *event,
                                      ta_xmpp_client_hook_t hook);
 
+/**
+ * @name: ta_xmpp_client::event_lookup
+ * @type: static method
+ * @param name: The event name
+ *
+ * Returns the id of the event called `name' or -1 if there is no
+ * such event.
+ */
+int ta_xmpp_client_event_lookup (const char *name);
+
+/**
+ * @name: ta_xmpp_client::event_connect_id
+ * @type: method
+ * @param event: Id of the event, see `ta_xmpp_client_event_lookup'.
+ * @param hook (callable): The hook to be connected to the event.
+ * @param user_data (optional): User defined value to be passed to the
+ * hook.
+ * @raise: XMPP_NO_SUCH_EVENT_ERROR
+ *
+ * Same as `ta_xmpp_client_event_connect' but skips the lookup of
+ * the event name.
+ */
+int ta_xmpp_client_event_connect_id (ta_xmpp_client_t *client,
+                                     ta_xmpp_client_event_t event,
+                                     ta_xmpp_client_hook_t hook,
+                                     void *user_data);
+
+/**
+ * @name: ta_xmpp_client::event_disconnect_id
+ * @type: method
+ * @param event: Id of the event, see `ta_xmpp_client_event_lookup'.
+ * @param hook (callable): Hook to be disconnected from the event. If
+ * it is `NULL', all hooks will be deleted.
+ * @raise: XMPP_NO_SUCH_EVENT_ERROR
+ *
+ * Same as `ta_xmpp_client_event_disconnect' but skips the lookup of
+ * the event name.
+ */
+int ta_xmpp_client_event_disconnect_id (ta_xmpp_client_t *client,
+                                        ta_xmpp_client_event_t event,
+                                        ta_xmpp_client_hook_t hook);
+
 #ifdef __cplusplus
 }
 #endif
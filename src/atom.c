@@ -896,250 +896,403 @@ ta_atom_entry_set_from_file (ta_atom_entry_t *entry,
   return result;
 }
 
+/* Atom elements known by the parsers */
+enum {
+  ATOM_UNKNOWN,
+  ATOM_AUTHOR,
+  ATOM_CATEGORY,
+  ATOM_CONTENT,
+  ATOM_EMAIL,
+  ATOM_ENTRY,
+  ATOM_ID,
+  ATOM_IN_REPLY_TO,
+  ATOM_LINK,
+  ATOM_NAME,
+  ATOM_PUBLISHED,
+  ATOM_RIGHTS,
+  ATOM_SUMMARY,
+  ATOM_TITLE,
+  ATOM_UPDATED,
+  ATOM_URI
+};
+
+/* Tells which element `node' is. The first letter narrows the
+ * candidates down to one or two names, so parsers can walk the
+ * children once and switch on the result. */
+static int
+_atom_element (iks *node)
+{
+  const char *name;
+  if (iks_type (node) != IKS_TAG || (name = iks_name (node)) == NULL)
+    return ATOM_UNKNOWN;
+
+#define IS(str) (strcmp (name + 1, (str) + 1) == 0)
+  switch (name[0])
+    {
+    case 'a':
+      return IS ("author") ? ATOM_AUTHOR : ATOM_UNKNOWN;
+    case 'c':
+      return IS ("category") ? ATOM_CATEGORY :
+        IS ("content") ? ATOM_CONTENT : ATOM_UNKNOWN;
+    case 'e':
+      return IS ("entry") ? ATOM_ENTRY :
+        IS ("email") ? ATOM_EMAIL : ATOM_UNKNOWN;
+    case 'i':
+      return IS ("id") ? ATOM_ID :
+        IS ("in-reply-to") ? ATOM_IN_REPLY_TO : ATOM_UNKNOWN;
+    case 'l':
+      return IS ("link") ? ATOM_LINK : ATOM_UNKNOWN;
+    case 'n':
+      return IS ("name") ? ATOM_NAME : ATOM_UNKNOWN;
+    case 'p':
+      return IS ("published") ? ATOM_PUBLISHED : ATOM_UNKNOWN;
+    case 'r':
+      return IS ("rights") ? ATOM_RIGHTS : ATOM_UNKNOWN;
+    case 's':
+      return IS ("summary") ? ATOM_SUMMARY : ATOM_UNKNOWN;
+    case 't':
+      return IS ("title") ? ATOM_TITLE : ATOM_UNKNOWN;
+    case 'u':
+      return IS ("updated") ? ATOM_UPDATED :
+        IS ("uri") ? ATOM_URI : ATOM_UNKNOWN;
+    default:
+      return ATOM_UNKNOWN;
+    }
+#undef IS
+}
+
+/* Text of an element, like `iks_find_cdata' does */
+#define _atom_cdata(node) (iks_cdata (iks_child (node)))
+
+/* Parses an iri, returns NULL if it is not valid */
+static ta_iri_t *
+_atom_parse_iri (const char *str)
+{
+  ta_iri_t *iri = ta_iri_new ();
+  if (ta_iri_set_from_string (iri, str) != TA_OK)
+    {
+      ta_object_unref (iri);
+      return NULL;
+    }
+  return iri;
+}
+
+static ta_atom_person_t *
+_atom_parse_person (iks *node)
+{
+  ta_atom_person_t *person;
+  ta_iri_t *iri = NULL;
+  char *name = NULL, *email = NULL, *uri = NULL;
+  iks *child;
+
+  for (child = iks_child (node); child; child = iks_next (child))
+    switch (_atom_element (child))
+      {
+      case ATOM_NAME:
+        if (!name)
+          name = _atom_cdata (child);
+        break;
+      case ATOM_EMAIL:
+        if (!email)
+          email = _atom_cdata (child);
+        break;
+      case ATOM_URI:
+        if (!uri)
+          uri = _atom_cdata (child);
+        break;
+      }
+
+  /* Specification is clear, an ta_atom:author element *MUST* have a
+   * name. */
+  if (!name)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR, "Author with no name");
+      return NULL;
+    }
+
+  /* Like above, specification denies invalid iris in an uri of a
+   * person object. */
+  if (uri && (iri = _atom_parse_iri (uri)) == NULL)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "Author with an invalid iri in uri field");
+      return NULL;
+    }
+  person = ta_atom_person_new (name, email, iri);
+  if (iri)
+    ta_object_unref (iri);
+  return person;
+}
+
+static ta_atom_category_t *
+_atom_parse_category (iks *node)
+{
+  ta_atom_category_t *cat;
+  ta_iri_t *iri = NULL;
+  char *term, *label, *scheme;
+
+  term = iks_find_attrib (node, "term");
+  label = iks_find_attrib (node, "label");
+  scheme = iks_find_attrib (node, "scheme");
+  if (!term)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "Category with no term attribute");
+      return NULL;
+    }
+  if (scheme && (iri = _atom_parse_iri (scheme)) == NULL)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "Category scheme attribute is not a valid iri");
+      return NULL;
+    }
+  cat = ta_atom_category_new (term, label, iri);
+  if (iri)
+    ta_object_unref (iri);
+  return cat;
+}
+
+static ta_atom_link_t *
+_atom_parse_link (iks *node)
+{
+  ta_atom_link_t *link;
+  ta_iri_t *iri;
+  char *href, *attr;
+
+  if ((href = iks_find_attrib (node, "href")) == NULL)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR, "Link with no href attribute");
+      return NULL;
+    }
+  if ((iri = _atom_parse_iri (href)) == NULL)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "Link href attribute is not a valid iri");
+      return NULL;
+    }
+
+  /* The link takes the reference of the iri */
+  link = ta_atom_link_new (iri);
+  if ((attr = iks_find_attrib (node, "rel")) != NULL)
+    ta_atom_link_set_rel (link, attr);
+  if ((attr = iks_find_attrib (node, "type")) != NULL)
+    ta_atom_link_set_type (link, attr);
+  if ((attr = iks_find_attrib (node, "title")) != NULL)
+    ta_atom_link_set_title (link, attr);
+  if ((attr = iks_find_attrib (node, "length")) != NULL)
+    ta_atom_link_set_length (link, attr);
+  return link;
+}
+
+static ta_atom_in_reply_to_t *
+_atom_parse_in_reply_to (iks *node)
+{
+  ta_atom_in_reply_to_t *irt;
+  ta_iri_t *iri;
+  char *ref, *href, *source, *type;
+
+  ref = iks_find_attrib (node, "ref");
+  href = iks_find_attrib (node, "href");
+  source = iks_find_attrib (node, "source");
+  type = iks_find_attrib (node, "type");
+  if (!ref)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "InReplyTo element with no ref attribute.");
+      return NULL;
+    }
+  if ((iri = _atom_parse_iri (ref)) == NULL)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "InReplyTo element with an invalid ref attribute");
+      return NULL;
+    }
+  irt = ta_atom_in_reply_to_new (iri);
+  ta_object_unref (iri);
+
+  /* Invalid optional attributes are just left out */
+  if (href && (iri = _atom_parse_iri (href)) != NULL)
+    {
+      ta_atom_in_reply_to_set_href (irt, iri);
+      ta_object_unref (iri);
+    }
+  if (source && (iri = _atom_parse_iri (source)) != NULL)
+    {
+      ta_atom_in_reply_to_set_source (irt, iri);
+      ta_object_unref (iri);
+    }
+  if (type)
+    ta_atom_in_reply_to_set_type (irt, type);
+  return irt;
+}
+
+static ta_atom_content_t *
+_atom_parse_content (iks *node, int *skip)
+{
+  ta_atom_content_t *ct;
+  ta_iri_t *iri;
+  char *type, *src, *text;
+
+  type = iks_find_attrib (node, "type");
+  src = iks_find_attrib (node, "src");
+  text = _atom_cdata (node);
+  if (!type && !src)
+    type = "text";
+
+  /* When content is filled, entry content should have no src
+   * attribute */
+  if (src && text)
+    {
+      ta_error_set (TA_ATOM_PARSING_ERROR,
+                    "Invalid content, it has the src attribute set "
+                    "and content tag is filled");
+      return NULL;
+    }
+  if (!src && !text)
+    {
+      *skip = 1;
+      return NULL;
+    }
+
+  ct = ta_atom_content_new (type);
+  if (src)
+    {
+      if ((iri = _atom_parse_iri (src)) == NULL)
+        {
+          ta_error_set (TA_ATOM_PARSING_ERROR,
+                        "Invalid iri in content src attribute");
+          ta_object_unref (ct);
+          return NULL;
+        }
+      ta_atom_content_set_src (ct, iri);
+      ta_object_unref (iri);
+    }
+  else
+    ta_atom_content_set_content (ct, text, iks_cdata_size (iks_child (node)));
+  return ct;
+}
+
+/* Adds an object parsed by one of the helpers above to the entry or
+ * feed, returns 0 if the parser failed */
+#define ADD_PARSED(obj, parse, add, target)     \
+  do {                                          \
+    if (((obj) = (parse)) == NULL)              \
+      return 0;                                 \
+    add ((target), (obj));                      \
+    ta_object_unref (obj);                      \
+  } while (0)
+
 int
 ta_atom_entry_set_from_iks (ta_atom_entry_t *entry,
                             iks        *ik)
 {
   ta_iri_t *eid;
-  iks *child, *content;
-  char *id, *title, *updated, *published, *summary, *rights;
+  ta_atom_person_t *author;
+  ta_atom_category_t *cat;
+  ta_atom_link_t *link;
+  ta_atom_in_reply_to_t *irt;
+  ta_atom_content_t *ct;
+  iks *child, *content = NULL;
+  char *id = NULL, *title = NULL, *updated = NULL, *published = NULL;
+  char *summary = NULL, *rights = NULL;
+  int skip = 0;
 
   if (strcmp (iks_name (ik), "entry") ||
       !iks_has_children (ik))
     {
-      iks_delete (ik);
       ta_error_set (TA_ATOM_PARSING_ERROR, "Wrong root entry element");
       return 0;
     }
-  id = iks_find_cdata (ik, "id");
+
+  /* All the children are visited once. Simple fields are kept until
+   * the required ones are validated, like `iks_find' the first
+   * element of each name wins. */
+  for (child = iks_child (ik); child; child = iks_next (child))
+    switch (_atom_element (child))
+      {
+      case ATOM_ID:
+        if (!id)
+          id = _atom_cdata (child);
+        break;
+      case ATOM_TITLE:
+        if (!title)
+          title = _atom_cdata (child);
+        break;
+      case ATOM_UPDATED:
+        if (!updated)
+          updated = _atom_cdata (child);
+        break;
+      case ATOM_PUBLISHED:
+        if (!published)
+          published = _atom_cdata (child);
+        break;
+      case ATOM_SUMMARY:
+        if (!summary)
+          summary = _atom_cdata (child);
+        break;
+      case ATOM_RIGHTS:
+        if (!rights)
+          rights = _atom_cdata (child);
+        break;
+      case ATOM_CONTENT:
+        if (!content)
+          content = child;
+        break;
+      case ATOM_AUTHOR:
+        ADD_PARSED (author, _atom_parse_person (child),
+                    ta_atom_entry_add_author, entry);
+        break;
+      case ATOM_CATEGORY:
+        ADD_PARSED (cat, _atom_parse_category (child),
+                    ta_atom_entry_add_category, entry);
+        break;
+      case ATOM_LINK:
+        ADD_PARSED (link, _atom_parse_link (child),
+                    ta_atom_entry_add_link, entry);
+        break;
+      case ATOM_IN_REPLY_TO:
+        ADD_PARSED (irt, _atom_parse_in_reply_to (child),
+                    ta_atom_entry_add_inreplyto, entry);
+        break;
+      }
+
   if (!id)
     {
       ta_error_set (TA_ATOM_PARSING_ERROR, "No <id> element found");
       return 0;
     }
-  eid = ta_iri_new ();
-  if (!ta_iri_set_from_string (eid, id))
+  if ((eid = _atom_parse_iri (id)) == NULL)
     {
       ta_error_set (TA_ATOM_PARSING_ERROR, "Invalid <id> iri");
-      ta_object_unref (eid);
       return 0;
     }
-  title = iks_find_cdata (ik, "title");
   if (!title)
     {
       ta_error_set (TA_ATOM_PARSING_ERROR, "No <title> element found");
+      ta_object_unref (eid);
       return 0;
     }
 
-  /* Here we have almost all required fields */
   ta_atom_entry_set_id (entry, eid);
+  ta_object_unref (eid);
   ta_atom_entry_set_title (entry, title);
-
-  updated = iks_find_cdata (ik, "updated");
   if (updated)
-    {
-      time_t updatedt;
-      updatedt = iso8601_to_time (updated);
-      ta_atom_entry_set_updated (entry, updatedt);
-    }
-
-  published = iks_find_cdata (ik, "published");
+    ta_atom_entry_set_updated (entry, iso8601_to_time (updated));
   if (published)
-    {
-      time_t publishedt;
-      publishedt = iso8601_to_time (published);
-      ta_atom_entry_set_published (entry, publishedt);
-    }
-
-  summary = iks_find_cdata (ik, "summary");
+    ta_atom_entry_set_published (entry, iso8601_to_time (published));
   if (summary)
     ta_atom_entry_set_summary (entry, summary);
-
-  rights = iks_find_cdata (ik, "rights");
   if (rights)
     ta_atom_entry_set_rights (entry, rights);
 
-  content = iks_find (ik, "content");
   if (content)
     {
-      ta_atom_content_t *ct;
-      char *type = NULL, *src = NULL, *scontent = NULL;
-      int content_len = 0;
-      type = iks_find_attrib (content, "type");
-      src = iks_find_attrib (content, "src");
-      scontent = iks_find_cdata (ik, "content");
-      if (!type && !src)
-        type = "text";
-
-      /* When content is filled, entry content should have no src
-       * attribute */
-      if (src && scontent)
-        {
-          ta_error_set (TA_ATOM_PARSING_ERROR,
-                        "Invalid content, it has the src attribute set "
-                        "and content tag is filled");
-          return 0;
-        }
-      if (!src && !scontent)
-        goto look_for_children;
-
-      ct = ta_atom_content_new (type);
-      if (scontent)
-        {
-          content_len = iks_cdata_size (iks_child (content));
-          ta_atom_content_set_content (ct, scontent, content_len);
-        }
-      if (src)
-        {
-          ta_iri_t *srci;
-          srci = ta_iri_new ();
-          if (!ta_iri_set_from_string (srci, src))
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                            "Invalid iri in content src attribute");
-              ta_object_unref (srci);
-              ta_object_unref (ct);
-              return 0;
-            }
-          ta_atom_content_set_src (ct, srci);
-        }
-      if (scontent)
-        ta_atom_content_set_content (ct, scontent, content_len);
-      ta_atom_entry_set_content (entry, ct);
-    }
-
- look_for_children:
-
-  /* Looking for more structured data */
-  for (child = iks_child (ik); child; child = iks_next (child))
-    {
-      if (!strcmp (iks_name (child), "author"))
-        {
-          char *name, *email = NULL, *uri = NULL;
-          ta_iri_t *iri = NULL;
-          ta_atom_person_t *author;
-          name = iks_find_cdata (child, "name");
-
-          /* Specification is clear, an ta_atom:author element *MUST*
-           * have a name. */
-          if (!name)
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR, "Author with no name");
-              return 0;
-            }
-          email = iks_find_cdata (child, "email");
-          uri = iks_find_cdata (child, "uri");
-          iri = ta_iri_new ();
-
-          /* Like above, specification denies invalid iris in an uri
-           * of a person object. */
-          if (uri && !ta_iri_set_from_string (iri, uri))
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                            "Author with an invalid iri in uri field");
-              ta_object_unref (iri);
-              return 0;
-            }
-          author = ta_atom_person_new (name, email, iri);
-          ta_atom_entry_add_author (entry, author);
-        }
-      if (!strcmp (iks_name (child), "category"))
-        {
-          ta_atom_category_t *cat;
-          ta_iri_t *iri = NULL;
-          char *term = NULL, *label = NULL, *scheme = NULL;
-          term = iks_find_attrib (child, "term");
-          label = iks_find_attrib (child, "label");
-          scheme = iks_find_attrib (child, "scheme");
-          if (!term)
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                            "Category with no term attribute");
-              return 0;
-            }
-          if (scheme)
-            {
-              iri = ta_iri_new ();
-              if (!ta_iri_set_from_string (iri, scheme))
-                {
-                  ta_error_set (TA_ATOM_PARSING_ERROR,
-                                "Category scheme attribute is not a "
-                                "valid iri");
-                  ta_object_unref (iri);
-                  return 0;
-                }
-            }
-          cat = ta_atom_category_new (term, label, iri);
-          ta_atom_entry_add_category (entry, cat);
-        }
-      if (!strcmp (iks_name (child), "in-reply-to"))
+      if ((ct = _atom_parse_content (content, &skip)) == NULL && !skip)
+        return 0;
+      if (ct)
         {
-          ta_atom_in_reply_to_t *irt;
-          ta_iri_t *iri_ref;
-          char *ref, *href, *source, *type;
-          ref = iks_find_attrib (child, "ref");
-          href = iks_find_attrib (child, "href");
-          source = iks_find_attrib (child, "source");
-          type = iks_find_attrib (child, "type");
-          if (!ref)
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                            "InReplyTo element with no ref attribute.");
-              return 0;
-            }
-
-          iri_ref = ta_iri_new ();
-          if (!ta_iri_set_from_string (iri_ref, ref))
-            {
-              const ta_error_t *error = ta_error_last ();
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                            "InReplyTo element with an invalid ref "
-                            "attribute: %s",
-                            error->message);
-              ta_error_clear ();
-              return 0;
-            }
-          else
-            irt = ta_atom_in_reply_to_new (iri_ref);
-
-          if (href)
-            {
-              ta_iri_t *iri_href;
-              iri_href = ta_iri_new ();
-              if (!ta_iri_set_from_string (iri_href, href))
-                {
-                  const ta_error_t *error = ta_error_last ();
-                  ta_error_set (TA_ATOM_PARSING_ERROR,
-                                "InReplyTo element with an invalid href "
-                                "attribute: %s",
-                                error->message);
-                  ta_error_clear ();
-                  ta_object_unref (irt);
-                }
-              else
-                ta_atom_in_reply_to_set_href (irt, iri_href);
-            }
-
-          if (source)
-            {
-              ta_iri_t *iri_source;
-              iri_source = ta_iri_new ();
-              if (!ta_iri_set_from_string (iri_source, source))
-                {
-                  const ta_error_t *error = ta_error_last ();
-                  ta_error_set (TA_ATOM_PARSING_ERROR,
-                                "InReplyTo element with an invalid "
-                                "source attribute: %s",
-                                error->message);
-                  ta_error_clear ();
-                  ta_object_unref (irt);
-                }
-              else
-                ta_atom_in_reply_to_set_source (irt, iri_source);
-            }
-
-          if (type)
-            ta_atom_in_reply_to_set_type (irt, type);
+          ta_atom_entry_set_content (entry, ct);
+          ta_object_unref (ct);
         }
     }
   return 1;
@@ -1545,127 +1698,80 @@ int
 ta_atom_feed_set_from_iks (ta_atom_feed_t *feed, iks *ik)
 {
   ta_iri_t *eid;
+  ta_atom_person_t *author;
+  ta_atom_category_t *cat;
+  ta_atom_link_t *link;
+  ta_atom_entry_t *entry;
   iks *child;
-  char *id, *title, *updated;
+  char *id = NULL, *title = NULL, *updated = NULL;
 
   if (strcmp (iks_name (ik), "feed") ||
       !iks_has_children (ik))
     {
-      iks_delete (ik);
       ta_error_set (TA_ATOM_PARSING_ERROR, "Wrong root feed element");
       return 0;
     }
-  id = iks_find_cdata (ik, "id");
+
+  for (child = iks_child (ik); child; child = iks_next (child))
+    switch (_atom_element (child))
+      {
+      case ATOM_ID:
+        if (!id)
+          id = _atom_cdata (child);
+        break;
+      case ATOM_TITLE:
+        if (!title)
+          title = _atom_cdata (child);
+        break;
+      case ATOM_UPDATED:
+        if (!updated)
+          updated = _atom_cdata (child);
+        break;
+      case ATOM_AUTHOR:
+        ADD_PARSED (author, _atom_parse_person (child),
+                    ta_atom_feed_add_author, feed);
+        break;
+      case ATOM_CATEGORY:
+        ADD_PARSED (cat, _atom_parse_category (child),
+                    ta_atom_feed_add_category, feed);
+        break;
+      case ATOM_LINK:
+        ADD_PARSED (link, _atom_parse_link (child),
+                    ta_atom_feed_add_link, feed);
+        break;
+      case ATOM_ENTRY:
+        /* Broken entries are skipped */
+        entry = ta_atom_entry_new (NULL);
+        if (ta_atom_entry_set_from_iks (entry, child))
+          ta_atom_feed_add_entry (feed, entry);
+        else
+          ta_error_clear ();
+        ta_object_unref (entry);
+        break;
+      }
+
   if (!id)
     {
       ta_error_set (TA_ATOM_PARSING_ERROR, "No <id> element found");
       return 0;
     }
-  eid = ta_iri_new ();
-  if (!ta_iri_set_from_string (eid, id))
+  if ((eid = _atom_parse_iri (id)) == NULL)
     {
       ta_error_set (TA_ATOM_PARSING_ERROR, "Invalid <id> iri");
-      ta_object_unref (eid);
       return 0;
     }
-  title = iks_find_cdata (ik, "title");
   if (!title)
     {
       ta_error_set (TA_ATOM_PARSING_ERROR, "No <title> element found");
+      ta_object_unref (eid);
       return 0;
     }
 
-  /* Here we have almost all required fields */
   ta_atom_feed_set_id (feed, eid);
+  ta_object_unref (eid);
   ta_atom_feed_set_title (feed, title);
-
-  updated = iks_find_cdata (ik, "updated");
   if (updated)
-    {
-      time_t updatedt;
-      updatedt = iso8601_to_time (updated);
-      ta_atom_feed_set_updated (feed, updatedt);
-    }
-
-  /* Looking for more structured data */
-  for (child = iks_child (ik); child; child = iks_next (child))
-    {
-      if (!strcmp (iks_name (child), "author"))
-        {
-          char *name, *email = NULL, *uri = NULL;
-          ta_iri_t *iri = NULL;
-          ta_atom_person_t *author;
-          name = iks_find_cdata (child, "name");
-
-          /* Specification is clear, an ta_atom:author element *MUST*
-           * have a name. */
-          if (!name)
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR, "Author with no name");
-              return 0;
-            }
-          email = iks_find_cdata (child, "email");
-          uri = iks_find_cdata (child, "uri");
-          iri = ta_iri_new ();
-          if (uri)
-            ta_iri_set_from_string (iri, uri);
-
-          /* Like above, specification denies invalid iris in an ta_atom
-           * person. */
-          if (uri && !ta_iri_set_from_string (iri, uri))
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                            "Author with an invalid iri in uri field");
-              ta_object_unref (iri);
-              return 0;
-            }
-          author = ta_atom_person_new (name, email, iri);
-          ta_atom_feed_add_author (feed, author);
-        }
-      else if (!strcmp (iks_name (child), "category"))
-        {
-          ta_atom_category_t *cat;
-          ta_iri_t *iri = NULL;
-          char *term = NULL, *label = NULL, *scheme = NULL;
-          term = iks_find_attrib (child, "term");
-          label = iks_find_attrib (child, "label");
-          scheme = iks_find_attrib (child, "scheme");
-          if (!term)
-            {
-              ta_error_set (TA_ATOM_PARSING_ERROR,
-                                 "Category with no term attribute");
-              return 0;
-            }
-          if (scheme)
-            {
-              iri = ta_iri_new ();
-              if (!ta_iri_set_from_string (iri, scheme))
-                {
-                  ta_error_set (TA_ATOM_PARSING_ERROR,
-                                "Category scheme attribute is not a "
-                                "valid iri");
-                  ta_object_unref (iri);
-                  return 0;
-                }
-            }
-          cat = ta_atom_category_new (term, label, iri);
-          ta_atom_feed_add_category (feed, cat);
-        }
-      else if (!strcmp (iks_name (child), "entry"))
-        {
-          ta_atom_entry_t *entry;
-
-          entry = ta_atom_entry_new (NULL);
-          ta_atom_entry_set_from_iks (entry, child);
-          if (ta_error_last() != NULL)
-            {
-              ta_error_clear ();
-              ta_object_unref (entry);
-              continue;
-            }
-          ta_atom_feed_add_entry (feed, entry);
-        }
-    }
+    ta_atom_feed_set_updated (feed, iso8601_to_time (updated));
   return 1;
 }
 
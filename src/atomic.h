@@ -0,0 +1,47 @@
+/* atomic.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Thin wrappers around the atomic builtins of the compiler. This
+ * header is private, it is not installed. */
+
+#ifndef _TANINGIA_ATOMIC_H_
+#define _TANINGIA_ATOMIC_H_
+
+#define ta_atomic_load(ptr)                             \
+  __atomic_load_n ((ptr), __ATOMIC_ACQUIRE)
+
+#define ta_atomic_store(ptr, val)                       \
+  __atomic_store_n ((ptr), (val), __ATOMIC_RELEASE)
+
+#define ta_atomic_exchange(ptr, val)                    \
+  __atomic_exchange_n ((ptr), (val), __ATOMIC_ACQ_REL)
+
+/* Both return the new value */
+#define ta_atomic_add(ptr, val)                         \
+  __atomic_add_fetch ((ptr), (val), __ATOMIC_ACQ_REL)
+
+#define ta_atomic_sub(ptr, val)                         \
+  __atomic_sub_fetch ((ptr), (val), __ATOMIC_ACQ_REL)
+
+/* Returns true if `*ptr' was `*expected' and got replaced by
+ * `desired', otherwise the current value is stored in `*expected' */
+#define ta_atomic_cas(ptr, expected, desired)                   \
+  __atomic_compare_exchange_n ((ptr), (expected), (desired), 0, \
+                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#endif  /* _TANINGIA_ATOMIC_H_ */
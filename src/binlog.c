@@ -0,0 +1,439 @@
+/* binlog.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <taningia/error.h>
+#include <taningia/binlog.h>
+
+#include "atomic.h"
+#include "fmtargs.h"
+
+#define MAGIC "TABINLOG"
+#define VERSION 1
+#define HEADER_SIZE 64
+#define SEEN_SIZE 1024
+#define LINE_SIZE 4096
+
+/* Layout of a binary log: the header, the dictionary and then the
+ * records. The same layout is used in memory, in mapped files and in
+ * dumps. */
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t records;
+  uint64_t dict_size;
+  uint64_t next;                /* Records written so far */
+  uint64_t dict_used;
+};
+
+/* Dictionary entries are followed by their text and padded to 8
+ * bytes. `kind' is written last, it is zero while the entry is being
+ * written. */
+struct dict_entry {
+  uint64_t id;
+  uint32_t size;
+  uint32_t kind;
+};
+
+enum {
+  DICT_NONE,
+  DICT_NAME,
+  DICT_FORMAT
+};
+
+/* `seq' is the position of the record plus one, it is zero while the
+ * record is being written */
+struct record {
+  uint64_t seq;
+  uint64_t time;                /* Nanoseconds since the epoch */
+  uint64_t format;
+  uint64_t name;
+  uint32_t level;
+  uint32_t args_size;
+  unsigned char args[TA_BINLOG_RECORD_SIZE - 40];
+};
+
+struct _ta_binlog_t {
+  ta_object_t parent;
+  unsigned char *data;
+  size_t size;
+  int fd;                       /* -1 for logs in memory */
+  struct header *header;
+  unsigned char *dict;
+  struct record *records;
+
+  /* Strings already copied to the dictionary */
+  const void *seen[SEEN_SIZE];
+};
+
+static const char *_labels[] = {
+  "[ DEBUG ] ",
+  "[  INFO ] ",
+  "[  WARN ] ",
+  "[ ERROR ] ",
+  "[ CRITI ] "
+};
+
+static size_t
+_ta_binlog_size (int records)
+{
+  return HEADER_SIZE + TA_BINLOG_DICT_SIZE +
+    (size_t) records * sizeof (struct record);
+}
+
+/* ta_binlog_t */
+
+static void
+ta_binlog_free (ta_binlog_t *binlog)
+{
+  if (binlog->fd < 0)
+    free (binlog->data);
+  else
+    {
+      munmap (binlog->data, binlog->size);
+      close (binlog->fd);
+    }
+}
+
+/* Initializes a binlog using `data' as its storage */
+static void
+_ta_binlog_init (ta_binlog_t *binlog, unsigned char *data, int fd,
+                 int records)
+{
+  ta_object_init (TA_CAST_OBJECT (binlog), (ta_free_func_t) ta_binlog_free);
+  binlog->data = data;
+  binlog->size = _ta_binlog_size (records);
+  binlog->fd = fd;
+  binlog->header = (struct header *) data;
+  binlog->dict = data + HEADER_SIZE;
+  binlog->records = (struct record *) (binlog->dict + TA_BINLOG_DICT_SIZE);
+  memset (binlog->seen, 0, sizeof (binlog->seen));
+
+  memcpy (binlog->header->magic, MAGIC, sizeof (binlog->header->magic));
+  binlog->header->version = VERSION;
+  binlog->header->record_size = sizeof (struct record);
+  binlog->header->records = records;
+  binlog->header->dict_size = TA_BINLOG_DICT_SIZE;
+  binlog->header->next = 0;
+  binlog->header->dict_used = 0;
+}
+
+ta_binlog_t *
+ta_binlog_new (int records)
+{
+  ta_binlog_t *binlog;
+  if (records < 1)
+    records = 1;
+  binlog = malloc (sizeof (ta_binlog_t));
+  _ta_binlog_init (binlog, calloc (1, _ta_binlog_size (records)), -1,
+                   records);
+  return binlog;
+}
+
+ta_binlog_t *
+ta_binlog_new_file (const char *path, int records)
+{
+  ta_binlog_t *binlog;
+  void *data;
+  size_t size;
+  int fd;
+
+  if (records < 1)
+    records = 1;
+  size = _ta_binlog_size (records);
+  if ((fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+      ta_error_set (TA_LOG_BINLOG_ERROR, "Could not open %s: %s", path,
+                    strerror (errno));
+      return NULL;
+    }
+  if (ftruncate (fd, size) < 0 ||
+      (data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0)) == MAP_FAILED)
+    {
+      ta_error_set (TA_LOG_BINLOG_ERROR, "Could not map %s: %s", path,
+                    strerror (errno));
+      close (fd);
+      return NULL;
+    }
+
+  binlog = malloc (sizeof (ta_binlog_t));
+  _ta_binlog_init (binlog, data, fd, records);
+  return binlog;
+}
+
+/* Copies `text' to the dictionary the first time `id' is seen */
+static void
+_ta_binlog_define (ta_binlog_t *binlog, const void *id, int kind,
+                   const char *text)
+{
+  struct dict_entry *entry;
+  const void *current;
+  uint64_t size, offset;
+  size_t hash, i, len;
+
+  hash = ((uintptr_t) id >> 3) * 2654435761u;
+  for (i = 0; i < SEEN_SIZE; i++)
+    {
+      const void **slot = &binlog->seen[(hash + i) & (SEEN_SIZE - 1)];
+      if ((current = ta_atomic_load (slot)) == id)
+        return;
+      if (current == NULL)
+        {
+          if (ta_atomic_cas (slot, &current, id))
+            break;
+          if (current == id)
+            return;
+        }
+    }
+  /* Decoded as unknown */
+  if (i == SEEN_SIZE)
+    return;
+
+  len = strlen (text) + 1;
+  size = (sizeof (struct dict_entry) + len + 7) & ~((uint64_t) 7);
+  offset = ta_atomic_add (&binlog->header->dict_used, size) - size;
+  if (offset + size > TA_BINLOG_DICT_SIZE)
+    return;
+
+  entry = (struct dict_entry *) (binlog->dict + offset);
+  entry->id = (uintptr_t) id;
+  entry->size = (uint32_t) size;
+  memcpy (entry + 1, text, len);
+  ta_atomic_store (&entry->kind, (uint32_t) kind);
+}
+
+void
+ta_binlog_vwrite (ta_binlog_t *binlog, ta_log_t *log, ta_log_level_t level,
+                  const char *fmt, va_list args)
+{
+  struct record *record;
+  struct timespec now;
+  uint64_t pos;
+
+  _ta_binlog_define (binlog, log, DICT_NAME, log->name);
+  _ta_binlog_define (binlog, fmt, DICT_FORMAT, fmt);
+
+  pos = ta_atomic_add (&binlog->header->next, 1) - 1;
+  record = &binlog->records[pos % binlog->header->records];
+  ta_atomic_store (&record->seq, 0);
+
+  clock_gettime (CLOCK_REALTIME, &now);
+  record->time = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  record->format = (uintptr_t) fmt;
+  record->name = (uintptr_t) log;
+  record->level = level;
+  record->args_size = ta_fmt_capture (record->args, sizeof (record->args),
+                                      fmt, args);
+  ta_atomic_store (&record->seq, pos + 1);
+}
+
+unsigned long
+ta_binlog_get_written (ta_binlog_t *binlog)
+{
+  return ta_atomic_load (&binlog->header->next);
+}
+
+int
+ta_binlog_dump (ta_binlog_t *binlog, int fd)
+{
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < binlog->size)
+    {
+      if ((n = write (fd, binlog->data + done, binlog->size - done)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          ta_error_set (TA_LOG_BINLOG_ERROR, "Could not dump: %s",
+                        strerror (errno));
+          return TA_ERROR;
+        }
+      done += n;
+    }
+  return TA_OK;
+}
+
+/* Decoding */
+
+struct dict_ref {
+  uint64_t id;
+  int kind;
+  const char *text;
+};
+
+static int
+_dict_ref_cmp (const void *a, const void *b)
+{
+  const struct dict_ref *ra = a, *rb = b;
+  if (ra->id != rb->id)
+    return ra->id < rb->id ? -1 : 1;
+  return ra->kind - rb->kind;
+}
+
+static const char *
+_dict_find (struct dict_ref *refs, size_t count, uint64_t id, int kind)
+{
+  struct dict_ref key, *found;
+  key.id = id;
+  key.kind = kind;
+  found = bsearch (&key, refs, count, sizeof (struct dict_ref),
+                   _dict_ref_cmp);
+  return found ? found->text : NULL;
+}
+
+/* Reads the dictionary, returns the number of entries */
+static size_t
+_dict_load (const struct header *header, const unsigned char *dict,
+            struct dict_ref **refs)
+{
+  const struct dict_entry *entry;
+  uint64_t used, offset;
+  size_t count = 0, allocated = 64;
+
+  used = header->dict_used < header->dict_size ?
+    header->dict_used : header->dict_size;
+  *refs = malloc (allocated * sizeof (struct dict_ref));
+
+  for (offset = 0; offset + sizeof (struct dict_entry) <= used;
+       offset += entry->size)
+    {
+      entry = (const struct dict_entry *) (dict + offset);
+      if (entry->size < sizeof (struct dict_entry) ||
+          offset + entry->size > used)
+        break;
+      /* Being written or not terminated */
+      if (entry->kind == DICT_NONE ||
+          ((const char *) entry)[entry->size - 1] != '\0')
+        continue;
+      if (count == allocated)
+        {
+          allocated *= 2;
+          *refs = realloc (*refs, allocated * sizeof (struct dict_ref));
+        }
+      (*refs)[count].id = entry->id;
+      (*refs)[count].kind = entry->kind;
+      (*refs)[count].text = (const char *) (entry + 1);
+      count++;
+    }
+  qsort (*refs, count, sizeof (struct dict_ref), _dict_ref_cmp);
+  return count;
+}
+
+int
+ta_binlog_decode (const void *data, size_t size, FILE *out)
+{
+  const struct header *header = data;
+  const struct record *records, *record;
+  struct dict_ref *refs;
+  size_t nrefs;
+  uint64_t pos, first;
+  const char *name, *fmt;
+  char line[LINE_SIZE], date[32];
+  struct tm tm;
+  time_t secs;
+  int count = 0;
+
+  if (size < HEADER_SIZE ||
+      memcmp (header->magic, MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != VERSION ||
+      header->record_size != sizeof (struct record) ||
+      size < HEADER_SIZE + header->dict_size +
+      header->records * sizeof (struct record))
+    {
+      ta_error_set (TA_LOG_BINLOG_ERROR, "Not a binary log");
+      return TA_ERROR;
+    }
+
+  nrefs = _dict_load (header, (const unsigned char *) data + HEADER_SIZE,
+                      &refs);
+  records = (const struct record *)
+    ((const unsigned char *) data + HEADER_SIZE + header->dict_size);
+  first = header->next > header->records ?
+    header->next - header->records : 0;
+
+  for (pos = first; pos < header->next; pos++)
+    {
+      record = &records[pos % header->records];
+      if (record->seq != pos + 1)
+        continue;
+
+      name = _dict_find (refs, nrefs, record->name, DICT_NAME);
+      if ((fmt = _dict_find (refs, nrefs, record->format,
+                             DICT_FORMAT)) != NULL)
+        ta_fmt_render (line, sizeof (line), fmt, record->args,
+                       record->args_size < sizeof (record->args) ?
+                       record->args_size : sizeof (record->args));
+      else
+        snprintf (line, sizeof (line), "(format %#llx not recorded)",
+                  (unsigned long long) record->format);
+
+      secs = record->time / 1000000000;
+      localtime_r (&secs, &tm);
+      strftime (date, sizeof (date), "%Y-%m-%d %H:%M:%S", &tm);
+      fprintf (out, "%s[ %s.%06lu ] [ %s ] %s\n",
+               _labels[record->level <= TA_LOG_CRITICAL ?
+                       record->level : TA_LOG_CRITICAL],
+               date, (unsigned long) (record->time % 1000000000) / 1000,
+               name ? name : "?", line);
+      count++;
+    }
+
+  free (refs);
+  return count;
+}
+
+int
+ta_binlog_decode_file (const char *path, FILE *out)
+{
+  struct stat st;
+  void *data;
+  int fd, count;
+
+  if ((fd = open (path, O_RDONLY)) < 0 || fstat (fd, &st) < 0)
+    {
+      ta_error_set (TA_LOG_BINLOG_ERROR, "Could not open %s: %s", path,
+                    strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return TA_ERROR;
+    }
+  if (st.st_size == 0 ||
+      (data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                    fd, 0)) == MAP_FAILED)
+    {
+      ta_error_set (TA_LOG_BINLOG_ERROR, "Could not map %s", path);
+      close (fd);
+      return TA_ERROR;
+    }
+  count = ta_binlog_decode (data, st.st_size, out);
+  munmap (data, st.st_size);
+  close (fd);
+  return count;
+}
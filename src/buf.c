@@ -63,15 +63,20 @@ ta_buf_dealloc (ta_buf_t *b)
 int
 ta_buf_cat (ta_buf_t *b, const char *s)
 {
-  int s_size = strlen (s);
+  return ta_buf_ncat (b, s, strlen (s));
+}
+
 
+int
+ta_buf_ncat (ta_buf_t *b, const char *s, int len)
+{
   /* Allocating enough room to the new data */
-  if (_buf_realloc (b, b->string_length + s_size + 1) != TA_OK)
+  if (_buf_realloc (b, b->string_length + len + 1) != TA_OK)
     return TA_ERROR;
 
   /* Copying stuff */
-  memmove (b->ptr + b->string_length, s, s_size);
-  b->string_length += s_size;
+  memmove (b->ptr + b->string_length, s, len);
+  b->string_length += len;
   b->ptr[b->string_length] = '\0';
 
   return TA_OK;
@@ -144,6 +149,15 @@ ta_buf_dump (ta_buf_t *b)
     return NULL;
 }
 
+void
+ta_buf_reset (ta_buf_t *b)
+{
+  /* Keeps the allocated memory around to be reused */
+  b->string_length = 0;
+  if (b->ptr)
+    b->ptr[0] = '\0';
+}
+
 /* Private API */
 
 int
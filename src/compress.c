@@ -0,0 +1,275 @@
+/* compress.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <zlib.h>
+#include <iksemel.h>
+
+#include <taningia/error.h>
+#include "compress.h"
+
+/* Size of the buffers holding compressed data */
+#define COMPRESS_BUF_SIZE 16384
+
+struct ta_compress {
+  int fd;
+  int own;
+  int level;
+  int flush;
+  int active;
+  void *data;
+  ta_xmpp_client_compress_stats_t *stats;
+
+  z_stream deflater;
+  z_stream inflater;
+
+  /* The last call to inflate() filled the buffer of the caller, so it
+   * might have more output even without new input */
+  int inflate_pending;
+
+  unsigned char inbuf[COMPRESS_BUF_SIZE];
+  unsigned char outbuf[COMPRESS_BUF_SIZE];
+};
+
+int
+ta_compress_dial (const char *server, int port, int *fd)
+{
+  struct addrinfo hints, *addrs, *addr;
+  char service[16];
+  int sock = -1;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf (service, sizeof (service), "%d", port);
+  if (getaddrinfo (server, service, &hints, &addrs) != 0)
+    return IKS_NET_NODNS;
+
+  for (addr = addrs; addr; addr = addr->ai_next)
+    {
+      if ((sock = socket (addr->ai_family, addr->ai_socktype,
+                          addr->ai_protocol)) < 0)
+        continue;
+      if (connect (sock, addr->ai_addr, addr->ai_addrlen) == 0)
+        break;
+      close (sock);
+      sock = -1;
+    }
+  freeaddrinfo (addrs);
+  if (sock < 0)
+    return IKS_NET_NOCONN;
+  *fd = sock;
+  return IKS_OK;
+}
+
+ta_compress_t *
+ta_compress_new (int fd, int own, int level, ta_xmpp_compress_flush_t flush,
+                 ta_xmpp_client_compress_stats_t *stats, void *data)
+{
+  ta_compress_t *compress;
+  compress = malloc (sizeof (ta_compress_t));
+  compress->fd = fd;
+  compress->own = own;
+  compress->level = level;
+  compress->active = 0;
+  compress->data = data;
+  compress->stats = stats;
+  compress->inflate_pending = 0;
+  switch (flush)
+    {
+    case TA_XMPP_COMPRESS_FLUSH_PARTIAL:
+      compress->flush = Z_PARTIAL_FLUSH;
+      break;
+    case TA_XMPP_COMPRESS_FLUSH_FULL:
+      compress->flush = Z_FULL_FLUSH;
+      break;
+    default:
+      compress->flush = Z_SYNC_FLUSH;
+      break;
+    }
+  return compress;
+}
+
+void
+ta_compress_free (ta_compress_t *compress)
+{
+  if (compress->active)
+    {
+      deflateEnd (&compress->deflater);
+      inflateEnd (&compress->inflater);
+    }
+  if (compress->own)
+    close (compress->fd);
+  free (compress);
+}
+
+int
+ta_compress_start (ta_compress_t *compress)
+{
+  if (compress->active)
+    return TA_OK;
+
+  memset (&compress->deflater, 0, sizeof (z_stream));
+  memset (&compress->inflater, 0, sizeof (z_stream));
+  if (deflateInit (&compress->deflater, compress->level) != Z_OK)
+    return TA_ERROR;
+  if (inflateInit (&compress->inflater) != Z_OK)
+    {
+      deflateEnd (&compress->deflater);
+      return TA_ERROR;
+    }
+  compress->active = 1;
+  return TA_OK;
+}
+
+int
+ta_compress_is_active (ta_compress_t *compress)
+{
+  return compress->active;
+}
+
+int
+ta_compress_get_fd (ta_compress_t *compress)
+{
+  return compress->fd;
+}
+
+void *
+ta_compress_get_data (ta_compress_t *compress)
+{
+  return compress->data;
+}
+
+static int
+_write_all (int fd, const void *data, size_t len)
+{
+  const char *p = (const char *) data;
+  ssize_t n;
+  while (len > 0)
+    {
+      if ((n = write (fd, p, len)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return IKS_NET_RWERR;
+        }
+      p += n;
+      len -= n;
+    }
+  return IKS_OK;
+}
+
+int
+ta_compress_send (void *socket, const char *data, size_t len)
+{
+  ta_compress_t *compress = (ta_compress_t *) socket;
+  z_stream *z = &compress->deflater;
+  size_t size;
+  int err;
+
+  if (!compress->active)
+    return _write_all (compress->fd, data, len);
+
+  /* Everything given to a single call is flushed to the network, so
+   * batching stanzas in one write also makes the compression better */
+  z->next_in = (unsigned char *) data;
+  z->avail_in = len;
+  do
+    {
+      z->next_out = compress->outbuf;
+      z->avail_out = COMPRESS_BUF_SIZE;
+      if (deflate (z, compress->flush) == Z_STREAM_ERROR)
+        return IKS_NET_RWERR;
+      size = COMPRESS_BUF_SIZE - z->avail_out;
+      if ((err = _write_all (compress->fd, compress->outbuf, size)) != IKS_OK)
+        return err;
+      compress->stats->compressed_out += size;
+    }
+  while (z->avail_out == 0);
+  compress->stats->raw_out += len;
+  return IKS_OK;
+}
+
+/* Waits for the socket to be readable. Returns 1 if it is, 0 on
+ * timeout or -1 on error. */
+static int
+_wait (int fd, int timeout)
+{
+  struct pollfd pfd;
+  int ready;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  while ((ready = poll (&pfd, 1, timeout < 0 ? -1 : timeout * 1000)) < 0)
+    if (errno != EINTR)
+      return -1;
+  return ready > 0;
+}
+
+int
+ta_compress_recv (void *socket, char *buffer, size_t size, int timeout)
+{
+  ta_compress_t *compress = (ta_compress_t *) socket;
+  z_stream *z = &compress->inflater;
+  ssize_t n;
+  int ready, ret;
+
+  if (!compress->active)
+    {
+      if ((ready = _wait (compress->fd, timeout)) <= 0)
+        return ready;
+      n = read (compress->fd, buffer, size);
+      return n > 0 ? (int) n : -1;
+    }
+
+  for (;;)
+    {
+      /* Output of data that was already read comes first */
+      if (z->avail_in > 0 || compress->inflate_pending)
+        {
+          z->next_out = (unsigned char *) buffer;
+          z->avail_out = size;
+          ret = inflate (z, Z_SYNC_FLUSH);
+          if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return -1;
+          compress->inflate_pending = z->avail_out == 0;
+          if ((n = size - z->avail_out) > 0)
+            {
+              compress->stats->raw_in += n;
+              return (int) n;
+            }
+        }
+
+      if ((ready = _wait (compress->fd, timeout)) <= 0)
+        return ready;
+      if ((n = read (compress->fd, compress->inbuf, COMPRESS_BUF_SIZE)) <= 0)
+        return -1;
+      compress->stats->compressed_in += n;
+      z->next_in = compress->inbuf;
+      z->avail_in = n;
+      timeout = 0;
+    }
+}
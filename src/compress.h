@@ -0,0 +1,65 @@
+/* compress.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Socket wrapper used as an iksemel transport by the xmpp client to
+ * implement XEP-0138 stream compression. Data goes through untouched
+ * until `ta_compress_start' is called, then everything is compressed
+ * with zlib in both directions. This header is private, it is not
+ * installed. */
+
+#ifndef _TANINGIA_COMPRESS_H_
+#define _TANINGIA_COMPRESS_H_
+
+#include <stddef.h>
+#include <taningia/xmpp.h>
+
+typedef struct ta_compress ta_compress_t;
+
+/* Opens a TCP connection to `server'. Returns an iksemel error code
+ * and, on success, stores the socket in `fd'. */
+int ta_compress_dial (const char *server, int port, int *fd);
+
+/* Wraps the socket `fd', that is closed by `ta_compress_free' only
+ * if `own' is set. `level' is the zlib compression level and the
+ * byte counters are added to `stats'. `data' is kept for the caller,
+ * see `ta_compress_get_data'. */
+ta_compress_t *ta_compress_new (int fd, int own, int level,
+                                ta_xmpp_compress_flush_t flush,
+                                ta_xmpp_client_compress_stats_t *stats,
+                                void *data);
+
+void ta_compress_free (ta_compress_t *compress);
+
+/* Compresses everything from now on. Returns TA_OK or TA_ERROR if
+ * zlib could not be initialized. */
+int ta_compress_start (ta_compress_t *compress);
+
+int ta_compress_is_active (ta_compress_t *compress);
+
+int ta_compress_get_fd (ta_compress_t *compress);
+
+void *ta_compress_get_data (ta_compress_t *compress);
+
+/* Send and receive functions of the iksemel transport. `socket' is a
+ * `ta_compress_t' and `timeout' is given in seconds, -1 waits
+ * forever. */
+int ta_compress_send (void *socket, const char *data, size_t len);
+
+int ta_compress_recv (void *socket, char *buffer, size_t size, int timeout);
+
+#endif  /* _TANINGIA_COMPRESS_H_ */
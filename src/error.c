@@ -25,67 +25,69 @@
 #include <taningia/global.h>
 #include <taningia/error.h>
 
+#include "fmtargs.h"
+
+
+/* Formats the message of the last error in the buffer of the state */
+static void
+_format_message (ta_global_state_t *state)
+{
+  ta_error_t *error = &state->error_t;
+  char *message;
+  int n;
+
+  n = ta_fmt_render (error->message, state->error_message_size,
+                     state->error_fmt, state->error_args,
+                     state->error_args_size);
+  if (n >= 0 && (size_t) n >= state->error_message_size)
+    {
+      if ((message = realloc (error->message, n + 1)) == NULL)
+        return;
+      error->message = message;
+      state->error_message_size = n + 1;
+      ta_fmt_render (error->message, state->error_message_size,
+                     state->error_fmt, state->error_args,
+                     state->error_args_size);
+    }
+  state->error_fmt = NULL;
+}
 
 const ta_error_t *
 ta_error_last (void)
 {
-  return TA_GLOBAL->last_error;
+  ta_global_state_t *state = TA_GLOBAL;
+  if (state->last_error && state->error_fmt)
+    _format_message (state);
+  return state->last_error;
 }
 
-void
-ta_error_clear (void)
+int
+ta_error_last_code (void)
 {
-  if (TA_GLOBAL->last_error)
-    free (TA_GLOBAL->last_error->message);
-  TA_GLOBAL->last_error = NULL;
+  ta_global_state_t *state = TA_GLOBAL;
+  return state->last_error ? state->last_error->code : TA_OK;
 }
 
-static void
-set_err (int code, char *msg)
+void
+ta_error_clear (void)
 {
-  ta_error_t *error = &TA_GLOBAL->error_t;
-  free (error->message);
-  error->code = code;
-  error->message = msg;
-  TA_GLOBAL->last_error = error;
+  ta_global_state_t *state = TA_GLOBAL;
+  state->last_error = NULL;
+  state->error_fmt = NULL;
 }
 
 void
 ta_error_set (int errcode, const char *fmt, ...)
 {
-  int n, size = 32;
-  char *msg, *tmp;
+  ta_global_state_t *state = TA_GLOBAL;
   va_list args;
 
-  /* Allocating some bytes to the first try of vsnprintf */
-  msg = calloc (size, sizeof (char *));
-
-  /* Well, we don't know how many params the user will send. So, let's
-   * figure it out */
-  while (1)
-    {
-      va_start (args, fmt);
-      n = vsnprintf (msg, size, fmt, args);
-      va_end (args);
-
-      /* Ok, we're done! gtfo */
-      if (n > -1 && n < size)
-        break;
-
-      /* Need more memory */
-      if (n > -1)
-        size = n + 1;           /* glibc 1.2 */
-      else
-        size *= 2;              /* glibc 2.0 */
-      if ((tmp = realloc (msg, size)) == NULL)
-        {
-          free (msg);
-          return;
-        }
-      else
-        msg = tmp;
-    }
-
-  /* Setting the error */
-  set_err (errcode, msg);
+  /* Only the arguments are copied here, nothing is allocated */
+  va_start (args, fmt);
+  state->error_args_size = ta_fmt_capture (state->error_args,
+                                           TA_ERROR_ARGS_SIZE, fmt, args);
+  va_end (args);
+  state->error_fmt = fmt;
+  state->error_t.code = errcode;
+  state->last_error = &state->error_t;
 }
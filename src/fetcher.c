@@ -0,0 +1,264 @@
+/* fetcher.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <iksemel.h>
+
+#include <taningia/error.h>
+#include <taningia/log.h>
+#include <taningia/fetcher.h>
+
+struct _ta_pubsub_fetcher_t {
+  ta_object_t parent;
+  ta_xmpp_client_t *client;
+  char *from;
+  char *to;
+  char *node;
+  int page_size;
+  ta_log_t *log;
+
+  int running;
+  int in_flight;
+  int flags;
+  int fetched;
+  int count;
+  ta_pubsub_event_cb_t item_cb;
+  ta_pubsub_fetcher_done_cb_t done_cb;
+  void *data;
+};
+
+/* Counts the reported items and lets the user callback stop the
+ * fetcher */
+static int
+_ta_pubsub_fetcher_item (const ta_pubsub_event_t *event, void *data)
+{
+  ta_pubsub_fetcher_t *fetcher = (ta_pubsub_fetcher_t *) data;
+  fetcher->fetched++;
+  if (fetcher->item_cb (event, fetcher->data))
+    fetcher->running = 0;
+  return !fetcher->running;
+}
+
+static void
+_ta_pubsub_fetcher_done (ta_pubsub_fetcher_t *fetcher, int status)
+{
+  fetcher->running = 0;
+  if (fetcher->done_cb)
+    fetcher->done_cb (fetcher, status, fetcher->data);
+}
+
+static int _ta_pubsub_fetcher_request (ta_pubsub_fetcher_t *fetcher,
+                                       const char *after);
+
+/* Number of items in a page. Servers may send less items than asked
+ * for, even when there are more left. */
+static int
+_page_length (iks *answer)
+{
+  iks *item;
+  int length = 0;
+  for (item = iks_first_tag (iks_find (iks_find (answer, "pubsub"), "items"));
+       item; item = iks_next_tag (item))
+    if (strcmp (iks_name (item), "item") == 0)
+      length++;
+  return length;
+}
+
+/* Called by the client when a page arrives or when its request times
+ * out. The answer is only valid during this call, that's why the next
+ * page is asked before the items of this one are reported. */
+static void
+_ta_pubsub_fetcher_answer (ta_xmpp_client_t *TA_UNUSED(client),
+                           iks *answer, void *data)
+{
+  ta_pubsub_fetcher_t *fetcher = (ta_pubsub_fetcher_t *) data;
+  const char *last;
+  int more = 0, items;
+
+  fetcher->in_flight--;
+  if (!fetcher->running)
+    goto end;
+  if (answer == NULL)
+    {
+      /* The timeout error is already set */
+      _ta_pubsub_fetcher_done (fetcher, TA_ERROR);
+      goto end;
+    }
+
+  if (ta_pubsub_parse_page (answer, &last, &fetcher->count) == TA_OK &&
+      last != NULL)
+    {
+      /* Prefetching. An empty page ends the iteration, otherwise the
+       * items received so far are compared to the node size, when the
+       * server tells it. */
+      items = _page_length (answer);
+      more = items > 0 && (fetcher->count < 0 ||
+                           fetcher->fetched + items < fetcher->count);
+      if (more && _ta_pubsub_fetcher_request (fetcher, last) != TA_OK)
+        {
+          _ta_pubsub_fetcher_done (fetcher, TA_ERROR);
+          goto end;
+        }
+    }
+
+  items = ta_pubsub_parse_items (answer, fetcher->flags,
+                                 _ta_pubsub_fetcher_item, fetcher);
+  if (items == TA_ERROR)
+    {
+      /* The page already requested will be ignored */
+      _ta_pubsub_fetcher_done (fetcher, TA_ERROR);
+      goto end;
+    }
+  if (fetcher->running && (!more || items == 0))
+    _ta_pubsub_fetcher_done (fetcher, TA_OK);
+
+ end:
+  ta_object_unref (fetcher);
+}
+
+static int
+_ta_pubsub_fetcher_request (ta_pubsub_fetcher_t *fetcher, const char *after)
+{
+  iks *iq;
+  int err;
+
+  ta_log_debug (fetcher->log, "Asking items of %s after %s",
+                fetcher->node, after ? after : "(start)");
+  iq = ta_pubsub_node_items_page (fetcher->from, fetcher->to, fetcher->node,
+                                  fetcher->page_size, after);
+  ta_object_ref (fetcher);
+  fetcher->in_flight++;
+  err = ta_xmpp_client_send_and_filter (fetcher->client, iq,
+                                        _ta_pubsub_fetcher_answer,
+                                        fetcher, NULL);
+  iks_delete (iq);
+  if (err != TA_OK)
+    {
+      ta_error_set (XMPP_SEND_ERROR, "Unable to ask items of %s",
+                    fetcher->node);
+      fetcher->in_flight--;
+      ta_object_unref (fetcher);
+      return TA_ERROR;
+    }
+  return TA_OK;
+}
+
+/* ta_pubsub_fetcher_t */
+
+static void
+ta_pubsub_fetcher_free (ta_pubsub_fetcher_t *fetcher)
+{
+  ta_object_unref (fetcher->client);
+  free (fetcher->from);
+  free (fetcher->to);
+  free (fetcher->node);
+  ta_object_unref (fetcher->log);
+}
+
+void
+ta_pubsub_fetcher_init (ta_pubsub_fetcher_t *fetcher,
+                        ta_xmpp_client_t *client,
+                        const char *from,
+                        const char *to,
+                        const char *node,
+                        int page_size)
+{
+  ta_object_init (TA_CAST_OBJECT (fetcher),
+                  (ta_free_func_t) ta_pubsub_fetcher_free);
+  fetcher->client = ta_object_ref (client);
+  fetcher->from = strdup (from);
+  fetcher->to = strdup (to);
+  fetcher->node = strdup (node);
+  fetcher->page_size = page_size < 1 ? 1 : page_size;
+  fetcher->log = ta_log_new ("pubsub-fetcher");
+  fetcher->running = 0;
+  fetcher->in_flight = 0;
+  fetcher->flags = 0;
+  fetcher->fetched = 0;
+  fetcher->count = -1;
+  fetcher->item_cb = NULL;
+  fetcher->done_cb = NULL;
+  fetcher->data = NULL;
+}
+
+ta_pubsub_fetcher_t *
+ta_pubsub_fetcher_new (ta_xmpp_client_t *client,
+                       const char *from,
+                       const char *to,
+                       const char *node,
+                       int page_size)
+{
+  ta_pubsub_fetcher_t *fetcher;
+  fetcher = malloc (sizeof (ta_pubsub_fetcher_t));
+  ta_pubsub_fetcher_init (fetcher, client, from, to, node, page_size);
+  return fetcher;
+}
+
+ta_log_t *
+ta_pubsub_fetcher_get_logger (ta_pubsub_fetcher_t *fetcher)
+{
+  return fetcher->log;
+}
+
+int
+ta_pubsub_fetcher_get_fetched (ta_pubsub_fetcher_t *fetcher)
+{
+  return fetcher->fetched;
+}
+
+int
+ta_pubsub_fetcher_get_count (ta_pubsub_fetcher_t *fetcher)
+{
+  return fetcher->count;
+}
+
+int
+ta_pubsub_fetcher_start (ta_pubsub_fetcher_t *fetcher,
+                         int flags,
+                         ta_pubsub_event_cb_t item_cb,
+                         ta_pubsub_fetcher_done_cb_t done_cb,
+                         void *data)
+{
+  /* A cancelled fetcher might still be waiting for a page */
+  if (fetcher->running || fetcher->in_flight > 0)
+    {
+      ta_error_set (TA_PUBSUB_FETCH_ERROR, "Fetcher already running");
+      return TA_ERROR;
+    }
+  fetcher->running = 1;
+  fetcher->flags = flags;
+  fetcher->fetched = 0;
+  fetcher->count = -1;
+  fetcher->item_cb = item_cb;
+  fetcher->done_cb = done_cb;
+  fetcher->data = data;
+  if (_ta_pubsub_fetcher_request (fetcher, NULL) != TA_OK)
+    {
+      fetcher->running = 0;
+      return TA_ERROR;
+    }
+  return TA_OK;
+}
+
+void
+ta_pubsub_fetcher_cancel (ta_pubsub_fetcher_t *fetcher)
+{
+  fetcher->running = 0;
+}
@@ -0,0 +1,424 @@
+/* fmtargs.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+
+#include "fmtargs.h"
+
+/* Longest conversion spec rebuilt by `ta_fmt_render' */
+#define SPEC_SIZE 64
+
+/* Tags of the captured arguments. Each one is followed by its value,
+ * strings are prefixed by their size in two bytes. */
+enum {
+  ARG_END,
+  ARG_INT,
+  ARG_UINT,
+  ARG_DOUBLE,
+  ARG_STRING,
+  ARG_POINTER,
+  ARG_NONE                      /* Consumed but not captured */
+};
+
+struct spec {
+  char flags[8];
+  int width;                    /* -1 when not given, -2 for `*' */
+  int precision;                /* Same as `width' */
+  char length;                  /* `H' for hh, `q' for ll */
+  char conv;
+};
+
+/* Parses the conversion that starts right after a `%'. Returns the
+ * position after it or NULL if it is not complete. */
+static const char *
+_parse_spec (const char *p, struct spec *spec)
+{
+  size_t nflags = 0;
+
+  while (*p && strchr ("-+ #0'", *p) && nflags < sizeof (spec->flags) - 1)
+    spec->flags[nflags++] = *p++;
+  spec->flags[nflags] = '\0';
+
+  spec->width = -1;
+  if (*p == '*')
+    {
+      spec->width = -2;
+      p++;
+    }
+  else if (*p >= '0' && *p <= '9')
+    spec->width = (int) strtol (p, (char **) &p, 10);
+
+  spec->precision = -1;
+  if (*p == '.')
+    {
+      p++;
+      if (*p == '*')
+        {
+          spec->precision = -2;
+          p++;
+        }
+      else
+        spec->precision = (int) strtol (p, (char **) &p, 10);
+    }
+
+  spec->length = '\0';
+  switch (*p)
+    {
+    case 'h':
+      spec->length = p[1] == 'h' ? 'H' : 'h';
+      p += spec->length == 'H' ? 2 : 1;
+      break;
+    case 'l':
+      spec->length = p[1] == 'l' ? 'q' : 'l';
+      p += spec->length == 'q' ? 2 : 1;
+      break;
+    case 'j': case 'z': case 't': case 'L':
+      spec->length = *p++;
+      break;
+    }
+
+  if (*p == '\0')
+    return NULL;
+  spec->conv = *p++;
+  return p;
+}
+
+/* Capture */
+
+static int
+_put (unsigned char *buf, size_t size, size_t *pos, int tag,
+      const void *value, size_t len)
+{
+  if (*pos + 1 + len > size)
+    return 0;
+  buf[(*pos)++] = (unsigned char) tag;
+  if (len > 0)
+    memcpy (buf + *pos, value, len);
+  *pos += len;
+  return 1;
+}
+
+static int
+_put_int (unsigned char *buf, size_t size, size_t *pos, long long value)
+{
+  return _put (buf, size, pos, ARG_INT, &value, sizeof (value));
+}
+
+static int
+_put_string (unsigned char *buf, size_t size, size_t *pos, const char *str,
+             int precision)
+{
+  size_t len, room;
+  uint16_t len16;
+
+  if (*pos + 1 + sizeof (len16) >= size)
+    return 0;
+  room = size - *pos - 1 - sizeof (len16);
+  if (room > UINT16_MAX)
+    room = UINT16_MAX;
+  if (precision >= 0 && (size_t) precision < room)
+    room = precision;
+  if (str == NULL)
+    str = "(null)";
+  for (len = 0; len < room && str[len]; len++);
+
+  len16 = (uint16_t) len;
+  buf[(*pos)++] = ARG_STRING;
+  memcpy (buf + *pos, &len16, sizeof (len16));
+  memcpy (buf + *pos + sizeof (len16), str, len);
+  *pos += sizeof (len16) + len;
+  return 1;
+}
+
+size_t
+ta_fmt_capture (void *data, size_t size, const char *fmt, va_list args)
+{
+  unsigned char *buf = (unsigned char *) data;
+  struct spec spec;
+  size_t pos = 0;
+  long long ival;
+  unsigned long long uval;
+  double dval;
+  void *pval;
+  int ok = 1;
+
+  while (ok && (fmt = strchr (fmt, '%')) != NULL)
+    {
+      if ((fmt = _parse_spec (fmt + 1, &spec)) == NULL)
+        break;
+      if (spec.width == -2)
+        ok = _put_int (buf, size, &pos, va_arg (args, int));
+      if (ok && spec.precision == -2)
+        ok = _put_int (buf, size, &pos, va_arg (args, int));
+      if (!ok)
+        break;
+
+      switch (spec.conv)
+        {
+        case '%':
+          break;
+        case 'd': case 'i':
+          switch (spec.length)
+            {
+            case 'H': ival = (signed char) va_arg (args, int); break;
+            case 'h': ival = (short) va_arg (args, int); break;
+            case 'l': ival = va_arg (args, long); break;
+            case 'q': ival = va_arg (args, long long); break;
+            case 'j': ival = va_arg (args, intmax_t); break;
+            case 'z': ival = va_arg (args, size_t); break;
+            case 't': ival = va_arg (args, ptrdiff_t); break;
+            default: ival = va_arg (args, int); break;
+            }
+          ok = _put_int (buf, size, &pos, ival);
+          break;
+        case 'o': case 'u': case 'x': case 'X':
+          switch (spec.length)
+            {
+            case 'H': uval = (unsigned char) va_arg (args, unsigned); break;
+            case 'h': uval = (unsigned short) va_arg (args, unsigned); break;
+            case 'l': uval = va_arg (args, unsigned long); break;
+            case 'q': uval = va_arg (args, unsigned long long); break;
+            case 'j': uval = va_arg (args, uintmax_t); break;
+            case 'z': uval = va_arg (args, size_t); break;
+            case 't': uval = va_arg (args, ptrdiff_t); break;
+            default: uval = va_arg (args, unsigned int); break;
+            }
+          ok = _put (buf, size, &pos, ARG_UINT, &uval, sizeof (uval));
+          break;
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+          if (spec.length == 'L')
+            dval = (double) va_arg (args, long double);
+          else
+            dval = va_arg (args, double);
+          ok = _put (buf, size, &pos, ARG_DOUBLE, &dval, sizeof (dval));
+          break;
+        case 'c':
+          /* Wide chars are not supported */
+          if (spec.length == 'l')
+            {
+              va_arg (args, wint_t);
+              ok = _put (buf, size, &pos, ARG_NONE, NULL, 0);
+            }
+          else
+            ok = _put_int (buf, size, &pos, va_arg (args, int));
+          break;
+        case 's':
+          if (spec.length == 'l')
+            {
+              va_arg (args, void *);
+              ok = _put (buf, size, &pos, ARG_NONE, NULL, 0);
+            }
+          else
+            ok = _put_string (buf, size, &pos, va_arg (args, const char *),
+                              spec.precision);
+          break;
+        case 'p':
+          pval = va_arg (args, void *);
+          ok = _put (buf, size, &pos, ARG_POINTER, &pval, sizeof (pval));
+          break;
+        case 'n':
+          /* Never written, it makes no sense later */
+          va_arg (args, void *);
+          ok = _put (buf, size, &pos, ARG_NONE, NULL, 0);
+          break;
+        default:
+          /* The type of the argument is unknown, nothing after it can
+           * be read */
+          ok = 0;
+          break;
+        }
+    }
+
+  if (pos < size)
+    buf[pos++] = ARG_END;
+  return pos;
+}
+
+/* Render */
+
+struct reader {
+  const unsigned char *buf;
+  size_t len;
+  size_t pos;
+};
+
+/* Reads the next argument, returns its tag. `value' must hold 8
+ * bytes, strings are returned by pointer and size. */
+static int
+_get (struct reader *reader, void *value, const char **str, size_t *slen)
+{
+  uint16_t len16;
+  int tag;
+
+  if (reader->pos >= reader->len)
+    return ARG_END;
+  tag = reader->buf[reader->pos++];
+  switch (tag)
+    {
+    case ARG_INT: case ARG_UINT: case ARG_DOUBLE:
+      if (reader->pos + 8 > reader->len)
+        return ARG_END;
+      memcpy (value, reader->buf + reader->pos, 8);
+      reader->pos += 8;
+      break;
+    case ARG_POINTER:
+      if (reader->pos + sizeof (void *) > reader->len)
+        return ARG_END;
+      memcpy (value, reader->buf + reader->pos, sizeof (void *));
+      reader->pos += sizeof (void *);
+      break;
+    case ARG_STRING:
+      if (reader->pos + sizeof (len16) > reader->len)
+        return ARG_END;
+      memcpy (&len16, reader->buf + reader->pos, sizeof (len16));
+      reader->pos += sizeof (len16);
+      if (reader->pos + len16 > reader->len)
+        return ARG_END;
+      *str = (const char *) reader->buf + reader->pos;
+      *slen = len16;
+      reader->pos += len16;
+      break;
+    case ARG_NONE:
+      break;
+    default:
+      reader->pos = reader->len;
+      return ARG_END;
+    }
+  return tag;
+}
+
+static int
+_get_int (struct reader *reader)
+{
+  long long value = 0;
+  const char *str;
+  size_t slen;
+  if (_get (reader, &value, &str, &slen) != ARG_INT)
+    return 0;
+  return (int) value;
+}
+
+/* Appends text to the output keeping the snprintf semantics */
+#define APPEND(call)                                            \
+  do {                                                          \
+    int _n = (call);                                            \
+    if (_n > 0)                                                 \
+      total += _n;                                              \
+  } while (0)
+
+#define ROOM() ((size_t) total < size ? size - total : 0)
+#define CURSOR() ((size_t) total < size ? out + total : NULL)
+
+int
+ta_fmt_render (char *out, size_t size, const char *fmt, const void *args,
+               size_t len)
+{
+  struct reader reader;
+  struct spec spec;
+  const char *start, *next, *str = NULL;
+  char spec_str[SPEC_SIZE];
+  size_t slen = 0;
+  int total = 0, width, precision, tag;
+  union {
+    long long i;
+    unsigned long long u;
+    double d;
+    void *p;
+  } value;
+
+  reader.buf = (const unsigned char *) args;
+  reader.len = len;
+  reader.pos = 0;
+  if (size > 0)
+    out[0] = '\0';
+
+  while (*fmt)
+    {
+      if ((start = strchr (fmt, '%')) == NULL)
+        start = fmt + strlen (fmt);
+      if (start > fmt)
+        APPEND (snprintf (CURSOR (), ROOM (), "%.*s", (int) (start - fmt),
+                          fmt));
+      if (*start == '\0')
+        break;
+      if ((next = _parse_spec (start + 1, &spec)) == NULL)
+        {
+          APPEND (snprintf (CURSOR (), ROOM (), "%s", start));
+          break;
+        }
+      fmt = next;
+      if (spec.conv == '%')
+        {
+          APPEND (snprintf (CURSOR (), ROOM (), "%%"));
+          continue;
+        }
+
+      width = spec.width == -2 ? _get_int (&reader) :
+        spec.width < 0 ? 0 : spec.width;
+      precision = spec.precision == -2 ? _get_int (&reader) : spec.precision;
+      value.u = 0;
+      tag = _get (&reader, &value, &str, &slen);
+
+      /* The length modifier is replaced by the one of the captured
+       * value and `*' by the captured numbers */
+      switch (tag)
+        {
+        case ARG_INT:
+          if (spec.conv == 'c')
+            {
+              snprintf (spec_str, SPEC_SIZE, "%%%s*c", spec.flags);
+              APPEND (snprintf (CURSOR (), ROOM (), spec_str,
+                                width, (int) value.i));
+              break;
+            }
+          /* fall through */
+        case ARG_UINT:
+          snprintf (spec_str, SPEC_SIZE, "%%%s*.*ll%c", spec.flags, spec.conv);
+          APPEND (snprintf (CURSOR (), ROOM (), spec_str, width, precision,
+                            value.i));
+          break;
+        case ARG_DOUBLE:
+          snprintf (spec_str, SPEC_SIZE, "%%%s*.*%c", spec.flags, spec.conv);
+          APPEND (snprintf (CURSOR (), ROOM (), spec_str,
+                            width, precision, value.d));
+          break;
+        case ARG_STRING:
+          if (precision < 0 || (size_t) precision > slen)
+            precision = (int) slen;
+          snprintf (spec_str, SPEC_SIZE, "%%%s*.*s", spec.flags);
+          APPEND (snprintf (CURSOR (), ROOM (), spec_str,
+                            width, precision, str));
+          break;
+        case ARG_POINTER:
+          snprintf (spec_str, SPEC_SIZE, "%%%s*p", spec.flags);
+          APPEND (snprintf (CURSOR (), ROOM (), spec_str,
+                            width, value.p));
+          break;
+        default:
+          APPEND (snprintf (CURSOR (), ROOM (), "?"));
+          break;
+        }
+    }
+  return total;
+}
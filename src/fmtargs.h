@@ -0,0 +1,42 @@
+/* fmtargs.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Captures the arguments of a printf-like call in a compact buffer,
+ * so the text can be formatted later, maybe by another process. This
+ * header is private, it is not installed. */
+
+#ifndef _TANINGIA_FMTARGS_H_
+#define _TANINGIA_FMTARGS_H_
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/* Copies the arguments used by `fmt' to `buf' and returns how many
+ * bytes were used. Numbers are copied as they are and strings are
+ * copied up to the room left in `buf'. Arguments that don't fit at all
+ * are rendered as `?'. */
+size_t ta_fmt_capture (void *buf, size_t size, const char *fmt,
+                       va_list args);
+
+/* Formats `fmt' with arguments captured by `ta_fmt_capture'. Works
+ * like snprintf: the output is truncated to `size' and the length of
+ * the whole text is returned. */
+int ta_fmt_render (char *out, size_t size, const char *fmt,
+                   const void *args, size_t len);
+
+#endif  /* _TANINGIA_FMTARGS_H_ */
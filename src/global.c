@@ -29,37 +29,113 @@
 #ifdef HAVE_LIBPTHREAD
 
 #include <pthread.h>
+#include "atomic.h"
 
+/* The key is still needed when the compiler has thread local
+ * variables, its destructor releases the state when threads exit. It
+ * is created by the setup function and deleted by the teardown, which
+ * might happen more than once, so `_tls_ready' is used instead of a
+ * pthread_once_t. Each new key bumps `_tls_generation'. */
 static pthread_key_t _tls_key;
-static int _tls_init = 0;
+static pthread_mutex_t _tls_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _tls_ready = 0;
+static unsigned int _tls_generation = 0;
+
+#ifdef TA_THREAD_LOCAL
+static TA_THREAD_LOCAL ta_global_state_t *_tls_state = NULL;
+static TA_THREAD_LOCAL unsigned int _tls_state_generation = 0;
+#endif
+
+/* Called when a thread that used the state exits */
+static void
+_state_free (void *data)
+{
+  ta_global_state_t *state = (ta_global_state_t *) data;
+#ifdef TA_THREAD_LOCAL
+  _tls_state = NULL;
+#endif
+  free (state->error_t.message);
+  free (state->log_buf);
+  free (state);
+}
+
+/* Creates the key if it does not exist. Returns 0 if it fails. */
+static int
+_tls_create (void)
+{
+  int ready;
+  pthread_mutex_lock (&_tls_lock);
+  if (!_tls_ready && pthread_key_create (&_tls_key, _state_free) == 0)
+    {
+      ta_atomic_add (&_tls_generation, 1);
+      ta_atomic_store (&_tls_ready, 1);
+    }
+  ready = _tls_ready;
+  pthread_mutex_unlock (&_tls_lock);
+  return ready;
+}
 
 void
 ta_global_state_setup (void)
 {
-  pthread_key_create (&_tls_key, free);
-  _tls_init = 1;
+  _tls_create ();
 }
 
 void
 ta_global_state_teardown (void)
 {
-  pthread_key_delete (_tls_key);
-  _tls_init = 0;
+  void *state;
+
+  pthread_mutex_lock (&_tls_lock);
+  if (_tls_ready)
+    {
+      /* Destructors are not called for the thread deleting the key */
+      if ((state = pthread_getspecific (_tls_key)) != NULL)
+        {
+          pthread_setspecific (_tls_key, NULL);
+          _state_free (state);
+        }
+      pthread_key_delete (_tls_key);
+      ta_atomic_store (&_tls_ready, 0);
+    }
+  pthread_mutex_unlock (&_tls_lock);
 }
 
 ta_global_state_t *
 ta_global_state_get (void)
 {
   void *state;
-  if ((state = pthread_getspecific (_tls_key)) != NULL)
-    return state;
 
-  state = malloc (sizeof (ta_global_state_t));
-  if (!state)
-    return NULL;
+#ifdef TA_THREAD_LOCAL
+  /* Only the first call of each thread (and the first one after the
+   * state is set up again) goes past this point */
+  if (_tls_state != NULL &&
+      _tls_state_generation == ta_atomic_load (&_tls_generation))
+    return _tls_state;
+#endif
 
-  memset (state, 0x0, sizeof (ta_global_state_t));
-  pthread_setspecific (_tls_key, state);
+  /* Programs that never called the setup function still work */
+  if (!ta_atomic_load (&_tls_ready) && !_tls_create ())
+    return NULL;
+  if ((state = pthread_getspecific (_tls_key)) == NULL)
+    {
+#ifdef TA_THREAD_LOCAL
+      /* The state of this thread belonged to a key that was deleted,
+       * it is moved to the new one so it is still released when the
+       * thread exits */
+      if ((state = _tls_state) == NULL)
+#endif
+        {
+          if ((state = malloc (sizeof (ta_global_state_t))) == NULL)
+            return NULL;
+          memset (state, 0x0, sizeof (ta_global_state_t));
+        }
+      pthread_setspecific (_tls_key, state);
+    }
+#ifdef TA_THREAD_LOCAL
+  _tls_state = state;
+  _tls_state_generation = ta_atomic_load (&_tls_generation);
+#endif
   return (ta_global_state_t *) state;
 }
 
@@ -75,6 +151,9 @@ ta_global_state_setup (void)
 void
 ta_global_state_teardown (void)
 {
+  free (__ta_state.error_t.message);
+  free (__ta_state.log_buf);
+  memset (&__ta_state, 0x0, sizeof (ta_global_state_t));
 }
 
 ta_global_state_t *
@@ -0,0 +1,140 @@
+/* idgen.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <taningia/idgen.h>
+
+#include "atomic.h"
+
+struct _ta_idgen_t {
+  ta_object_t parent;
+  char prefix[TA_IDGEN_PREFIX_SIZE + 2];
+  unsigned long counter;
+};
+
+/* Chars used in the prefix and in the counter. The prefix takes five
+ * bits of each random byte, the counter is written in base 36. */
+static const char _alphabet[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+static ta_idgen_t _default_gen;
+static pthread_once_t _default_once = PTHREAD_ONCE_INIT;
+
+/* Fills `buf' with random bytes. When /dev/urandom is not available,
+ * the current time, the pid and an address are mixed instead, which
+ * is still enough to tell two generators apart. */
+static void
+_random_bytes (unsigned char *buf, size_t size, void *salt)
+{
+  struct timeval tv;
+  unsigned long seed;
+  size_t i;
+  int fd;
+
+  if ((fd = open ("/dev/urandom", O_RDONLY)) >= 0)
+    {
+      ssize_t n = read (fd, buf, size);
+      close (fd);
+      if (n == (ssize_t) size)
+        return;
+    }
+
+  gettimeofday (&tv, NULL);
+  seed = (unsigned long) tv.tv_sec ^ ((unsigned long) tv.tv_usec << 16) ^
+    ((unsigned long) getpid () << 8) ^ (unsigned long) salt;
+  for (i = 0; i < size; i++)
+    {
+      /* xorshift */
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      buf[i] = (unsigned char) (seed >> 24);
+    }
+}
+
+static void
+_default_init (void)
+{
+  ta_idgen_init (&_default_gen);
+}
+
+void
+ta_idgen_init (ta_idgen_t *gen)
+{
+  unsigned char bytes[TA_IDGEN_PREFIX_SIZE];
+  int i;
+
+  ta_object_init (TA_CAST_OBJECT (gen), NULL);
+  _random_bytes (bytes, sizeof (bytes), gen);
+  for (i = 0; i < TA_IDGEN_PREFIX_SIZE; i++)
+    gen->prefix[i] = _alphabet[bytes[i] & 0x1f];
+  gen->prefix[TA_IDGEN_PREFIX_SIZE] = '-';
+  gen->prefix[TA_IDGEN_PREFIX_SIZE + 1] = '\0';
+  gen->counter = 0;
+}
+
+ta_idgen_t *
+ta_idgen_new (void)
+{
+  ta_idgen_t *gen;
+  gen = malloc (sizeof (ta_idgen_t));
+  ta_idgen_init (gen);
+  return gen;
+}
+
+ta_idgen_t *
+ta_idgen_get_default (void)
+{
+  pthread_once (&_default_once, _default_init);
+  return &_default_gen;
+}
+
+const char *
+ta_idgen_get_prefix (ta_idgen_t *gen)
+{
+  return gen->prefix;
+}
+
+int
+ta_idgen_next (ta_idgen_t *gen, char *buf)
+{
+  char digits[16];
+  unsigned long n;
+  int len = TA_IDGEN_PREFIX_SIZE + 1, i = 0;
+
+  n = ta_atomic_add (&gen->counter, 1);
+
+  /* Digits come out in the reverse order */
+  do
+    {
+      digits[i++] = _alphabet[n % 36];
+      n /= 36;
+    }
+  while (n > 0);
+
+  memcpy (buf, gen->prefix, len);
+  while (i > 0)
+    buf[len++] = digits[--i];
+  buf[len] = '\0';
+  return len;
+}
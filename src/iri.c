@@ -595,7 +595,7 @@ ta_tag_set_from_string (ta_tag_t *tag, const char *tagstr)
   /* The rest of our function will use parameters set by the next
    * line. If something wrong happens, user will need to handle this
    * error like any other error caused by the tag parsing*/
-  if (!ta_iri_set_from_string (TA_CAST_IRI (tag), tagstr))
+  if (ta_iri_set_from_string (TA_CAST_IRI (tag), tagstr) != TA_OK)
     return 0;
   else
     {
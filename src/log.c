@@ -21,14 +21,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#include <taningia/log.h>
 #include <time.h>
+#include <taningia/global.h>
+#include <taningia/log.h>
+#include <taningia/binlog.h>
 
 static void
 ta_log_free (ta_log_t *log)
 {
   free (log->name);
   free (log->date_format);
+  if (log->binlog)
+    ta_object_unref (log->binlog);
 }
 
 void
@@ -41,6 +45,7 @@ ta_log_init (ta_log_t *log, const char *domain_name)
   log->handler_data = NULL;
   log->use_colors = 0;
   log->date_format = strdup ("%x %X");
+  log->binlog = NULL;
 }
 
 ta_log_t *
@@ -98,234 +103,235 @@ ta_log_get_date_format (ta_log_t *log)
   return log->date_format;
 }
 
-/* I had problems to make it as a simple static function because of
- * the varargs stuff. I'll try to implement it better soon */
-#define get_message(fmt, argp) {                \
-  int n, size;                                  \
-  char *np;                                     \
-  va_list argp;                                 \
-                                                \
-  size = 64;                                    \
-                                                \
-  if ((msg = malloc (size)) == NULL)            \
-    msg = NULL;                                 \
-  else                                          \
-    while (1)                                   \
-      {                                         \
-        va_start (argp, fmt);                   \
-        n = vsnprintf (msg, size, fmt, argp);   \
-        va_end (argp);                          \
-        if (n > -1 && n < size)                 \
-          break;                                \
-        if (n > -1)                             \
-          size = n+1;                           \
-        else                                    \
-          size *= 2;                            \
-        if ((np = realloc (msg, size)) == NULL) \
-          {                                     \
-            free (msg);                         \
-            msg = NULL;                         \
-            break;                              \
-          }                                     \
-        else                                    \
-          msg = np;                             \
-      }                                         \
-  }
-
-static char *
-_ta_log_localtime (ta_log_t * log)
+void
+ta_log_set_binlog (ta_log_t *log, ta_binlog_t *binlog)
 {
-  struct tm * timeinfo;
-  time_t rawtime = time (NULL);
-  char *buffer = malloc (MAX_DATE_SIZE);
-  if (buffer == NULL)
-    return NULL;
+  if (binlog)
+    ta_object_ref (binlog);
+  if (log->binlog)
+    ta_object_unref (log->binlog);
+  log->binlog = binlog;
+}
 
-  time (&rawtime);
-  timeinfo = localtime (&rawtime);
+#define LOG_BUF_MIN 256
+
+/* How each level is written to stderr. The date and the name are
+ * taken from the formatted message, that's why their size is given. */
+static const char *_plain_formats[] = {
+  "[ DEBUG ] [ %.*s ] [ %.*s ]  %s\n",
+  "[  INFO ] [ %.*s ] [ %.*s ] %s\n",
+  "[  WARN ] [ %.*s ] [ %.*s ] %s\n",
+  "[ ERROR ] [ %.*s ] [ %.*s ] %s\n",
+  "[ CRITI ] [ %.*s ] [ %.*s ]  %s\n"
+};
+
+static const char *_color_formats[] = {
+  /* Blue */
+  "\033[;34m[ DEBUG ] [ %.*s ]\033[;0m \033[0;0m[ %.*s ] %s\033[;0m\n",
+  /* Cyan */
+  "\033[;36m[  INFO ] [ %.*s ]\033[;0m \033[;0m[ %.*s ] %s\033[;0m\n",
+  /* Yellow */
+  "\033[;33m[  WARN ] [ %.*s ]\033[;0m \033[;0m[ %.*s ] %s\033[;0m\n",
+  /* Red foreground */
+  "\033[1;31m[ ERROR ] [ %.*s ]\033[1;0m\033[1;1m [ %.*s ] %s\033[1;0m\n",
+  /* Red with no bold */
+  "\033[;31m[ CRITI ] [ %.*s ]\033[;0m \033[;0m[ %.*s ] %s\033[;0m\n"
+};
+
+/* Returns the current date formatted with the date format of `log'.
+ * The result is cached by the calling thread until the second or the
+ * format changes. */
+static const char *
+_ta_log_localtime (ta_log_t *log, ta_global_state_t *state, size_t *len)
+{
+  struct tm timeinfo;
+  time_t rawtime = time (NULL);
+  size_t flen;
 
   if (log->date_format == NULL)
     {
-      free (buffer);
-      return NULL;
+      *len = 0;
+      return "";
     }
-  if (strftime (buffer, MAX_DATE_SIZE, log->date_format, timeinfo))
-    return buffer;
+  if (rawtime == state->log_time &&
+      strcmp (log->date_format, state->log_date_format) == 0)
+    {
+      *len = state->log_date_len;
+      return state->log_date;
+    }
+
+  localtime_r (&rawtime, &timeinfo);
+  state->log_date_len = strftime (state->log_date, MAX_DATE_SIZE,
+                                  log->date_format, &timeinfo);
+  if (state->log_date_len == 0)
+    state->log_date[0] = '\0';
 
-  fprintf (stderr, "Oh god, fix it! Date format too long!");
-  return NULL;
+  /* Formats that don't fit in the cache are formatted every time */
+  if ((flen = strlen (log->date_format)) < MAX_DATE_SIZE)
+    {
+      memcpy (state->log_date_format, log->date_format, flen + 1);
+      state->log_time = rawtime;
+    }
+  else
+    state->log_time = (time_t) -1;
+
+  *len = state->log_date_len;
+  return state->log_date;
 }
 
+/* Makes sure that `*buf' holds at least `size' bytes */
 static int
-_call_handler (ta_log_t *log, const char *msg, const char *ltime,
-               ta_log_level_t level)
+_ta_log_reserve (char **buf, size_t *bufsize, size_t size)
 {
-  if (log->handler) {
-    char *full;
-    int ret = 0;
-    size_t
-      size1 = strlen (ltime),
-      size2 = strlen (log->name),
-      size3 = strlen (msg),
-      total = size1+size2+size3+5;
-    full = malloc (total + 1);
-    memcpy (full, "[", 1);
-    memcpy (full+1, ltime, size1);
-    memcpy (full+1+size1, "][", 2);
-    memcpy (full+3+size1, log->name, size2);
-    memcpy (full+3+size1+size2, "] ", 2);
-    memcpy (full+5+size1+size2, msg, size3);
-    full[total] = '\0';
-    if (log->handler (log, level, full, log->handler_data))
-      ret = 1;
-    free (full);
-    return ret;
-  }
-  return 0;
+  char *nbuf;
+  if (size <= *bufsize)
+    return 1;
+  if (size < *bufsize * 2)
+    size = *bufsize * 2;
+  if (size < LOG_BUF_MIN)
+    size = LOG_BUF_MIN;
+  if ((nbuf = realloc (*buf, size)) == NULL)
+    return 0;
+  *buf = nbuf;
+  *bufsize = size;
+  return 1;
 }
 
-void
-ta_log_info (ta_log_t *log, const char *fmt, ...)
+/* Formats `[date][name] message' in `*buf' and hands it to the
+ * handler or writes it to stderr */
+static void
+_ta_log_format (ta_log_t *log, ta_log_level_t level, char **buf,
+                size_t *bufsize, const char *date, size_t date_len,
+                const char *fmt, va_list args)
 {
-  char *ta_log_time;
-  char *msg;                    /* Filled by get_message() */
+  size_t name_len = strlen (log->name), head = date_len + name_len + 5;
+  va_list copy;
+  int n;
 
-  if (!(log->level <= TA_LOG_INFO))
+  if (!_ta_log_reserve (buf, bufsize, head + 1))
     return;
-  get_message (fmt, argp);
-  if (msg == NULL)
+  (*buf)[0] = '[';
+  memcpy (*buf + 1, date, date_len);
+  memcpy (*buf + 1 + date_len, "][", 2);
+  memcpy (*buf + 3 + date_len, log->name, name_len);
+  memcpy (*buf + 3 + date_len + name_len, "] ", 2);
+
+  va_copy (copy, args);
+  n = vsnprintf (*buf + head, *bufsize - head, fmt, copy);
+  va_end (copy);
+  if (n < 0)
     return;
-  ta_log_time = _ta_log_localtime (log);
-  if (_call_handler (log, msg, ta_log_time, TA_LOG_INFO))
+  if ((size_t) n >= *bufsize - head)
+    {
+      if (!_ta_log_reserve (buf, bufsize, head + n + 1))
+        return;
+      vsnprintf (*buf + head, n + 1, fmt, args);
+    }
+
+  if (log->handler && log->handler (log, level, *buf, log->handler_data))
     return;
-  if (!log->use_colors)
-    fprintf (stderr, "[  INFO ] [ %s ] [ %s ] %s\n", ta_log_time,
-             log->name, msg);
-  else
-    /* Cyan */
-    fprintf (stderr,
-             "\033[;36m[  INFO ] [ %s ]\033[;0m \033[;0m[ %s ] %s\033[;0m\n",
-             ta_log_time,
-             log->name,
-             msg);
-
-  free (ta_log_time);
-  free (msg);
+  fprintf (stderr,
+           log->use_colors ? _color_formats[level] : _plain_formats[level],
+           (int) date_len, *buf + 1, (int) name_len, *buf + 3 + date_len,
+           *buf + head);
 }
 
-void
-ta_log_warn (ta_log_t *log, const char *fmt, ...)
+static void
+_ta_log_write (ta_log_t *log, ta_log_level_t level, const char *fmt,
+               va_list args)
 {
-  char *ta_log_time;
-  char *msg;                    /* Filled by get_message() */
+  ta_global_state_t *state;
+  const char *date;
+  char *buf = NULL, ldate[MAX_DATE_SIZE];
+  size_t date_len, bufsize = 0;
 
-  if (!(log->level <= TA_LOG_WARN))
+  if (log->binlog)
+    {
+      ta_binlog_vwrite (log->binlog, log, level, fmt, args);
+      return;
+    }
+
+  state = TA_GLOBAL;
+  date = _ta_log_localtime (log, state, &date_len);
+
+  /* Handlers that log something can't reuse the buffer in use, they
+   * get their own */
+  if (state->log_busy)
+    {
+      memcpy (ldate, date, date_len);
+      _ta_log_format (log, level, &buf, &bufsize, ldate, date_len,
+                      fmt, args);
+      free (buf);
+      return;
+    }
+  state->log_busy = 1;
+  _ta_log_format (log, level, &state->log_buf, &state->log_buf_size,
+                  date, date_len, fmt, args);
+  state->log_busy = 0;
+}
+
+void
+ta_log_write (ta_log_t *log, ta_log_level_t level, const char *fmt, ...)
+{
+  va_list args;
+  if (!ta_log_is_enabled (log, level))
     return;
-  get_message (fmt, argp);
-  if (msg == NULL)
+  va_start (args, fmt);
+  _ta_log_write (log, level, fmt, args);
+  va_end (args);
+}
+
+void
+ta_log_info (ta_log_t *log, const char *fmt, ...)
+{
+  va_list args;
+  if (!ta_log_is_enabled (log, TA_LOG_INFO))
     return;
-  ta_log_time = _ta_log_localtime (log);
-  if (_call_handler (log, msg, ta_log_time, TA_LOG_WARN))
+  va_start (args, fmt);
+  _ta_log_write (log, TA_LOG_INFO, fmt, args);
+  va_end (args);
+}
+
+void
+ta_log_warn (ta_log_t *log, const char *fmt, ...)
+{
+  va_list args;
+  if (!ta_log_is_enabled (log, TA_LOG_WARN))
     return;
-  if (!log->use_colors)
-    fprintf (stderr, "[  WARN ] [ %s ] [ %s ] %s\n", ta_log_time,
-             log->name, msg);
-  else
-    /* Yellow */
-    fprintf (stderr,
-             "\033[;33m[  WARN ] [ %s ]\033[;0m \033[;0m[ %s ] %s\033[;0m\n",
-             ta_log_time,
-             log->name,
-             msg);
-
-  free (ta_log_time);
-  free (msg);
+  va_start (args, fmt);
+  _ta_log_write (log, TA_LOG_WARN, fmt, args);
+  va_end (args);
 }
 
 void
 ta_log_debug (ta_log_t *log, const char *fmt, ...)
 {
-  char *ta_log_time;
-  char *msg;                    /* Filled by get_message() */
-
-  if (!(log->level <= TA_LOG_DEBUG))
-    return;
-  get_message (fmt, argp);
-  if (msg == NULL)
+  va_list args;
+  if (!ta_log_is_enabled (log, TA_LOG_DEBUG))
     return;
-  ta_log_time = _ta_log_localtime (log);
-  if (_call_handler (log, msg, ta_log_time, TA_LOG_DEBUG))
-    return;
-  if (!log->use_colors)
-    fprintf (stderr, "[ DEBUG ] [ %s ] [ %s ]  %s\n", ta_log_time,
-             log->name, msg);
-  else
-    /* Blue */
-    fprintf (stderr,
-             "\033[;34m[ DEBUG ] [ %s ]\033[;0m \033[0;0m[ %s ] %s\033[;0m\n",
-             ta_log_time,
-             log->name,
-             msg);
-
-  free (ta_log_time);
-  free (msg);
+  va_start (args, fmt);
+  _ta_log_write (log, TA_LOG_DEBUG, fmt, args);
+  va_end (args);
 }
 
 void
 ta_log_critical (ta_log_t *log, const char *fmt, ...)
 {
-  char *ta_log_time;
-  char *msg;                    /* Filled by get_message() */
-
-  if (!(log->level <= TA_LOG_CRITICAL))
+  va_list args;
+  if (!ta_log_is_enabled (log, TA_LOG_CRITICAL))
     return;
-  get_message (fmt, argp);
-  if (msg == NULL)
-    return;
-  ta_log_time = _ta_log_localtime (log);
-  if (_call_handler (log, msg, ta_log_time, TA_LOG_CRITICAL))
-    return;
-  if (!log->use_colors)
-    fprintf (stderr, "[ CRITI ] [ %s ] [ %s ]  %s\n", ta_log_time,
-             log->name, msg);
-  else
-    /* Red with no bold */
-    fprintf (stderr,
-             "\033[;31m[ CRITI ] [ %s ]\033[;0m \033[;0m[ %s ] %s\033[;0m\n",
-             ta_log_time,
-             log->name,
-             msg);
-
-  free (ta_log_time);
-  free (msg);
+  va_start (args, fmt);
+  _ta_log_write (log, TA_LOG_CRITICAL, fmt, args);
+  va_end (args);
 }
 
 void
 ta_log_error (ta_log_t *log, const char *fmt, ...)
 {
-  char *ta_log_time;
-  char *msg;                    /* Filled by get_message() */
-
-  if (!(log->level <= TA_LOG_ERROR))
+  va_list args;
+  if (!ta_log_is_enabled (log, TA_LOG_ERROR))
     return;
-  get_message (fmt, argp);
-  if (msg == NULL)
-    return;
-  ta_log_time = _ta_log_localtime (log);
-  if (_call_handler (log, msg, ta_log_time, TA_LOG_ERROR))
-    return;
-  if (!log->use_colors)
-    fprintf (stderr, "[ ERROR ] [ %s ] [ %s ] %s\n", ta_log_time,
-             log->name, msg);
-  else
-    /* Red foreground */
-    fprintf (stderr,
-             "\033[1;31m[ ERROR ] [ %s ]\033[1;0m"
-             "\033[1;1m [ %s ] %s\033[1;0m\n",
-             ta_log_time,
-             log->name,
-             msg);
-
-  free (ta_log_time);
-  free (msg);
+  va_start (args, fmt);
+  _ta_log_write (log, TA_LOG_ERROR, fmt, args);
+  va_end (args);
 }
@@ -0,0 +1,437 @@
+/* logsink.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <taningia/error.h>
+#include <taningia/logsink.h>
+
+#include "atomic.h"
+
+#define DEFAULT_SAMPLE_RATE 10
+#define DEFAULT_INTERVAL 50
+#define LABEL_SIZE 10
+#define MAX_BATCH 64
+
+static const char *_labels[] = {
+  "[ DEBUG ] ",
+  "[  INFO ] ",
+  "[  WARN ] ",
+  "[ ERROR ] ",
+  "[ CRITI ] "
+};
+
+/* A slot of the ring. `seq' tells who owns it: producers can fill it
+ * when it is equal to their position and the writer can read it when
+ * it is one past its position. */
+struct record {
+  unsigned long seq;
+  size_t size;
+  char text[TA_LOG_SINK_RECORD_SIZE];
+};
+
+struct _ta_log_sink_t {
+  ta_object_t parent;
+  int fd;
+  ta_log_sink_policy_t policy;
+  int sample_rate;
+  int interval;
+
+  struct record *ring;
+  unsigned long mask;
+  unsigned long head;           /* Next position claimed by producers */
+  unsigned long tail;           /* Next position read by the writer */
+  unsigned long sample_count;
+
+  ta_log_sink_stats_t stats;
+
+  /* Only used to put the writer or blocked producers to sleep, never
+   * in the path of a message that fits in the ring */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t room;
+  int running;
+  int sleeping;
+  int waiters;
+};
+
+/* Ring helpers */
+
+/* Claims a free slot, returns NULL when the ring is full */
+static struct record *
+_ring_claim (ta_log_sink_t *sink, unsigned long *pos)
+{
+  struct record *slot;
+  unsigned long seq;
+  long diff;
+
+  *pos = ta_atomic_load (&sink->head);
+  for (;;)
+    {
+      slot = &sink->ring[*pos & sink->mask];
+      seq = ta_atomic_load (&slot->seq);
+      diff = (long) (seq - *pos);
+      if (diff == 0)
+        {
+          if (ta_atomic_cas (&sink->head, pos, *pos + 1))
+            return slot;
+        }
+      else if (diff < 0)
+        return NULL;
+      else
+        *pos = ta_atomic_load (&sink->head);
+    }
+}
+
+static int
+_ring_fill (ta_log_sink_t *sink)
+{
+  return (int) (ta_atomic_load (&sink->head) - ta_atomic_load (&sink->tail));
+}
+
+static void
+_wake_writer (ta_log_sink_t *sink)
+{
+  /* A wake up lost to a race with the writer going to sleep only
+   * delays the write until the end of its interval */
+  if (ta_atomic_load (&sink->sleeping))
+    {
+      pthread_mutex_lock (&sink->lock);
+      pthread_cond_signal (&sink->wake);
+      pthread_mutex_unlock (&sink->lock);
+    }
+}
+
+/* Waits until the writer frees some room. Returns 0 if the writer is
+ * not running, then no room will ever come. */
+static int
+_wait_room (ta_log_sink_t *sink)
+{
+  int running;
+  pthread_mutex_lock (&sink->lock);
+  if ((running = sink->running))
+    {
+      ta_atomic_add (&sink->waiters, 1);
+      pthread_cond_signal (&sink->wake);
+      pthread_cond_wait (&sink->room, &sink->lock);
+      ta_atomic_sub (&sink->waiters, 1);
+    }
+  pthread_mutex_unlock (&sink->lock);
+  return running;
+}
+
+/* Writes a batch of records, finishing partial writes so lines never
+ * get mixed. A descriptor that is not ready is waited for during one
+ * interval at most, the records are given up after that or after any
+ * other error. Returns how many records were completely written. */
+static int
+_write_batch (ta_log_sink_t *sink, struct iovec *iov, int count)
+{
+  struct pollfd pfd;
+  ssize_t written;
+  int i = 0;
+
+  while (i < count)
+    {
+      written = writev (sink->fd, iov + i, count - i);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+          pfd.fd = sink->fd;
+          pfd.events = POLLOUT;
+          if (poll (&pfd, 1, sink->interval) > 0 &&
+              !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+            continue;
+        }
+      if (written <= 0)
+        break;
+      while (i < count && (size_t) written >= iov[i].iov_len)
+        written -= iov[i++].iov_len;
+      if (i < count)
+        {
+          iov[i].iov_base = (char *) iov[i].iov_base + written;
+          iov[i].iov_len -= written;
+        }
+    }
+  return i;
+}
+
+/* Writes all the records the writer owns. Returns how many were
+ * taken from the ring, written or not. */
+static int
+_ta_log_sink_drain (ta_log_sink_t *sink)
+{
+  struct iovec iov[MAX_BATCH];
+  struct record *slots[MAX_BATCH];
+  struct record *slot;
+  unsigned long tail = sink->tail;
+  int count = 0, total = 0, done, i;
+
+  for (;;)
+    {
+      slot = &sink->ring[tail & sink->mask];
+      if (count < MAX_BATCH && ta_atomic_load (&slot->seq) == tail + 1)
+        {
+          iov[count].iov_base = slot->text;
+          iov[count].iov_len = slot->size;
+          slots[count++] = slot;
+          tail++;
+          continue;
+        }
+      if (count == 0)
+        break;
+
+      /* Records that could not be written are counted and dropped,
+       * keeping them would stop the producers once the ring fills */
+      done = _write_batch (sink, iov, count);
+      ta_atomic_add (&sink->stats.writes, 1);
+      ta_atomic_add (&sink->stats.written, done);
+      if (done < count)
+        ta_atomic_add (&sink->stats.failed, count - done);
+
+      /* Gives the slots back to the producers */
+      for (i = 0; i < count; i++)
+        ta_atomic_store (&slots[i]->seq,
+                         sink->tail + i + sink->mask + 1);
+      ta_atomic_store (&sink->tail, tail);
+      total += count;
+      count = 0;
+    }
+
+  if (ta_atomic_load (&sink->waiters))
+    {
+      pthread_mutex_lock (&sink->lock);
+      pthread_cond_broadcast (&sink->room);
+      pthread_mutex_unlock (&sink->lock);
+    }
+  return total;
+}
+
+static void *
+_ta_log_sink_writer (void *data)
+{
+  ta_log_sink_t *sink = (ta_log_sink_t *) data;
+  struct timeval now;
+  struct timespec until;
+
+  for (;;)
+    {
+      if (_ta_log_sink_drain (sink) > 0)
+        continue;
+
+      pthread_mutex_lock (&sink->lock);
+      if (!sink->running)
+        {
+          pthread_mutex_unlock (&sink->lock);
+          break;
+        }
+      ta_atomic_store (&sink->sleeping, 1);
+      if (_ring_fill (sink) == 0)
+        {
+          gettimeofday (&now, NULL);
+          until.tv_sec = now.tv_sec + sink->interval / 1000;
+          until.tv_nsec = now.tv_usec * 1000 +
+            (sink->interval % 1000) * 1000000L;
+          if (until.tv_nsec >= 1000000000L)
+            {
+              until.tv_sec++;
+              until.tv_nsec -= 1000000000L;
+            }
+          pthread_cond_timedwait (&sink->wake, &sink->lock, &until);
+        }
+      ta_atomic_store (&sink->sleeping, 0);
+      pthread_mutex_unlock (&sink->lock);
+    }
+
+  /* Messages logged while stopping */
+  _ta_log_sink_drain (sink);
+  return NULL;
+}
+
+/* ta_log_sink_t */
+
+static void
+ta_log_sink_free (ta_log_sink_t *sink)
+{
+  ta_log_sink_stop (sink);
+  free (sink->ring);
+  pthread_mutex_destroy (&sink->lock);
+  pthread_cond_destroy (&sink->wake);
+  pthread_cond_destroy (&sink->room);
+}
+
+void
+ta_log_sink_init (ta_log_sink_t *sink, int fd, int capacity,
+                  ta_log_sink_policy_t policy)
+{
+  unsigned long size = 2, i;
+
+  ta_object_init (TA_CAST_OBJECT (sink), (ta_free_func_t) ta_log_sink_free);
+  while (size < (unsigned long) capacity)
+    size <<= 1;
+
+  sink->fd = fd;
+  sink->policy = policy;
+  sink->sample_rate = DEFAULT_SAMPLE_RATE;
+  sink->interval = DEFAULT_INTERVAL;
+  sink->ring = malloc (size * sizeof (struct record));
+  sink->mask = size - 1;
+  for (i = 0; i < size; i++)
+    sink->ring[i].seq = i;
+  sink->head = 0;
+  sink->tail = 0;
+  sink->sample_count = 0;
+  memset (&sink->stats, 0, sizeof (ta_log_sink_stats_t));
+  pthread_mutex_init (&sink->lock, NULL);
+  pthread_cond_init (&sink->wake, NULL);
+  pthread_cond_init (&sink->room, NULL);
+  sink->running = 0;
+  sink->sleeping = 0;
+  sink->waiters = 0;
+}
+
+ta_log_sink_t *
+ta_log_sink_new (int fd, int capacity, ta_log_sink_policy_t policy)
+{
+  ta_log_sink_t *sink;
+  sink = malloc (sizeof (ta_log_sink_t));
+  ta_log_sink_init (sink, fd, capacity, policy);
+  return sink;
+}
+
+void
+ta_log_sink_set_sample_rate (ta_log_sink_t *sink, int rate)
+{
+  sink->sample_rate = rate < 1 ? 1 : rate;
+}
+
+void
+ta_log_sink_set_interval (ta_log_sink_t *sink, int msecs)
+{
+  sink->interval = msecs < 1 ? 1 : msecs;
+}
+
+void
+ta_log_sink_attach (ta_log_sink_t *sink, ta_log_t *log)
+{
+  ta_log_set_handler (log, ta_log_sink_handler, sink);
+}
+
+int
+ta_log_sink_handler (ta_log_t *TA_UNUSED(log), ta_log_level_t level,
+                     const char *message, void *data)
+{
+  ta_log_sink_t *sink = (ta_log_sink_t *) data;
+  struct record *slot;
+  unsigned long pos;
+  size_t size;
+
+  if (sink->policy == TA_LOG_SINK_SAMPLE &&
+      _ring_fill (sink) > (int) (sink->mask + 1) / 4 * 3 &&
+      ta_atomic_add (&sink->sample_count, 1) % sink->sample_rate != 0)
+    {
+      ta_atomic_add (&sink->stats.dropped, 1);
+      return 1;
+    }
+
+  while ((slot = _ring_claim (sink, &pos)) == NULL)
+    {
+      if (sink->policy != TA_LOG_SINK_BLOCK || !_wait_room (sink))
+        {
+          ta_atomic_add (&sink->stats.dropped, 1);
+          return 1;
+        }
+      ta_atomic_add (&sink->stats.blocked, 1);
+    }
+
+  size = strlen (message);
+  if (size > TA_LOG_SINK_RECORD_SIZE - LABEL_SIZE - 1)
+    size = TA_LOG_SINK_RECORD_SIZE - LABEL_SIZE - 1;
+  memcpy (slot->text, _labels[level], LABEL_SIZE);
+  memcpy (slot->text + LABEL_SIZE, message, size);
+  slot->text[LABEL_SIZE + size] = '\n';
+  slot->size = LABEL_SIZE + size + 1;
+
+  /* Publishes the record to the writer */
+  ta_atomic_store (&slot->seq, pos + 1);
+  ta_atomic_add (&sink->stats.accepted, 1);
+  _wake_writer (sink);
+  return 1;
+}
+
+int
+ta_log_sink_start (ta_log_sink_t *sink)
+{
+  int err;
+  pthread_mutex_lock (&sink->lock);
+  if (sink->running)
+    {
+      pthread_mutex_unlock (&sink->lock);
+      return TA_OK;
+    }
+  sink->running = 1;
+  if ((err = pthread_create (&sink->thread, NULL,
+                             _ta_log_sink_writer, sink)) != 0)
+    {
+      sink->running = 0;
+      pthread_mutex_unlock (&sink->lock);
+      ta_error_set (TA_LOG_SINK_ERROR, "Could not start the writer: %s",
+                    strerror (err));
+      return TA_ERROR;
+    }
+  pthread_mutex_unlock (&sink->lock);
+  return TA_OK;
+}
+
+void
+ta_log_sink_stop (ta_log_sink_t *sink)
+{
+  pthread_mutex_lock (&sink->lock);
+  if (!sink->running)
+    {
+      pthread_mutex_unlock (&sink->lock);
+      return;
+    }
+  sink->running = 0;
+  pthread_cond_signal (&sink->wake);
+
+  /* Blocked producers give up */
+  pthread_cond_broadcast (&sink->room);
+  pthread_mutex_unlock (&sink->lock);
+  pthread_join (sink->thread, NULL);
+}
+
+void
+ta_log_sink_get_stats (ta_log_sink_t *sink, ta_log_sink_stats_t *stats)
+{
+  stats->accepted = ta_atomic_load (&sink->stats.accepted);
+  stats->written = ta_atomic_load (&sink->stats.written);
+  stats->dropped = ta_atomic_load (&sink->stats.dropped);
+  stats->blocked = ta_atomic_load (&sink->stats.blocked);
+  stats->writes = ta_atomic_load (&sink->stats.writes);
+  stats->failed = ta_atomic_load (&sink->stats.failed);
+}
@@ -0,0 +1,534 @@
+/* pool.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include <taningia/error.h>
+#include <taningia/list.h>
+#include <taningia/srv.h>
+#include <taningia/timer.h>
+#include <taningia/pool.h>
+
+#define DEFAULT_PORT 5222
+#define DEFAULT_DELAY 250
+#define DEFAULT_TIMEOUT 5000
+#define DEFAULT_MAX_IDLE 30000
+#define RETRY_INTERVAL 1000
+
+/* Addresses tried in a single round */
+#define MAX_CANDIDATES 32
+
+struct warm_conn {
+  int fd;
+  unsigned long since;
+};
+
+struct _ta_xmpp_pool_t {
+  ta_object_t parent;
+  char *domain;
+  char *host;
+  int port;
+  int delay;
+  int timeout;
+  int max_idle;
+
+  /* Connections ready to be taken, the newest ones last */
+  struct warm_conn *ready;
+  int nready;
+  int warm;
+
+  ta_xmpp_pool_stats_t stats;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;          /* The pool thread has work to do */
+  pthread_cond_t available;     /* A connection is ready */
+  int running;
+};
+
+/* Waits on `cond' for at most `msecs' milliseconds */
+static void
+_pool_wait (pthread_cond_t *cond, pthread_mutex_t *lock, long msecs)
+{
+  struct timeval now;
+  struct timespec until;
+
+  gettimeofday (&now, NULL);
+  until.tv_sec = now.tv_sec + msecs / 1000;
+  until.tv_nsec = now.tv_usec * 1000 + (msecs % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L)
+    {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+  pthread_cond_timedwait (cond, lock, &until);
+}
+
+/* Connection attempts */
+
+/* Appends the addresses of `host' to `candidates', alternating the
+ * address families as the section 4 of the RFC 8305 suggests */
+static int
+_pool_add_addresses (struct addrinfo **lists, int *nlists,
+                     struct addrinfo **candidates, int count,
+                     const char *host, int port)
+{
+  struct addrinfo hints, *res, *ai, *v6 = NULL, *v4 = NULL;
+  char service[8];
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  snprintf (service, sizeof (service), "%d", port);
+  if (getaddrinfo (host, service, &hints, &res) != 0)
+    return count;
+  lists[(*nlists)++] = res;
+
+  for (ai = res; ai; ai = ai->ai_next)
+    if (ai->ai_family == AF_INET6 && !v6)
+      v6 = ai;
+    else if (ai->ai_family == AF_INET && !v4)
+      v4 = ai;
+
+  while ((v6 || v4) && count < MAX_CANDIDATES)
+    {
+      if (v6)
+        {
+          candidates[count++] = v6;
+          for (v6 = v6->ai_next; v6 && v6->ai_family != AF_INET6;
+               v6 = v6->ai_next);
+        }
+      if (v4 && count < MAX_CANDIDATES)
+        {
+          candidates[count++] = v4;
+          for (v4 = v4->ai_next; v4 && v4->ai_family != AF_INET;
+               v4 = v4->ai_next);
+        }
+    }
+  return count;
+}
+
+/* Starts a connection to each candidate, one after the other, without
+ * waiting for the previous ones to fail. Returns the first socket that
+ * gets connected or -1. */
+static int
+_pool_race (ta_xmpp_pool_t *pool, struct addrinfo **candidates, int count)
+{
+  struct pollfd pfds[MAX_CANDIDATES];
+  unsigned long now, started = 0, deadline;
+  int active = 0, next = 0, winner = -1, fd, err, i;
+  socklen_t len;
+  long wait;
+
+  deadline = ta_timer_now () + pool->timeout;
+  while (winner < 0)
+    {
+      now = ta_timer_now ();
+      if (now >= deadline)
+        break;
+
+      /* Time to try the next address */
+      if (next < count && (active == 0 || now >= started + pool->delay))
+        {
+          struct addrinfo *ai = candidates[next++];
+          fd = socket (ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK
+                       | SOCK_CLOEXEC, 0);
+          if (fd < 0)
+            continue;
+          pthread_mutex_lock (&pool->lock);
+          pool->stats.attempts++;
+          pthread_mutex_unlock (&pool->lock);
+          if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            {
+              winner = fd;
+              break;
+            }
+          if (errno != EINPROGRESS)
+            {
+              close (fd);
+              continue;
+            }
+          pfds[active].fd = fd;
+          pfds[active].events = POLLOUT;
+          active++;
+          started = now;
+        }
+      if (active == 0)
+        {
+          if (next >= count)
+            break;
+          continue;
+        }
+
+      wait = deadline - now;
+      if (next < count && (long) (started + pool->delay - now) < wait)
+        wait = started + pool->delay - now;
+      if (poll (pfds, active, wait) <= 0)
+        continue;
+
+      for (i = 0; i < active; )
+        {
+          if (pfds[i].revents == 0)
+            {
+              i++;
+              continue;
+            }
+          len = sizeof (err);
+          if (getsockopt (pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0
+              && err == 0 && winner < 0)
+            winner = pfds[i].fd;
+          else
+            close (pfds[i].fd);
+          pfds[i] = pfds[--active];
+        }
+    }
+
+  /* The losers are not needed anymore */
+  for (i = 0; i < active; i++)
+    close (pfds[i].fd);
+
+  /* Clients expect a blocking socket, as the ones created by
+   * iksemel */
+  if (winner >= 0)
+    fcntl (winner, F_SETFL, fcntl (winner, F_GETFL) & ~O_NONBLOCK);
+  return winner;
+}
+
+static int
+_pool_connect (ta_xmpp_pool_t *pool)
+{
+  struct addrinfo *lists[MAX_CANDIDATES], *candidates[MAX_CANDIDATES];
+  ta_list_t *targets = NULL, *t;
+  ta_srv_target_t *target;
+  char *host;
+  int nlists = 0, count = 0, port, fd, i;
+
+  pthread_mutex_lock (&pool->lock);
+  host = pool->host ? strdup (pool->host) : NULL;
+  port = pool->port;
+  pthread_mutex_unlock (&pool->lock);
+
+  if (host)
+    count = _pool_add_addresses (lists, &nlists, candidates, count,
+                                 host, port);
+  else
+    {
+      /* SRV answers are cached, asking again for each round is
+       * cheap */
+      targets = ta_srv_query_domain ("_xmpp-client._tcp", pool->domain);
+      for (t = targets; t; t = t->next)
+        {
+          target = (ta_srv_target_t *) t->data;
+          if (nlists < MAX_CANDIDATES && count < MAX_CANDIDATES)
+            count = _pool_add_addresses (lists, &nlists, candidates, count,
+                                         ta_srv_target_get_host (target),
+                                         ta_srv_target_get_port (target));
+          ta_object_unref (target);
+        }
+      ta_list_free (targets);
+      if (targets == NULL)
+        count = _pool_add_addresses (lists, &nlists, candidates, count,
+                                     pool->domain, port);
+    }
+  free (host);
+
+  fd = count ? _pool_race (pool, candidates, count) : -1;
+  for (i = 0; i < nlists; i++)
+    freeaddrinfo (lists[i]);
+  return fd;
+}
+
+/* Warm connections */
+
+/* A connection is still good if the server didn't close it nor send
+ * anything, it has no reason to talk before the stream header */
+static int
+_pool_conn_alive (int fd)
+{
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll (&pfd, 1, 0) == 0;
+}
+
+/* Drops connections that waited too long. Must be called with the
+ * lock held. Returns how long until the next one gets too old. */
+static long
+_pool_expire (ta_xmpp_pool_t *pool)
+{
+  unsigned long now = ta_timer_now ();
+  long next = pool->max_idle;
+  int i = 0;
+
+  while (i < pool->nready)
+    {
+      if (now - pool->ready[i].since >= (unsigned long) pool->max_idle)
+        {
+          close (pool->ready[i].fd);
+          memmove (&pool->ready[i], &pool->ready[i + 1],
+                   (pool->nready - i - 1) * sizeof (struct warm_conn));
+          pool->nready--;
+          pool->stats.expired++;
+          continue;
+        }
+      if ((long) (pool->ready[i].since + pool->max_idle - now) < next)
+        next = pool->ready[i].since + pool->max_idle - now;
+      i++;
+    }
+  return next;
+}
+
+static void *
+_pool_run (void *data)
+{
+  ta_xmpp_pool_t *pool = (ta_xmpp_pool_t *) data;
+  long next;
+  int fd;
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->running)
+    {
+      next = _pool_expire (pool);
+      if (pool->nready >= pool->warm)
+        {
+          _pool_wait (&pool->wake, &pool->lock, next);
+          continue;
+        }
+
+      /* Connecting may take a while, clients can still take the
+       * connections already made */
+      pthread_mutex_unlock (&pool->lock);
+      fd = _pool_connect (pool);
+      pthread_mutex_lock (&pool->lock);
+
+      if (fd < 0)
+        {
+          pool->stats.failed++;
+          if (pool->running)
+            _pool_wait (&pool->wake, &pool->lock, RETRY_INTERVAL);
+          continue;
+        }
+      pool->stats.connected++;
+      if (!pool->running || pool->nready >= pool->warm)
+        {
+          close (fd);
+          continue;
+        }
+      pool->ready[pool->nready].fd = fd;
+      pool->ready[pool->nready].since = ta_timer_now ();
+      pool->nready++;
+      pthread_cond_broadcast (&pool->available);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+/* ta_xmpp_pool_* functions */
+
+static void
+ta_xmpp_pool_free (ta_xmpp_pool_t *pool)
+{
+  ta_xmpp_pool_stop (pool);
+  free (pool->ready);
+  free (pool->domain);
+  free (pool->host);
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->wake);
+  pthread_cond_destroy (&pool->available);
+}
+
+void
+ta_xmpp_pool_init (ta_xmpp_pool_t *pool, const char *domain, int warm)
+{
+  ta_object_init (TA_CAST_OBJECT (pool), (ta_free_func_t) ta_xmpp_pool_free);
+  pool->domain = strdup (domain);
+  pool->host = NULL;
+  pool->port = DEFAULT_PORT;
+  pool->delay = DEFAULT_DELAY;
+  pool->timeout = DEFAULT_TIMEOUT;
+  pool->max_idle = DEFAULT_MAX_IDLE;
+  pool->warm = warm > 0 ? warm : 1;
+  pool->ready = malloc (pool->warm * sizeof (struct warm_conn));
+  pool->nready = 0;
+  memset (&pool->stats, 0, sizeof (ta_xmpp_pool_stats_t));
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->wake, NULL);
+  pthread_cond_init (&pool->available, NULL);
+  pool->running = 0;
+}
+
+ta_xmpp_pool_t *
+ta_xmpp_pool_new (const char *domain, int warm)
+{
+  ta_xmpp_pool_t *pool;
+  pool = malloc (sizeof (ta_xmpp_pool_t));
+  ta_xmpp_pool_init (pool, domain, warm);
+  return pool;
+}
+
+void
+ta_xmpp_pool_set_host (ta_xmpp_pool_t *pool, const char *host, int port)
+{
+  pthread_mutex_lock (&pool->lock);
+  free (pool->host);
+  pool->host = host ? strdup (host) : NULL;
+  pool->port = port > 0 ? port : DEFAULT_PORT;
+  pthread_mutex_unlock (&pool->lock);
+}
+
+void
+ta_xmpp_pool_set_delay (ta_xmpp_pool_t *pool, int msecs)
+{
+  pool->delay = msecs > 0 ? msecs : DEFAULT_DELAY;
+}
+
+void
+ta_xmpp_pool_set_timeout (ta_xmpp_pool_t *pool, int msecs)
+{
+  pool->timeout = msecs > 0 ? msecs : DEFAULT_TIMEOUT;
+}
+
+void
+ta_xmpp_pool_set_max_idle (ta_xmpp_pool_t *pool, int msecs)
+{
+  pthread_mutex_lock (&pool->lock);
+  pool->max_idle = msecs > 0 ? msecs : DEFAULT_MAX_IDLE;
+  pthread_cond_signal (&pool->wake);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+int
+ta_xmpp_pool_start (ta_xmpp_pool_t *pool)
+{
+  int err;
+  pthread_mutex_lock (&pool->lock);
+  if (pool->running)
+    {
+      pthread_mutex_unlock (&pool->lock);
+      return TA_OK;
+    }
+  pool->running = 1;
+  if ((err = pthread_create (&pool->thread, NULL, _pool_run, pool)) != 0)
+    {
+      pool->running = 0;
+      pthread_mutex_unlock (&pool->lock);
+      ta_error_set (TA_XMPP_POOL_ERROR, "Could not start the pool: %s",
+                    strerror (err));
+      return TA_ERROR;
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return TA_OK;
+}
+
+void
+ta_xmpp_pool_stop (ta_xmpp_pool_t *pool)
+{
+  pthread_mutex_lock (&pool->lock);
+  if (!pool->running)
+    {
+      pthread_mutex_unlock (&pool->lock);
+      return;
+    }
+  pool->running = 0;
+  pthread_cond_signal (&pool->wake);
+  pthread_cond_broadcast (&pool->available);
+  pthread_mutex_unlock (&pool->lock);
+  pthread_join (pool->thread, NULL);
+
+  while (pool->nready)
+    close (pool->ready[--pool->nready].fd);
+}
+
+int
+ta_xmpp_pool_take_wait (ta_xmpp_pool_t *pool, int msecs)
+{
+  unsigned long deadline = ta_timer_now () + (msecs > 0 ? msecs : 0);
+  unsigned long now = 0;
+  int fd = -1;
+
+  pthread_mutex_lock (&pool->lock);
+  while (fd < 0)
+    {
+      while (pool->nready && fd < 0)
+        {
+          fd = pool->ready[--pool->nready].fd;
+          if (!_pool_conn_alive (fd))
+            {
+              close (fd);
+              fd = -1;
+              pool->stats.expired++;
+            }
+        }
+      if (fd >= 0 || !pool->running || msecs == 0
+          || (msecs > 0 && (now = ta_timer_now ()) >= deadline))
+        break;
+      if (msecs < 0)
+        pthread_cond_wait (&pool->available, &pool->lock);
+      else
+        _pool_wait (&pool->available, &pool->lock, deadline - now);
+    }
+
+  /* The pool thread makes a new one */
+  if (fd >= 0)
+    {
+      pool->stats.taken++;
+      pthread_cond_signal (&pool->wake);
+    }
+  pthread_mutex_unlock (&pool->lock);
+
+  if (fd < 0)
+    ta_error_set (TA_XMPP_POOL_ERROR, "No connection ready to %s",
+                  pool->domain);
+  return fd;
+}
+
+int
+ta_xmpp_pool_take (ta_xmpp_pool_t *pool)
+{
+  return ta_xmpp_pool_take_wait (pool, 0);
+}
+
+int
+ta_xmpp_pool_get_ready (ta_xmpp_pool_t *pool)
+{
+  int ready;
+  pthread_mutex_lock (&pool->lock);
+  ready = pool->nready;
+  pthread_mutex_unlock (&pool->lock);
+  return ready;
+}
+
+void
+ta_xmpp_pool_get_stats (ta_xmpp_pool_t *pool, ta_xmpp_pool_stats_t *stats)
+{
+  pthread_mutex_lock (&pool->lock);
+  *stats = pool->stats;
+  pthread_mutex_unlock (&pool->lock);
+}
@@ -0,0 +1,427 @@
+/* publisher.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iksemel.h>
+
+#include <taningia/error.h>
+#include <taningia/log.h>
+#include <taningia/publisher.h>
+
+#define DEFAULT_MAX_RETRIES 3
+
+/* An item waiting for room in the window or for an answer. `next'
+ * links the pending items and `sent_next' the ones waiting for an
+ * answer. The publisher of an item sent before the publisher was
+ * closed is NULL. */
+struct publish_item {
+  struct publish_item *next;
+  struct publish_item *sent_next;
+  ta_pubsub_publisher_t *publisher;
+  char *id;
+  iks *stanza;
+  iks *payload;
+  int retries;
+  ta_pubsub_publisher_cb_t callback;
+  void *data;
+};
+
+struct _ta_pubsub_publisher_t {
+  ta_object_t parent;
+  ta_xmpp_client_t *client;
+  char *from;
+  char *to;
+  int window;
+  int max_retries;
+  int in_flight;
+  int closed;
+  ta_log_t *log;
+
+  /* Items waiting for an answer */
+  struct publish_item *sent;
+
+  /* Items not sent yet, in the order they were published */
+  struct publish_item *pending_head;
+  struct publish_item *pending_tail;
+  int pending;
+};
+
+static void _ta_pubsub_publisher_dispatch (ta_pubsub_publisher_t *publisher);
+
+/* publish_item helpers */
+
+static void
+_item_free (struct publish_item *item)
+{
+  if (item->id)
+    free (item->id);
+  iks_delete (item->stanza);
+  iks_delete (item->payload);
+  free (item);
+}
+
+static void
+_item_push (ta_pubsub_publisher_t *publisher, struct publish_item *item)
+{
+  item->next = NULL;
+  if (publisher->pending_tail)
+    publisher->pending_tail->next = item;
+  else
+    publisher->pending_head = item;
+  publisher->pending_tail = item;
+  publisher->pending++;
+}
+
+static struct publish_item *
+_item_pop (ta_pubsub_publisher_t *publisher)
+{
+  struct publish_item *item = publisher->pending_head;
+  if (item == NULL)
+    return NULL;
+  if ((publisher->pending_head = item->next) == NULL)
+    publisher->pending_tail = NULL;
+  publisher->pending--;
+  return item;
+}
+
+static void
+_item_sent (ta_pubsub_publisher_t *publisher, struct publish_item *item)
+{
+  item->sent_next = publisher->sent;
+  publisher->sent = item;
+  publisher->in_flight++;
+}
+
+static void
+_item_answered (ta_pubsub_publisher_t *publisher, struct publish_item *item)
+{
+  struct publish_item **link;
+  for (link = &publisher->sent; *link; link = &(*link)->sent_next)
+    if (*link == item)
+      {
+        *link = item->sent_next;
+        break;
+      }
+  publisher->in_flight--;
+}
+
+/* Calls the user callback and releases the item */
+static void
+_item_done (struct publish_item *item, int status, iks *answer)
+{
+  if (item->callback)
+    item->callback (item->publisher, item->id, status, answer, item->data);
+  _item_free (item);
+}
+
+/* Errors worth trying again: requests that were not answered in time
+ * while the connection is still up and errors the server asks us to
+ * retry later. */
+static int
+_is_transient (ta_pubsub_publisher_t *publisher, iks *answer)
+{
+  char *type;
+  if (answer == NULL)
+    return ta_error_last_code () == TA_XMPP_TIMEOUT_ERROR &&
+      ta_xmpp_client_is_running (publisher->client) == TA_OK;
+  type = iks_find_attrib (iks_find (answer, "error"), "type");
+  return type != NULL && strcmp (type, "wait") == 0;
+}
+
+/* Called by the client when the server answers a publish request or
+ * when it times out. */
+static void
+_ta_pubsub_publisher_answer (ta_xmpp_client_t *TA_UNUSED(client),
+                             iks *answer, void *data)
+{
+  struct publish_item *item = (struct publish_item *) data;
+  ta_pubsub_publisher_t *publisher = item->publisher;
+  char *type;
+
+  /* The publisher was closed and already gave up on this item */
+  if (publisher == NULL)
+    {
+      _item_free (item);
+      return;
+    }
+
+  _item_answered (publisher, item);
+  type = answer ? iks_find_attrib (answer, "type") : NULL;
+
+  if (type != NULL && strcmp (type, "result") == 0)
+    _item_done (item, TA_OK, answer);
+  else if (item->retries < publisher->max_retries &&
+           _is_transient (publisher, answer))
+    {
+      item->retries++;
+      ta_log_warn (publisher->log, "Sending %s again (%d/%d)",
+                   item->id ? item->id : "(no id)", item->retries,
+                   publisher->max_retries);
+
+      /* Going to the end of the line, so the server gets a chance to
+       * recover before seeing this item again */
+      _item_push (publisher, item);
+    }
+  else
+    {
+      if (answer != NULL)
+        ta_error_set (TA_PUBSUB_PUBLISH_ERROR,
+                      "Server refused %s",
+                      item->id ? item->id : "(no id)");
+      _item_done (item, TA_ERROR, answer);
+    }
+
+  /* There is room for one more request now. The reference held by
+   * the answered request is released in the end because it might be
+   * the last one. */
+  _ta_pubsub_publisher_dispatch (publisher);
+  ta_object_unref (publisher);
+}
+
+/* Sends pending items while there is room in the window */
+static void
+_ta_pubsub_publisher_dispatch (ta_pubsub_publisher_t *publisher)
+{
+  struct publish_item *item;
+
+  while (publisher->in_flight < publisher->window &&
+         (item = _item_pop (publisher)) != NULL)
+    {
+      if (ta_xmpp_client_is_running (publisher->client) != TA_OK)
+        {
+          ta_error_set (XMPP_CONNECTION_ERROR, "Client not connected");
+          _item_done (item, TA_ERROR, NULL);
+          continue;
+        }
+
+      ta_object_ref (publisher);
+      _item_sent (publisher, item);
+      if (ta_xmpp_client_send_and_filter (publisher->client, item->stanza,
+                                          _ta_pubsub_publisher_answer,
+                                          item, NULL) != TA_OK)
+        {
+          _item_answered (publisher, item);
+          _item_done (item, TA_ERROR, NULL);
+          ta_object_unref (publisher);
+        }
+    }
+}
+
+/* ta_pubsub_publisher_t */
+
+static void
+ta_pubsub_publisher_free (ta_pubsub_publisher_t *publisher)
+{
+  struct publish_item *item;
+
+  /* Only items that were never sent can be here, answered requests
+   * hold a reference to the publisher. */
+  while ((item = _item_pop (publisher)) != NULL)
+    {
+      ta_error_set (TA_PUBSUB_PUBLISH_ERROR,
+                    "Publisher released before sending the item");
+      _item_done (item, TA_ERROR, NULL);
+    }
+  ta_object_unref (publisher->client);
+  free (publisher->from);
+  free (publisher->to);
+  ta_object_unref (publisher->log);
+}
+
+void
+ta_pubsub_publisher_init (ta_pubsub_publisher_t *publisher,
+                          ta_xmpp_client_t *client,
+                          const char *from,
+                          const char *to,
+                          int window)
+{
+  ta_object_init (TA_CAST_OBJECT (publisher),
+                  (ta_free_func_t) ta_pubsub_publisher_free);
+  publisher->client = ta_object_ref (client);
+  publisher->from = strdup (from);
+  publisher->to = strdup (to);
+  publisher->window = window < 1 ? 1 : window;
+  publisher->max_retries = DEFAULT_MAX_RETRIES;
+  publisher->in_flight = 0;
+  publisher->closed = 0;
+  publisher->sent = NULL;
+  publisher->log = ta_log_new ("pubsub-publisher");
+  publisher->pending_head = NULL;
+  publisher->pending_tail = NULL;
+  publisher->pending = 0;
+}
+
+ta_pubsub_publisher_t *
+ta_pubsub_publisher_new (ta_xmpp_client_t *client,
+                         const char *from,
+                         const char *to,
+                         int window)
+{
+  ta_pubsub_publisher_t *publisher;
+  publisher = malloc (sizeof (ta_pubsub_publisher_t));
+  ta_pubsub_publisher_init (publisher, client, from, to, window);
+  return publisher;
+}
+
+ta_log_t *
+ta_pubsub_publisher_get_logger (ta_pubsub_publisher_t *publisher)
+{
+  return publisher->log;
+}
+
+int
+ta_pubsub_publisher_get_window (ta_pubsub_publisher_t *publisher)
+{
+  return publisher->window;
+}
+
+void
+ta_pubsub_publisher_set_window (ta_pubsub_publisher_t *publisher, int window)
+{
+  publisher->window = window < 1 ? 1 : window;
+  _ta_pubsub_publisher_dispatch (publisher);
+}
+
+int
+ta_pubsub_publisher_get_max_retries (ta_pubsub_publisher_t *publisher)
+{
+  return publisher->max_retries;
+}
+
+void
+ta_pubsub_publisher_set_max_retries (ta_pubsub_publisher_t *publisher,
+                                     int retries)
+{
+  publisher->max_retries = retries;
+}
+
+int
+ta_pubsub_publisher_get_in_flight (ta_pubsub_publisher_t *publisher)
+{
+  return publisher->in_flight;
+}
+
+int
+ta_pubsub_publisher_get_pending (ta_pubsub_publisher_t *publisher)
+{
+  return publisher->pending;
+}
+
+void
+ta_pubsub_publisher_close (ta_pubsub_publisher_t *publisher)
+{
+  struct publish_item *item;
+
+  if (publisher->closed)
+    return;
+  publisher->closed = 1;
+
+  /* Protects the publisher from being freed by the loop below, it
+   * might only be alive because of the requests being dropped */
+  ta_object_ref (publisher);
+  while ((item = _item_pop (publisher)) != NULL)
+    {
+      ta_error_set (TA_PUBSUB_PUBLISH_ERROR,
+                    "Publisher closed before sending the item");
+      _item_done (item, TA_ERROR, NULL);
+    }
+
+  /* Requests waiting for an answer are left to the client, they
+   * release their items when they are answered or time out. */
+  while ((item = publisher->sent) != NULL)
+    {
+      _item_answered (publisher, item);
+      ta_error_set (TA_PUBSUB_PUBLISH_ERROR,
+                    "Publisher closed before %s was answered",
+                    item->id ? item->id : "(no id)");
+      if (item->callback)
+        item->callback (publisher, item->id, TA_ERROR, NULL, item->data);
+      item->callback = NULL;
+      item->publisher = NULL;
+      ta_object_unref (publisher);
+    }
+  ta_object_unref (publisher);
+}
+
+/* Queues a request built by the caller. `id' is what the callback
+ * receives. */
+static int
+_ta_pubsub_publisher_push (ta_pubsub_publisher_t *publisher,
+                           const char *id,
+                           iks *stanza,
+                           iks *payload,
+                           ta_pubsub_publisher_cb_t cb,
+                           void *data)
+{
+  struct publish_item *item;
+
+  if (publisher->closed)
+    {
+      iks_delete (stanza);
+      iks_delete (payload);
+      ta_error_set (TA_PUBSUB_PUBLISH_ERROR, "Publisher closed");
+      return TA_ERROR;
+    }
+
+  item = malloc (sizeof (struct publish_item));
+  item->publisher = publisher;
+  item->id = id ? strdup (id) : NULL;
+  item->stanza = stanza;
+  item->payload = payload;
+  item->retries = 0;
+  item->callback = cb;
+  item->data = data;
+
+  _item_push (publisher, item);
+  _ta_pubsub_publisher_dispatch (publisher);
+  return TA_OK;
+}
+
+int
+ta_pubsub_publisher_publish (ta_pubsub_publisher_t *publisher,
+                             const char *node,
+                             const char *id,
+                             iks *payload,
+                             ta_pubsub_publisher_cb_t cb,
+                             void *data)
+{
+  iks *stanza;
+
+  /* The payload is linked to the stanza but it lives in its own
+   * stack, that's why both are freed in the end. Retries send the
+   * same stanza again. */
+  stanza = ta_pubsub_node_publish_iks (publisher->from, publisher->to,
+                                       node, id, payload);
+  return _ta_pubsub_publisher_push (publisher, id, stanza, payload, cb,
+                                    data);
+}
+
+int
+ta_pubsub_publisher_create_node (ta_pubsub_publisher_t *publisher,
+                                 const char *node,
+                                 ta_pubsub_node_config_t *config,
+                                 ta_pubsub_publisher_cb_t cb,
+                                 void *data)
+{
+  iks *stanza;
+  stanza = ta_pubsub_node_create_with_config (publisher->from,
+                                              publisher->to, node, config);
+  return _ta_pubsub_publisher_push (publisher, node, stanza, NULL, cb,
+                                    data);
+}
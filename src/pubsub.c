@@ -21,8 +21,11 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
-#include <assert.h>
 
+#include <taningia/error.h>
+#include <taningia/idgen.h>
+#include <taningia/iri.h>
+#include <taningia/list.h>
 #include <taningia/pubsub.h>
 
 #define NS_INFO              "http://jabber.org/protocol/disco#info"
@@ -30,6 +33,20 @@
 #define NS_PS_CONFIG         "http://jabber.org/protocol/pubsub#node_config"
 #define NS_PS_OWNER          "http://jabber.org/protocol/pubsub#owner"
 #define NODE_SIZE_MAX        256 /* Max size of a node name */
+#define CONFIG_PREFIX        "pubsub#"
+
+/* Appends a string literal to a buffer without calling strlen() */
+#define CAT_LITERAL(b, s)    ta_buf_ncat ((b), (s), sizeof (s) - 1)
+
+/* Pieces of the publish stanza written by the `_buf' builders */
+#define PUBLISH_HEAD         "<iq type='set' from='"
+#define PUBLISH_TO           "' to='"
+#define PUBLISH_ID           "' id='"
+#define PUBLISH_NODE         "'><pubsub xmlns='" TA_PUBSUB_NS "'><publish node='"
+#define PUBLISH_ITEM         "'><item"
+#define PUBLISH_ITEM_ID      " id='"
+#define PUBLISH_ITEM_CLOSE   "'>"
+#define PUBLISH_TAIL         "</item></publish></pubsub></iq>"
 
 /* Generic help functions */
 
@@ -40,9 +57,8 @@ createiq (const char *from,
           const char *ns)
 {
   iks *iq;
-  char sid[32];
-  static int nid = 0;
-  snprintf (sid, 32, "query%d", nid++);
+  char sid[TA_IDGEN_ID_SIZE];
+  ta_idgen_next (ta_idgen_get_default (), sid);
   iq = iks_make_iq (type, ns);
   iks_insert_attrib (iq, "from", from);
   iks_insert_attrib (iq, "to", to);
@@ -54,10 +70,9 @@ static iks *
 createiqps (const char *from, const char *to, enum iksubtype type)
 {
   iks *iq;
-  char sid[32];
+  char sid[TA_IDGEN_ID_SIZE];
   char *t = NULL;
-  static int nid = 0;
-  snprintf (sid, 32, "ps%d", nid++);
+  ta_idgen_next (ta_idgen_get_default (), sid);
   iq = iks_new ("iq");
   switch (type) {
   case IKS_TYPE_GET: t = "get"; break;
@@ -74,6 +89,66 @@ createiqps (const char *from, const char *to, enum iksubtype type)
   return iq;
 }
 
+/* Appends `s' to the buffer escaping XML special chars. Runs of
+ * regular chars are copied at once. */
+static int
+_buf_cat_escaped (ta_buf_t *b, const char *s, int len)
+{
+  const char *start = s, *end = s + len, *entity;
+  int elen;
+
+  for (; s < end; s++)
+    {
+      switch (*s)
+        {
+        case '&': entity = "&amp;"; elen = 5; break;
+        case '<': entity = "&lt;"; elen = 4; break;
+        case '>': entity = "&gt;"; elen = 4; break;
+        case '\'': entity = "&apos;"; elen = 6; break;
+        case '"': entity = "&quot;"; elen = 6; break;
+        default: continue;
+        }
+      if (ta_buf_ncat (b, start, s - start) != TA_OK ||
+          ta_buf_ncat (b, entity, elen) != TA_OK)
+        return TA_ERROR;
+      start = s + 1;
+    }
+  return ta_buf_ncat (b, start, end - start);
+}
+
+static int
+_buf_cat_attrib (ta_buf_t *b, const char *s)
+{
+  return _buf_cat_escaped (b, s, strlen (s));
+}
+
+/* Writes everything but the payload and the tail of a publish
+ * stanza */
+static int
+_buf_publish_head (ta_buf_t *b,
+                   const char *sid,
+                   const char *from,
+                   const char *to,
+                   const char *node,
+                   const char *id)
+{
+  if (CAT_LITERAL (b, PUBLISH_HEAD) != TA_OK ||
+      _buf_cat_attrib (b, from) != TA_OK ||
+      CAT_LITERAL (b, PUBLISH_TO) != TA_OK ||
+      _buf_cat_attrib (b, to) != TA_OK ||
+      CAT_LITERAL (b, PUBLISH_ID) != TA_OK ||
+      _buf_cat_attrib (b, sid) != TA_OK ||
+      CAT_LITERAL (b, PUBLISH_NODE) != TA_OK ||
+      _buf_cat_attrib (b, node) != TA_OK)
+    return TA_ERROR;
+  if (id == NULL)
+    return CAT_LITERAL (b, PUBLISH_ITEM ">");
+  if (CAT_LITERAL (b, PUBLISH_ITEM PUBLISH_ITEM_ID) != TA_OK ||
+      _buf_cat_attrib (b, id) != TA_OK)
+    return TA_ERROR;
+  return CAT_LITERAL (b, PUBLISH_ITEM_CLOSE);
+}
+
 /* general stuff */
 
 iks *
@@ -189,6 +264,28 @@ ta_pubsub_node_items (const char *from,
   return iq;
 }
 
+iks *
+ta_pubsub_node_items_page (const char *from,
+                           const char *to,
+                           const char *node,
+                           int max,
+                           const char *after)
+{
+  iks *iq, *set;
+  char num[32];
+  iq = ta_pubsub_node_items (from, to, node, 0);
+  set = iks_insert (iks_child (iq), "set");
+  iks_insert_attrib (set, "xmlns", TA_RSM_NS);
+  if (max > 0)
+    {
+      snprintf (num, sizeof (num), "%d", max);
+      iks_insert_cdata (iks_insert (set, "max"), num, 0);
+    }
+  if (after)
+    iks_insert_cdata (iks_insert (set, "after"), after, 0);
+  return iq;
+}
+
 iks *
 ta_pubsub_node_publish_text (const char *from,
                              const char *to,
@@ -226,6 +323,122 @@ ta_pubsub_node_publish_iks (const char *from,
   return iq;
 }
 
+iks *
+ta_pubsub_node_publish_items (const char *from,
+                              const char *to,
+                              const char *node,
+                              const ta_pubsub_item_t *items,
+                              int count)
+{
+  iks *iq, *publish, *item;
+  int i;
+  iq = createiqps (from, to, IKS_TYPE_SET);
+  publish = iks_insert (iks_child (iq), "publish");
+  iks_insert_attrib (publish, "node", node);
+  for (i = 0; i < count; i++)
+    {
+      item = iks_insert (publish, "item");
+      if (items[i].id)
+        iks_insert_attrib (item, "id", items[i].id);
+      if (items[i].payload)
+        iks_insert_node (item, items[i].payload);
+    }
+  return iq;
+}
+
+int
+ta_pubsub_node_publish_text_buf (ta_buf_t *buf,
+                                 const char *sid,
+                                 const char *from,
+                                 const char *to,
+                                 const char *node,
+                                 const char *id,
+                                 const char *body,
+                                 int len)
+{
+  if (_buf_publish_head (buf, sid, from, to, node, id) != TA_OK ||
+      _buf_cat_escaped (buf, body, len > 0 ? len : (int) strlen (body))
+      != TA_OK)
+    return TA_ERROR;
+  return CAT_LITERAL (buf, PUBLISH_TAIL);
+}
+
+int
+ta_pubsub_node_publish_xml_buf (ta_buf_t *buf,
+                                const char *sid,
+                                const char *from,
+                                const char *to,
+                                const char *node,
+                                const char *id,
+                                const char *payload,
+                                int len)
+{
+  if (_buf_publish_head (buf, sid, from, to, node, id) != TA_OK ||
+      ta_buf_ncat (buf, payload, len > 0 ? len : (int) strlen (payload))
+      != TA_OK)
+    return TA_ERROR;
+  return CAT_LITERAL (buf, PUBLISH_TAIL);
+}
+
+/* Frees the nodes under `node' that were allocated in stacks other
+ * than `stack' */
+static void
+_iks_delete_foreign (iks *node, ikstack *stack)
+{
+  iks *child, *next;
+  for (child = iks_child (node); child; child = next)
+    {
+      next = iks_next (child);
+      if (iks_type (child) != IKS_TAG)
+        continue;
+      if (iks_stack (child) == stack)
+        _iks_delete_foreign (child, stack);
+      else
+        {
+          _iks_delete_foreign (child, iks_stack (child));
+          iks_delete (child);
+        }
+    }
+}
+
+/* Frees an iks tree built from many stacks, like the ones returned by
+ * `ta_atom_entry_to_iks()' */
+static void
+_iks_delete_all (iks *root)
+{
+  _iks_delete_foreign (root, iks_stack (root));
+  iks_delete (root);
+}
+
+iks *
+ta_pubsub_node_publish_feed (const char *from,
+                             const char *to,
+                             const char *node,
+                             ta_atom_feed_t *feed)
+{
+  iks *iq, *publish, *item, *entry;
+  ta_list_t *tmp;
+  char *id;
+  iq = createiqps (from, to, IKS_TYPE_SET);
+  publish = iks_insert (iks_child (iq), "publish");
+  iks_insert_attrib (publish, "node", node);
+  for (tmp = ta_atom_feed_get_entries (feed); tmp; tmp = tmp->next)
+    {
+      if ((entry = ta_atom_entry_to_iks (tmp->data)) == NULL)
+        continue;
+
+      /* Entries are copied to the stanza stack, so the whole thing
+       * can be freed with a single `iks_delete()' call */
+      item = iks_insert (publish, "item");
+      id = ta_iri_to_string (ta_atom_entry_get_id (tmp->data));
+      iks_insert_attrib (item, "id", id);
+      free (id);
+      iks_insert_node (item, iks_copy_within (entry, iks_stack (iq)));
+      _iks_delete_all (entry);
+    }
+  return iq;
+}
+
 iks *
 ta_pubsub_node_delete (const char *from, const char *to, const char *node)
 {
@@ -253,63 +466,202 @@ ta_pubsub_node_delete_item (const char *from,
   return iq;
 }
 
+/* Node configuration */
+
+struct _ta_pubsub_node_config_t {
+  ta_object_t parent;
+  iks *form;
+  int size;
+};
+
+/* Turns `form' into an empty node configuration form */
+static iks *
+_form_fill (iks *form)
+{
+  iks *field;
+  iks_insert_attrib (form, "xmlns", "jabber:x:data");
+  iks_insert_attrib (form, "type", "submit");
+  field = iks_insert (form, "field");
+  iks_insert_attrib (field, "var", "FORM_TYPE");
+  iks_insert_attrib (field, "type", "hidden");
+  iks_insert_cdata (iks_insert (field, "value"), NS_PS_CONFIG, 0);
+  return form;
+}
+
+static iks *
+_form_insert (iks *parent)
+{
+  return _form_fill (iks_insert (parent, "x"));
+}
+
+/* Adds the `pubsub#name' field to a configuration form. Returns
+ * TA_ERROR if the name is too long. */
+static int
+_form_add_field (iks *form, const char *name, const char *value)
+{
+  char var[NODE_SIZE_MAX];
+  size_t len = strlen (name);
+  iks *field;
+
+  if (len + sizeof (CONFIG_PREFIX) > sizeof (var))
+    return TA_ERROR;
+  memcpy (var, CONFIG_PREFIX, sizeof (CONFIG_PREFIX) - 1);
+  memcpy (var + sizeof (CONFIG_PREFIX) - 1, name, len + 1);
+  field = iks_insert (form, "field");
+  iks_insert_attrib (field, "var", var);
+  iks_insert_cdata (iks_insert (field, "value"), value, 0);
+  return TA_OK;
+}
+
+/* Builds a create request and returns its `<configure/>' element in
+ * `configure' */
+static iks *
+_create_iq (const char *from, const char *to, const char *node,
+            iks **configure)
+{
+  iks *iq, *create;
+  iq = createiqps (from, to, IKS_TYPE_SET);
+  create = iks_insert (iks_child (iq), "create");
+  if (node)
+    iks_insert_attrib (create, "node", node);
+  *configure = iks_insert (iks_child (iq), "configure");
+  return iq;
+}
+
+/* Adds a field of the form being built by `ta_pubsub_node_create' or
+ * `ta_pubsub_node_createv', creating it on the first call */
+static int
+_create_add_field (iks *configure, iks **form, const char *name,
+                   const char *value)
+{
+  /* Making sure that user didn't forget to build `pairs' of keys and
+   * vals */
+  if (value == NULL)
+    {
+      ta_error_set (TA_PUBSUB_CONFIG_ERROR,
+                    "Configuration field %s has no value", name);
+      return TA_ERROR;
+    }
+  if (*form == NULL)
+    *form = _form_insert (configure);
+  if (_form_add_field (*form, name, value) != TA_OK)
+    {
+      ta_error_set (TA_PUBSUB_CONFIG_ERROR,
+                    "Configuration field name too long: %s", name);
+      return TA_ERROR;
+    }
+  return TA_OK;
+}
+
+static void
+ta_pubsub_node_config_free (ta_pubsub_node_config_t *config)
+{
+  iks_delete (config->form);
+}
+
+void
+ta_pubsub_node_config_init (ta_pubsub_node_config_t *config)
+{
+  ta_object_init (TA_CAST_OBJECT (config),
+                  (ta_free_func_t) ta_pubsub_node_config_free);
+  config->form = _form_fill (iks_new ("x"));
+  config->size = 0;
+}
+
+ta_pubsub_node_config_t *
+ta_pubsub_node_config_new (void)
+{
+  ta_pubsub_node_config_t *config;
+  config = malloc (sizeof (ta_pubsub_node_config_t));
+  ta_pubsub_node_config_init (config);
+  return config;
+}
+
+int
+ta_pubsub_node_config_get_size (ta_pubsub_node_config_t *config)
+{
+  return config->size;
+}
+
+int
+ta_pubsub_node_config_add (ta_pubsub_node_config_t *config,
+                           const char *name,
+                           const char *value)
+{
+  if (name == NULL || *name == '\0' || value == NULL)
+    {
+      ta_error_set (TA_PUBSUB_CONFIG_ERROR,
+                    "Configuration fields need a name and a value");
+      return TA_ERROR;
+    }
+  if (_form_add_field (config->form, name, value) != TA_OK)
+    {
+      ta_error_set (TA_PUBSUB_CONFIG_ERROR,
+                    "Configuration field name too long: %s", name);
+      return TA_ERROR;
+    }
+  config->size++;
+  return TA_OK;
+}
+
+int
+ta_pubsub_node_config_add_params (ta_pubsub_node_config_t *config,
+                                  const char **params)
+{
+  int i;
+
+  /* Validating everything before touching the form */
+  for (i = 0; params[i] != NULL; i += 2)
+    if (params[i + 1] == NULL)
+      {
+        ta_error_set (TA_PUBSUB_CONFIG_ERROR,
+                      "Configuration field %s has no value", params[i]);
+        return TA_ERROR;
+      }
+  for (i = 0; params[i] != NULL; i += 2)
+    if (ta_pubsub_node_config_add (config, params[i],
+                                   params[i + 1]) != TA_OK)
+      return TA_ERROR;
+  return TA_OK;
+}
+
+iks *
+ta_pubsub_node_create_with_config (const char *from,
+                                   const char *to,
+                                   const char *node,
+                                   ta_pubsub_node_config_t *config)
+{
+  iks *iq, *configure;
+  iq = _create_iq (from, to, node, &configure);
+  if (config && config->size > 0)
+    iks_insert_node (configure, iks_copy_within (config->form,
+                                                 iks_stack (iq)));
+  return iq;
+}
+
 iks *
 ta_pubsub_node_create (const char *from,
                        const char *to,
                        const char *node,
                        ...)
 {
-  iks *iq, *create, *config, *form;
+  iks *iq, *configure, *form = NULL;
+  const char *name, *value;
   va_list args;
-  char *arg;
-  int nargs, nvals, i;
-  iq = createiqps (from, to, IKS_TYPE_SET);
-  create = iks_insert (iks_child (iq), "create");
-
-  if (node)
-    iks_insert_attrib (create, "node", node);
 
-  /* Building configuration */
-  form = NULL;
-  config = iks_insert (iks_child (iq), "configure");
-  nargs = nvals = i = 0;
+  iq = _create_iq (from, to, node, &configure);
   va_start (args, node);
-
-  /* Creating the dataform to hold config info */
-  while ((arg = va_arg (args, char *)) != NULL)
+  while ((name = va_arg (args, const char *)) != NULL)
     {
-      iks *field = NULL;
-      if (form == NULL)
-        {
-          iks *f;
-          form = iks_insert (config, "x");
-          iks_insert_attrib (form, "xmlns", "jabber:x:data");
-          iks_insert_attrib (form, "type", "submit");
-          f = iks_insert (form, "field");
-          iks_insert_attrib (f, "var", "FORM_TYPE");
-          iks_insert_attrib (f, "type", "hidden");
-          iks_insert_cdata (iks_insert (f, "value"), NS_PS_CONFIG, 0);
-        }
-      if (i % 2 == 0)           /* Handling args */
+      value = va_arg (args, const char *);
+      if (_create_add_field (configure, &form, name, value) != TA_OK)
         {
-          char fname[NODE_SIZE_MAX];
-          snprintf (fname, NODE_SIZE_MAX, "pubsub#%s", arg);
-          field = iks_insert (form, "field");
-          iks_insert_attrib (field, "var", fname);
-          nargs++;
+          iks_delete (iq);
+          iq = NULL;
+          break;
         }
-      else                      /* Handling vals */
-        {
-          iks_insert_cdata (iks_insert (field, "value"), arg, 0);
-          nvals++;
-        }
-      i++;
     }
   va_end (args);
-
-  /* Making sure that user didn't forget to build `pairs' of keys and
-   * vals */
-  assert (nargs == nvals);
   return iq;
 }
 
@@ -319,53 +671,287 @@ ta_pubsub_node_createv (const char *from,
                         const char *node,
                         const char **conf_params)
 {
-  iks *iq, *create, *config, *form;
-  const char *arg;
-  int nargs, nvals, i;
-  iq = createiqps (from, to, IKS_TYPE_SET);
-  create = iks_insert (iks_child (iq), "create");
+  iks *iq, *configure, *form = NULL;
+  int i;
 
-  if (node)
-    iks_insert_attrib (create, "node", node);
+  iq = _create_iq (from, to, node, &configure);
+  for (i = 0; conf_params && conf_params[i] != NULL; i += 2)
+    if (_create_add_field (configure, &form, conf_params[i],
+                           conf_params[i + 1]) != TA_OK)
+      {
+        iks_delete (iq);
+        return NULL;
+      }
+  return iq;
+}
 
-  /* Building configuration */
-  config = iks_insert (iks_child (iq), "configure");
-  form = NULL;
-  nargs = nvals = i = 0;
+/* Answer parsers */
 
-  /* Creating the dataform to hold config info */
-  while (conf_params && (arg = conf_params[i]) != NULL)
-    {
-      iks *field = NULL;
-      if (form == NULL)
+static const char *const _item_attribs[] = { "id", "publisher" };
+static const char *const _subscription_attribs[] =
+  { "node", "jid", "subid", "subscription" };
+static const char *const _affiliation_attribs[] =
+  { "node", "jid", "affiliation" };
+
+/* Reads the attributes named in `names' walking the attribute list of
+ * `x' only once. Missing attributes are set to NULL. */
+static void
+_read_attribs (iks *x, const char *const *names, const char **values,
+               int count)
+{
+  iks *attr;
+  int i;
+  for (i = 0; i < count; i++)
+    values[i] = NULL;
+  for (attr = iks_attrib (x); attr; attr = iks_next (attr))
+    for (i = 0; i < count; i++)
+      if (values[i] == NULL && strcmp (iks_name (attr), names[i]) == 0)
         {
-          iks *f;
-          form = iks_insert (config, "x");
-          iks_insert_attrib (form, "xmlns", "jabber:x:data");
-          iks_insert_attrib (form, "type", "submit");
-          f = iks_insert (form, "field");
-          iks_insert_attrib (f, "var", "FORM_TYPE");
-          iks_insert_attrib (f, "type", "hidden");
-          iks_insert_cdata (iks_insert (f, "value"), NS_PS_CONFIG, 0);
+          values[i] = iks_cdata (attr);
+          break;
         }
-      if (i % 2 == 0)           /* Handling args */
+}
+
+/* Returns the first child of `x' named `name' */
+static iks *
+_find_child (iks *x, const char *name)
+{
+  iks *child;
+  for (child = iks_first_tag (x); child; child = iks_next_tag (child))
+    if (strcmp (iks_name (child), name) == 0)
+      return child;
+  return NULL;
+}
+
+/* Returns the element named `name' inside the `<pubsub/>' element of
+ * an answer. The error is set when the server answered with an error
+ * or when there's no such element. */
+static iks *
+_find_answer_child (iks *answer, const char *name)
+{
+  iks *child;
+  char *type = iks_find_attrib (answer, "type");
+
+  if (type && strcmp (type, "error") == 0)
+    {
+      child = iks_first_tag (_find_child (answer, "error"));
+      ta_error_set (TA_PUBSUB_PARSING_ERROR,
+                    "Server answered with an error: %s",
+                    child ? iks_name (child) : "unknown");
+      return NULL;
+    }
+  if ((child = _find_child (_find_child (answer, "pubsub"), name)) == NULL)
+    ta_error_set (TA_PUBSUB_PARSING_ERROR, "No <%s> element found", name);
+  return child;
+}
+
+/* Fills an event for `item' and calls `cb' with it */
+static int
+_report_item (iks *item, ta_pubsub_event_type_t type, const char *node,
+              int flags, ta_pubsub_event_cb_t cb, void *data)
+{
+  ta_pubsub_event_t event;
+  const char *values[2];
+  int ret;
+
+  _read_attribs (item, _item_attribs, values, 2);
+  event.type = type;
+  event.node = node;
+  event.id = values[0];
+  event.publisher = values[1];
+  event.payload = iks_first_tag (item);
+  event.entry = NULL;
+
+  if ((flags & TA_PUBSUB_PARSE_ENTRIES) && event.payload &&
+      strcmp (iks_name (event.payload), "entry") == 0)
+    {
+      event.entry = ta_atom_entry_new (NULL);
+      if (!ta_atom_entry_set_from_iks (event.entry, event.payload))
         {
-          char fname[NODE_SIZE_MAX];
-          snprintf (fname, NODE_SIZE_MAX, "pubsub#%s", arg);
-          field = iks_insert (form, "field");
-          iks_insert_attrib (field, "var", fname);
-          nargs++;
+          /* Not an entry after all, only the payload is reported */
+          ta_error_clear ();
+          ta_object_unref (event.entry);
+          event.entry = NULL;
         }
-      else                      /* Handling vals */
+    }
+
+  ret = cb (&event, data);
+  if (event.entry)
+    ta_object_unref (event.entry);
+  return ret;
+}
+
+/* Reports the children of an `<items/>' element. Returns the number
+ * of events reported and sets `stop' when the callback asks to. */
+static int
+_report_items (iks *items, int flags, ta_pubsub_event_cb_t cb, void *data,
+               int *stop)
+{
+  iks *child;
+  const char *node, *name;
+  int count = 0;
+  ta_pubsub_event_type_t type;
+
+  node = iks_find_attrib (items, "node");
+  for (child = iks_first_tag (items); child && !*stop;
+       child = iks_next_tag (child))
+    {
+      name = iks_name (child);
+      if (strcmp (name, "item") == 0)
+        type = TA_PUBSUB_ITEM_PUBLISHED;
+      else if (strcmp (name, "retract") == 0)
+        type = TA_PUBSUB_ITEM_RETRACTED;
+      else
+        continue;
+      count++;
+      *stop = _report_item (child, type, node, flags, cb, data);
+    }
+  return count;
+}
+
+int
+ta_pubsub_parse_items (iks *answer,
+                       int flags,
+                       ta_pubsub_event_cb_t cb,
+                       void *data)
+{
+  iks *items;
+  int stop = 0;
+  if ((items = _find_answer_child (answer, "items")) == NULL)
+    return TA_ERROR;
+  return _report_items (items, flags, cb, data, &stop);
+}
+
+int
+ta_pubsub_parse_page (iks *answer, const char **last, int *count)
+{
+  iks *set, *child;
+  const char *name;
+
+  *last = NULL;
+  if (count)
+    *count = -1;
+  if ((set = _find_child (_find_child (answer, "pubsub"), "set")) == NULL)
+    return TA_ERROR;
+
+  for (child = iks_first_tag (set); child; child = iks_next_tag (child))
+    {
+      name = iks_name (child);
+      if (strcmp (name, "last") == 0)
+        *last = iks_cdata (iks_child (child));
+      else if (count && strcmp (name, "count") == 0 && iks_child (child))
+        *count = atoi (iks_cdata (iks_child (child)));
+    }
+  return TA_OK;
+}
+
+int
+ta_pubsub_parse_event (iks *message,
+                       int flags,
+                       ta_pubsub_event_cb_t cb,
+                       void *data)
+{
+  iks *event, *child;
+  const char *name;
+  int count = 0, stop = 0;
+  ta_pubsub_event_t node_event;
+
+  event = _find_child (message, "event");
+  if (event == NULL ||
+      iks_strcmp (iks_find_attrib (event, "xmlns"), TA_PUBSUB_EVENT_NS) != 0)
+    {
+      ta_error_set (TA_PUBSUB_PARSING_ERROR, "No pubsub event found");
+      return TA_ERROR;
+    }
+
+  for (child = iks_first_tag (event); child && !stop;
+       child = iks_next_tag (child))
+    {
+      name = iks_name (child);
+      if (strcmp (name, "items") == 0)
         {
-          iks_insert_cdata (iks_insert (field, "value"), arg, 0);
-          nvals++;
+          count += _report_items (child, flags, cb, data, &stop);
+          continue;
         }
-      i++;
+      else if (strcmp (name, "purge") == 0)
+        node_event.type = TA_PUBSUB_NODE_PURGED;
+      else if (strcmp (name, "delete") == 0)
+        node_event.type = TA_PUBSUB_NODE_DELETED;
+      else if (strcmp (name, "configuration") == 0)
+        node_event.type = TA_PUBSUB_NODE_CONFIGURED;
+      else
+        continue;
+
+      node_event.node = iks_find_attrib (child, "node");
+      node_event.id = NULL;
+      node_event.publisher = NULL;
+      node_event.payload = iks_first_tag (child);
+      node_event.entry = NULL;
+      count++;
+      stop = cb (&node_event, data);
     }
+  return count;
+}
 
-  /* Making sure that user didn't forget to build `pairs' of keys and
-   * vals */
-  assert (nargs == nvals);
-  return iq;
+int
+ta_pubsub_parse_subscriptions (iks *answer,
+                               ta_pubsub_subscription_cb_t cb,
+                               void *data)
+{
+  iks *subscriptions, *child;
+  const char *node, *values[4];
+  ta_pubsub_subscription_t subscription;
+  int count = 0;
+
+  subscriptions = _find_answer_child (answer, "subscriptions");
+  if (subscriptions == NULL)
+    return TA_ERROR;
+  node = iks_find_attrib (subscriptions, "node");
+
+  for (child = iks_first_tag (subscriptions); child;
+       child = iks_next_tag (child))
+    {
+      if (strcmp (iks_name (child), "subscription") != 0)
+        continue;
+      _read_attribs (child, _subscription_attribs, values, 4);
+      subscription.node = values[0] ? values[0] : node;
+      subscription.jid = values[1];
+      subscription.subid = values[2];
+      subscription.subscription = values[3];
+      count++;
+      if (cb (&subscription, data))
+        break;
+    }
+  return count;
+}
+
+int
+ta_pubsub_parse_affiliations (iks *answer,
+                              ta_pubsub_affiliation_cb_t cb,
+                              void *data)
+{
+  iks *affiliations, *child;
+  const char *node, *values[3];
+  ta_pubsub_affiliation_t affiliation;
+  int count = 0;
+
+  affiliations = _find_answer_child (answer, "affiliations");
+  if (affiliations == NULL)
+    return TA_ERROR;
+  node = iks_find_attrib (affiliations, "node");
+
+  for (child = iks_first_tag (affiliations); child;
+       child = iks_next_tag (child))
+    {
+      if (strcmp (iks_name (child), "affiliation") != 0)
+        continue;
+      _read_attribs (child, _affiliation_attribs, values, 3);
+      affiliation.node = values[0] ? values[0] : node;
+      affiliation.jid = values[1];
+      affiliation.affiliation = values[2];
+      count++;
+      if (cb (&affiliation, data))
+        break;
+    }
+  return count;
 }
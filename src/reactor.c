@@ -0,0 +1,712 @@
+/* reactor.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <taningia/error.h>
+#include <taningia/log.h>
+#include <taningia/list.h>
+#include <taningia/reactor.h>
+#include "atomic.h"
+#include "hashtable.h"
+
+/* Maximum amount of events read by each call to `epoll_wait()' */
+#define MAX_EVENTS 64
+
+/* A registered client. The event loop receives pointers to these
+ * entries from epoll, so they are only freed after dispatching all the
+ * events of an iteration. */
+struct reactor_entry {
+  ta_xmpp_client_t *client;
+  struct reactor_loop *loop;
+  int alive;
+
+  /* Tells registrations of the same client apart, a removal asked
+   * before the client was added again must not drop the new one */
+  unsigned long serial;
+};
+
+/* A removal asked by a hook running in another loop */
+struct reactor_removal {
+  ta_xmpp_client_t *client;
+  unsigned long serial;
+};
+
+struct reactor_loop {
+  ta_xmpp_reactor_t *reactor;
+  pthread_t thread;
+
+  /* Recursive, hooks called while dispatching events are allowed to
+   * add or remove clients. */
+  pthread_mutex_t lock;
+
+  int epfd;
+  int wakefd;
+  int dispatching;
+
+  struct reactor_entry **entries;
+  int count;
+  int size;
+
+  /* Entries removed while dispatching, freed in the end of the
+   * iteration */
+  ta_list_t *dead;
+
+  /* Clients that hooks running in other loops asked to remove. They
+   * can't wait for our lock while holding theirs, so the removal is
+   * done by this loop. `pending_lock' is never held while taking the
+   * lock of a loop. */
+  pthread_mutex_t pending_lock;
+  ta_list_t *removals;
+};
+
+struct _ta_xmpp_reactor_t {
+  ta_object_t parent;
+  struct reactor_loop *loops;
+  int nloops;
+  int running;
+  ta_log_t *log;
+
+  /* Entry of each registered client, so removals only touch the loop
+   * driving it. Changed with the lock of that loop held, but
+   * `owners_lock' is never held while taking the lock of a loop. */
+  pthread_mutex_t owners_lock;
+  hashtable_t *owners;
+  unsigned long next_serial;
+};
+
+/* The loop dispatching events in the current thread, if any. Each
+ * thread only sees its own value, so no locking is needed. */
+#ifdef TA_THREAD_LOCAL
+
+static TA_THREAD_LOCAL struct reactor_loop *_current_loop = NULL;
+
+static struct reactor_loop *
+_loop_current (void)
+{
+  return _current_loop;
+}
+
+static void
+_loop_set_current (struct reactor_loop *loop)
+{
+  _current_loop = loop;
+}
+
+#else
+
+static pthread_key_t _current_key;
+static pthread_once_t _current_once = PTHREAD_ONCE_INIT;
+
+static void
+_current_create (void)
+{
+  pthread_key_create (&_current_key, NULL);
+}
+
+static struct reactor_loop *
+_loop_current (void)
+{
+  pthread_once (&_current_once, _current_create);
+  return pthread_getspecific (_current_key);
+}
+
+static void
+_loop_set_current (struct reactor_loop *loop)
+{
+  pthread_once (&_current_once, _current_create);
+  pthread_setspecific (_current_key, loop);
+}
+
+#endif
+
+/* reactor_loop helpers */
+
+static void
+_loop_init (struct reactor_loop *loop, ta_xmpp_reactor_t *reactor)
+{
+  pthread_mutexattr_t attr;
+  struct epoll_event ev;
+
+  loop->reactor = reactor;
+  loop->dispatching = 0;
+  loop->entries = NULL;
+  loop->count = 0;
+  loop->size = 0;
+  loop->dead = NULL;
+  loop->removals = NULL;
+  pthread_mutex_init (&loop->pending_lock, NULL);
+
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&loop->lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+
+  /* The wake up descriptor is registered with a NULL pointer, that's
+   * how it is told apart from the clients. */
+  loop->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  loop->wakefd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->epfd < 0 || loop->wakefd < 0)
+    {
+      ta_log_error (reactor->log, "Failed to create event loop: %s",
+                    strerror (errno));
+      return;
+    }
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl (loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev);
+}
+
+/* Connected to the `connected' event of the clients. Clients that
+ * reconnect by themselves get a new descriptor that must be watched
+ * too, epoll forgot the old one when it was closed. */
+static int
+_loop_reconnected (ta_xmpp_client_t *client, void *TA_UNUSED(data),
+                   void *user_data)
+{
+  struct reactor_entry *entry = (struct reactor_entry *) user_data;
+  struct epoll_event ev;
+  int fd;
+
+  if ((fd = ta_xmpp_client_get_fd (client)) < 0)
+    return 0;
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = entry;
+  if (epoll_ctl (entry->loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0
+      && errno != EEXIST)
+    ta_log_error (entry->loop->reactor->log,
+                  "Failed to watch the new connection of %s: %s",
+                  ta_xmpp_client_get_jid (client), strerror (errno));
+  return 0;
+}
+
+static void
+_loop_reap (struct reactor_loop *loop)
+{
+  ta_list_t *tmp;
+  struct reactor_entry *entry;
+  for (tmp = loop->dead; tmp; tmp = tmp->next)
+    {
+      entry = (struct reactor_entry *) tmp->data;
+      ta_object_unref (entry->client);
+      free (entry);
+    }
+  ta_list_free (loop->dead);
+  loop->dead = NULL;
+}
+
+static void
+_loop_free (struct reactor_loop *loop)
+{
+  ta_list_t *tmp;
+  int i;
+  for (i = 0; i < loop->count; i++)
+    {
+      ta_xmpp_client_event_disconnect_id (loop->entries[i]->client,
+                                          TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                          _loop_reconnected);
+      ta_object_unref (loop->entries[i]->client);
+      free (loop->entries[i]);
+    }
+  free (loop->entries);
+  _loop_reap (loop);
+  for (tmp = loop->removals; tmp; tmp = tmp->next)
+    {
+      ta_object_unref (((struct reactor_removal *) tmp->data)->client);
+      free (tmp->data);
+    }
+  ta_list_free (loop->removals);
+  if (loop->epfd >= 0)
+    close (loop->epfd);
+  if (loop->wakefd >= 0)
+    close (loop->wakefd);
+  pthread_mutex_destroy (&loop->pending_lock);
+  pthread_mutex_destroy (&loop->lock);
+}
+
+static void
+_loop_wake (struct reactor_loop *loop)
+{
+  uint64_t one = 1;
+  ssize_t n = write (loop->wakefd, &one, sizeof (one));
+  (void) n;
+}
+
+/* Installed as the queue notifier of the clients, so stanzas enqueued
+ * from other threads wake up the loop driving their client. */
+static void
+_loop_notify (ta_xmpp_client_t *TA_UNUSED(client), void *data)
+{
+  _loop_wake ((struct reactor_loop *) data);
+}
+
+static int
+_loop_find (struct reactor_loop *loop, ta_xmpp_client_t *client)
+{
+  int i;
+  for (i = 0; i < loop->count; i++)
+    if (loop->entries[i]->client == client)
+      return i;
+  return -1;
+}
+
+static unsigned int
+_hash_pointer (const void *key)
+{
+  return (unsigned int) ((uintptr_t) key >> 4);
+}
+
+static int
+_pointer_equal (const void *key1, const void *key2)
+{
+  return key1 == key2;
+}
+
+/* Finds out which loop drives `client' and the serial of its entry.
+ * Returns NULL if it is not registered. */
+static struct reactor_loop *
+_reactor_owner (ta_xmpp_reactor_t *reactor, ta_xmpp_client_t *client,
+                unsigned long *serial)
+{
+  struct reactor_entry *entry;
+  struct reactor_loop *loop = NULL;
+  pthread_mutex_lock (&reactor->owners_lock);
+  if ((entry = hashtable_get (reactor->owners, client)) != NULL)
+    {
+      loop = entry->loop;
+      *serial = entry->serial;
+    }
+  pthread_mutex_unlock (&reactor->owners_lock);
+  return loop;
+}
+
+/* Removes the entry at the position `idx'. The last entry takes its
+ * place, so the order of the clients is not preserved. */
+static void
+_loop_drop (struct reactor_loop *loop, int idx)
+{
+  struct reactor_entry *entry = loop->entries[idx];
+  ta_xmpp_reactor_t *reactor = loop->reactor;
+  int fd;
+
+  pthread_mutex_lock (&reactor->owners_lock);
+  hashtable_del (reactor->owners, entry->client);
+  pthread_mutex_unlock (&reactor->owners_lock);
+
+  /* The descriptor might be already closed, in that case epoll have
+   * already forgotten about it. */
+  if ((fd = ta_xmpp_client_get_fd (entry->client)) >= 0)
+    epoll_ctl (loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+  ta_xmpp_client_set_queue_notify (entry->client, NULL, NULL);
+  ta_xmpp_client_event_disconnect_id (entry->client,
+                                      TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                      _loop_reconnected);
+
+  loop->entries[idx] = loop->entries[loop->count - 1];
+  ta_atomic_store (&loop->count, loop->count - 1);
+  entry->alive = 0;
+  loop->dead = ta_list_append (loop->dead, entry);
+  if (!loop->dispatching)
+    _loop_reap (loop);
+}
+
+/* Asks `loop' to remove the registration `serial' of `client' the
+ * next time it wakes up. Must be called with the lock of `loop'
+ * released. */
+static void
+_loop_defer_remove (struct reactor_loop *loop, ta_xmpp_client_t *client,
+                    unsigned long serial)
+{
+  struct reactor_removal *removal;
+  removal = malloc (sizeof (struct reactor_removal));
+  removal->client = ta_object_ref (client);
+  removal->serial = serial;
+  pthread_mutex_lock (&loop->pending_lock);
+  loop->removals = ta_list_append (loop->removals, removal);
+  pthread_mutex_unlock (&loop->pending_lock);
+  _loop_wake (loop);
+}
+
+/* Removes the clients that other loops asked to. Called with the lock
+ * of `loop' held. */
+static void
+_loop_remove_pending (struct reactor_loop *loop)
+{
+  struct reactor_removal *removal;
+  ta_list_t *removals, *tmp;
+  int idx;
+
+  pthread_mutex_lock (&loop->pending_lock);
+  removals = loop->removals;
+  loop->removals = NULL;
+  pthread_mutex_unlock (&loop->pending_lock);
+
+  for (tmp = removals; tmp; tmp = tmp->next)
+    {
+      removal = (struct reactor_removal *) tmp->data;
+      if ((idx = _loop_find (loop, removal->client)) >= 0 &&
+          loop->entries[idx]->serial == removal->serial)
+        _loop_drop (loop, idx);
+      ta_object_unref (removal->client);
+      free (removal);
+    }
+  ta_list_free (removals);
+}
+
+/* Finds out how long the loop can sleep without missing the deadline
+ * of any of its clients. Clients with stanzas waiting to be written
+ * don't let it sleep at all. */
+static int
+_loop_timeout (struct reactor_loop *loop)
+{
+  long timeout = -1, t;
+  int i;
+  for (i = 0; i < loop->count; i++)
+    {
+      if (ta_xmpp_client_get_io_events (loop->entries[i]->client) &
+          TA_XMPP_CLIENT_WANT_WRITE)
+        return 0;
+      t = ta_xmpp_client_get_timeout (loop->entries[i]->client);
+      if (t >= 0 && (timeout < 0 || t < timeout))
+        timeout = t;
+    }
+  return timeout > INT_MAX ? INT_MAX : (int) timeout;
+}
+
+static void
+_loop_process (struct reactor_loop *loop, struct reactor_entry *entry)
+{
+  int idx;
+  ta_xmpp_client_t *client = entry->client;
+
+  if (ta_xmpp_client_process (client, 0) == TA_OK &&
+      ta_xmpp_client_is_running (client) == TA_OK)
+    return;
+
+  /* A hook might have removed the client already */
+  if (entry->alive && (idx = _loop_find (loop, client)) >= 0)
+    {
+      ta_log_info (loop->reactor->log, "Dropping client %s",
+                   ta_xmpp_client_get_jid (client));
+      _loop_drop (loop, idx);
+    }
+}
+
+static int
+_loop_run (struct reactor_loop *loop)
+{
+  ta_xmpp_reactor_t *reactor = loop->reactor;
+  struct epoll_event events[MAX_EVENTS];
+  struct reactor_entry *entry;
+  uint64_t val;
+  ssize_t r;
+  int n, i, timeout;
+
+  while (ta_atomic_load (&reactor->running))
+    {
+      pthread_mutex_lock (&loop->lock);
+      _loop_remove_pending (loop);
+      timeout = _loop_timeout (loop);
+      pthread_mutex_unlock (&loop->lock);
+
+      if ((n = epoll_wait (loop->epfd, events, MAX_EVENTS, timeout)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          ta_log_error (reactor->log, "Event loop failed: %s",
+                        strerror (errno));
+          ta_error_set (TA_XMPP_REACTOR_ERROR, "Event loop failed: %s",
+                        strerror (errno));
+          return TA_ERROR;
+        }
+
+      pthread_mutex_lock (&loop->lock);
+      loop->dispatching = 1;
+      _loop_set_current (loop);
+      _loop_remove_pending (loop);
+
+      for (i = 0; i < n; i++)
+        {
+          if ((entry = events[i].data.ptr) == NULL)
+            {
+              r = read (loop->wakefd, &val, sizeof (val));
+              (void) r;
+              continue;
+            }
+          if (entry->alive)
+            _loop_process (loop, entry);
+        }
+
+      /* Expiring requests and writing the outbound queue of clients
+       * without network activity. The list is walked backwards because
+       * dropped clients are replaced by the last one. */
+      for (i = loop->count - 1; i >= 0; i--)
+        {
+          if (i >= loop->count)
+            continue;
+          entry = loop->entries[i];
+          if (ta_xmpp_client_get_timeout (entry->client) == 0 ||
+              (ta_xmpp_client_get_io_events (entry->client) &
+               TA_XMPP_CLIENT_WANT_WRITE))
+            _loop_process (loop, entry);
+        }
+
+      loop->dispatching = 0;
+      _loop_set_current (NULL);
+      _loop_reap (loop);
+      pthread_mutex_unlock (&loop->lock);
+    }
+  return TA_OK;
+}
+
+static void *
+_loop_thread (void *data)
+{
+  _loop_run ((struct reactor_loop *) data);
+  return NULL;
+}
+
+/* ta_xmpp_reactor_t */
+
+static void
+ta_xmpp_reactor_free (ta_xmpp_reactor_t *reactor)
+{
+  int i;
+  for (i = 0; i < reactor->nloops; i++)
+    _loop_free (&reactor->loops[i]);
+  free (reactor->loops);
+  hashtable_destroy (reactor->owners);
+  pthread_mutex_destroy (&reactor->owners_lock);
+  ta_object_unref (reactor->log);
+}
+
+void
+ta_xmpp_reactor_init (ta_xmpp_reactor_t *reactor, int nthreads)
+{
+  int i;
+  ta_object_init (TA_CAST_OBJECT (reactor),
+                  (ta_free_func_t) ta_xmpp_reactor_free);
+  reactor->log = ta_log_new ("xmpp-reactor");
+  reactor->running = 0;
+  reactor->owners = hashtable_create (_hash_pointer, _pointer_equal,
+                                      NULL, NULL);
+  reactor->next_serial = 0;
+  pthread_mutex_init (&reactor->owners_lock, NULL);
+  reactor->nloops = nthreads < 1 ? 1 : nthreads;
+  reactor->loops = malloc (sizeof (struct reactor_loop) * reactor->nloops);
+  for (i = 0; i < reactor->nloops; i++)
+    _loop_init (&reactor->loops[i], reactor);
+}
+
+ta_xmpp_reactor_t *
+ta_xmpp_reactor_new (int nthreads)
+{
+  ta_xmpp_reactor_t *reactor;
+  reactor = malloc (sizeof (ta_xmpp_reactor_t));
+  ta_xmpp_reactor_init (reactor, nthreads);
+  return reactor;
+}
+
+ta_log_t *
+ta_xmpp_reactor_get_logger (ta_xmpp_reactor_t *reactor)
+{
+  return reactor->log;
+}
+
+int
+ta_xmpp_reactor_add (ta_xmpp_reactor_t *reactor, ta_xmpp_client_t *client)
+{
+  struct reactor_loop *loop;
+  struct reactor_entry *entry;
+  struct epoll_event ev;
+  int i, fd;
+
+  if ((fd = ta_xmpp_client_get_fd (client)) < 0)
+    {
+      ta_error_set (TA_XMPP_REACTOR_ERROR, "Client %s is not connected",
+                    ta_xmpp_client_get_jid (client));
+      return TA_ERROR;
+    }
+  if (ta_xmpp_client_is_secure (client))
+    {
+      ta_error_set (TA_XMPP_REACTOR_ERROR,
+                    "Client %s uses TLS, reading it would block the loop",
+                    ta_xmpp_client_get_jid (client));
+      return TA_ERROR;
+    }
+
+  /* Clients added from hooks stay in the loop that is running the
+   * hook, so we never hold the lock of two loops at once. Otherwise,
+   * the least busy loop gets the new client. The counters are only a
+   * hint, they are read without taking the lock of each loop. */
+  loop = _loop_current ();
+  if (loop == NULL || loop->reactor != reactor)
+    {
+      loop = &reactor->loops[0];
+      for (i = 1; i < reactor->nloops; i++)
+        if (ta_atomic_load (&reactor->loops[i].count) <
+            ta_atomic_load (&loop->count))
+          loop = &reactor->loops[i];
+    }
+
+  entry = malloc (sizeof (struct reactor_entry));
+  entry->client = client;
+  entry->loop = loop;
+  entry->alive = 1;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = entry;
+
+  pthread_mutex_lock (&loop->lock);
+  pthread_mutex_lock (&reactor->owners_lock);
+  if (hashtable_get (reactor->owners, client) != NULL)
+    {
+      pthread_mutex_unlock (&reactor->owners_lock);
+      pthread_mutex_unlock (&loop->lock);
+      free (entry);
+      ta_error_set (TA_XMPP_REACTOR_ERROR, "Client %s is already registered",
+                    ta_xmpp_client_get_jid (client));
+      return TA_ERROR;
+    }
+  entry->serial = reactor->next_serial++;
+  hashtable_set (reactor->owners, client, entry);
+  pthread_mutex_unlock (&reactor->owners_lock);
+
+  ta_xmpp_client_set_queue_notify (client, _loop_notify, loop);
+  if (epoll_ctl (loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      ta_xmpp_client_set_queue_notify (client, NULL, NULL);
+      pthread_mutex_lock (&reactor->owners_lock);
+      hashtable_del (reactor->owners, client);
+      pthread_mutex_unlock (&reactor->owners_lock);
+      pthread_mutex_unlock (&loop->lock);
+      free (entry);
+      ta_error_set (TA_XMPP_REACTOR_ERROR, "Failed to register client: %s",
+                    strerror (errno));
+      return TA_ERROR;
+    }
+  if (loop->count == loop->size)
+    {
+      loop->size = loop->size ? loop->size * 2 : 16;
+      loop->entries = realloc (loop->entries,
+                               sizeof (struct reactor_entry *) * loop->size);
+    }
+  loop->entries[loop->count] = entry;
+  ta_atomic_store (&loop->count, loop->count + 1);
+  ta_object_ref (client);
+  ta_xmpp_client_event_connect_id (client, TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                   _loop_reconnected, entry);
+  pthread_mutex_unlock (&loop->lock);
+
+  /* The loop must recalculate its timeout */
+  _loop_wake (loop);
+  return TA_OK;
+}
+
+int
+ta_xmpp_reactor_remove (ta_xmpp_reactor_t *reactor, ta_xmpp_client_t *client)
+{
+  struct reactor_loop *loop, *current;
+  unsigned long serial;
+  int idx;
+
+  if ((loop = _reactor_owner (reactor, client, &serial)) == NULL)
+    {
+      ta_error_set (TA_XMPP_REACTOR_ERROR, "Client %s is not registered",
+                    ta_xmpp_client_get_jid (client));
+      return TA_ERROR;
+    }
+
+  /* A hook already holds the lock of its loop. Waiting for the lock
+   * of another one could deadlock with a hook of that loop doing the
+   * same, so a busy loop is asked to remove the client by itself
+   * instead. */
+  current = _loop_current ();
+  if (current == NULL || loop == current)
+    pthread_mutex_lock (&loop->lock);
+  else if (pthread_mutex_trylock (&loop->lock) != 0)
+    {
+      _loop_defer_remove (loop, client, serial);
+      return TA_OK;
+    }
+
+  /* The client might have been removed (or even added again) while
+   * the lock was not held */
+  if ((idx = _loop_find (loop, client)) < 0 ||
+      loop->entries[idx]->serial != serial)
+    {
+      pthread_mutex_unlock (&loop->lock);
+      ta_error_set (TA_XMPP_REACTOR_ERROR, "Client %s is not registered",
+                    ta_xmpp_client_get_jid (client));
+      return TA_ERROR;
+    }
+  _loop_drop (loop, idx);
+  pthread_mutex_unlock (&loop->lock);
+  return TA_OK;
+}
+
+int
+ta_xmpp_reactor_get_count (ta_xmpp_reactor_t *reactor)
+{
+  int i, count = 0;
+  for (i = 0; i < reactor->nloops; i++)
+    count += ta_atomic_load (&reactor->loops[i].count);
+  return count;
+}
+
+int
+ta_xmpp_reactor_run (ta_xmpp_reactor_t *reactor)
+{
+  int i, ret;
+
+  ta_atomic_store (&reactor->running, 1);
+  reactor->loops[0].thread = pthread_self ();
+  for (i = 1; i < reactor->nloops; i++)
+    pthread_create (&reactor->loops[i].thread, NULL, _loop_thread,
+                    &reactor->loops[i]);
+
+  ret = _loop_run (&reactor->loops[0]);
+
+  /* The first loop might have died because of an error, the others
+   * must follow it. */
+  ta_xmpp_reactor_stop (reactor);
+  for (i = 1; i < reactor->nloops; i++)
+    pthread_join (reactor->loops[i].thread, NULL);
+  return ret;
+}
+
+void
+ta_xmpp_reactor_stop (ta_xmpp_reactor_t *reactor)
+{
+  int i;
+  ta_atomic_store (&reactor->running, 0);
+  for (i = 0; i < reactor->nloops; i++)
+    _loop_wake (&reactor->loops[i]);
+}
@@ -19,62 +19,253 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <resolv.h>
 #include <arpa/nameser_compat.h>
+#include <taningia/common.h>
+#include <taningia/error.h>
 #include <taningia/list.h>
+#include <taningia/timer.h>
 #include <taningia/srv.h>
 
+#include "hashtable.h"
+#include "hashtable-utils.h"
+
+/* Servers are told through EDNS0 that we accept answers this big over
+ * UDP. Bigger ones come truncated and are asked again over TCP. */
+#define SRV_UDP_SIZE 4096
+
+/* Room for the question and the EDNS0 record of a query */
+#define SRV_QUERY_SIZE 512
+
+/* Default values of the resolver settings */
+#define SRV_TIMEOUT 2000
+#define SRV_ATTEMPTS 3
+#define SRV_NEGATIVE_TTL 60
+
+/* Records of an answer, kept in the cache */
+struct srv_record
+{
+  u_int32_t ttl;
+  u_int16_t _class;
+  u_int16_t priority;
+  u_int16_t weight;
+  u_int16_t port;
+  char *host;
+};
+
+struct srv_entry
+{
+  struct srv_record *records;
+  int count;
+  unsigned long expires;
+};
+
+struct srv_waiter
+{
+  ta_srv_callback_t callback;
+  void *data;
+  ta_list_t *targets;
+};
+
+/* A question sent to the name servers. Everybody asking for the same
+ * name while it is not answered waits for the same query. Relative
+ * names are tried with each domain of the search list, `names' holds
+ * the fully qualified names still to ask. */
+struct srv_query
+{
+  ta_srv_resolver_t *resolver;
+  char *key;
+  char *names[MAXDNSRCH + 2];
+  int nnames;
+  int name;
+  u_int16_t id;
+  int tries;
+  int server;
+  int len;
+  u_char packet[SRV_QUERY_SIZE];
+  ta_timer_t timer;
+  ta_list_t *waiters;
+};
+
+struct _ta_srv_resolver_t
+{
+  ta_object_t parent;
+  struct sockaddr_in6 servers[MAXNS]; /* IPv4 ones are kept mapped */
+  int nservers;
+  int next_server;
+  int rotate;
+  char *search[MAXDNSRCH + 1];
+  int ndots;
+  int family;
+  int fd;
+  int timeout;
+  int attempts;
+  int negative_ttl;
+  u_int16_t next_id;
+  unsigned int seed;
+  hashtable_t *cache;
+  hashtable_t *pending;
+  ta_timer_wheel_t *timers;
+  u_char answer[SRV_UDP_SIZE];
+};
+
 /* Forward declarations */
 
 ta_srv_target_t *ta_srv_target_new (void);
 void ta_srv_target_init (ta_srv_target_t *target);
 
+static void _srv_query_expired (ta_timer_t *timer, void *data);
+
+/* Used by `ta_srv_query_domain' */
+static ta_srv_resolver_t *_default_resolver = NULL;
+static pthread_mutex_t _default_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _default_answered = PTHREAD_COND_INITIALIZER;
+static int _default_polling = 0;
+
 /* ta_srv_* functions and their static dependencies */
 
 int
 ta_srv_init (void)
 {
+  /* The next query creates a resolver that knows the name servers
+   * just read */
+  pthread_mutex_lock (&_default_lock);
+  if (_default_resolver)
+    {
+      ta_object_unref (_default_resolver);
+      _default_resolver = NULL;
+    }
+  pthread_mutex_unlock (&_default_lock);
   return res_init ();
 }
 
 static int
-cmp_targets (ta_list_t *a, ta_list_t *b)
+_srv_cmp_targets (const void *a, const void *b)
 {
-  ta_srv_target_t *ta, *tb;
-  ta = (ta_srv_target_t *) a->data;
-  tb = (ta_srv_target_t *) b->data;
+  const ta_srv_target_t *ta = *(ta_srv_target_t * const *) a;
+  const ta_srv_target_t *tb = *(ta_srv_target_t * const *) b;
 
-  if (ta->priority == tb->priority)
-    return ta->weight - tb->weight;
-  else
+  /* Targets with weight equals to 0 go first in their priority, as
+   * the section "The format of the SRV RR" of the RFC 2782 asks */
+  if (ta->priority != tb->priority)
     return ta->priority - tb->priority;
+  return (ta->weight != 0) - (tb->weight != 0);
 }
 
-ta_list_t *
-ta_srv_query_domain (const char *name, const char *domain)
+/* Adds `value' to the weight of the element `i' of a Fenwick tree
+ * holding the prefix sums of the weights of `size' targets */
+static void
+_srv_tree_add (unsigned long *tree, int size, int i, long value)
 {
-  HEADER *message;
-  u_char answer[1024];
-  u_char *p, *end;
-  int len, count, priority;
-  ta_list_t *targets = NULL;
+  for (i++; i <= size; i += i & -i)
+    tree[i - 1] += value;
+}
 
-  /* Vars to apply the sorting algorithm */
-  int sum, num, randint, weight;
-  ta_srv_target_t *target;
-  ta_list_t *t = NULL, *out = NULL, *tail = NULL;
+/* Returns the first element whose prefix sum is at least `sum', that
+ * must be greater than zero */
+static int
+_srv_tree_find (unsigned long *tree, int size, unsigned long sum)
+{
+  int pos = 0, step;
+  for (step = 1; step * 2 <= size; step *= 2);
+  for (; step; step /= 2)
+    if (pos + step <= size && tree[pos + step - 1] < sum)
+      {
+        pos += step;
+        sum -= tree[pos - 1];
+      }
+  return pos;
+}
 
-  /* Values to be read for each target */
-  char buf[1024];
+/* Writes to `order' the targets of `sorted', already sorted with
+ * `_srv_cmp_targets', in the order they should be tried. Inside each
+ * priority the targets are picked at random giving precedence to the
+ * ones with higher weight. Picking and removing a target from the
+ * prefix sums takes O(log n). `tree' and `taken' are scratch space for
+ * `size' elements. */
+static void
+_srv_order_targets (ta_srv_target_t **sorted, ta_srv_target_t **order,
+                    int size, unsigned long *tree, char *taken,
+                    unsigned int *seed)
+{
+  ta_srv_target_t **group;
+  unsigned long sum, pick;
+  int lo, hi, n, i, j, first;
+
+  for (lo = 0; lo < size; lo = hi)
+    {
+      for (hi = lo; hi < size
+             && sorted[hi]->priority == sorted[lo]->priority; hi++);
+      group = sorted + lo;
+      n = hi - lo;
+
+      /* Prefix sums of the weights of this priority, built in O(n) */
+      sum = 0;
+      for (i = 0; i < n; i++)
+        {
+          tree[i] = group[i]->weight;
+          sum += tree[i];
+          taken[i] = 0;
+        }
+      for (i = 1; i <= n; i++)
+        if ((j = i + (i & -i)) <= n)
+          tree[j - 1] += tree[i - 1];
+
+      for (first = 0, j = 0; j < n; j++)
+        {
+          /* A random number between 0 and the sum of the weights left.
+           * Zero picks the first target left, which is one without
+           * weight if there is any. */
+          pick = (unsigned long) (((double) rand_r (seed)
+                                   / ((double) RAND_MAX + 1.0)) * (sum + 1));
+          if (pick == 0)
+            {
+              while (taken[first])
+                first++;
+              i = first;
+            }
+          else
+            i = _srv_tree_find (tree, n, pick);
+
+          *order++ = group[i];
+          taken[i] = 1;
+          _srv_tree_add (tree, n, i, -(long) group[i]->weight);
+          sum -= group[i]->weight;
+        }
+    }
+}
+
+/* Reads the SRV records of `answer'. Returns their number or -1 if
+ * the message is not valid. The smallest ttl found is stored in
+ * `ttl'. */
+static int
+_srv_parse (const u_char *answer, int len, struct srv_record **records,
+            u_int32_t *ttl)
+{
+  const HEADER *message;
+  const u_char *p, *end;
+  struct srv_record *rec;
+  int count, n, found = 0;
   u_int16_t type, rdlength;
+  char buf[1024];
 
-  len = res_querydomain (name, domain, C_IN, T_SRV, answer, sizeof (answer));
-  if (len <= 0)
-    return NULL;
+  *records = NULL;
+  *ttl = 0;
+  if (len < (int) sizeof (HEADER))
+    return -1;
 
   /* HEADER type defined in `arpa/nameser_compat.h'. See 4.1.1. Header
    * section format in RFC 1035. */
-  message = (HEADER *) answer;
+  message = (const HEADER *) answer;
 
   /* Finding bounds of received answer */
   p = answer + sizeof (HEADER);
@@ -82,101 +273,975 @@ ta_srv_query_domain (const char *name, const char *domain)
 
   /* We don't need to handle query section */
   count = ntohs (message->qdcount);
-  while (count-- && p < end)
+  while (count--)
     {
-      p += dn_expand (answer, end, p, buf, sizeof (buf));
-      p += 4;
+      if ((n = dn_skipname (p, end)) < 0 || p + n + 4 > end)
+        return -1;
+      p += n + 4;
     }
 
-  /* Reading the answer section that is what we really want */
   count = ntohs (message->ancount);
-  while (count-- && p < end)
-    {
-      ta_srv_target_t *t = ta_srv_target_new ();
+  if (count == 0)
+    return 0;
+  if ((*records = calloc (count, sizeof (struct srv_record))) == NULL)
+    return -1;
 
-      p += dn_expand (answer, end, p, buf, sizeof (buf));
+  /* Reading the answer section that is what we really want */
+  while (count--)
+    {
+      if ((n = dn_skipname (p, end)) < 0 || p + n + 10 > end)
+        goto invalid;
+      p += n;
+      rec = &(*records)[found];
       GETSHORT (type, p);
-      GETSHORT (t->_class, p);
-      GETLONG (t->ttl, p);
+      GETSHORT (rec->_class, p);
+      GETLONG (rec->ttl, p);
       GETSHORT (rdlength, p);
+      if (p + rdlength > end)
+        goto invalid;
 
       /* We're not interested in non IN SRV records */
-      if (type != T_SRV || t->_class != C_IN)
+      if (type != T_SRV || rec->_class != C_IN || rdlength < 7)
         {
           /* skipping to the next target */
           p += rdlength;
           continue;
         }
 
-      GETSHORT (t->priority, p);
-      GETSHORT (t->weight, p);
-      GETSHORT (t->port, p);
-      p += dn_expand (answer, end, p, buf, sizeof (buf));
-      t->host = strdup (buf);
-      targets = ta_list_append (targets, t);
-    }
-
-  /* Here we start to handle what the section "The format of the SRV
-   * RR" of the RFC 2782 says about the ordering of targets. Based on
-   * the priority and weight fields.
-   *
-   * In the first step, we just sort targets list by its priority
-   * putting targets with the same priority in the right order (lowers
-   * first) except the ones that has weight equals to 0. That are
-   * placed in the first positions. */
-  targets = ta_list_sort (targets, cmp_targets);
-
-  /* Now we'll group all targets with same priority respecting their
-   * weight attribute. */
-  while (targets)
-    {
-      priority = ((ta_srv_target_t *) targets->data)->priority;
-
-      /* As specified in the algorithm, in the first step, we need to
-       * sum the weight of all targets with the same priority and count
-       * them. */
-      sum = num = 0;
-      for (t = targets; t; t = t->next)
+      GETSHORT (rec->priority, p);
+      GETSHORT (rec->weight, p);
+      GETSHORT (rec->port, p);
+      if ((n = dn_expand (answer, end, p, buf, sizeof (buf))) < 0)
+        goto invalid;
+      p += rdlength - 6;
+      rec->host = strdup (buf);
+      if (found == 0 || rec->ttl < *ttl)
+        *ttl = rec->ttl;
+      found++;
+    }
+  return found;
+
+ invalid:
+  while (found--)
+    free ((*records)[found].host);
+  free (*records);
+  *records = NULL;
+  return -1;
+}
+
+/* Builds a new list of targets out of the records of an entry, in
+ * the order they should be tried */
+static ta_list_t *
+_srv_entry_targets (ta_srv_resolver_t *resolver, struct srv_entry *entry)
+{
+  ta_srv_target_t **sorted, **order, *t;
+  ta_list_t *targets = NULL;
+  unsigned long *tree;
+  char *taken;
+  int i, n = entry->count;
+
+  if (n == 0)
+    return NULL;
+  sorted = malloc (n * (2 * sizeof (ta_srv_target_t *)
+                        + sizeof (unsigned long) + 1));
+  order = sorted + n;
+  tree = (unsigned long *) (order + n);
+  taken = (char *) (tree + n);
+
+  for (i = 0; i < n; i++)
+    {
+      t = ta_srv_target_new ();
+      t->ttl = entry->records[i].ttl;
+      t->_class = entry->records[i]._class;
+      t->priority = entry->records[i].priority;
+      t->weight = entry->records[i].weight;
+      t->port = entry->records[i].port;
+      t->host = strdup (entry->records[i].host);
+      sorted[i] = t;
+    }
+  qsort (sorted, n, sizeof (ta_srv_target_t *), _srv_cmp_targets);
+  _srv_order_targets (sorted, order, n, tree, taken, &resolver->seed);
+
+  for (i = n - 1; i >= 0; i--)
+    targets = ta_list_prepend (targets, order[i]);
+  free (sorted);
+  return targets;
+}
+
+static void
+_srv_entry_free (struct srv_entry *entry)
+{
+  int i;
+  for (i = 0; i < entry->count; i++)
+    free (entry->records[i].host);
+  free (entry->records);
+  free (entry);
+}
+
+/* Names are case insensitive, so are the keys of the cache */
+static char *
+_srv_key (const char *name, const char *domain)
+{
+  char *key, *p;
+  size_t len = strlen (name);
+
+  if ((key = malloc (len + (domain ? strlen (domain) : 0) + 2)) == NULL)
+    return NULL;
+  memcpy (key, name, len + 1);
+  if (domain && *domain)
+    {
+      key[len] = '.';
+      strcpy (key + len + 1, domain);
+    }
+  for (p = key; *p; p++)
+    *p = tolower ((unsigned char) *p);
+  return key;
+}
+
+static struct srv_entry *
+_srv_cache_lookup (ta_srv_resolver_t *resolver, const char *key)
+{
+  struct srv_entry *entry;
+  if ((entry = hashtable_get (resolver->cache, key)) == NULL)
+    return NULL;
+  if (entry->expires > ta_timer_now ())
+    return entry;
+  hashtable_del (resolver->cache, key);
+  return NULL;
+}
+
+static void
+_srv_query_free (struct srv_query *query)
+{
+  ta_list_t *w;
+  int i;
+  for (w = query->waiters; w; w = w->next)
+    free (w->data);
+  ta_list_free (query->waiters);
+  for (i = 0; i < query->nnames; i++)
+    free (query->names[i]);
+  free (query->key);
+  free (query);
+}
+
+/* Removes a query from the resolver and tells everybody waiting for
+ * it about the answer. A NULL `entry' means that the query failed
+ * with the `error' code. */
+static void
+_srv_query_finish (struct srv_query *query, struct srv_entry *entry,
+                   int error)
+{
+  ta_srv_resolver_t *resolver = query->resolver;
+  struct srv_waiter *waiter;
+  ta_list_t *w;
+
+  ta_timer_wheel_cancel (resolver->timers, &query->timer);
+  hashtable_del (resolver->pending, query->key);
+
+  /* Targets are built before the callbacks run, they may ask for the
+   * same name again or clear the cache */
+  for (w = query->waiters; w; w = w->next)
+    {
+      waiter = (struct srv_waiter *) w->data;
+      waiter->targets = entry ? _srv_entry_targets (resolver, entry) : NULL;
+    }
+  if (entry && entry->expires > ta_timer_now ())
+    hashtable_set (resolver->cache, strdup (query->key), entry);
+  else if (entry)
+    _srv_entry_free (entry);
+
+  for (w = query->waiters; w; w = w->next)
+    {
+      waiter = (struct srv_waiter *) w->data;
+      waiter->callback (resolver, error, waiter->targets, waiter->data);
+    }
+  _srv_query_free (query);
+}
+
+/* Servers are kept as IPv6 addresses, IPv4 ones are mapped so all of
+ * them can be compared the same way */
+static int
+_srv_addr_map (const struct sockaddr *addr, struct sockaddr_in6 *out)
+{
+  const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+
+  if (addr->sa_family == AF_INET6)
+    {
+      memcpy (out, addr, sizeof (struct sockaddr_in6));
+      return TA_OK;
+    }
+  if (addr->sa_family != AF_INET)
+    return TA_ERROR;
+  memset (out, 0, sizeof (struct sockaddr_in6));
+  out->sin6_family = AF_INET6;
+  out->sin6_port = in->sin_port;
+  out->sin6_addr.s6_addr[10] = out->sin6_addr.s6_addr[11] = 0xff;
+  memcpy (&out->sin6_addr.s6_addr[12], &in->sin_addr, 4);
+  return TA_OK;
+}
+
+static int
+_srv_addr_parse (const char *address, int port, struct sockaddr_in6 *out)
+{
+  struct sockaddr_in in;
+
+  memset (out, 0, sizeof (struct sockaddr_in6));
+  out->sin6_family = AF_INET6;
+  out->sin6_port = htons (port > 0 ? port : NAMESERVER_PORT);
+  if (inet_pton (AF_INET6, address, &out->sin6_addr) == 1)
+    return TA_OK;
+
+  memset (&in, 0, sizeof (in));
+  in.sin_family = AF_INET;
+  in.sin_port = out->sin6_port;
+  if (inet_pton (AF_INET, address, &in.sin_addr) == 1)
+    return _srv_addr_map ((struct sockaddr *) &in, out);
+  ta_error_set (TA_SRV_QUERY_ERROR, "Invalid name server address %s",
+                address);
+  return TA_ERROR;
+}
+
+/* Gives the address of the server `index' in the family of the
+ * sockets of the resolver. Returns its length or 0 when that family
+ * can't reach the server. */
+static socklen_t
+_srv_server_addr (ta_srv_resolver_t *resolver, int index,
+                  struct sockaddr_storage *out)
+{
+  const struct sockaddr_in6 *server = &resolver->servers[index];
+  struct sockaddr_in *in = (struct sockaddr_in *) out;
+
+  memset (out, 0, sizeof (struct sockaddr_storage));
+  if (index >= resolver->nservers)
+    return 0;
+  if (resolver->family == AF_INET6)
+    {
+      memcpy (out, server, sizeof (struct sockaddr_in6));
+      return sizeof (struct sockaddr_in6);
+    }
+  if (!IN6_IS_ADDR_V4MAPPED (&server->sin6_addr))
+    return 0;
+  in->sin_family = AF_INET;
+  in->sin_port = server->sin6_port;
+  memcpy (&in->sin_addr, &server->sin6_addr.s6_addr[12], 4);
+  return sizeof (struct sockaddr_in);
+}
+
+static int
+_srv_is_server (ta_srv_resolver_t *resolver, const struct sockaddr *addr)
+{
+  struct sockaddr_in6 from;
+  int i;
+
+  if (_srv_addr_map (addr, &from) != TA_OK)
+    return 0;
+  for (i = 0; i < resolver->nservers; i++)
+    if (resolver->servers[i].sin6_port == from.sin6_port
+        && IN6_ARE_ADDR_EQUAL (&resolver->servers[i].sin6_addr,
+                               &from.sin6_addr))
+      return 1;
+  return 0;
+}
+
+/* IPv6 sockets reach IPv4 servers too, through mapped addresses */
+static int
+_srv_socket (int family, int type)
+{
+  int fd, off = 0;
+
+  if ((fd = socket (family, type | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+  if (family == AF_INET6
+      && setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof (off)) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* Sends the query to the next server. Servers that can't be reached
+ * are skipped, each of them counts as a try. */
+static int
+_srv_query_send (struct srv_query *query)
+{
+  ta_srv_resolver_t *resolver = query->resolver;
+  struct sockaddr_storage addr;
+  socklen_t len;
+  int error = EAFNOSUPPORT;
+
+  if (resolver->fd < 0)
+    {
+      resolver->family = AF_INET6;
+      resolver->fd = _srv_socket (AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK);
+      if (resolver->fd < 0)
+        {
+          resolver->family = AF_INET;
+          resolver->fd = _srv_socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK);
+        }
+      if (resolver->fd < 0)
         {
-          target = (ta_srv_target_t *) t->data;
+          ta_error_set (TA_SRV_QUERY_ERROR, "Could not create socket: %s",
+                        strerror (errno));
+          return TA_ERROR;
+        }
+    }
 
-          /* Since we have sorted the list by the priority. Higher
-           * priorities will be in the top. */
-          if (target->priority != priority)
-            break;
+  while (query->tries < resolver->attempts * resolver->nservers)
+    {
+      /* Retries go to the next server. The first one is always the
+       * same unless resolv.conf asks to rotate them. */
+      if (query->tries++ > 0)
+        query->server = (query->server + 1) % resolver->nservers;
+      else if (resolver->rotate)
+        {
+          query->server = resolver->next_server;
+          resolver->next_server = (query->server + 1) % resolver->nservers;
+        }
+      else
+        query->server = 0;
 
-          sum += target->weight;
-          num++;
+      if ((len = _srv_server_addr (resolver, query->server, &addr)) == 0)
+        continue;
+      if (sendto (resolver->fd, query->packet, query->len, 0,
+                  (struct sockaddr *) &addr, len) >= 0)
+        {
+          ta_timer_wheel_add (resolver->timers, &query->timer,
+                              ta_timer_now () + resolver->timeout);
+          return TA_OK;
         }
+      error = errno;
+    }
+  ta_error_set (TA_SRV_QUERY_ERROR, "Could not send query: %s",
+                strerror (error));
+  return TA_ERROR;
+}
+
+static void
+_srv_query_expired (ta_timer_t *TA_UNUSED(timer), void *data)
+{
+  struct srv_query *query = (struct srv_query *) data;
+
+  if (query->tries < query->resolver->attempts * query->resolver->nservers
+      && _srv_query_send (query) == TA_OK)
+    return;
+  ta_error_set (TA_SRV_TIMEOUT_ERROR, "No answer for %s", query->key);
+  _srv_query_finish (query, NULL, TA_SRV_TIMEOUT_ERROR);
+}
+
+/* Builds the packet asking for the current name of the query */
+static int
+_srv_query_pack (struct srv_query *query)
+{
+  HEADER *header;
+  u_char *p;
+  int len;
+
+  len = res_mkquery (QUERY, query->names[query->name], C_IN, T_SRV, NULL,
+                     0, NULL, query->packet, sizeof (query->packet) - 11);
+  if (len < 0)
+    {
+      ta_error_set (TA_SRV_QUERY_ERROR, "Invalid name %s",
+                    query->names[query->name]);
+      return TA_ERROR;
+    }
+
+  /* The EDNS0 OPT record telling the size of answers we accept. See
+   * section 6.1.2 of the RFC 6891. */
+  p = query->packet + len;
+  *p++ = 0;
+  PUTSHORT (T_OPT, p);
+  PUTSHORT (SRV_UDP_SIZE, p);
+  PUTLONG (0, p);
+  PUTSHORT (0, p);
+
+  query->len = p - query->packet;
+  query->id = query->resolver->next_id++;
+  query->tries = 0;
+  header = (HEADER *) query->packet;
+  header->id = htons (query->id);
+  header->arcount = htons (1);
+  return TA_OK;
+}
+
+static int
+_srv_query_add_name (struct srv_query *query, const char *name,
+                     const char *domain)
+{
+  char *full;
+  size_t len = strlen (name);
+
+  if ((full = malloc (len + (domain ? strlen (domain) : 0) + 2)) == NULL)
+    return TA_ERROR;
+  memcpy (full, name, len + 1);
+  if (domain)
+    {
+      full[len] = '.';
+      strcpy (full + len + 1, domain);
+    }
+  query->names[query->nnames++] = full;
+  return TA_OK;
+}
+
+/* Lists the names asked for `key' in the order res_search(3) would
+ * ask them. Names given with a domain are never searched. */
+static int
+_srv_query_names (struct srv_query *query, int relative)
+{
+  ta_srv_resolver_t *resolver = query->resolver;
+  const char *p;
+  int i, dots = 0, first;
+  size_t len = strlen (query->key);
+
+  if (!relative || (len > 0 && query->key[len - 1] == '.'))
+    {
+      if (_srv_query_add_name (query, query->key, NULL) != TA_OK)
+        return TA_ERROR;
+      /* Answers come without the trailing dot */
+      len = strlen (query->names[0]);
+      if (len > 1 && query->names[0][len - 1] == '.')
+        query->names[0][len - 1] = '\0';
+      return TA_OK;
+    }
+
+  for (p = query->key; *p; p++)
+    dots += *p == '.';
+  first = dots >= resolver->ndots;
+  if (first && _srv_query_add_name (query, query->key, NULL) != TA_OK)
+    return TA_ERROR;
+  for (i = 0; resolver->search[i]; i++)
+    if (_srv_query_add_name (query, query->key, resolver->search[i])
+        != TA_OK)
+      return TA_ERROR;
+  if (!first && _srv_query_add_name (query, query->key, NULL) != TA_OK)
+    return TA_ERROR;
+  return TA_OK;
+}
+
+static struct srv_query *
+_srv_query_new (ta_srv_resolver_t *resolver, char *key, int relative)
+{
+  struct srv_query *query;
 
-      /* Let's find a random target in this priority level giving
-       * precedence to the entries with higher weight. */
-      while (num)
+  if ((query = calloc (1, sizeof (struct srv_query))) == NULL)
+    return NULL;
+  query->key = key;
+  query->resolver = resolver;
+  ta_timer_init (&query->timer, _srv_query_expired, query);
+  if (_srv_query_names (query, relative) != TA_OK
+      || _srv_query_pack (query) != TA_OK)
+    {
+      query->key = NULL;
+      _srv_query_free (query);
+      return NULL;
+    }
+  return query;
+}
+
+static int
+_srv_io (int fd, void *buf, size_t len, int writing)
+{
+  ssize_t n;
+  size_t done = 0;
+  while (done < len)
+    {
+      if (writing)
+        n = send (fd, (char *) buf + done, len - done, MSG_NOSIGNAL);
+      else
+        n = recv (fd, (char *) buf + done, len - done, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return TA_ERROR;
+      done += n;
+    }
+  return TA_OK;
+}
+
+/* Asks again over TCP when the answer didn't fit in a datagram. The
+ * answer is read here, so this call blocks up to the resolver
+ * timeout. It should be rare, few names have that many targets. */
+static u_char *
+_srv_query_tcp (struct srv_query *query, int *len)
+{
+  ta_srv_resolver_t *resolver = query->resolver;
+  struct sockaddr_storage addr;
+  struct timeval tv;
+  u_char size[2], *answer = NULL;
+  socklen_t addrlen;
+  int fd;
+
+  /* The server that sent the truncated answer is asked */
+  addrlen = _srv_server_addr (resolver, query->server, &addr);
+  if (addrlen == 0 || (fd = _srv_socket (resolver->family, SOCK_STREAM)) < 0)
+    return NULL;
+  tv.tv_sec = resolver->timeout / 1000;
+  tv.tv_usec = (resolver->timeout % 1000) * 1000;
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+  size[0] = query->len >> 8;
+  size[1] = query->len & 0xff;
+  if (connect (fd, (struct sockaddr *) &addr, addrlen) < 0
+      || _srv_io (fd, size, 2, 1) != TA_OK
+      || _srv_io (fd, query->packet, query->len, 1) != TA_OK
+      || _srv_io (fd, size, 2, 0) != TA_OK)
+    goto out;
+
+  *len = (size[0] << 8) | size[1];
+  if ((answer = malloc (*len)) == NULL)
+    goto out;
+  if (_srv_io (fd, answer, *len, 0) != TA_OK)
+    {
+      free (answer);
+      answer = NULL;
+    }
+
+ out:
+  close (fd);
+  return answer;
+}
+
+/* Finds the query answered by a message. The question is compared
+ * too, so stray answers to old queries are ignored. */
+static struct srv_query *
+_srv_find_query (ta_srv_resolver_t *resolver, const u_char *answer, int len)
+{
+  const HEADER *header = (const HEADER *) answer;
+  struct srv_query *query;
+  char name[1024];
+  void *iter;
+
+  if (len < (int) sizeof (HEADER) || !header->qr
+      || ntohs (header->qdcount) != 1
+      || dn_expand (answer, answer + len, answer + sizeof (HEADER),
+                    name, sizeof (name)) < 0)
+    return NULL;
+
+  for (iter = hashtable_iter (resolver->pending); iter;
+       iter = hashtable_iter_next (resolver->pending, iter))
+    {
+      query = (struct srv_query *) hashtable_iter_value (iter);
+      if (query->id == ntohs (header->id)
+          && strcasecmp (query->names[query->name], name) == 0)
+        return query;
+    }
+  return NULL;
+}
+
+/* Asks for the next name of the search list */
+static void
+_srv_query_next (struct srv_query *query)
+{
+  ta_timer_wheel_cancel (query->resolver->timers, &query->timer);
+  query->name++;
+  if (_srv_query_pack (query) != TA_OK || _srv_query_send (query) != TA_OK)
+    _srv_query_finish (query, NULL, TA_SRV_QUERY_ERROR);
+}
+
+static void
+_srv_handle_answer (ta_srv_resolver_t *resolver, const u_char *answer,
+                    int len)
+{
+  const HEADER *header = (const HEADER *) answer;
+  struct srv_query *query;
+  struct srv_entry *entry;
+  u_char *full = NULL;
+  u_int32_t ttl;
+  int count, rcode;
+
+  if ((query = _srv_find_query (resolver, answer, len)) == NULL)
+    return;
+
+  if (header->tc)
+    {
+      if ((full = _srv_query_tcp (query, &len)) == NULL)
         {
-          randint = ((float) rand() / (float) RAND_MAX) * (sum+1);
-          for (t = targets; ; t = t->next)
-            {
-              weight = ((ta_srv_target_t *) t->data)->weight;
-              if (weight >= randint)
-                break;
-              randint -= weight;
-            }
+          ta_error_set (TA_SRV_QUERY_ERROR,
+                        "Could not read the answer for %s over TCP",
+                        query->key);
+          _srv_query_finish (query, NULL, TA_SRV_QUERY_ERROR);
+          return;
+        }
+      answer = full;
+      header = (const HEADER *) answer;
+    }
 
-          /* Here's the winner! Let's just set the `out' element and go
-           * ahead setting the new sum value and decreasing the number
-           * of targets. */
-          targets = ta_list_remove (targets, t->data, NULL);
-          if (!out)
-            out = t;
-          else
-            tail->next = t;
-          tail = t;
-          sum -= weight;
-          num--;
+  rcode = len >= (int) sizeof (HEADER) ? header->rcode : FORMERR;
+  if (rcode != NOERROR && rcode != NXDOMAIN)
+    {
+      ta_error_set (TA_SRV_QUERY_ERROR, "Server failed to answer %s (%d)",
+                    query->key, rcode);
+      _srv_query_finish (query, NULL, TA_SRV_QUERY_ERROR);
+      free (full);
+      return;
+    }
+
+  if ((entry = malloc (sizeof (struct srv_entry))) == NULL)
+    {
+      ta_error_set (TA_SRV_QUERY_ERROR, "Not enough memory");
+      _srv_query_finish (query, NULL, TA_SRV_QUERY_ERROR);
+      free (full);
+      return;
+    }
+  entry->records = NULL;
+  count = rcode == NXDOMAIN ? 0 : _srv_parse (answer, len, &entry->records,
+                                              &ttl);
+  free (full);
+  if (count < 0)
+    {
+      free (entry);
+      ta_error_set (TA_SRV_QUERY_ERROR, "Invalid answer for %s",
+                    query->key);
+      _srv_query_finish (query, NULL, TA_SRV_QUERY_ERROR);
+      return;
+    }
+  if (count == 0 && query->name + 1 < query->nnames)
+    {
+      free (entry->records);
+      free (entry);
+      _srv_query_next (query);
+      return;
+    }
+
+  /* Names without targets are remembered for a while too, so they
+   * aren't asked again on each reconnection attempt */
+  if (count == 0)
+    {
+      free (entry->records);
+      entry->records = NULL;
+      ttl = resolver->negative_ttl;
+    }
+  entry->count = count;
+  entry->expires = ta_timer_now () + ttl * 1000UL;
+  _srv_query_finish (query, entry, TA_OK);
+}
+
+/* ta_srv_resolver_* functions */
+
+static void
+ta_srv_resolver_free (ta_srv_resolver_t *resolver)
+{
+  void *iter;
+  int i;
+
+  /* Queries still waiting are failed, so their callers know */
+  while ((iter = hashtable_iter (resolver->pending)) != NULL)
+    {
+      ta_error_set (TA_SRV_QUERY_ERROR, "Resolver released");
+      _srv_query_finish (hashtable_iter_value (iter), NULL,
+                         TA_SRV_QUERY_ERROR);
+    }
+  hashtable_destroy (resolver->pending);
+  hashtable_destroy (resolver->cache);
+  ta_object_unref (resolver->timers);
+  for (i = 0; resolver->search[i]; i++)
+    free (resolver->search[i]);
+  if (resolver->fd >= 0)
+    close (resolver->fd);
+}
+
+/* Reads the name servers, the search list and the options of
+ * resolv.conf, as res_init(3) left them for this thread */
+static void
+_srv_resolver_configure (ta_srv_resolver_t *resolver)
+{
+  const struct sockaddr *addr;
+  int i;
+
+  if (!(_res.options & RES_INIT))
+    res_init ();
+
+  resolver->nservers = 0;
+  for (i = 0; i < _res.nscount && i < MAXNS; i++)
+    {
+      addr = (const struct sockaddr *) &_res.nsaddr_list[i];
+#ifdef __GLIBC__
+      /* glibc keeps IPv6 servers out of `nsaddr_list' */
+      if (addr->sa_family != AF_INET && _res._u._ext.nsaddrs[i])
+        addr = (const struct sockaddr *) _res._u._ext.nsaddrs[i];
+#endif
+      if (_srv_addr_map (addr, &resolver->servers[resolver->nservers])
+          == TA_OK)
+        resolver->nservers++;
+    }
+  if (resolver->nservers == 0)
+    _srv_addr_parse ("127.0.0.1", 0, &resolver->servers[resolver->nservers++]);
+
+  for (i = 0; i < MAXDNSRCH && _res.dnsrch[i]; i++)
+    resolver->search[i] = strdup (_res.dnsrch[i]);
+  resolver->search[i] = NULL;
+  resolver->ndots = _res.ndots;
+  resolver->rotate = (_res.options & RES_ROTATE) != 0;
+  resolver->timeout = _res.retrans > 0 ? _res.retrans * 1000 : SRV_TIMEOUT;
+  resolver->attempts = _res.retry > 0 ? _res.retry : SRV_ATTEMPTS;
+}
+
+void
+ta_srv_resolver_init (ta_srv_resolver_t *resolver)
+{
+  struct timeval tv;
+
+  ta_object_init (TA_CAST_OBJECT (resolver),
+                  (ta_free_func_t) ta_srv_resolver_free);
+  _srv_resolver_configure (resolver);
+
+  gettimeofday (&tv, NULL);
+  resolver->fd = -1;
+  resolver->family = AF_INET6;
+  resolver->next_server = 0;
+  resolver->negative_ttl = SRV_NEGATIVE_TTL;
+  resolver->next_id = (u_int16_t) (tv.tv_usec ^ (getpid () << 4));
+  resolver->seed = (unsigned int) (tv.tv_sec ^ tv.tv_usec ^ getpid ());
+  resolver->cache = hashtable_create (hash_string, string_equal, free,
+                                      (free_fn) _srv_entry_free);
+  resolver->pending = hashtable_create (hash_string, string_equal,
+                                        NULL, NULL);
+  resolver->timers = ta_timer_wheel_new (ta_timer_now ());
+}
+
+ta_srv_resolver_t *
+ta_srv_resolver_new (void)
+{
+  ta_srv_resolver_t *resolver = malloc (sizeof (ta_srv_resolver_t));
+  ta_srv_resolver_init (resolver);
+  return resolver;
+}
+
+int
+ta_srv_resolver_set_nameserver (ta_srv_resolver_t *resolver,
+                                const char *address, int port)
+{
+  struct sockaddr_in6 server;
+  if (_srv_addr_parse (address, port, &server) != TA_OK)
+    return TA_ERROR;
+  resolver->servers[0] = server;
+  resolver->nservers = 1;
+  resolver->next_server = 0;
+  return TA_OK;
+}
+
+int
+ta_srv_resolver_add_nameserver (ta_srv_resolver_t *resolver,
+                                const char *address, int port)
+{
+  if (resolver->nservers == MAXNS)
+    {
+      ta_error_set (TA_SRV_QUERY_ERROR, "Only %d name servers are used",
+                    MAXNS);
+      return TA_ERROR;
+    }
+  if (_srv_addr_parse (address, port,
+                       &resolver->servers[resolver->nservers]) != TA_OK)
+    return TA_ERROR;
+  resolver->nservers++;
+  return TA_OK;
+}
+
+void
+ta_srv_resolver_set_timeout (ta_srv_resolver_t *resolver, int msecs,
+                             int attempts)
+{
+  resolver->timeout = msecs > 0 ? msecs : SRV_TIMEOUT;
+  resolver->attempts = attempts > 0 ? attempts : 1;
+}
+
+void
+ta_srv_resolver_set_negative_ttl (ta_srv_resolver_t *resolver, int secs)
+{
+  resolver->negative_ttl = secs >= 0 ? secs : 0;
+}
+
+void
+ta_srv_resolver_clear_cache (ta_srv_resolver_t *resolver)
+{
+  void *iter;
+  while ((iter = hashtable_iter (resolver->cache)) != NULL)
+    hashtable_del (resolver->cache, hashtable_iter_key (iter));
+}
+
+int
+ta_srv_resolver_query_async (ta_srv_resolver_t *resolver, const char *name,
+                             const char *domain, ta_srv_callback_t callback,
+                             void *data)
+{
+  struct srv_waiter *waiter;
+  struct srv_entry *entry;
+  struct srv_query *query;
+  char *key;
+
+  if ((key = _srv_key (name, domain)) == NULL)
+    {
+      ta_error_set (TA_SRV_QUERY_ERROR, "Not enough memory");
+      return TA_ERROR;
+    }
+
+  /* Cached answers are given right away */
+  if ((entry = _srv_cache_lookup (resolver, key)) != NULL)
+    {
+      free (key);
+      callback (resolver, TA_OK, _srv_entry_targets (resolver, entry), data);
+      return TA_OK;
+    }
+
+  waiter = malloc (sizeof (struct srv_waiter));
+  waiter->callback = callback;
+  waiter->data = data;
+
+  /* Somebody already asked for this name */
+  if ((query = hashtable_get (resolver->pending, key)) != NULL)
+    {
+      free (key);
+      query->waiters = ta_list_append (query->waiters, waiter);
+      return TA_OK;
+    }
+
+  if ((query = _srv_query_new (resolver, key, !domain || !*domain)) == NULL)
+    {
+      free (key);
+      free (waiter);
+      return TA_ERROR;
+    }
+  query->waiters = ta_list_append (query->waiters, waiter);
+  if (_srv_query_send (query) != TA_OK)
+    {
+      _srv_query_free (query);
+      return TA_ERROR;
+    }
+  hashtable_set (resolver->pending, query->key, query);
+  return TA_OK;
+}
+
+int
+ta_srv_resolver_get_fd (ta_srv_resolver_t *resolver)
+{
+  return resolver->fd;
+}
+
+int
+ta_srv_resolver_get_pending (ta_srv_resolver_t *resolver)
+{
+  return (int) resolver->pending->size;
+}
+
+long
+ta_srv_resolver_next_timeout (ta_srv_resolver_t *resolver)
+{
+  return ta_timer_wheel_next_timeout (resolver->timers, ta_timer_now ());
+}
+
+int
+ta_srv_resolver_process (ta_srv_resolver_t *resolver)
+{
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+  ssize_t len;
+  int count = 0;
+
+  while (resolver->fd >= 0)
+    {
+      fromlen = sizeof (from);
+      len = recvfrom (resolver->fd, resolver->answer,
+                      sizeof (resolver->answer), 0,
+                      (struct sockaddr *) &from, &fromlen);
+      if (len < 0)
+        break;
+
+      /* Only the servers we ask can answer. Late answers to a try
+       * sent to another server are as good as the last one. */
+      if (!_srv_is_server (resolver, (struct sockaddr *) &from))
+        continue;
+      _srv_handle_answer (resolver, resolver->answer, len);
+      count++;
+    }
+  ta_timer_wheel_advance (resolver->timers, ta_timer_now ());
+  return count;
+}
+
+struct srv_result
+{
+  int done;
+  int error;
+  ta_list_t *targets;
+};
+
+static void
+_srv_query_done (ta_srv_resolver_t *TA_UNUSED(resolver), int error,
+                 ta_list_t *targets, void *data)
+{
+  struct srv_result *result = (struct srv_result *) data;
+  result->done = 1;
+  result->error = error;
+  result->targets = targets;
+}
+
+ta_list_t *
+ta_srv_resolver_query (ta_srv_resolver_t *resolver, const char *name,
+                       const char *domain)
+{
+  struct srv_result result = { 0, TA_OK, NULL };
+  struct pollfd pfd;
+
+  if (ta_srv_resolver_query_async (resolver, name, domain,
+                                   _srv_query_done, &result) != TA_OK)
+    return NULL;
+  while (!result.done)
+    {
+      pfd.fd = resolver->fd;
+      pfd.events = POLLIN;
+      if (poll (&pfd, 1, ta_srv_resolver_next_timeout (resolver)) < 0
+          && errno != EINTR)
+        break;
+      ta_srv_resolver_process (resolver);
+    }
+  return result.targets;
+}
+
+/* The lock is only held while the resolver is used. A single thread
+ * at a time waits on its socket without it, the others wait for that
+ * thread to read the answers, which may be theirs. */
+ta_list_t *
+ta_srv_query_domain (const char *name, const char *domain)
+{
+  struct srv_result result = { 0, TA_OK, NULL };
+  ta_srv_resolver_t *resolver;
+  struct pollfd pfd;
+  long timeout;
+
+  pthread_mutex_lock (&_default_lock);
+  if (!_default_resolver)
+    _default_resolver = ta_srv_resolver_new ();
+
+  /* `ta_srv_init' may replace the default resolver meanwhile */
+  resolver = ta_object_ref (_default_resolver);
+  if (ta_srv_resolver_query_async (resolver, name, domain,
+                                   _srv_query_done, &result) != TA_OK)
+    result.done = 1;
+  while (!result.done)
+    {
+      if (_default_polling)
+        {
+          pthread_cond_wait (&_default_answered, &_default_lock);
+          continue;
         }
+      _default_polling = 1;
+      pfd.fd = resolver->fd;
+      pfd.events = POLLIN;
+      timeout = ta_srv_resolver_next_timeout (resolver);
+      pthread_mutex_unlock (&_default_lock);
+      poll (&pfd, 1, timeout);
+      pthread_mutex_lock (&_default_lock);
+      ta_srv_resolver_process (resolver);
+      _default_polling = 0;
+      pthread_cond_broadcast (&_default_answered);
     }
+  ta_object_unref (resolver);
+  pthread_mutex_unlock (&_default_lock);
 
-  return out;
+  /* The answer may have been read by another thread */
+  if (result.error != TA_OK)
+    ta_error_set (result.error, "Could not resolve %s", name);
+  return result.targets;
 }
 
 /* ta_srv_target_* stuff */
@@ -247,3 +1312,90 @@ ta_srv_target_get_host (ta_srv_target_t *target)
 {
   return target->host;
 }
+
+/* ta_srv_target_set_* stuff */
+
+struct _ta_srv_target_set_t
+{
+  ta_object_t parent;
+  int size;
+  unsigned int seed;
+  ta_srv_target_t **sorted;
+  ta_srv_target_t **order;
+  unsigned long *tree;
+  char *taken;
+};
+
+static void
+ta_srv_target_set_free (ta_srv_target_set_t *set)
+{
+  int i;
+  for (i = 0; i < set->size; i++)
+    ta_object_unref (set->sorted[i]);
+  free (set->sorted);
+}
+
+void
+ta_srv_target_set_init (ta_srv_target_set_t *set, ta_list_t *targets)
+{
+  struct timeval tv;
+  ta_list_t *t;
+  int n = 0;
+
+  ta_object_init (TA_CAST_OBJECT (set),
+                  (ta_free_func_t) ta_srv_target_set_free);
+  for (t = targets; t; t = t->next)
+    n++;
+
+  /* A single block holds the targets and the scratch space of the
+   * shuffle, so shuffling never allocates memory */
+  set->size = n;
+  set->sorted = malloc (n * (2 * sizeof (ta_srv_target_t *)
+                             + sizeof (unsigned long) + 1) + 1);
+  set->order = set->sorted + n;
+  set->tree = (unsigned long *) (set->order + n);
+  set->taken = (char *) (set->tree + n);
+  for (n = 0, t = targets; t; t = t->next)
+    set->sorted[n++] = ta_object_ref (t->data);
+  qsort (set->sorted, n, sizeof (ta_srv_target_t *), _srv_cmp_targets);
+
+  gettimeofday (&tv, NULL);
+  set->seed = (unsigned int) (tv.tv_sec ^ tv.tv_usec ^ getpid ()
+                              ^ (unsigned long) set);
+  ta_srv_target_set_shuffle (set);
+}
+
+ta_srv_target_set_t *
+ta_srv_target_set_new (ta_list_t *targets)
+{
+  ta_srv_target_set_t *set = malloc (sizeof (ta_srv_target_set_t));
+  ta_srv_target_set_init (set, targets);
+  return set;
+}
+
+void
+ta_srv_target_set_set_seed (ta_srv_target_set_t *set, unsigned int seed)
+{
+  set->seed = seed;
+}
+
+void
+ta_srv_target_set_shuffle (ta_srv_target_set_t *set)
+{
+  _srv_order_targets (set->sorted, set->order, set->size, set->tree,
+                      set->taken, &set->seed);
+}
+
+int
+ta_srv_target_set_get_size (ta_srv_target_set_t *set)
+{
+  return set->size;
+}
+
+ta_srv_target_t *
+ta_srv_target_set_get (ta_srv_target_set_t *set, int index)
+{
+  if (index < 0 || index >= set->size)
+    return NULL;
+  return set->order[index];
+}
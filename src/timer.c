@@ -0,0 +1,333 @@
+/* timer.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <taningia/timer.h>
+
+#define ROOT_MASK     (TA_TIMER_ROOT_SIZE - 1)
+#define LEVEL_MASK    (TA_TIMER_LEVEL_SIZE - 1)
+
+/* Amount of bits to shift an expiration time to find its slot in the
+ * level `l' (starting from 1, the root level doesn't need it). */
+#define LEVEL_SHIFT(l) (TA_TIMER_ROOT_BITS + ((l) - 1) * TA_TIMER_LEVEL_BITS)
+
+/* Biggest distance from the wheel clock that a timer can be placed
+ * without being clamped to the last slot of the last level. */
+#define MAX_DELTA     ((1UL << LEVEL_SHIFT (TA_TIMER_WHEEL_LEVELS)) - 1)
+
+/* Comparing times this way keeps everything working when the clock
+ * wraps around. */
+#define TIME_AFTER(a, b) ((long) ((b) - (a)) < 0)
+
+/* Level value of timers that were removed from the wheel but still
+ * have to be fired by `ta_timer_wheel_flush()'. */
+#define DETACHED      TA_TIMER_WHEEL_LEVELS
+
+
+/* Timer list helpers */
+
+static void
+_timer_link (ta_timer_t **head, ta_timer_t *timer)
+{
+  timer->next = *head;
+  if (timer->next)
+    timer->next->pprev = &timer->next;
+  *head = timer;
+  timer->pprev = head;
+}
+
+static void
+_timer_unlink (ta_timer_wheel_t *wheel, ta_timer_t *timer)
+{
+  *timer->pprev = timer->next;
+  if (timer->next)
+    timer->next->pprev = timer->pprev;
+  timer->next = NULL;
+  timer->pprev = NULL;
+  if (timer->level != DETACHED)
+    {
+      wheel->level_count[timer->level]--;
+      wheel->count--;
+    }
+}
+
+/* Finds the right slot for a timer based on how far its expiration
+ * time is from the wheel clock. */
+static void
+_timer_place (ta_timer_wheel_t *wheel, ta_timer_t *timer,
+              unsigned long expires)
+{
+  unsigned long delta = expires - wheel->current;
+  ta_timer_t **head;
+  int level;
+
+  if (delta < TA_TIMER_ROOT_SIZE)
+    {
+      level = 0;
+      head = &wheel->root[expires & ROOT_MASK];
+    }
+  else
+    {
+      if (delta > MAX_DELTA)
+        expires = wheel->current + MAX_DELTA;
+      for (level = 1; level < TA_TIMER_WHEEL_LEVELS - 1; level++)
+        if (delta < (1UL << LEVEL_SHIFT (level + 1)))
+          break;
+      head = &wheel->levels[level - 1]
+        [(expires >> LEVEL_SHIFT (level)) & LEVEL_MASK];
+    }
+
+  timer->level = level;
+  _timer_link (head, timer);
+  wheel->level_count[level]++;
+  wheel->count++;
+}
+
+/* Called each time the clock crosses the boundary of the root
+ * level. Timers of the slot that is now current in the upper levels
+ * are redistributed to the lower ones. */
+static void
+_timer_cascade (ta_timer_wheel_t *wheel)
+{
+  ta_timer_t *timer;
+  ta_timer_t **head;
+  int level, idx;
+
+  for (level = 1; level < TA_TIMER_WHEEL_LEVELS; level++)
+    {
+      idx = (wheel->current >> LEVEL_SHIFT (level)) & LEVEL_MASK;
+      head = &wheel->levels[level - 1][idx];
+      while ((timer = *head) != NULL)
+        {
+          _timer_unlink (wheel, timer);
+          _timer_place (wheel, timer, timer->expires);
+        }
+
+      /* Upper levels only need to be touched when this one wraps. */
+      if (idx != 0)
+        break;
+    }
+}
+
+static int
+_timer_run_slot (ta_timer_wheel_t *wheel, ta_timer_t **head)
+{
+  ta_timer_t *timer;
+  int fired = 0;
+
+  /* Callbacks may add new timers, but never to the slot being run,
+   * since expired timers are always scheduled to the next tick. */
+  while ((timer = *head) != NULL)
+    {
+      _timer_unlink (wheel, timer);
+      timer->callback (timer, timer->data);
+      fired++;
+    }
+  return fired;
+}
+
+
+/* Public API */
+
+
+unsigned long
+ta_timer_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void
+ta_timer_init (ta_timer_t *timer, ta_timer_func_t callback, void *data)
+{
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->expires = 0;
+  timer->level = 0;
+  timer->callback = callback;
+  timer->data = data;
+}
+
+int
+ta_timer_is_pending (ta_timer_t *timer)
+{
+  return timer->pprev != NULL;
+}
+
+void
+ta_timer_wheel_init (ta_timer_wheel_t *wheel, unsigned long now)
+{
+  ta_object_init (TA_CAST_OBJECT (wheel), NULL);
+  wheel->current = now;
+  wheel->count = 0;
+  memset (wheel->level_count, 0, sizeof (wheel->level_count));
+  memset (wheel->root, 0, sizeof (wheel->root));
+  memset (wheel->levels, 0, sizeof (wheel->levels));
+}
+
+ta_timer_wheel_t *
+ta_timer_wheel_new (unsigned long now)
+{
+  ta_timer_wheel_t *wheel;
+  wheel = malloc (sizeof (ta_timer_wheel_t));
+  ta_timer_wheel_init (wheel, now);
+  return wheel;
+}
+
+void
+ta_timer_wheel_add (ta_timer_wheel_t *wheel, ta_timer_t *timer,
+                    unsigned long expires)
+{
+  if (ta_timer_is_pending (timer))
+    ta_timer_wheel_cancel (wheel, timer);
+
+  /* The slot of the current tick was already run, so the closest we
+   * can get from an expired deadline is the next tick. */
+  if (!TIME_AFTER (expires, wheel->current))
+    expires = wheel->current + 1;
+  timer->expires = expires;
+  _timer_place (wheel, timer, expires);
+}
+
+void
+ta_timer_wheel_cancel (ta_timer_wheel_t *wheel, ta_timer_t *timer)
+{
+  if (ta_timer_is_pending (timer))
+    _timer_unlink (wheel, timer);
+}
+
+int
+ta_timer_wheel_advance (ta_timer_wheel_t *wheel, unsigned long now)
+{
+  unsigned long next, tick;
+  int fired = 0;
+
+  while (TIME_AFTER (now, wheel->current))
+    {
+      /* Nothing to wait for, the clock can just jump */
+      if (wheel->count == 0)
+        {
+          wheel->current = now;
+          break;
+        }
+
+      /* Skipping empty slots of the root level up to its next
+       * boundary, where the upper levels must be cascaded. */
+      next = (wheel->current | ROOT_MASK) + 1;
+      if (wheel->level_count[0] > 0)
+        for (tick = wheel->current + 1; tick != next; tick++)
+          if (wheel->root[tick & ROOT_MASK] != NULL)
+            {
+              next = tick;
+              break;
+            }
+      if (TIME_AFTER (next, now))
+        {
+          wheel->current = now;
+          break;
+        }
+
+      wheel->current = next;
+      if ((wheel->current & ROOT_MASK) == 0)
+        _timer_cascade (wheel);
+      fired += _timer_run_slot (wheel,
+                                &wheel->root[wheel->current & ROOT_MASK]);
+    }
+  return fired;
+}
+
+long
+ta_timer_wheel_next_timeout (ta_timer_wheel_t *wheel, unsigned long now)
+{
+  unsigned long deadline = 0, base, candidate;
+  int found = 0, level, i;
+
+  if (wheel->count == 0)
+    return -1;
+
+  /* Timers in the root level have exact deadlines */
+  if (wheel->level_count[0] > 0)
+    for (i = 1; i <= TA_TIMER_ROOT_SIZE; i++)
+      if (wheel->root[(wheel->current + i) & ROOT_MASK] != NULL)
+        {
+          deadline = wheel->current + i;
+          found = 1;
+          break;
+        }
+
+  /* For the upper levels we only know when their slots are going to
+   * be cascaded, which is early enough. */
+  for (level = 1; level < TA_TIMER_WHEEL_LEVELS; level++)
+    {
+      if (wheel->level_count[level] == 0)
+        continue;
+      base = wheel->current >> LEVEL_SHIFT (level);
+      for (i = 1; i <= TA_TIMER_LEVEL_SIZE; i++)
+        if (wheel->levels[level - 1][(base + i) & LEVEL_MASK] != NULL)
+          {
+            candidate = (base + i) << LEVEL_SHIFT (level);
+            if (!found || TIME_AFTER (deadline, candidate))
+              deadline = candidate;
+            found = 1;
+            break;
+          }
+    }
+
+  if (!TIME_AFTER (deadline, now))
+    return 0;
+  if (deadline - now > LONG_MAX)
+    return LONG_MAX;
+  return (long) (deadline - now);
+}
+
+void
+ta_timer_wheel_flush (ta_timer_wheel_t *wheel)
+{
+  ta_timer_t *detached = NULL, *timer;
+  int i, level;
+
+  /* Moving everything to a local list first. Otherwise timers added
+   * by the callbacks would be fired too. */
+  for (i = 0; i < TA_TIMER_ROOT_SIZE; i++)
+    while ((timer = wheel->root[i]) != NULL)
+      {
+        _timer_unlink (wheel, timer);
+        timer->level = DETACHED;
+        _timer_link (&detached, timer);
+      }
+  for (level = 1; level < TA_TIMER_WHEEL_LEVELS; level++)
+    for (i = 0; i < TA_TIMER_LEVEL_SIZE; i++)
+      while ((timer = wheel->levels[level - 1][i]) != NULL)
+        {
+          _timer_unlink (wheel, timer);
+          timer->level = DETACHED;
+          _timer_link (&detached, timer);
+        }
+
+  _timer_run_slot (wheel, &detached);
+}
+
+int
+ta_timer_wheel_get_count (ta_timer_wheel_t *wheel)
+{
+  return wheel->count;
+}
@@ -17,20 +17,106 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include <iksemel.h>
 
+#include <taningia/common.h>
 #include <taningia/mem.h>
+#include <taningia/buf.h>
 #include <taningia/xmpp.h>
 #include <taningia/log.h>
-#include <taningia/list.h>
+#include <taningia/timer.h>
+#include <taningia/idgen.h>
 
-#include "hashtable.h"
-#include "hashtable-utils.h"
+#include "atomic.h"
+#ifdef HAVE_ZLIB
+# include "compress.h"
+#endif
+
+/* Time, in milliseconds, that a request sent with
+ * `ta_xmpp_client_send_and_filter()' waits for an answer */
+#define DEFAULT_REQUEST_TIMEOUT 30000
+
+/* Default maximum number of stanzas in the outbound queue */
+#define DEFAULT_QUEUE_LIMIT 4096
+
+/* Queued stanzas are written when this many bytes are accumulated */
+#define QUEUE_BATCH_SIZE 65536
+
+/* Namespace of XEP-0198, Stream Management */
+#define NS_SM "urn:xmpp:sm:3"
+
+/* Namespaces of XEP-0138, Stream Compression */
+#define NS_COMPRESS "http://jabber.org/protocol/compress"
+#define NS_FEATURE_COMPRESS "http://jabber.org/features/compress"
+
+/* The server is asked to acknowledge what it received after this many
+ * stanzas are sent or after this many milliseconds */
+#define DEFAULT_ACK_STANZAS 16
+#define DEFAULT_ACK_DELAY 1000
+
+/* Default number of unacknowledged stanzas kept to be sent again */
+#define DEFAULT_REPLAY_LIMIT 1024
+
+/* Buffers of the replay ring bigger than this are not reused */
+#define SM_SLOT_KEEP 4096
+
+/* Clients that lose their connection while the pool has none ready
+ * ask it again every POOL_POLL_INTERVAL milliseconds, for at most
+ * POOL_WAIT milliseconds */
+#define POOL_POLL_INTERVAL 50
+#define POOL_WAIT 5000
+
+/* Stream management states. While resuming, stanzas are held until the
+ * server confirms that the stream was resumed. */
+enum sm_state {
+  SM_OFF,
+  SM_ENABLING,
+  SM_ON,
+  SM_RESUMING
+};
+
+struct hook_data {
+  ta_xmpp_client_hook_t hook;
+  void *data;
+};
+
+/* Hooks of an event, kept contiguous so calling them doesn't chase
+ * pointers. Hooks disconnected while the event is being dispatched
+ * are only marked (their `hook' becomes NULL) and `dead' is set, the
+ * vector is compacted once the outermost dispatch is over. */
+struct hook_vector {
+  struct hook_data *hooks;
+  int count;
+  int size;
+  int dispatching;
+  int dead;
+};
+
+/* A slot of the replay ring */
+struct sm_slot {
+  char *data;
+  size_t len;
+  size_t size;
+};
 
+/* A serialized stanza waiting in the outbound queue */
+struct queue_node {
+  struct queue_node *next;
+  char *data;
+  int len;
+};
 
 struct _ta_xmpp_client_t {
   ta_object_t parent;
@@ -53,14 +139,97 @@ struct _ta_xmpp_client_t {
 
   ta_log_t *log;
 
-  hashtable_t *events;
+  /* Hooks of each event, indexed by `ta_xmpp_client_event_t' */
+  struct hook_vector events[TA_XMPP_CLIENT_EVENT_LAST];
+
+  /* Deadlines of requests waiting for an answer */
+  ta_timer_wheel_t *timers;
+  int request_timeout;
+
+  /* Ids of the stanzas that don't have one */
+  ta_idgen_t *idgen;
+
+  /* Outbound queue. Any thread can push to `queue_tail' and update
+   * the counters, `queue_head' and `queue_buf' belong to the thread
+   * running the loop. */
+  struct queue_node *queue_head;
+  struct queue_node *queue_tail;
+  struct queue_node queue_stub;
+  ta_buf_t queue_buf;
+  int queue_depth;
+  int queue_limit;
+  int queue_max_depth;
+  unsigned long queue_enqueued;
+  unsigned long queue_rejected;
+  unsigned long queue_written;
+  unsigned long queue_writes;
+  ta_xmpp_client_notify_func_t queue_notify;
+  void *queue_notify_data;
+
+  /* Used by the default queue notifier to wake up the loop */
+  int wakefds[2];
+
+  /* Socket given to `ta_xmpp_client_connect_fd', iksemel doesn't
+   * close the ones it didn't create */
+  int fd;
+
+  /* Gives a new connection when the current one breaks */
+  ta_xmpp_pool_t *pool;
+
+  /* Reconnection, see `ta_xmpp_client_set_reconnect()' */
+  int reconnect_min;
+  int reconnect_max;
+  int reconnect_limit;
+  int reconnect_attempts;
+  unsigned int reconnect_seed;
+  ta_timer_t reconnect_timer;
+  struct xmpp_dial *dial;
+
+  /* Waiting for the pool, see `_ta_xmpp_client_recover()' */
+  ta_timer_t pool_timer;
+  unsigned long pool_deadline;
+
+  /* Stream management. The counters wrap around at 2^32, like the
+   * ones of the server. `sm_first' is the number of the oldest
+   * stanza in the ring, the ones before it were acknowledged or
+   * dropped from the full ring. */
+  int use_sm;
+  int sm_supported;
+  enum sm_state sm_state;
+  char *sm_id;
+  unsigned int sm_inbound;
+  unsigned int sm_outbound;
+  unsigned int sm_acked;
+  unsigned int sm_first;
+  int sm_unrequested;
+  int ack_stanzas;
+  int ack_delay;
+  ta_timer_t sm_ack_timer;
+  struct sm_slot *sm_ring;
+  unsigned int sm_ring_size;
+  unsigned int sm_ring_start;
+  unsigned int sm_ring_count;
+  int sm_ring_limit;
+  unsigned long sm_sent;
+  unsigned long sm_acked_total;
+  unsigned long sm_replayed;
+  unsigned long sm_overwritten;
+  unsigned long sm_requests;
+
+  /* Stream compression, see `ta_xmpp_client_set_compression()'. The
+   * compressor is the socket of the iksemel transport, it lives as
+   * long as the connection. `compress_fd' is the socket that the
+   * transport adopts instead of opening a new one. */
+  int compress_level;
+  ta_xmpp_compress_flush_t compress_flush;
+  int compress_offered;
+  ta_xmpp_client_compress_stats_t compress_stats;
+#ifdef HAVE_ZLIB
+  ta_compress_t *compress;
+  int compress_fd;
+#endif
 };
 
-struct hook_data {
-  ta_xmpp_client_hook_t hook;
-  void *data;
-  ta_free_func_t free_data_func;
-};
 
 struct watch_data {
   char *stanza_id;
@@ -69,6 +238,23 @@ struct watch_data {
   ta_xmpp_client_answer_cb_t callback;
   void *data;
   ta_free_func_t free_data_func;
+  ta_timer_t timer;
+};
+
+/* Reconnection attempts that can't use a warm connection of the pool
+ * dial in a thread of their own, so the loop driving the client never
+ * waits for name lookups nor for connect(2). The thread and the client
+ * hold a reference each, the client adopts the socket once `done' is
+ * set or forgets the dial by clearing `client'. */
+struct xmpp_dial {
+  pthread_mutex_t lock;
+  int refs;
+  ta_xmpp_client_t *client;
+  char *host;
+  int port;
+  int fd;
+  int error;
+  int done;
 };
 
 /* Prototypes of some local functions */
@@ -77,27 +263,28 @@ static int _ta_xmpp_client_hook   (void *data, int type, iks *node);
 
 static int _ta_xmpp_client_do_run (void *user_data);
 
-/* hook_data helpers */
+static int _ta_xmpp_client_check_recv (ta_xmpp_client_t *client, int err);
 
-static struct hook_data *
-hdata_new (ta_xmpp_client_hook_t hook, void *data, ta_free_func_t free_data)
-{
-  struct hook_data *hdata;
-  hdata = malloc (sizeof (struct hook_data));
-  hdata->hook = hook;
-  hdata->data = data;
-  hdata->free_data_func = free_data;
-  return hdata;
-}
+static void _ta_xmpp_client_watch_expired (ta_timer_t *timer, void *data);
 
-static void
-hdata_free (void *val)
-{
-  struct hook_data *hdata = (struct hook_data *) val;
-  if (hdata->free_data_func)
-    hdata->free_data_func (hdata->data);
-  free (hdata);
-}
+static void _ta_xmpp_client_queue_clear (ta_xmpp_client_t *client);
+
+static void _ta_xmpp_client_reconnect_expired (ta_timer_t *timer, void *data);
+
+static void _ta_xmpp_client_pool_expired (ta_timer_t *timer, void *data);
+
+static void _ta_xmpp_client_dial_cancel (ta_xmpp_client_t *client);
+
+/* Names of the events, indexed by `ta_xmpp_client_event_t' */
+static const char *event_names[TA_XMPP_CLIENT_EVENT_LAST] = {
+  "connected",
+  "authenticated",
+  "authentication-failed",
+  "message-received",
+  "presence-noticed",
+  "resumed",
+  "acked"
+};
 
 /* watch_data helpers */
 
@@ -114,6 +301,7 @@ wdata_new (const char *stanza_id, ta_xmpp_client_t *client,
   wdata->data = data;
   wdata->free_data_func = free_data;
   wdata->rule = NULL;           /* Must be filled by hand. */
+  ta_timer_init (&wdata->timer, _ta_xmpp_client_watch_expired, wdata);
   return wdata;
 }
 
@@ -128,22 +316,323 @@ wdata_free (void *val)
   free (wdata);
 }
 
-/* Look for an entry called `event' in the client event hash table and
- * then executes all hooks added to the list in that entry. If a hook
- * returns a true value, the iteration is stopped. */
+/* Outbound queue helpers. This is the intrusive MPSC queue described
+ * by Dmitry Vyukov: producers only exchange the tail pointer and then
+ * link the previous node to the new one, the consumer walks from the
+ * head. The stub node keeps the queue from ever being really empty. */
+
+static void
+_queue_push (ta_xmpp_client_t *client, struct queue_node *node)
+{
+  struct queue_node *prev;
+  node->next = NULL;
+  prev = ta_atomic_exchange (&client->queue_tail, node);
+  ta_atomic_store (&prev->next, node);
+}
+
+/* Returns NULL when the queue is empty or when a producer exchanged
+ * the tail but did not link its node yet. */
+static struct queue_node *
+_queue_pop (ta_xmpp_client_t *client)
+{
+  struct queue_node *head = client->queue_head;
+  struct queue_node *next = ta_atomic_load (&head->next);
+
+  if (head == &client->queue_stub)
+    {
+      if (next == NULL)
+        return NULL;
+      client->queue_head = head = next;
+      next = ta_atomic_load (&next->next);
+    }
+  if (next != NULL)
+    {
+      client->queue_head = next;
+      return head;
+    }
+  if (head != ta_atomic_load (&client->queue_tail))
+    return NULL;
+
+  /* `head' is the last node, the stub is pushed back so it can be
+   * detached. */
+  _queue_push (client, &client->queue_stub);
+  if ((next = ta_atomic_load (&head->next)) != NULL)
+    {
+      client->queue_head = next;
+      return head;
+    }
+  return NULL;
+}
+
+/* Pops a node and releases the place it reserved in the queue. Never
+ * waits: a node whose producer did not finish linking it is left for
+ * the next call, its place is still counted in the depth. */
+static struct queue_node *
+_queue_take (ta_xmpp_client_t *client)
+{
+  struct queue_node *node;
+  if ((node = _queue_pop (client)) != NULL)
+    ta_atomic_sub (&client->queue_depth, 1);
+  return node;
+}
+
+static void
+_queue_node_free (struct queue_node *node)
+{
+  iks_free (node->data);
+  free (node);
+}
+
+/* Stream management helpers. Sent stanzas are kept in a ring until
+ * the server acknowledges them. Each slot keeps its buffer after being
+ * released, so a client sending stanzas of similar sizes stops
+ * allocating memory once the ring is warm. */
+
+static void
+_sm_slot_release (struct sm_slot *slot)
+{
+  if (slot->size > SM_SLOT_KEEP)
+    {
+      free (slot->data);
+      slot->data = NULL;
+      slot->size = 0;
+    }
+  slot->len = 0;
+}
+
+/* Releases the oldest stanza of the ring */
+static void
+_sm_pop (ta_xmpp_client_t *client)
+{
+  _sm_slot_release (&client->sm_ring[client->sm_ring_start]);
+  client->sm_ring_start = (client->sm_ring_start + 1) &
+    (client->sm_ring_size - 1);
+  client->sm_ring_count--;
+  client->sm_first++;
+}
+
+/* Replaces the ring by one with room for `limit' stanzas, rounded up
+ * to a power of two. The oldest stanzas are lost if they don't fit. */
+static void
+_sm_ring_resize (ta_xmpp_client_t *client, int limit)
+{
+  struct sm_slot *ring;
+  unsigned int size = 1, i, old;
+
+  while ((int) size < limit)
+    size <<= 1;
+  while (client->sm_ring_count > size)
+    {
+      _sm_pop (client);
+      client->sm_overwritten++;
+    }
+
+  ring = calloc (size, sizeof (struct sm_slot));
+  old = client->sm_ring_size;
+  for (i = 0; i < old; i++)
+    {
+      struct sm_slot *slot =
+        &client->sm_ring[(client->sm_ring_start + i) & (old - 1)];
+      if (i < client->sm_ring_count)
+        ring[i] = *slot;
+      else
+        free (slot->data);
+    }
+  free (client->sm_ring);
+  client->sm_ring = ring;
+  client->sm_ring_size = size;
+  client->sm_ring_start = 0;
+}
+
+/* Keeps a copy of a sent stanza until the server acknowledges it. When
+ * the ring is full the oldest stanza is dropped, it can't be sent
+ * again anymore. */
+static void
+_sm_track (ta_xmpp_client_t *client, const char *data, size_t len)
+{
+  struct sm_slot *slot;
+
+  if (client->sm_ring == NULL)
+    _sm_ring_resize (client, client->sm_ring_limit);
+  if (client->sm_ring_count == client->sm_ring_size)
+    {
+      ta_log_debug (client->log, "Replay buffer full, dropping stanza %u",
+                    client->sm_first);
+      _sm_pop (client);
+      client->sm_overwritten++;
+    }
+
+  slot = &client->sm_ring[(client->sm_ring_start + client->sm_ring_count) &
+                          (client->sm_ring_size - 1)];
+  if (slot->size < len + 1)
+    {
+      slot->data = realloc (slot->data, len + 1);
+      slot->size = len + 1;
+    }
+  memcpy (slot->data, data, len);
+  slot->data[len] = '\0';
+  slot->len = len;
+
+  client->sm_ring_count++;
+  client->sm_outbound++;
+  client->sm_unrequested++;
+  client->sm_sent++;
+}
+
+/* Forgets the stanzas acknowledged by the `h' value received from the
+ * server. Returns how many stanzas were acknowledged. */
+static unsigned int
+_sm_ack (ta_xmpp_client_t *client, unsigned int h)
+{
+  unsigned int count = h - client->sm_acked;
+
+  if (count > client->sm_outbound - client->sm_acked)
+    {
+      ta_log_warn (client->log, "Server acknowledged %u stanzas but only "
+                   "%u are waiting", count,
+                   client->sm_outbound - client->sm_acked);
+      count = client->sm_outbound - client->sm_acked;
+    }
+  client->sm_acked += count;
+  client->sm_acked_total += count;
+  while (client->sm_ring_count > 0 &&
+         (int) (client->sm_acked - client->sm_first) > 0)
+    _sm_pop (client);
+  return count;
+}
+
+/* Forgets all the stanzas of the ring */
+static void
+_sm_forget (ta_xmpp_client_t *client)
+{
+  while (client->sm_ring_count > 0)
+    _sm_pop (client);
+  client->sm_acked = client->sm_first = client->sm_outbound;
+}
+
+/* Asks the server to acknowledge what it received. Unless `force' is
+ * set, the request is only sent when a batch is complete, otherwise
+ * the batch timer is started. */
+static void
+_sm_request (ta_xmpp_client_t *client, int force)
+{
+  int batch;
+
+  if (client->parser == NULL || client->sm_unrequested == 0
+      || client->sm_state == SM_OFF || client->sm_state == SM_RESUMING)
+    return;
+
+  /* Never waiting for more stanzas than half of the ring holds */
+  batch = client->sm_ring_size / 2;
+  if (client->ack_stanzas > 0 && client->ack_stanzas < batch)
+    batch = client->ack_stanzas;
+  if (!force && client->sm_unrequested < batch)
+    {
+      if (client->ack_delay > 0 &&
+          !ta_timer_is_pending (&client->sm_ack_timer))
+        ta_timer_wheel_add (client->timers, &client->sm_ack_timer,
+                            ta_timer_now () + client->ack_delay);
+      return;
+    }
+
+  ta_timer_wheel_cancel (client->timers, &client->sm_ack_timer);
+  client->sm_unrequested = 0;
+  client->sm_requests++;
+  iks_send_raw (client->parser, "<r xmlns='" NS_SM "'/>");
+}
+
+/* Fired by the client timer wheel when stanzas waited too long for
+ * their batch to be complete */
+static void
+_sm_ack_expired (ta_timer_t *TA_UNUSED(timer), void *data)
+{
+  _sm_request ((ta_xmpp_client_t *) data, 1);
+}
+
+/* Sends the stanzas of the ring again, numbering them after the last
+ * one acknowledged */
+static void
+_sm_replay (ta_xmpp_client_t *client)
+{
+  unsigned int i;
+
+  client->sm_first = client->sm_acked;
+  client->sm_outbound = client->sm_acked + client->sm_ring_count;
+  for (i = 0; i < client->sm_ring_count; i++)
+    iks_send_raw (client->parser,
+                  client->sm_ring[(client->sm_ring_start + i) &
+                                  (client->sm_ring_size - 1)].data);
+  client->sm_replayed += client->sm_ring_count;
+  client->sm_unrequested += client->sm_ring_count;
+  _sm_request (client, 0);
+}
+
+/* Forgets the stream, it won't be resumed */
+static void
+_sm_reset (ta_xmpp_client_t *client)
+{
+  if (client->timers)
+    ta_timer_wheel_cancel (client->timers, &client->sm_ack_timer);
+  _sm_forget (client);
+  if (client->sm_id)
+    {
+      free (client->sm_id);
+      client->sm_id = NULL;
+    }
+  client->sm_state = SM_OFF;
+  client->sm_inbound = 0;
+  client->sm_outbound = 0;
+  client->sm_acked = 0;
+  client->sm_first = 0;
+  client->sm_unrequested = 0;
+}
+
+/* Default queue notifier, wakes up `ta_xmpp_client_process()' */
+static void
+_ta_xmpp_client_queue_wake (ta_xmpp_client_t *client, void *TA_UNUSED(data))
+{
+  char c = 0;
+  ssize_t n;
+  if (client->wakefds[1] >= 0)
+    {
+      n = write (client->wakefds[1], &c, 1);
+      (void) n;
+    }
+}
+
+/* Removes the hooks marked as disconnected, keeping the order of the
+ * others */
+static void
+_hook_vector_compact (struct hook_vector *vector)
+{
+  int i, kept = 0;
+  for (i = 0; i < vector->count; i++)
+    if (vector->hooks[i].hook != NULL)
+      vector->hooks[kept++] = vector->hooks[i];
+  vector->count = kept;
+  vector->dead = 0;
+}
+
+/* Executes all hooks connected to `event'. If a hook returns a true
+ * value, the iteration is stopped. The vector is read again after
+ * each call because hooks may connect or disconnect others. */
 static void
 _ta_xmpp_client_call_event_hooks (ta_xmpp_client_t *client,
-                                  const char *event, void *data)
+                                  ta_xmpp_client_event_t event, void *data)
 {
-  ta_list_t *tmp;
-  ta_list_t *hooks = hashtable_get (client->events, event);
+  struct hook_vector *vector = &client->events[event];
   struct hook_data *hdata;
-  for (tmp = hooks; tmp; tmp = tmp->next)
+  int i;
+
+  vector->dispatching++;
+  for (i = 0; i < vector->count; i++)
     {
-      hdata = (struct hook_data *) tmp->data;
-      if ((*hdata->hook) (client, data, hdata->data))
-        return;
+      hdata = &vector->hooks[i];
+      if (hdata->hook != NULL && (*hdata->hook) (client, data, hdata->data))
+        break;
     }
+  if (--vector->dispatching == 0 && vector->dead)
+    _hook_vector_compact (vector);
 }
 
 /* Callback fired when a <message /> is received by the xmpp
@@ -153,7 +642,7 @@ _ta_xmpp_client_ikshook_message_received (void *data, ikspak *pak)
 {
   ta_xmpp_client_t *client;
   client = (ta_xmpp_client_t *) data;
-  _ta_xmpp_client_call_event_hooks (client, "message-received", pak);
+  _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_MESSAGE_RECEIVED, pak);
   return IKS_FILTER_EAT;
 }
 
@@ -164,7 +653,7 @@ _ta_xmpp_client_ikshook_presence_noticed (void *data, ikspak *pak)
 {
   ta_xmpp_client_t *client;
   client = (ta_xmpp_client_t *) data;
-  _ta_xmpp_client_call_event_hooks (client, "presence-noticed", pak);
+  _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_PRESENCE_NOTICED, pak);
   return IKS_FILTER_EAT;
 }
 
@@ -180,6 +669,9 @@ _ta_xmpp_client_ikshook_watcher (void *data, ikspak *pak)
 {
   struct watch_data *wdata = (struct watch_data *) data;
 
+  /* The answer arrived in time, the deadline is not needed anymore */
+  ta_timer_wheel_cancel (wdata->client->timers, &wdata->timer);
+
   /* Calling the user defined callback. */
   wdata->callback (wdata->client, pak->x, wdata->data);
 
@@ -191,6 +683,33 @@ _ta_xmpp_client_ikshook_watcher (void *data, ikspak *pak)
   return IKS_FILTER_EAT;
 }
 
+/* Fired by the client timer wheel when a request sent by
+ * `ta_xmpp_client_send_and_filter()' is not answered in time or when
+ * the client is disconnected with pending requests. The user defined
+ * callback receives a NULL node and the error is set. */
+static void
+_ta_xmpp_client_watch_expired (ta_timer_t *TA_UNUSED(timer), void *data)
+{
+  struct watch_data *wdata = (struct watch_data *) data;
+  ta_xmpp_client_t *client = wdata->client;
+
+  if (client->running)
+    {
+      ta_log_warn (client->log, "Request %s timed out", wdata->stanza_id);
+      ta_error_set (TA_XMPP_TIMEOUT_ERROR, "Request %s timed out",
+                    wdata->stanza_id);
+    }
+  else
+    ta_error_set (TA_XMPP_TIMEOUT_ERROR,
+                  "Client disconnected before request %s was answered",
+                  wdata->stanza_id);
+
+  wdata->callback (client, NULL, wdata->data);
+  if (client->filter && wdata->rule != NULL)
+    iks_filter_remove_rule (client->filter, wdata->rule);
+  wdata_free (wdata);
+}
+
 #ifdef DEBUG
 
 static void
@@ -213,6 +732,38 @@ _xmpp_client_log_hook (ta_xmpp_client_t *client, const char *data,
 static void
 ta_xmpp_client_free (ta_xmpp_client_t *client)
 {
+  int i;
+
+  /* Requests still waiting for an answer must be released while the
+   * filter holding their rules is still alive. */
+  if (client->timers)
+    {
+      ta_timer_wheel_cancel (client->timers, &client->reconnect_timer);
+      ta_timer_wheel_cancel (client->timers, &client->pool_timer);
+      ta_timer_wheel_cancel (client->timers, &client->sm_ack_timer);
+      ta_timer_wheel_flush (client->timers);
+      _ta_xmpp_client_dial_cancel (client);
+      ta_object_unref (client->timers);
+      client->timers = NULL;
+    }
+  _ta_xmpp_client_queue_clear (client);
+  ta_buf_dealloc (&client->queue_buf);
+  ta_object_unref (client->idgen);
+  _sm_reset (client);
+  if (client->sm_ring)
+    {
+      unsigned int i;
+      for (i = 0; i < client->sm_ring_size; i++)
+        free (client->sm_ring[i].data);
+      free (client->sm_ring);
+      client->sm_ring = NULL;
+    }
+  if (client->wakefds[0] >= 0)
+    {
+      close (client->wakefds[0]);
+      close (client->wakefds[1]);
+      client->wakefds[0] = client->wakefds[1] = -1;
+    }
   if (client->jid)
     {
       free (client->jid);
@@ -243,23 +794,28 @@ ta_xmpp_client_free (ta_xmpp_client_t *client)
       iks_filter_delete (client->filter);
       client->filter = NULL;
     }
+  if (client->fd >= 0)
+    {
+      close (client->fd);
+      client->fd = -1;
+    }
+  if (client->pool)
+    {
+      ta_object_unref (client->pool);
+      client->pool = NULL;
+    }
   if (client->log)
     {
       ta_object_unref (client->log);
       client->log = NULL;
     }
 
-  /* Freeing all hooks for all events. Maybe it is better to be done
-   * automatically. */
-  ta_xmpp_client_event_disconnect (client, "connected", NULL);
-  ta_xmpp_client_event_disconnect (client, "authenticated", NULL);
-  ta_xmpp_client_event_disconnect (client, "authentication-failed", NULL);
-  ta_xmpp_client_event_disconnect (client, "message-received", NULL);
-  ta_xmpp_client_event_disconnect (client, "presence-noticed", NULL);
-  if (client->events)
+  /* Freeing all hooks for all events */
+  for (i = 0; i < TA_XMPP_CLIENT_EVENT_LAST; i++)
     {
-      hashtable_destroy (client->events);
-      client->events = NULL;
+      free (client->events[i].hooks);
+      client->events[i].hooks = NULL;
+      client->events[i].count = client->events[i].size = 0;
     }
 }
 
@@ -304,17 +860,85 @@ ta_xmpp_client_init (ta_xmpp_client_t *client,
 
   /* taningia stuff */
   client->log = ta_log_new ("xmpp-client");
+  client->timers = ta_timer_wheel_new (ta_timer_now ());
+  client->request_timeout = DEFAULT_REQUEST_TIMEOUT;
+  client->idgen = ta_idgen_new ();
+
+  /* Outbound queue */
+  client->queue_stub.next = NULL;
+  client->queue_head = client->queue_tail = &client->queue_stub;
+  ta_buf_alloc (&client->queue_buf, 0);
+  client->queue_depth = 0;
+  client->queue_limit = DEFAULT_QUEUE_LIMIT;
+  client->queue_max_depth = 0;
+  client->queue_enqueued = 0;
+  client->queue_rejected = 0;
+  client->queue_written = 0;
+  client->queue_writes = 0;
+  client->queue_notify = _ta_xmpp_client_queue_wake;
+  client->queue_notify_data = NULL;
+  if (pipe (client->wakefds) == 0)
+    {
+      fcntl (client->wakefds[0], F_SETFL, O_NONBLOCK);
+      fcntl (client->wakefds[1], F_SETFL, O_NONBLOCK);
+      fcntl (client->wakefds[0], F_SETFD, FD_CLOEXEC);
+      fcntl (client->wakefds[1], F_SETFD, FD_CLOEXEC);
+    }
+  else
+    client->wakefds[0] = client->wakefds[1] = -1;
+  client->fd = -1;
+  client->pool = NULL;
+
+  /* Reconnection is disabled by default */
+  client->reconnect_min = 0;
+  client->reconnect_max = 0;
+  client->reconnect_limit = 0;
+  client->reconnect_attempts = 0;
+  client->reconnect_seed = ta_timer_now () ^ (uintptr_t) client;
+  ta_timer_init (&client->reconnect_timer,
+                 _ta_xmpp_client_reconnect_expired, client);
+  client->dial = NULL;
+  ta_timer_init (&client->pool_timer, _ta_xmpp_client_pool_expired, client);
+  client->pool_deadline = 0;
+
+  /* Stream management */
+  client->use_sm = 0;
+  client->sm_supported = 0;
+  client->sm_state = SM_OFF;
+  client->sm_id = NULL;
+  client->sm_inbound = 0;
+  client->sm_outbound = 0;
+  client->sm_acked = 0;
+  client->sm_first = 0;
+  client->sm_unrequested = 0;
+  client->ack_stanzas = DEFAULT_ACK_STANZAS;
+  client->ack_delay = DEFAULT_ACK_DELAY;
+  ta_timer_init (&client->sm_ack_timer, _sm_ack_expired, client);
+  client->sm_ring = NULL;
+  client->sm_ring_size = 0;
+  client->sm_ring_start = 0;
+  client->sm_ring_count = 0;
+  client->sm_ring_limit = DEFAULT_REPLAY_LIMIT;
+  client->sm_sent = 0;
+  client->sm_acked_total = 0;
+  client->sm_replayed = 0;
+  client->sm_overwritten = 0;
+  client->sm_requests = 0;
+
+  /* Stream compression is disabled by default */
+  client->compress_level = 0;
+  client->compress_flush = TA_XMPP_COMPRESS_FLUSH_SYNC;
+  client->compress_offered = 0;
+  memset (&client->compress_stats, 0, sizeof (client->compress_stats));
+#ifdef HAVE_ZLIB
+  client->compress = NULL;
+  client->compress_fd = -1;
+#endif
 
-  /* Initializing hash table that holds event hooks and adding all
-   * currently supported events. We actually don't free anything but
-   * the `hook_data' struct, so it is up to the caller to free the
+  /* Hook vectors of all events start empty. We actually don't free
+   * anything but the vectors, so it is up to the caller to free the
    * data field. */
-  client->events = hashtable_create (hash_string, string_equal, NULL, NULL);
-  hashtable_set (client->events, "connected", NULL);
-  hashtable_set (client->events, "authenticated", NULL);
-  hashtable_set (client->events, "authentication-failed", NULL);
-  hashtable_set (client->events, "message-received", NULL);
-  hashtable_set (client->events, "presence-noticed", NULL);
+  memset (client->events, 0, sizeof (client->events));
 }
 
 ta_xmpp_client_t *
@@ -396,17 +1020,77 @@ ta_xmpp_client_get_filter (ta_xmpp_client_t *client)
   return client->filter;
 }
 
+ta_idgen_t *
+ta_xmpp_client_get_idgen (ta_xmpp_client_t *client)
+{
+  return client->idgen;
+}
+
+int
+ta_xmpp_client_get_request_timeout (ta_xmpp_client_t *client)
+{
+  return client->request_timeout;
+}
+
+void
+ta_xmpp_client_set_request_timeout (ta_xmpp_client_t *client, int timeout)
+{
+  client->request_timeout = timeout;
+}
+
 int
 ta_xmpp_client_is_running (ta_xmpp_client_t *client)
 {
   return client->running ? TA_OK : TA_ERROR;
 }
 
+int
+ta_xmpp_client_is_secure (ta_xmpp_client_t *client)
+{
+  return client->use_tls ||
+    (client->parser != NULL && iks_is_secure (client->parser));
+}
+
+/* Writes a serialized stanza. With stream management on, stanzas are
+ * kept until the server acknowledges them, even the ones that could
+ * not be written, and they are only held while the stream is being
+ * resumed. */
+static int
+_ta_xmpp_client_write (ta_xmpp_client_t *client, const char *xml)
+{
+  int err = IKS_OK;
+
+  if (client->sm_state == SM_OFF)
+    return client->parser ? iks_send_raw (client->parser, xml)
+      : IKS_NET_NOCONN;
+
+  if (client->parser != NULL && client->sm_state != SM_RESUMING)
+    err = iks_send_raw (client->parser, xml);
+  _sm_track (client, xml, strlen (xml));
+  if (err == IKS_OK)
+    _sm_request (client, 0);
+  return err;
+}
+
+static int
+_ta_xmpp_client_send_node (ta_xmpp_client_t *client, iks *node)
+{
+  char *xml;
+  int err;
+
+  if (client->sm_state == SM_OFF && client->parser != NULL)
+    return iks_send (client->parser, node);
+  xml = iks_string (NULL, node);
+  err = _ta_xmpp_client_write (client, xml);
+  iks_free (xml);
+  return err;
+}
+
 int
 ta_xmpp_client_send (ta_xmpp_client_t *client, iks *node)
 {
   int err;
-  if ((err = iks_send (client->parser, node)) != IKS_OK)
+  if ((err = _ta_xmpp_client_send_node (client, node)) != IKS_OK)
     {
       ta_log_warn (client->log, "Fail to send the stanza");
       ta_error_set (XMPP_SEND_ERROR, "Failed to send the stanza");
@@ -422,7 +1106,7 @@ ta_xmpp_client_send_presence (ta_xmpp_client_t *client,
 {
   int err;
   iks *node = iks_make_pres (type, msg);
-  if ((err = iks_send (client->parser, node)) != IKS_OK)
+  if ((err = _ta_xmpp_client_send_node (client, node)) != IKS_OK)
     {
       ta_log_warn (client->log, "Fail to send the presence stanza");
       ta_error_set (XMPP_SEND_ERROR, "Failed to send the presence stanza");
@@ -433,18 +1117,26 @@ ta_xmpp_client_send_presence (ta_xmpp_client_t *client,
 }
 
 int
-ta_xmpp_client_send_and_filter (ta_xmpp_client_t *client, iks *node,
-                                ta_xmpp_client_answer_cb_t cb, void *data,
-                                ta_free_func_t free_cb)
+ta_xmpp_client_send_raw (ta_xmpp_client_t *client, const char *xml)
 {
   int err;
-  char *id;
-  iksrule *rule;
-  struct watch_data *wdata;
+  if ((err = _ta_xmpp_client_write (client, xml)) != IKS_OK)
+    {
+      ta_log_warn (client->log, "Fail to send the stanza");
+      ta_error_set (XMPP_SEND_ERROR, "Failed to send the stanza");
+      return err;
+    }
+  return TA_OK;
+}
 
-  /* Getting stanza id */
-  if ((id = iks_find_attrib (node, "id")) == NULL)
-    return 1;
+/* Registers `cb' to be called when the stanza identified by `id' is
+ * answered or when it times out. */
+static struct watch_data *
+_ta_xmpp_client_watch (ta_xmpp_client_t *client, const char *id,
+                       ta_xmpp_client_answer_cb_t cb, void *data,
+                       ta_free_func_t free_cb)
+{
+  struct watch_data *wdata;
 
   /* Now that all search fields were filled, it is time to build the
    * struct that will hold data received from params and found here
@@ -462,93 +1154,845 @@ ta_xmpp_client_send_and_filter (ta_xmpp_client_t *client, iks *node,
    * destructor and methods to manipulate it public, which is not the
    * case.
    */
-  rule =
+  wdata->rule =
     iks_filter_add_rule (client->filter,
                          (iksFilterHook *) _ta_xmpp_client_ikshook_watcher,
                          wdata, IKS_RULE_ID, id, IKS_RULE_DONE);
-  wdata->rule = rule;
-  wdata->stanza_id = strdup (id);
 
-  /* Finnaly, we're trying to send the stanza. With the filter
-   * properly registered. */
-  if ((err = iks_send (client->parser, node)) != IKS_OK)
-    {
-      ta_log_warn (client->log, "Fail to send the stanza");
-      ta_error_set (XMPP_SEND_ERROR, "Failed to send the stanza");
+  /* Making sure that the watch data will not live forever if the
+   * server never answers. */
+  if (client->request_timeout > 0)
+    ta_timer_wheel_add (client->timers, &wdata->timer,
+                        ta_timer_now () + client->request_timeout);
+  return wdata;
+}
 
-      iks_filter_remove_rule (client->filter, wdata->rule);
-      wdata_free (wdata);
-    }
-  return err;
+/* Undoes `_ta_xmpp_client_watch()' when the stanza could not be
+ * sent */
+static void
+_ta_xmpp_client_unwatch (ta_xmpp_client_t *client, struct watch_data *wdata)
+{
+  ta_log_warn (client->log, "Fail to send the stanza");
+  ta_error_set (XMPP_SEND_ERROR, "Failed to send the stanza");
+
+  ta_timer_wheel_cancel (client->timers, &wdata->timer);
+  iks_filter_remove_rule (client->filter, wdata->rule);
+  wdata_free (wdata);
 }
 
 int
-ta_xmpp_client_connect (ta_xmpp_client_t *client)
+ta_xmpp_client_send_and_filter (ta_xmpp_client_t *client, iks *node,
+                                ta_xmpp_client_answer_cb_t cb, void *data,
+                                ta_free_func_t free_cb)
 {
   int err;
+  char *id, sid[TA_IDGEN_ID_SIZE];
+  struct watch_data *wdata;
 
-  /* Iksemel stuff */
-  client->parser = iks_stream_new (IKS_NS_CLIENT, client,
-                                   _ta_xmpp_client_hook);
-  client->filter = iks_filter_new ();
-
-#ifdef DEBUG
-  iks_set_log_hook (client->parser, (iksLogHook *) _xmpp_client_log_hook);
-#endif
-
-  if (client->host)
-    err = iks_connect_via (client->parser, client->host,
-                           client->port, client->id->server);
-  else
-    err = iks_connect_tcp (client->parser, client->id->server, client->port);
-  if (err != IKS_OK)
+  /* Getting stanza id, stanzas without one get a fresh id */
+  if ((id = iks_find_attrib (node, "id")) == NULL)
     {
-      /* Something didnt't work properly here, so we need to handle
-       * the error and send some useful result to the user. */
-      switch (err)
-        {
-        case IKS_NET_NODNS:
-          ta_error_set (XMPP_CONNECTION_ERROR, "hostname lookup failed");
-          break;
+      ta_idgen_next (client->idgen, sid);
+      iks_insert_attrib (node, "id", sid);
+      id = sid;
+    }
 
-        case IKS_NET_NOCONN:
-          ta_error_set (XMPP_CONNECTION_ERROR, "connection failed");
-          break;
+  wdata = _ta_xmpp_client_watch (client, id, cb, data, free_cb);
 
-        default:
-          ta_error_set (XMPP_CONNECTION_ERROR, "io error");
-          break;
-        }
-      return TA_ERROR;
-    }
-  else
-    {
+  /* Finnaly, we're trying to send the stanza. With the filter
+   * properly registered. */
+  if ((err = _ta_xmpp_client_send_node (client, node)) != IKS_OK)
+    _ta_xmpp_client_unwatch (client, wdata);
+  return err;
+}
+
+int
+ta_xmpp_client_send_raw_and_filter (ta_xmpp_client_t *client,
+                                    const char *id, const char *xml,
+                                    ta_xmpp_client_answer_cb_t cb,
+                                    void *data, ta_free_func_t free_cb)
+{
+  int err;
+  struct watch_data *wdata;
+
+  wdata = _ta_xmpp_client_watch (client, id, cb, data, free_cb);
+  if ((err = _ta_xmpp_client_write (client, xml)) != IKS_OK)
+    _ta_xmpp_client_unwatch (client, wdata);
+  return err;
+}
+
+int
+ta_xmpp_client_enqueue (ta_xmpp_client_t *client, iks *node)
+{
+  struct queue_node *qnode;
+  int depth, max;
+
+  /* Everything that can be slow is done before reserving a place in
+   * the queue, the consumer might be waiting for our node. */
+  qnode = malloc (sizeof (struct queue_node));
+  qnode->data = iks_string (NULL, node);
+  qnode->len = strlen (qnode->data);
+
+  /* The place is only taken while the queue is under its limit, so
+   * the depth never counts stanzas that are going to be rejected */
+  depth = ta_atomic_load (&client->queue_depth);
+  do
+    {
+      if (client->queue_limit > 0 && depth >= client->queue_limit)
+        {
+          ta_atomic_add (&client->queue_rejected, 1);
+          _queue_node_free (qnode);
+          ta_error_set (TA_XMPP_QUEUE_FULL_ERROR,
+                        "Outbound queue is full (%d stanzas)",
+                        client->queue_limit);
+          return TA_ERROR;
+        }
+    }
+  while (!ta_atomic_cas (&client->queue_depth, &depth, depth + 1));
+  depth++;
+
+  max = ta_atomic_load (&client->queue_max_depth);
+  while (depth > max && !ta_atomic_cas (&client->queue_max_depth, &max, depth))
+    ;
+
+  _queue_push (client, qnode);
+  ta_atomic_add (&client->queue_enqueued, 1);
+
+  /* The loop never sleeps while the queue is not empty, so it only
+   * needs to be woken up when the first stanza arrives. */
+  if (depth == 1)
+    client->queue_notify (client, client->queue_notify_data);
+  return TA_OK;
+}
+
+/* Writes everything accumulated in `client->queue_buf' */
+static int
+_ta_xmpp_client_write_queue (ta_xmpp_client_t *client, int count)
+{
+  int err;
+  err = iks_send_raw (client->parser, ta_buf_cstr (&client->queue_buf));
+  ta_buf_reset (&client->queue_buf);
+  if (err != IKS_OK)
+    {
+      ta_log_error (client->log, "Failed to write the outbound queue");
+      ta_error_set (TA_XMPP_NETWORK_ERROR,
+                    "Failed to write the outbound queue");
+      client->running = 0;
+      return TA_ERROR;
+    }
+  ta_atomic_add (&client->queue_written, count);
+  ta_atomic_add (&client->queue_writes, 1);
+  return TA_OK;
+}
+
+int
+ta_xmpp_client_flush (ta_xmpp_client_t *client)
+{
+  struct queue_node *node;
+  int pending, count = 0, ret = TA_OK;
+
+  if (client->parser == NULL)
+    {
+      ta_error_set (XMPP_CONNECTION_ERROR, "Client not connected");
+      return TA_ERROR;
+    }
+
+  /* The queue waits for the stream to be resumed */
+  if (client->sm_state == SM_RESUMING)
+    return TA_OK;
+
+  /* Only what is already in the queue is written, otherwise busy
+   * producers could keep the loop here forever. Nodes that are still
+   * being linked are left for the next flush. */
+  pending = ta_atomic_load (&client->queue_depth);
+  while (pending-- > 0 && (node = _queue_take (client)) != NULL)
+    {
+      /* After a write error the remaining stanzas are just dropped,
+       * unless they can be sent again by stream management */
+      if (ret == TA_OK)
+        {
+          ta_buf_ncat (&client->queue_buf, node->data, node->len);
+          count++;
+          if (client->queue_buf.string_length >= QUEUE_BATCH_SIZE)
+            {
+              ret = _ta_xmpp_client_write_queue (client, count);
+              count = 0;
+            }
+        }
+      if (client->sm_state != SM_OFF)
+        _sm_track (client, node->data, node->len);
+      _queue_node_free (node);
+    }
+  if (ret == TA_OK && count > 0)
+    ret = _ta_xmpp_client_write_queue (client, count);
+  if (ret == TA_OK)
+    _sm_request (client, 0);
+  return ret;
+}
+
+int
+ta_xmpp_client_get_queue_limit (ta_xmpp_client_t *client)
+{
+  return client->queue_limit;
+}
+
+void
+ta_xmpp_client_set_queue_limit (ta_xmpp_client_t *client, int limit)
+{
+  client->queue_limit = limit;
+}
+
+void
+ta_xmpp_client_get_queue_stats (ta_xmpp_client_t *client,
+                                ta_xmpp_client_queue_stats_t *stats)
+{
+  stats->depth = ta_atomic_load (&client->queue_depth);
+  stats->max_depth = ta_atomic_load (&client->queue_max_depth);
+  stats->enqueued = ta_atomic_load (&client->queue_enqueued);
+  stats->rejected = ta_atomic_load (&client->queue_rejected);
+  stats->written = ta_atomic_load (&client->queue_written);
+  stats->writes = ta_atomic_load (&client->queue_writes);
+}
+
+void
+ta_xmpp_client_set_queue_notify (ta_xmpp_client_t *client,
+                                 ta_xmpp_client_notify_func_t func,
+                                 void *data)
+{
+  if (func == NULL)
+    {
+      client->queue_notify = _ta_xmpp_client_queue_wake;
+      client->queue_notify_data = NULL;
+    }
+  else
+    {
+      client->queue_notify = func;
+      client->queue_notify_data = data;
+    }
+}
+
+/* Creates the parser of a new connection. The filter is kept when
+ * the client reconnects, so requests waiting for an answer are not
+ * forgotten. */
+static void
+_ta_xmpp_client_setup (ta_xmpp_client_t *client)
+{
+  /* Connecting by hand replaces a reconnection in progress */
+  _ta_xmpp_client_dial_cancel (client);
+  ta_timer_wheel_cancel (client->timers, &client->reconnect_timer);
+  ta_timer_wheel_cancel (client->timers, &client->pool_timer);
+
+  client->parser = iks_stream_new (IKS_NS_CLIENT, client,
+                                   _ta_xmpp_client_hook);
+  client->features = 0;
+  client->sm_supported = 0;
+  client->compress_offered = 0;
+  client->authenticated = 0;
+
+#ifdef DEBUG
+  iks_set_log_hook (client->parser, (iksLogHook *) _xmpp_client_log_hook);
+#endif
+
+  if (client->filter != NULL)
+    return;
+  client->filter = iks_filter_new ();
+
+  /* Adding authentication handling rules to iksemel filter. This
+   * stuff will be integrated with our simple event system. The
+   * delcared callbacks only calls the user defined hook list. */
+
+  iks_filter_add_rule (client->filter,
+                       (iksFilterHook *)
+                         _ta_xmpp_client_ikshook_message_received,
+                       client,
+                       IKS_RULE_TYPE, IKS_PAK_MESSAGE,
+                       IKS_RULE_DONE);
+
+  iks_filter_add_rule (client->filter,
+                       (iksFilterHook *)
+                         _ta_xmpp_client_ikshook_presence_noticed,
+                       client,
+                       IKS_RULE_TYPE, IKS_PAK_PRESENCE,
+                       IKS_RULE_DONE);
+}
+
+/* Called once the stream of a new connection is open */
+static void
+_ta_xmpp_client_connected (ta_xmpp_client_t *client)
+{
+  client->running = 1;
+
+  /* Calling user defined hooks for the `connected' event. */
+  _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_CONNECTED, NULL);
+}
+
+/* Closes a broken connection, keeping everything that might still be
+ * useful in a new one */
+static void
+_ta_xmpp_client_drop (ta_xmpp_client_t *client)
+{
+  if (client->parser)
+    {
+      iks_parser_delete (client->parser);
+      client->parser = NULL;
+    }
+  if (client->fd >= 0)
+    {
+      close (client->fd);
+      client->fd = -1;
+    }
+  client->authenticated = 0;
+  ta_timer_wheel_cancel (client->timers, &client->sm_ack_timer);
+
+  /* Stanzas sent from now on wait for the stream to be resumed */
+  client->sm_state = client->sm_id ? SM_RESUMING : SM_OFF;
+}
+
+#ifdef HAVE_ZLIB
+
+/* Transport given to iksemel when compression is enabled. It starts
+ * as a plain socket and is switched to zlib once the server accepts
+ * to compress the stream. */
+
+static int
+_ta_xmpp_client_transport_connect (iksparser *parser, void **socketptr,
+                                   const char *server, int port)
+{
+  ta_xmpp_client_t *client;
+  int fd, own = 0, err;
+
+  client = (ta_xmpp_client_t *) iks_user_data (parser);
+  if ((fd = client->compress_fd) < 0)
+    {
+      if ((err = ta_compress_dial (server, port, &fd)) != IKS_OK)
+        return err;
+      own = 1;
+    }
+  client->compress = ta_compress_new (fd, own, client->compress_level,
+                                      client->compress_flush,
+                                      &client->compress_stats, client);
+  *socketptr = client->compress;
+  return IKS_OK;
+}
+
+static void
+_ta_xmpp_client_transport_close (void *socket)
+{
+  ta_xmpp_client_t *client;
+  client = (ta_xmpp_client_t *) ta_compress_get_data (socket);
+  client->compress = NULL;
+  ta_compress_free (socket);
+}
+
+static ikstransport _ta_xmpp_client_transport = {
+  IKS_TRANSPORT_V1,
+  _ta_xmpp_client_transport_connect,
+  ta_compress_send,
+  ta_compress_recv,
+  _ta_xmpp_client_transport_close,
+  NULL
+};
+
+#endif
+
+/* Opens the connection of the parser. Iksemel handles the socket by
+ * itself unless the stream might be compressed. */
+static int
+_ta_xmpp_client_dial (ta_xmpp_client_t *client)
+{
+#ifdef HAVE_ZLIB
+  if (client->compress_level > 0)
+    return iks_connect_with (client->parser,
+                             client->host ? client->host : client->id->server,
+                             client->port, client->id->server,
+                             &_ta_xmpp_client_transport);
+#endif
+  if (client->host)
+    return iks_connect_via (client->parser, client->host,
+                            client->port, client->id->server);
+  return iks_connect_tcp (client->parser, client->id->server, client->port);
+}
+
+/* Gives the socket `fd' to the parser and opens the stream */
+static int
+_ta_xmpp_client_adopt (ta_xmpp_client_t *client, int fd)
+{
+#ifdef HAVE_ZLIB
+  if (client->compress_level > 0)
+    {
+      int err;
+      client->compress_fd = fd;
+      err = iks_connect_with (client->parser, client->id->server, 0,
+                              client->id->server, &_ta_xmpp_client_transport);
+      client->compress_fd = -1;
+      return err;
+    }
+#endif
+  if (iks_connect_fd (client->parser, fd) != IKS_OK)
+    return IKS_NET_NOCONN;
+  return iks_send_header (client->parser, client->id->server);
+}
+
+/* The socket of the parser, iksemel doesn't know it when the
+ * connection goes through our transport */
+static int
+_ta_xmpp_client_fd (ta_xmpp_client_t *client)
+{
+#ifdef HAVE_ZLIB
+  if (client->compress != NULL)
+    return ta_compress_get_fd (client->compress);
+#endif
+  return iks_fd (client->parser);
+}
+
+/* Something didnt't work properly when connecting, so we need to
+ * handle the error and send some useful result to the user. */
+static void
+_ta_xmpp_client_connect_error (int err)
+{
+  switch (err)
+    {
+    case IKS_NET_NODNS:
+      ta_error_set (XMPP_CONNECTION_ERROR, "hostname lookup failed");
+      break;
+
+    case IKS_NET_NOCONN:
+      ta_error_set (XMPP_CONNECTION_ERROR, "connection failed");
+      break;
+
+    default:
+      ta_error_set (XMPP_CONNECTION_ERROR, "io error");
+      break;
+    }
+}
+
+int
+ta_xmpp_client_connect (ta_xmpp_client_t *client)
+{
+  int err;
+
+  /* Iksemel stuff */
+  _ta_xmpp_client_setup (client);
+
+  err = _ta_xmpp_client_dial (client);
+  if (err != IKS_OK)
+    {
+      _ta_xmpp_client_connect_error (err);
+      return TA_ERROR;
+    }
+  else
+    {
       ta_log_info (client->log, "Connected to xmpp:%s:%d",
                    client->host == NULL ? client->id->server : client->host,
                    client->port);
+      _ta_xmpp_client_connected (client);
+      return TA_OK;
+    }
+}
+
+int
+ta_xmpp_client_connect_fd (ta_xmpp_client_t *client, int fd)
+{
+  _ta_xmpp_client_setup (client);
+
+  /* The stream header is sent here, iksemel only sends it by itself
+   * when it opens the connection */
+  if (_ta_xmpp_client_adopt (client, fd) != IKS_OK)
+    {
+      ta_error_set (XMPP_CONNECTION_ERROR, "io error");
+      iks_parser_delete (client->parser);
+      client->parser = NULL;
+      return TA_ERROR;
+    }
+  client->fd = fd;
+  ta_log_info (client->log, "Connected to xmpp:%s through fd %d",
+               client->id->server, fd);
+  _ta_xmpp_client_connected (client);
+  return TA_OK;
+}
+
+ta_xmpp_pool_t *
+ta_xmpp_client_get_pool (ta_xmpp_client_t *client)
+{
+  return client->pool;
+}
+
+void
+ta_xmpp_client_set_pool (ta_xmpp_client_t *client, ta_xmpp_pool_t *pool)
+{
+  if (pool)
+    ta_object_ref (pool);
+  if (client->pool)
+    ta_object_unref (client->pool);
+  client->pool = pool;
+}
+
+void
+ta_xmpp_client_set_reconnect (ta_xmpp_client_t *client, int min_delay,
+                              int max_delay, int attempts)
+{
+  client->reconnect_min = min_delay > 0 ? min_delay : 0;
+  client->reconnect_max = max_delay > min_delay ? max_delay : min_delay;
+  client->reconnect_limit = attempts > 0 ? attempts : 0;
+}
+
+void
+ta_xmpp_client_set_stream_management (ta_xmpp_client_t *client,
+                                      int enabled)
+{
+  client->use_sm = enabled;
+}
+
+int
+ta_xmpp_client_get_unacked (ta_xmpp_client_t *client)
+{
+  return client->sm_outbound - client->sm_acked;
+}
+
+void
+ta_xmpp_client_set_ack_batch (ta_xmpp_client_t *client, int stanzas,
+                              int msecs)
+{
+  client->ack_stanzas = stanzas;
+  client->ack_delay = msecs;
+}
+
+void
+ta_xmpp_client_set_replay_limit (ta_xmpp_client_t *client, int stanzas)
+{
+  client->sm_ring_limit = stanzas > 0 ? stanzas : 1;
+  if (client->sm_ring)
+    _sm_ring_resize (client, client->sm_ring_limit);
+}
+
+void
+ta_xmpp_client_get_sm_stats (ta_xmpp_client_t *client,
+                             ta_xmpp_client_sm_stats_t *stats)
+{
+  stats->sent = client->sm_sent;
+  stats->acked = client->sm_acked_total;
+  stats->unacked = client->sm_outbound - client->sm_acked;
+  stats->kept = client->sm_ring_count;
+  stats->replayed = client->sm_replayed;
+  stats->overwritten = client->sm_overwritten;
+  stats->requests = client->sm_requests;
+}
+
+int
+ta_xmpp_client_set_compression (ta_xmpp_client_t *client, int level,
+                                 ta_xmpp_compress_flush_t flush)
+{
+#ifndef HAVE_ZLIB
+  if (level > 0)
+    {
+      ta_error_set (TA_XMPP_COMPRESS_ERROR,
+                    "Library built without support to stream compression");
+      return TA_ERROR;
+    }
+#endif
+  client->compress_level = level < 0 ? 0 : level > 9 ? 9 : level;
+  client->compress_flush = flush;
+  return TA_OK;
+}
+
+void
+ta_xmpp_client_get_compress_stats (ta_xmpp_client_t *client,
+                                   ta_xmpp_client_compress_stats_t *stats)
+{
+  *stats = client->compress_stats;
+}
+
+/* Schedules the next reconnection attempt. The delay doubles after
+ * each failed attempt and only its first half is fixed, the other one
+ * is random. Returns false when the client gives up. */
+static int
+_ta_xmpp_client_schedule_reconnect (ta_xmpp_client_t *client)
+{
+  long delay;
+  int shift;
+
+  if (client->reconnect_limit > 0 &&
+      client->reconnect_attempts >= client->reconnect_limit)
+    {
+      ta_log_error (client->log, "Giving up after %d reconnection attempts",
+                    client->reconnect_attempts);
+      ta_error_set (XMPP_CONNECTION_ERROR,
+                    "Giving up after %d reconnection attempts",
+                    client->reconnect_attempts);
+      client->running = 0;
+      return 0;
+    }
+
+  shift = client->reconnect_attempts < 16 ? client->reconnect_attempts : 16;
+  delay = (long) client->reconnect_min << shift;
+  if (delay > client->reconnect_max)
+    delay = client->reconnect_max;
+  delay = delay / 2 + rand_r (&client->reconnect_seed) % (delay / 2 + 1);
+
+  ta_log_info (client->log, "Reconnecting in %ld ms", delay);
+  ta_timer_wheel_add (client->timers, &client->reconnect_timer,
+                      ta_timer_now () + delay);
+  client->running = 1;
+  return 1;
+}
+
+/* Dialing in the background */
+
+static void
+_dial_release (struct xmpp_dial *dial)
+{
+  if (ta_atomic_sub (&dial->refs, 1) > 0)
+    return;
+  if (dial->fd >= 0)
+    close (dial->fd);
+  pthread_mutex_destroy (&dial->lock);
+  free (dial->host);
+  free (dial);
+}
+
+/* Opens a TCP connection to `host' the way iksemel does. Returns an
+ * iksemel error code and, on success, stores the socket in `fd'. */
+static int
+_dial_tcp (const char *host, int port, int *fd)
+{
+  struct addrinfo hints, *addrs, *addr;
+  char service[16];
+  int sock = -1;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf (service, sizeof (service), "%d", port);
+  if (getaddrinfo (host, service, &hints, &addrs) != 0)
+    return IKS_NET_NODNS;
+
+  for (addr = addrs; addr; addr = addr->ai_next)
+    {
+      if ((sock = socket (addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC,
+                          addr->ai_protocol)) < 0)
+        continue;
+      if (connect (sock, addr->ai_addr, addr->ai_addrlen) == 0)
+        break;
+      close (sock);
+      sock = -1;
+    }
+  freeaddrinfo (addrs);
+  if (sock < 0)
+    return IKS_NET_NOCONN;
+  *fd = sock;
+  return IKS_OK;
+}
+
+static void *
+_dial_run (void *data)
+{
+  struct xmpp_dial *dial = (struct xmpp_dial *) data;
+  ta_xmpp_client_t *client;
+  int fd = -1, error;
+
+  error = _dial_tcp (dial->host, dial->port, &fd);
+
+  pthread_mutex_lock (&dial->lock);
+  dial->fd = fd;
+  dial->error = error;
+  ta_atomic_store (&dial->done, 1);
 
-      /* Calling user defined hooks for the `connected' event. */
-      _ta_xmpp_client_call_event_hooks (client, "connected", NULL);
-
-      /* Adding authentication handling rules to iksemel filter. This
-       * stuff will be integrated with our simple event system. The
-       * delcared callbacks only calls the user defined hook list. */
-
-      iks_filter_add_rule (client->filter,
-                           (iksFilterHook *)
-                             _ta_xmpp_client_ikshook_message_received,
-                           client,
-                           IKS_RULE_TYPE, IKS_PAK_MESSAGE,
-                           IKS_RULE_DONE);
-
-      iks_filter_add_rule (client->filter,
-                           (iksFilterHook *)
-                             _ta_xmpp_client_ikshook_presence_noticed,
-                           client,
-                           IKS_RULE_TYPE, IKS_PAK_PRESENCE,
-                           IKS_RULE_DONE);
-      return TA_OK;
+  /* The loop driving the client is woken up the same way it is when
+   * other threads enqueue stanzas */
+  if ((client = dial->client) != NULL)
+    client->queue_notify (client, client->queue_notify_data);
+  pthread_mutex_unlock (&dial->lock);
+
+  _dial_release (dial);
+  return NULL;
+}
+
+static int
+_ta_xmpp_client_dial_start (ta_xmpp_client_t *client)
+{
+  struct xmpp_dial *dial;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int err;
+
+  if ((dial = calloc (1, sizeof (struct xmpp_dial))) == NULL)
+    {
+      ta_error_set (XMPP_CONNECTION_ERROR, "Not enough memory");
+      return TA_ERROR;
+    }
+  pthread_mutex_init (&dial->lock, NULL);
+  dial->refs = 2;
+  dial->client = client;
+  dial->host = strdup (client->host ? client->host : client->id->server);
+  dial->port = client->port;
+  dial->fd = -1;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  err = pthread_create (&thread, &attr, _dial_run, dial);
+  pthread_attr_destroy (&attr);
+  if (err != 0)
+    {
+      dial->refs = 1;
+      _dial_release (dial);
+      ta_error_set (XMPP_CONNECTION_ERROR, "Could not start dialing: %s",
+                    strerror (err));
+      return TA_ERROR;
+    }
+  client->dial = dial;
+  return TA_OK;
+}
+
+/* Forgets the dial in progress, its thread closes the socket it
+ * opens */
+static void
+_ta_xmpp_client_dial_cancel (ta_xmpp_client_t *client)
+{
+  struct xmpp_dial *dial = client->dial;
+
+  if (dial == NULL)
+    return;
+  pthread_mutex_lock (&dial->lock);
+  dial->client = NULL;
+  pthread_mutex_unlock (&dial->lock);
+  _dial_release (dial);
+  client->dial = NULL;
+}
+
+/* True when the dial thread is done and its socket can be adopted */
+static int
+_ta_xmpp_client_dial_done (ta_xmpp_client_t *client)
+{
+  return client->dial != NULL && ta_atomic_load (&client->dial->done);
+}
+
+/* Ends a reconnection attempt with the socket `fd', -1 when the
+ * attempt failed */
+static void
+_ta_xmpp_client_reconnected (ta_xmpp_client_t *client, int fd)
+{
+  if (fd >= 0 && ta_xmpp_client_connect_fd (client, fd) == TA_OK)
+    return;
+  if (fd >= 0)
+    close (fd);
+  ta_log_warn (client->log, "Reconnection attempt %d failed",
+               client->reconnect_attempts);
+  _ta_xmpp_client_schedule_reconnect (client);
+}
+
+/* Adopts the socket opened by the dial thread */
+static void
+_ta_xmpp_client_dial_finish (ta_xmpp_client_t *client)
+{
+  struct xmpp_dial *dial = client->dial;
+  int fd, error;
+
+  pthread_mutex_lock (&dial->lock);
+  fd = dial->fd;
+  error = dial->error;
+  dial->fd = -1;
+  dial->client = NULL;
+  pthread_mutex_unlock (&dial->lock);
+  _dial_release (dial);
+  client->dial = NULL;
+
+  if (fd < 0)
+    _ta_xmpp_client_connect_error (error);
+  _ta_xmpp_client_reconnected (client, fd);
+}
+
+/* Fired by the client timer wheel when it is time to reconnect. A
+ * warm connection of the pool is used when there is one ready,
+ * otherwise a new one is dialed in the background. */
+static void
+_ta_xmpp_client_reconnect_expired (ta_timer_t *TA_UNUSED(timer), void *data)
+{
+  ta_xmpp_client_t *client = (ta_xmpp_client_t *) data;
+  int fd;
+
+  client->reconnect_attempts++;
+  if (client->pool && (fd = ta_xmpp_pool_take (client->pool)) >= 0)
+    _ta_xmpp_client_reconnected (client, fd);
+  else if (_ta_xmpp_client_dial_start (client) != TA_OK)
+    _ta_xmpp_client_reconnected (client, -1);
+}
+
+/* Gives up waiting for the pool. The client reconnects by itself if
+ * it can. Returns true if the client keeps running. */
+static int
+_ta_xmpp_client_pool_failed (ta_xmpp_client_t *client)
+{
+  if (client->reconnect_min > 0)
+    return _ta_xmpp_client_schedule_reconnect (client);
+  ta_log_error (client->log, "No connection ready in the pool");
+  ta_error_set (XMPP_CONNECTION_ERROR, "No connection ready in the pool");
+  client->running = 0;
+  return 0;
+}
+
+/* Fired by the client timer wheel while it waits for a connection of
+ * the pool. The pool is asked without blocking, so the loop driving
+ * the client keeps serving the others meanwhile. */
+static void
+_ta_xmpp_client_pool_expired (ta_timer_t *timer, void *data)
+{
+  ta_xmpp_client_t *client = (ta_xmpp_client_t *) data;
+  unsigned long now = ta_timer_now ();
+  int fd = -1;
+
+  if (client->pool)
+    fd = ta_xmpp_pool_take (client->pool);
+  if (fd >= 0)
+    {
+      ta_log_info (client->log, "Failing over to fd %d", fd);
+      if (ta_xmpp_client_connect_fd (client, fd) == TA_OK)
+        return;
+      close (fd);
+    }
+  else if (client->pool && now < client->pool_deadline)
+    {
+      ta_timer_wheel_add (client->timers, timer, now + POOL_POLL_INTERVAL);
+      return;
+    }
+  _ta_xmpp_client_pool_failed (client);
+}
+
+/* Called when the connection breaks. The client fails over to a warm
+ * connection of the pool, waits for the pool to have one ready or,
+ * without a pool, schedules a new attempt when reconnection is
+ * enabled. Returns true if the client keeps running. */
+static int
+_ta_xmpp_client_recover (ta_xmpp_client_t *client)
+{
+  unsigned long now = ta_timer_now ();
+  int fd;
+
+  if (client->pool && (fd = ta_xmpp_pool_take (client->pool)) >= 0)
+    {
+      ta_log_warn (client->log, "Connection lost, failing over to fd %d",
+                   fd);
+      _ta_xmpp_client_drop (client);
+      if (ta_xmpp_client_connect_fd (client, fd) == TA_OK)
+        return 1;
+      close (fd);
+      return _ta_xmpp_client_pool_failed (client);
     }
+  if (client->pool)
+    {
+      ta_log_warn (client->log, "Connection lost, waiting for the pool");
+      _ta_xmpp_client_drop (client);
+      client->pool_deadline = now + POOL_WAIT;
+      ta_timer_wheel_add (client->timers, &client->pool_timer,
+                          now + POOL_POLL_INTERVAL);
+      client->running = 1;
+      return 1;
+    }
+  if (client->reconnect_min == 0)
+    return 0;
+
+  ta_log_warn (client->log, "Connection lost");
+  _ta_xmpp_client_drop (client);
+  return _ta_xmpp_client_schedule_reconnect (client);
 }
 
 int
@@ -558,11 +2002,212 @@ ta_xmpp_client_run (ta_xmpp_client_t *client)
   return (_ta_xmpp_client_do_run ((void *) client));
 }
 
+int
+ta_xmpp_client_get_fd (ta_xmpp_client_t *client)
+{
+  if (client->parser == NULL)
+    return -1;
+  return _ta_xmpp_client_fd (client);
+}
+
+/* True when the outbound queue can be written now. It is held while
+ * a stream is being resumed, so it must not keep the loop awake. */
+static int
+_ta_xmpp_client_has_writes (ta_xmpp_client_t *client)
+{
+  return client->sm_state != SM_RESUMING &&
+    ta_atomic_load (&client->queue_depth) > 0;
+}
+
+int
+ta_xmpp_client_get_io_events (ta_xmpp_client_t *client)
+{
+  int events;
+  if (client->parser == NULL)
+    return 0;
+  events = TA_XMPP_CLIENT_WANT_READ;
+  if (_ta_xmpp_client_has_writes (client))
+    events |= TA_XMPP_CLIENT_WANT_WRITE;
+  return events;
+}
+
+long
+ta_xmpp_client_get_timeout (ta_xmpp_client_t *client)
+{
+  /* A finished dial is adopted right away */
+  if (_ta_xmpp_client_dial_done (client))
+    return 0;
+  return ta_timer_wheel_next_timeout (client->timers, ta_timer_now ());
+}
+
+/* Sleeps until the next reconnection attempt, until the dial in
+ * progress is done, until the pool is asked again or until something
+ * else is due in the timer wheel, while the client has no connection.
+ * The queue notifier still wakes it up. */
+static int
+_ta_xmpp_client_wait_reconnect (ta_xmpp_client_t *client, int timeout)
+{
+  struct pollfd pfd;
+  long deadline;
+  char drain[64];
+  int nfds = 0;
+
+  deadline = ta_xmpp_client_get_timeout (client);
+  if (deadline >= 0 && (timeout < 0 || deadline < timeout))
+    timeout = (int) deadline;
+  if (timeout != 0)
+    {
+      if (client->wakefds[0] >= 0)
+        {
+          pfd.fd = client->wakefds[0];
+          pfd.events = POLLIN;
+          pfd.revents = 0;
+          nfds = 1;
+        }
+      if (poll (&pfd, nfds, timeout) > 0)
+        while (read (client->wakefds[0], drain, sizeof (drain)) > 0)
+          ;
+    }
+  if (_ta_xmpp_client_dial_done (client))
+    _ta_xmpp_client_dial_finish (client);
+  ta_timer_wheel_advance (client->timers, ta_timer_now ());
+  return TA_OK;
+}
+
+/* Waits up to `timeout' milliseconds for the socket to become
+ * readable, waking up early for stanzas enqueued by other threads.
+ * Returns 1 if it is readable, 0 if not or -1 on error. */
+static int
+_ta_xmpp_client_poll (ta_xmpp_client_t *client, int timeout)
+{
+  struct pollfd pfd[2];
+  char drain[64];
+  int ready, nfds = 1;
+
+  pfd[0].fd = _ta_xmpp_client_fd (client);
+  pfd[0].events = POLLIN;
+  pfd[0].revents = 0;
+  if (timeout != 0 && client->wakefds[0] >= 0)
+    {
+      pfd[1].fd = client->wakefds[0];
+      pfd[1].events = POLLIN;
+      pfd[1].revents = 0;
+      nfds = 2;
+    }
+  if ((ready = poll (pfd, nfds, timeout)) < 0)
+    return errno == EINTR ? 0 : -1;
+  if (ready > 0 && nfds == 2 && pfd[1].revents)
+    while (read (client->wakefds[0], drain, sizeof (drain)) > 0)
+      ;
+  return pfd[0].revents != 0;
+}
+
+/* Reads and parses what arrived, if anything did. Iksemel is only
+ * called when the socket is readable, plain streams then read what is
+ * there and return. Secure streams don't: the TLS layer of iksemel
+ * ignores the timeout and keeps reading until the connection drops,
+ * that's why only `ta_xmpp_client_run' drives them. */
+static int
+_ta_xmpp_client_read (ta_xmpp_client_t *client, int timeout)
+{
+  int ready;
+  if ((ready = _ta_xmpp_client_poll (client, timeout)) < 0)
+    {
+      ta_log_error (client->log, "IO error");
+      ta_error_set (TA_XMPP_IO_ERROR, "IO Error");
+      client->running = 0;
+      return TA_ERROR;
+    }
+  if (!ready)
+    return TA_OK;
+  return _ta_xmpp_client_check_recv (client, iks_recv (client->parser, 0));
+}
+
+/* The part of a step that doesn't depend on the network: writes the
+ * outbound queue, replaces a broken connection and expires the
+ * requests that were not answered in time */
+static int
+_ta_xmpp_client_tick (ta_xmpp_client_t *client, int ret)
+{
+  /* Stanzas enqueued by hooks or by other threads while we were
+   * waiting */
+  if (ret == TA_OK && client->parser != NULL)
+    ret = ta_xmpp_client_flush (client);
+
+  /* Broken connections are replaced by a warm one of the pool or
+   * reconnected later */
+  if (ret != TA_OK && ta_error_last_code () == TA_XMPP_NETWORK_ERROR
+      && _ta_xmpp_client_recover (client))
+    ret = TA_OK;
+
+  ta_timer_wheel_advance (client->timers, ta_timer_now ());
+  return ret;
+}
+
+/* A step of the main loop, see `ta_xmpp_client_process' */
+static int
+_ta_xmpp_client_step (ta_xmpp_client_t *client, int timeout)
+{
+  long deadline;
+  int ret;
+
+  if (client->parser == NULL)
+    {
+      if (client->dial || ta_timer_is_pending (&client->reconnect_timer)
+          || ta_timer_is_pending (&client->pool_timer))
+        return _ta_xmpp_client_wait_reconnect (client, timeout);
+      ta_error_set (XMPP_CONNECTION_ERROR, "Client not connected");
+      client->running = 0;
+      return TA_ERROR;
+    }
+
+  /* Writing what other threads enqueued since the last step */
+  if (ta_xmpp_client_flush (client) != TA_OK)
+    return _ta_xmpp_client_recover (client) ? TA_OK : TA_ERROR;
+
+  /* Never sleeping past the deadline of a pending request nor while
+   * there are stanzas to write */
+  deadline = ta_xmpp_client_get_timeout (client);
+  if (deadline >= 0 && (timeout < 0 || deadline < timeout))
+    timeout = (int) deadline;
+  if (_ta_xmpp_client_has_writes (client))
+    timeout = 0;
+
+  ret = _ta_xmpp_client_read (client, timeout);
+  return _ta_xmpp_client_tick (client, ret);
+}
+
+int
+ta_xmpp_client_process (ta_xmpp_client_t *client, int timeout)
+{
+  if (ta_xmpp_client_is_secure (client))
+    {
+      ta_error_set (TA_XMPP_TLS_ERROR,
+                    "Secure streams can't be processed step by step, "
+                    "use ta_xmpp_client_run");
+      return TA_ERROR;
+    }
+  return _ta_xmpp_client_step (client, timeout);
+}
+
 void
 ta_xmpp_client_disconnect (ta_xmpp_client_t *client)
 {
   client->running = 0;
 
+  /* Nothing is resumed after being disconnected on purpose */
+  ta_timer_wheel_cancel (client->timers, &client->reconnect_timer);
+  ta_timer_wheel_cancel (client->timers, &client->pool_timer);
+  _ta_xmpp_client_dial_cancel (client);
+  client->reconnect_attempts = 0;
+  _sm_reset (client);
+
+  /* Failing all requests that were not answered yet, they would never
+   * be answered in a new connection anyway. The same goes for stanzas
+   * that were not written yet. */
+  ta_timer_wheel_flush (client->timers);
+  _ta_xmpp_client_queue_clear (client);
+
   /* These fields are going to be filled again by the connect
    * method if called again. */
   if (client->parser)
@@ -575,89 +2220,117 @@ ta_xmpp_client_disconnect (ta_xmpp_client_t *client)
       iks_filter_delete (client->filter);
       client->filter = NULL;
     }
+  if (client->fd >= 0)
+    {
+      close (client->fd);
+      client->fd = -1;
+    }
   ta_log_info (client->log, "Disconnected");
 }
 
+int
+ta_xmpp_client_event_lookup (const char *name)
+{
+  int i;
+  for (i = 0; i < TA_XMPP_CLIENT_EVENT_LAST; i++)
+    if (strcmp (event_names[i], name) == 0)
+      return i;
+  return -1;
+}
+
+/* Resolves the name of an event, setting the error when it doesn't
+ * exist */
+static int
+_ta_xmpp_client_event_find (const char *event)
+{
+  int id;
+  if ((id = ta_xmpp_client_event_lookup (event)) < 0)
+    ta_error_set (XMPP_NO_SUCH_EVENT_ERROR,
+                  "XMPP client has no event called %s", event);
+  return id;
+}
+
 int
 ta_xmpp_client_event_connect (ta_xmpp_client_t *client,
                               const char *event,
                               ta_xmpp_client_hook_t hook,
                               void *user_data)
 {
-  ta_list_t *hooks = NULL;
+  int id;
+  if ((id = _ta_xmpp_client_event_find (event)) < 0)
+    return 0;
+  return ta_xmpp_client_event_connect_id (client, id, hook, user_data);
+}
+
+int
+ta_xmpp_client_event_disconnect (ta_xmpp_client_t *client,
+                                 const char *event,
+                                 ta_xmpp_client_hook_t hook)
+{
+  int id;
+  if ((id = _ta_xmpp_client_event_find (event)) < 0)
+    return 0;
+  return ta_xmpp_client_event_disconnect_id (client, id, hook);
+}
+
+int
+ta_xmpp_client_event_connect_id (ta_xmpp_client_t *client,
+                                 ta_xmpp_client_event_t event,
+                                 ta_xmpp_client_hook_t hook,
+                                 void *user_data)
+{
+  struct hook_vector *vector;
   struct hook_data *hdata;
-  hdata = hdata_new (hook, user_data, NULL);
 
-  /* Looking for an already created list. If already exists, we just
-   * append a new value. Otherwise, we create it and re-add the entry
-   * to the hash table. */
-  if (!hashtable_get_test (client->events, event, (void **) &hooks))
+  if ((int) event < 0 || event >= TA_XMPP_CLIENT_EVENT_LAST)
     {
       ta_error_set (XMPP_NO_SUCH_EVENT_ERROR,
-                    "XMPP client has no event called %s",
-                    event);
+                    "XMPP client has no event %d", event);
       return 0;
     }
-  if (hooks == NULL)
+
+  /* The vector grows by doubling, hooks are rarely connected */
+  vector = &client->events[event];
+  if (vector->count == vector->size)
     {
-      hooks = ta_list_append (hooks, hdata);
-      hashtable_set (client->events, (void *) event, hooks);
+      vector->size = vector->size ? vector->size * 2 : 4;
+      vector->hooks = realloc (vector->hooks,
+                               sizeof (struct hook_data) * vector->size);
     }
-  else
-    hooks = ta_list_append (hooks, hdata);
+  hdata = &vector->hooks[vector->count++];
+  hdata->hook = hook;
+  hdata->data = user_data;
   return 1;
 }
 
 int
-ta_xmpp_client_event_disconnect (ta_xmpp_client_t *client,
-                                 const char *event,
-                                 ta_xmpp_client_hook_t hook)
+ta_xmpp_client_event_disconnect_id (ta_xmpp_client_t *client,
+                                    ta_xmpp_client_event_t event,
+                                    ta_xmpp_client_hook_t hook)
 {
-  ta_list_t *hooks = NULL, *tmp = NULL, *elm = NULL, *removed = NULL;
+  struct hook_vector *vector;
+  int i;
 
-  /* Looks for the hook list in event hash table. If it is found, the
-   * hook is removed from the list and then the hook list is
-   * re-inserted in the hash table. This only works because the
-   * _insert function of the hash table replaces entries with same
-   * keys. */
-  if (!hashtable_get_test (client->events, event, (void **) &hooks))
+  if ((int) event < 0 || event >= TA_XMPP_CLIENT_EVENT_LAST)
     {
       ta_error_set (XMPP_NO_SUCH_EVENT_ERROR,
-                    "XMPP client has no event called %s",
-                    event);
+                    "XMPP client has no event %d", event);
       return 0;
     }
 
-  /* Nothing will work if hooks is NULL. */
-  tmp = hooks;
-  while (tmp)
-    {
-      /* The `tmp' element should be preserved because of the loop,
-       * let's cache its current value in the `elm' var and continue
-       * to iterate over the list. */
-      elm = tmp;
-      tmp = tmp->next;
-
-       /* If hook is null, all events are going to match this and will
-        * be deleted. */
-      if (hook != NULL && ((struct hook_data *) elm->data)->hook != hook)
-        continue;
-
-      /* We cannot use ta_list_remove function directly because we
-       * receive the hook reference that is just a member of the
-       * hook_data struct stored in the list iter. So, before removing
-       * we have to find the right element. It is done by the above
-       * `if' statement. */
-      hooks = ta_list_remove (hooks, elm->data, &removed);
-      if (removed)
-        {
-          hdata_free (removed->data);
-          free (removed);
-        }
-    }
-
-  /* Updating callback list in the event hashtable. */
-  hashtable_set (client->events, (void *) event, hooks);
+  /* If hook is null, all hooks match and are removed. Hooks are only
+   * marked here, moving the others down while the event is being
+   * dispatched would make the dispatch skip them. */
+  vector = &client->events[event];
+  for (i = 0; i < vector->count; i++)
+    if (vector->hooks[i].hook != NULL &&
+        (hook == NULL || vector->hooks[i].hook == hook))
+      {
+        vector->hooks[i].hook = NULL;
+        vector->dead = 1;
+      }
+  if (vector->dispatching == 0 && vector->dead)
+    _hook_vector_compact (vector);
   return 1;
 }
 
@@ -669,6 +2342,7 @@ _make_bind (ta_xmpp_client_t *client)
   iks *x, *y, *z;
   x = iks_new("iq");
   iks_insert_attrib(x, "type", "set");
+  iks_insert_attrib(x, "id", "bind");
   y = iks_insert(x, "bind");
   iks_insert_attrib(y, "xmlns", IKS_NS_XMPP_BIND);
   if (client->id->resource != NULL)
@@ -681,26 +2355,161 @@ _make_bind (ta_xmpp_client_t *client)
   iks_delete(x);
 }
 
+/* Binds a resource to a new session */
+static void
+_make_session (ta_xmpp_client_t *client)
+{
+  if (client->features & IKS_STREAM_BIND)
+    _make_bind (client);
+  if (client->features & IKS_STREAM_SESSION)
+    {
+      iks *x;
+      x = iks_make_session ();
+      iks_insert_attrib (x, "id", "auth");
+      iks_send (client->parser, x);
+      iks_delete (x);
+    }
+}
+
+/* Asks the server to resume the stream that was broken */
+static void
+_sm_resume (ta_xmpp_client_t *client)
+{
+  iks *x;
+  char h[16];
+
+  snprintf (h, sizeof (h), "%u", client->sm_inbound);
+  x = iks_new ("resume");
+  iks_insert_attrib (x, "xmlns", NS_SM);
+  iks_insert_attrib (x, "h", h);
+  iks_insert_attrib (x, "previd", client->sm_id);
+  iks_send (client->parser, x);
+  iks_delete (x);
+  ta_log_info (client->log, "Resuming stream %s", client->sm_id);
+}
+
+/* Called when the server answers the resource binding. Stream
+ * management is enabled in the new session when it is supported. */
+static void
+_on_bound (ta_xmpp_client_t *client)
+{
+  client->sm_state = SM_OFF;
+  if (client->use_sm && client->sm_supported)
+    {
+      client->sm_state = SM_ENABLING;
+      client->sm_inbound = 0;
+      client->sm_acked = 0;
+      client->sm_unrequested = 0;
+      iks_send_raw (client->parser,
+                    "<enable xmlns='" NS_SM "' resume='true'/>");
+    }
+
+  /* Stanzas that were not acknowledged in the previous stream are
+   * sent again, they are only kept if the new one has stream
+   * management too */
+  if (client->sm_ring_count > 0)
+    ta_log_info (client->log, "Sending %u stanzas of the previous "
+                 "stream again", client->sm_ring_count);
+  _sm_replay (client);
+  if (client->sm_state == SM_OFF)
+    _sm_forget (client);
+}
+
+/* Resumes the previous stream or binds a new session in an
+ * authenticated one */
+static void
+_open_session (ta_xmpp_client_t *client)
+{
+  if (client->sm_id != NULL && client->sm_supported)
+    {
+      _sm_resume (client);
+      return;
+    }
+
+  /* The previous stream can't be resumed, its stanzas are sent again
+   * once the new session is bound */
+  if (client->sm_id != NULL)
+    {
+      free (client->sm_id);
+      client->sm_id = NULL;
+      client->sm_state = SM_OFF;
+    }
+  _make_session (client);
+}
+
+/* Looks for the zlib method in the compression feature */
+static int
+_compress_offered (iks *node)
+{
+  iks *method;
+  char *cdata;
+
+  node = iks_find_with_attrib (node, "compression", "xmlns",
+                               NS_FEATURE_COMPRESS);
+  if (node == NULL)
+    return 0;
+  for (method = iks_first_tag (node); method; method = iks_next_tag (method))
+    if (strcmp (iks_name (method), "method") == 0 &&
+        (cdata = iks_cdata (iks_child (method))) != NULL &&
+        strcmp (cdata, "zlib") == 0)
+      return 1;
+  return 0;
+}
+
+/* Asks the server to compress the stream when it is worth it. There
+ * is nothing to gain on a stream already encrypted, TLS compresses it
+ * or the data is not compressible anymore. */
+static int
+_compress_request (ta_xmpp_client_t *client)
+{
+#ifdef HAVE_ZLIB
+  if (client->compress_level <= 0 || !client->compress_offered ||
+      client->compress == NULL || ta_compress_is_active (client->compress)
+      || iks_is_secure (client->parser))
+    return 0;
+  iks_send_raw (client->parser, "<compress xmlns='" NS_COMPRESS "'>"
+                "<method>zlib</method></compress>");
+  return 1;
+#else
+  (void) client;
+  return 0;
+#endif
+}
+
+/* Handles the answer to a compression request. The stream is
+ * restarted over zlib when the server accepts it. */
+static void
+_on_compress (ta_xmpp_client_t *client, const char *name)
+{
+#ifdef HAVE_ZLIB
+  if (strcmp (name, "compressed") == 0 && client->compress != NULL &&
+      ta_compress_start (client->compress) == TA_OK)
+    {
+      ta_log_info (client->log, "Stream compressed with zlib level %d",
+                   client->compress_level);
+      iks_send_header (client->parser, client->id->server);
+      return;
+    }
+#endif
+  ta_log_warn (client->log, "Stream compression failed: %s", name);
+  _open_session (client);
+}
+
 static void
 _on_features (ta_xmpp_client_t *client, iks *node)
 {
   client->features = iks_stream_features (node);
+  client->sm_supported =
+    iks_find_with_attrib (node, "sm", "xmlns", NS_SM) != NULL;
+  client->compress_offered = _compress_offered (node);
   if (client->use_sasl)
     {
       if (client->use_tls && !iks_is_secure (client->parser))
         return;
       if (client->authenticated)
         {
-          if (client->features & IKS_STREAM_BIND)
-            _make_bind (client);
-          if (client->features & IKS_STREAM_SESSION)
-            {
-              iks *x;
-              x = iks_make_session ();
-              iks_insert_attrib (x, "id", "auth");
-              iks_send (client->parser, x);
-              iks_delete (x);
-            }
+          if (!_compress_request (client))
+            _open_session (client);
         }
       else
         {
@@ -719,18 +2528,89 @@ _on_success (ta_xmpp_client_t *client)
 {
   iks_send_header (client->parser, client->id->server);
   client->authenticated = 1;
+  client->reconnect_attempts = 0;
   ta_log_info (client->log, "authentication successful");
 }
 
+/* Handles the `h' attribute of an acknowledgement */
+static void
+_on_sm_ack (ta_xmpp_client_t *client, const char *h)
+{
+  if (h != NULL && _sm_ack (client, strtoul (h, NULL, 10)) > 0)
+    _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_ACKED,
+                                      &client->sm_acked_total);
+}
+
+/* Handles the elements of the stream management namespace */
+static void
+_on_sm (ta_xmpp_client_t *client, const char *name, iks *node)
+{
+  char *h = iks_find_attrib (node, "h");
+  char *resume, *id, ack[64];
+
+  if (strcmp (name, "r") == 0)
+    {
+      snprintf (ack, sizeof (ack), "<a xmlns='" NS_SM "' h='%u'/>",
+                client->sm_inbound);
+      iks_send_raw (client->parser, ack);
+    }
+  else if (strcmp (name, "a") == 0)
+    _on_sm_ack (client, h);
+  else if (strcmp (name, "enabled") == 0)
+    {
+      resume = iks_find_attrib (node, "resume");
+      id = iks_find_attrib (node, "id");
+      client->sm_state = SM_ON;
+      if (client->sm_id)
+        free (client->sm_id);
+      client->sm_id = NULL;
+      if (id != NULL && resume != NULL &&
+          (strcmp (resume, "true") == 0 || strcmp (resume, "1") == 0))
+        client->sm_id = strdup (id);
+      ta_log_info (client->log, "Stream management enabled%s",
+                   client->sm_id ? ", the stream can be resumed" : "");
+    }
+  else if (strcmp (name, "resumed") == 0)
+    {
+      _on_sm_ack (client, h);
+      client->sm_state = SM_ON;
+      ta_log_info (client->log, "Stream %s resumed, sending %u stanzas "
+                   "again", client->sm_id, client->sm_ring_count);
+      _sm_replay (client);
+      _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_RESUMED, NULL);
+    }
+  else if (strcmp (name, "failed") == 0)
+    {
+      if (client->sm_state == SM_RESUMING)
+        {
+          /* Stanzas that the server says it got are not sent again */
+          _on_sm_ack (client, h);
+          ta_log_warn (client->log, "Stream %s could not be resumed",
+                       client->sm_id);
+          free (client->sm_id);
+          client->sm_id = NULL;
+          client->sm_state = SM_OFF;
+          _make_session (client);
+        }
+      else
+        {
+          ta_log_warn (client->log, "Stream management could not be "
+                       "enabled");
+          _sm_reset (client);
+        }
+    }
+}
+
 static int
 _ta_xmpp_client_hook (void *data, int type, iks *node)
 {
   ta_xmpp_client_t *client;
-  char *name, *stype = NULL, *id = NULL;
+  char *name, *stype = NULL, *id = NULL, *xmlns = NULL;
   client = (ta_xmpp_client_t *) data;
   name = iks_name (node);
   stype = iks_find_attrib (node, "type");
   id = iks_find_attrib (node, "id");
+  xmlns = iks_find_attrib (node, "xmlns");
 
   switch (type)
     {
@@ -748,14 +2628,28 @@ _ta_xmpp_client_hook (void *data, int type, iks *node)
       break;
 
     case IKS_NODE_NORMAL:
-      if (strcmp (name, "stream:features") == 0)
+      /* Stanzas received are counted for the acknowledgements */
+      if (client->sm_state == SM_ON &&
+          (strcmp (name, "message") == 0 || strcmp (name, "presence") == 0
+           || strcmp (name, "iq") == 0))
+        client->sm_inbound++;
+
+      if (xmlns != NULL && strcmp (xmlns, NS_SM) == 0)
+        _on_sm (client, name, node);
+      else if (xmlns != NULL && strcmp (xmlns, NS_COMPRESS) == 0)
+        _on_compress (client, name);
+      else if (strcmp (name, "stream:features") == 0)
         _on_features (client, node);
       else if (strcmp (name, "success") == 0)
         _on_success (client);
       else if (strcmp (name, "iq") == 0 &&
                (stype != NULL && strcmp (stype, "result") == 0) &&
                (id != NULL && strcmp (id, "auth") == 0))
-        _ta_xmpp_client_call_event_hooks (client, "authenticated", NULL);
+        _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_AUTHENTICATED, NULL);
+      else if (strcmp (name, "iq") == 0 &&
+               (stype != NULL && strcmp (stype, "result") == 0) &&
+               (id != NULL && strcmp (id, "bind") == 0))
+        _on_bound (client);
       else if (strcmp (name, "failure") == 0)
         {
           ikspak *pak;
@@ -763,7 +2657,7 @@ _ta_xmpp_client_hook (void *data, int type, iks *node)
 
           /* Calling hooks for `authentication-failed' event. */
           pak = iks_packet (node);
-          _ta_xmpp_client_call_event_hooks (client, "authentication-failed",
+          _ta_xmpp_client_call_event_hooks (client, TA_XMPP_CLIENT_EVENT_AUTH_FAILED,
                                             pak);
         }
       else if (client->filter != NULL)
@@ -774,12 +2668,10 @@ _ta_xmpp_client_hook (void *data, int type, iks *node)
         }
       break;
     case IKS_NODE_ERROR:
-      {
-        char *node_str;
-        node_str = iks_string (iks_stack (node), node);
-        ta_log_error (client->log, "Error stream: %s", node_str);
-        break;
-      }
+      /* The node is only serialized when the message is logged */
+      TA_LOG (client->log, TA_LOG_ERROR, "Error stream: %s",
+              iks_string (iks_stack (node), node));
+      break;
     }
 
   if (node)
@@ -789,6 +2681,52 @@ _ta_xmpp_client_hook (void *data, int type, iks *node)
 }
 
 
+/* Drops all stanzas in the outbound queue */
+static void
+_ta_xmpp_client_queue_clear (ta_xmpp_client_t *client)
+{
+  struct queue_node *node;
+  while ((node = _queue_take (client)) != NULL)
+    _queue_node_free (node);
+}
+
+/* Translates the return value of `iks_recv()' to taningia errors,
+ * stopping the client when the connection is not usable anymore. */
+static int
+_ta_xmpp_client_check_recv (ta_xmpp_client_t *client, int err)
+{
+  switch (err)
+    {
+    case IKS_HOOK:
+    case IKS_OK:
+      return TA_OK;
+
+    case IKS_NET_NOCONN:
+      if (_ta_xmpp_client_recover (client))
+        return TA_OK;
+      ta_log_info (client->log, "Client not connected, stopping main loop");
+      client->running = 0;
+      return TA_OK;
+
+    case IKS_NET_RWERR:
+      ta_log_error (client->log, "Network error");
+      ta_error_set (TA_XMPP_NETWORK_ERROR, "Network Error");
+      break;
+
+    case IKS_NET_TLSFAIL:
+      ta_log_error (client->log, "TLS handshake failed");
+      ta_error_set (TA_XMPP_TLS_ERROR, "TLS handshake failed");
+      break;
+
+    default:
+      ta_log_error (client->log, "IO error");
+      ta_error_set (TA_XMPP_IO_ERROR, "IO Error");
+      break;
+    }
+  client->running = 0;
+  return TA_ERROR;
+}
+
 static int
 _ta_xmpp_client_do_run (void *user_data)
 {
@@ -798,41 +2736,7 @@ _ta_xmpp_client_do_run (void *user_data)
   client = (ta_xmpp_client_t *) user_data;
 
   while (client->running)
-    {
-      switch (iks_recv (client->parser, -1))
-        {
-        case IKS_HOOK:
-        case IKS_OK:
-          break;
-
-        case IKS_NET_NOCONN:
-          ta_log_info (client->log,
-                       "Client not connected, stopping main loop");
-          client->running = 0;
-          break;
-
-        case IKS_NET_RWERR:
-          ta_log_error (client->log, "Network error");
-          ta_error_set (TA_XMPP_NETWORK_ERROR, "Network Error");
-          client->running = 0;
-          ret = TA_ERROR;
-          break;
-
-        case IKS_NET_TLSFAIL:
-          ta_log_error (client->log, "TLS handshake failed");
-          ta_error_set (TA_XMPP_TLS_ERROR, "TLS handshake failed");
-          client->running = 0;
-          ret = TA_ERROR;
-          break;
-
-        default:
-          ta_log_error (client->log, "IO error");
-          ta_error_set (TA_XMPP_IO_ERROR, "IO Error");
-          client->running = 0;
-          ret = TA_ERROR;
-          break;
-        }
-    }
+    ret = _ta_xmpp_client_step (client, -1);
   ta_log_info (client->log, "Main loop thread dying");
   return ret;
 }
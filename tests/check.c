@@ -27,6 +27,20 @@ Suite *list_suite (void);
 Suite *iri_suite (void);
 Suite *error_suite (void);
 Suite *buf_suite (void);
+Suite *timer_suite (void);
+Suite *xmpp_suite (void);
+Suite *pubsub_suite (void);
+Suite *idgen_suite (void);
+Suite *log_suite (void);
+Suite *logsink_suite (void);
+Suite *atom_suite (void);
+Suite *srv_suite (void);
+Suite *pool_suite (void);
+Suite *publisher_suite (void);
+Suite *fetcher_suite (void);
+#ifdef ENABLE_REACTOR_CHECKS
+Suite *reactor_suite (void);
+#endif
 
 int
 main (void)
@@ -41,6 +55,20 @@ main (void)
   srunner_add_suite(sr, iri_suite ());
   srunner_add_suite(sr, error_suite ());
   srunner_add_suite(sr, buf_suite ());
+  srunner_add_suite(sr, timer_suite ());
+  srunner_add_suite(sr, xmpp_suite ());
+  srunner_add_suite(sr, pubsub_suite ());
+  srunner_add_suite(sr, idgen_suite ());
+  srunner_add_suite(sr, log_suite ());
+  srunner_add_suite(sr, logsink_suite ());
+  srunner_add_suite(sr, atom_suite ());
+  srunner_add_suite(sr, srv_suite ());
+  srunner_add_suite(sr, pool_suite ());
+  srunner_add_suite(sr, publisher_suite ());
+  srunner_add_suite(sr, fetcher_suite ());
+#ifdef ENABLE_REACTOR_CHECKS
+  srunner_add_suite(sr, reactor_suite ());
+#endif
 
   srunner_run_all (sr, CK_NORMAL);
   number_failed = srunner_ntests_failed (sr);
@@ -0,0 +1,126 @@
+/* check_atom.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <taningia/atom.h>
+#include <taningia/list.h>
+#include <taningia/error.h>
+
+/* Builds an entry with whitespace between its children, like the ones
+ * written by people */
+static iks *
+_build_entry (iks *parent, const char *id, int with_title)
+{
+  iks *entry, *node;
+  entry = parent ? iks_insert (parent, "entry") : iks_new ("entry");
+  iks_insert_cdata (entry, "\n  ", 0);
+  if (id)
+    iks_insert_cdata (iks_insert (entry, "id"), id, 0);
+  iks_insert_cdata (entry, "\n  ", 0);
+  if (with_title)
+    iks_insert_cdata (iks_insert (entry, "title"), "Hello", 0);
+  node = iks_insert (entry, "author");
+  iks_insert_cdata (node, "\n    ", 0);
+  iks_insert_cdata (iks_insert (node, "name"), "Lincoln", 0);
+  iks_insert_cdata (iks_insert (node, "email"), "lincoln@comum.org", 0);
+  node = iks_insert (entry, "link");
+  iks_insert_attrib (node, "href", "http://comum.org/hello");
+  iks_insert_attrib (node, "rel", "alternate");
+  node = iks_insert (entry, "in-reply-to");
+  iks_insert_attrib (node, "ref", "http://comum.org/1");
+  node = iks_insert (entry, "content");
+  iks_insert_cdata (node, "Some text", 0);
+  iks_insert_cdata (entry, "\n", 0);
+  return entry;
+}
+
+
+START_TEST (test_atom_entry_from_iks)
+{
+  /* Given that I have an entry element */
+  ta_atom_entry_t *entry = ta_atom_entry_new (NULL);
+  ta_atom_person_t *author;
+  ta_atom_link_t *link;
+  iks *ik = _build_entry (NULL, "http://comum.org/hello", 1);
+
+  /* When I load it */
+  fail_unless (ta_atom_entry_set_from_iks (entry, ik) == 1,
+               "Entry should be parsed");
+
+  /* Then I see all its children */
+  fail_unless (strcmp (ta_atom_entry_get_title (entry), "Hello") == 0,
+               "Wrong title");
+  fail_unless (ta_list_len (ta_atom_entry_get_authors (entry)) == 1,
+               "Wrong number of authors");
+  author = ta_atom_entry_get_authors (entry)->data;
+  fail_unless (strcmp (ta_atom_person_get_name (author), "Lincoln") == 0,
+               "Wrong author name");
+  fail_unless (ta_list_len (ta_atom_entry_get_links (entry)) == 1,
+               "Wrong number of links");
+  link = ta_atom_entry_get_links (entry)->data;
+  fail_unless (strcmp (ta_atom_link_get_rel (link), "alternate") == 0,
+               "Wrong link rel");
+  fail_unless (ta_list_len (ta_atom_entry_get_inreplyto (entry)) == 1,
+               "Wrong number of in-reply-to elements");
+  fail_unless (ta_atom_entry_get_content (entry) != NULL, "No content");
+
+  iks_delete (ik);
+  ta_object_unref (entry);
+}
+END_TEST
+
+
+START_TEST (test_atom_feed_from_iks)
+{
+  /* Given that I have a feed with a broken entry among good ones */
+  ta_atom_feed_t *feed = ta_atom_feed_new (NULL);
+  iks *ik = iks_new ("feed");
+  iks_insert_cdata (iks_insert (ik, "id"), "http://comum.org/", 0);
+  iks_insert_cdata (iks_insert (ik, "title"), "Comum", 0);
+  _build_entry (ik, "http://comum.org/1", 1);
+  _build_entry (ik, "http://comum.org/2", 0);
+  _build_entry (ik, NULL, 1);
+  _build_entry (ik, "http://comum.org/3", 1);
+
+  /* When I load it */
+  fail_unless (ta_atom_feed_set_from_iks (feed, ik) == 1,
+               "Feed should be parsed");
+
+  /* Then I see that only the broken entries were skipped */
+  fail_unless (ta_list_len (ta_atom_feed_get_entries (feed)) == 2,
+               "Wrong number of entries");
+  fail_unless (ta_error_last () == NULL, "Error should be cleared");
+
+  iks_delete (ik);
+  ta_object_unref (feed);
+}
+END_TEST
+
+
+Suite *
+atom_suite ()
+{
+  Suite *s = suite_create ("taningia::atom");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_atom_entry_from_iks);
+  tcase_add_test (tc_core, test_atom_feed_from_iks);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
@@ -194,6 +194,49 @@ START_TEST (test_buf_dump_empty)
 END_TEST
 
 
+START_TEST (test_buf_ncat)
+{
+  /* Given that I have a new buffer */
+  ta_buf_t b = TA_BUF_INIT;
+  ta_buf_alloc (&b, 4);
+
+  /* When I append only a piece of a bigger string */
+  ta_buf_ncat (&b, "lincoln de sousa", 7);
+  ta_buf_ncat (&b, "!?", 1);
+
+  /* Then I see that only the requested bytes were copied */
+  fail_unless (strcmp (ta_buf_cstr (&b), "lincoln!") == 0, "Wrong string");
+  fail_unless (b.string_length == 8, "Wrong string length");
+  ta_buf_dealloc (&b);
+}
+END_TEST
+
+
+START_TEST (test_buf_reset)
+{
+  /* Given that I have a buffer with some stuff inside */
+  int allocated;
+  ta_buf_t b = TA_BUF_INIT;
+  ta_buf_alloc (&b, 8);
+  ta_buf_cat (&b, "some content that is big enough");
+  allocated = b.allocated_size;
+
+  /* When I reset it */
+  ta_buf_reset (&b);
+
+  /* Then I see that the string is empty but the memory is kept */
+  fail_unless (b.string_length == 0, "The string length must be 0 after a reset");
+  fail_unless (b.allocated_size == allocated, "Reset should not release memory");
+  fail_unless (strcmp (ta_buf_cstr (&b), "") == 0, "The string should be empty");
+
+  /* And I see that it can be used again */
+  ta_buf_cat (&b, "again");
+  fail_unless (strcmp (ta_buf_cstr (&b), "again") == 0, "Wrong string after reset");
+  ta_buf_dealloc (&b);
+}
+END_TEST
+
+
 Suite *
 buf_suite ()
 {
@@ -207,6 +250,8 @@ buf_suite ()
   tcase_add_test (tc_core, test_buf_dealloc);
   tcase_add_test (tc_core, test_buf_dump);
   tcase_add_test (tc_core, test_buf_dump_empty);
+  tcase_add_test (tc_core, test_buf_ncat);
+  tcase_add_test (tc_core, test_buf_reset);
   suite_add_tcase (s, tc_core);
   return s;
 }
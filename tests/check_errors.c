@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <taningia/error.h>
+#include <taningia/global.h>
 
 
 START_TEST (test_error_last_first_call_must_be_null)
@@ -91,6 +92,71 @@ START_TEST (test_error_clear)
 END_TEST
 
 
+START_TEST (test_error_last_code)
+{
+  /* Given that I set an error */
+  ta_error_set (42, "Error %d", 42);
+
+  /* When I only check its code */
+  /* Then I see the code */
+  fail_unless (ta_error_last_code () == 42, "Wrong error code");
+
+  /* When I clear the error */
+  ta_error_clear ();
+
+  /* Then I see that no code is set */
+  fail_unless (ta_error_last_code () == TA_OK, "Code should be cleared");
+}
+END_TEST
+
+
+START_TEST (test_error_set_from_last)
+{
+  const ta_error_t *error;
+  char arg[200];
+
+  /* Given that I read a short error */
+  ta_error_set (1, "Short");
+  error = ta_error_last ();
+
+  /* When I set a longer one with the message of the last one */
+  memset (arg, 'x', sizeof (arg) - 1);
+  arg[sizeof (arg) - 1] = '\0';
+  ta_error_set (2, "%s: %s", error->message, arg);
+  error = ta_error_last ();
+
+  /* Then I see both messages */
+  fail_unless (error->code == 2, "Wrong error code");
+  fail_unless (strncmp (error->message, "Short: xxx", 10) == 0,
+               "Wrong error message");
+  fail_unless (strlen (error->message) == 7 + sizeof (arg) - 1,
+               "Message truncated");
+}
+END_TEST
+
+
+START_TEST (test_error_setup_again)
+{
+  const ta_error_t *error;
+
+  /* Given that I set an error and tear the global state down */
+  ta_error_set (1, "Before teardown");
+  ta_global_state_teardown ();
+
+  /* When I set it up again and set another error */
+  ta_global_state_setup ();
+  fail_unless (ta_error_last () == NULL, "State should start clean");
+  ta_error_set (2, "After setup");
+  error = ta_error_last ();
+
+  /* Then I see the new error */
+  fail_unless (error != NULL && error->code == 2, "Wrong error code");
+  fail_unless (strcmp (error->message, "After setup") == 0,
+               "Wrong error message");
+}
+END_TEST
+
+
 Suite *
 error_suite ()
 {
@@ -100,6 +166,9 @@ error_suite ()
   tcase_add_test (tc_core, test_error_set);
   tcase_add_test (tc_core, test_error_set_twice);
   tcase_add_test (tc_core, test_error_clear);
+  tcase_add_test (tc_core, test_error_last_code);
+  tcase_add_test (tc_core, test_error_set_from_last);
+  tcase_add_test (tc_core, test_error_setup_again);
   suite_add_tcase (s, tc_core);
   return s;
 }
@@ -0,0 +1,163 @@
+/* check_fetcher.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <taningia/error.h>
+#include <taningia/timer.h>
+#include <taningia/fetcher.h>
+#include "fixtures.h"
+
+/* The fake node and the most items the fake server sends at once */
+#define NODE_SIZE 120
+#define SERVER_MAX 50
+
+/* What the fetcher reported */
+struct results {
+  int items;
+  int done;
+  int status;
+};
+
+static int
+_item_cb (const ta_pubsub_event_t *TA_UNUSED(event), void *data)
+{
+  ((struct results *) data)->items++;
+  return 0;
+}
+
+static void
+_done_cb (ta_pubsub_fetcher_t *TA_UNUSED(fetcher), int status, void *data)
+{
+  struct results *results = (struct results *) data;
+  results->done = 1;
+  results->status = status;
+}
+
+/* Copies the value of the attribute or the text that follows `mark'
+ * in `start' to `out'. Returns NULL if it is not found. */
+static char *
+_read_value (const char *start, const char *mark, char end, char *out,
+             size_t size)
+{
+  const char *value, *stop;
+  if ((value = strstr (start, mark)) == NULL)
+    return NULL;
+  value += strlen (mark);
+  if ((stop = strchr (value, end)) == NULL ||
+      (size_t) (stop - value) >= size)
+    return NULL;
+  memcpy (out, value, stop - value);
+  out[stop - value] = '\0';
+  return out;
+}
+
+/* Answers the page requests written by the client with at most
+ * SERVER_MAX items of a node holding NODE_SIZE items named after their
+ * positions. Returns how many requests were answered. */
+static int
+_server_answer (ta_xmpp_client_t *client, int fd)
+{
+  char buf[4096], reply[8192], id[64], after[64], *iq, *next;
+  int count = 0, first, i;
+  size_t len;
+
+  fixture_server_read (fd, buf, sizeof (buf));
+  for (iq = strstr (buf, "<iq "); iq; iq = next)
+    {
+      if ((next = strstr (iq + 1, "<iq ")) != NULL)
+        next[-1] = '\0';
+      if (_read_value (iq, "id='", '\'', id, sizeof (id)) == NULL)
+        break;
+      first = 0;
+      if (_read_value (iq, "<after>", '<', after, sizeof (after)) != NULL)
+        first = atoi (after) + 1;
+
+      len = snprintf (reply, sizeof (reply),
+                      "<iq type='result' id='%s'><pubsub "
+                      "xmlns='http://jabber.org/protocol/pubsub'>"
+                      "<items node='node'>", id);
+      for (i = first; i < NODE_SIZE && i < first + SERVER_MAX; i++)
+        len += snprintf (reply + len, sizeof (reply) - len,
+                         "<item id='%d'/>", i);
+      len += snprintf (reply + len, sizeof (reply) - len,
+                       "</items><set xmlns='http://jabber.org/protocol/rsm'>"
+                       "<first index='%d'>%d</first><last>%d</last>"
+                       "<count>%d</count></set></pubsub></iq>",
+                       first, first, i - 1, NODE_SIZE);
+      if (write (fd, reply, len) < 0)
+        break;
+      count++;
+    }
+  ta_xmpp_client_process (client, 100);
+  return count;
+}
+
+START_TEST (test_fetcher_short_pages)
+{
+  /* Given that I have a fetcher asking for pages bigger than what the
+   * server sends at once */
+  ta_xmpp_client_t *client;
+  ta_pubsub_fetcher_t *fetcher;
+  struct results results = { 0, 0, TA_ERROR };
+  unsigned long start;
+  int peer;
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  fetcher = ta_pubsub_fetcher_new (client, "lincoln@localhost",
+                                   "pubsub.localhost", "node", 100);
+
+  /* When I fetch all the items of the node */
+  fail_unless (ta_pubsub_fetcher_start (fetcher, 0, _item_cb, _done_cb,
+                                        &results) == TA_OK,
+               "Fetcher should start");
+  start = ta_timer_now ();
+  while (!results.done)
+    {
+      fail_unless (ta_timer_now () - start < 2000, "Fetcher got stuck");
+      _server_answer (client, peer);
+    }
+
+  /* Then I see that no item was left behind */
+  fail_unless (results.status == TA_OK, "Fetcher should succeed");
+  fail_unless (results.items == NODE_SIZE, "All the items should be seen");
+  fail_unless (ta_pubsub_fetcher_get_fetched (fetcher) == NODE_SIZE,
+               "Wrong number of fetched items");
+
+  ta_object_unref (fetcher);
+  ta_xmpp_client_disconnect (client);
+  ta_object_unref (client);
+  close (peer);
+}
+END_TEST
+
+Suite *
+fetcher_suite ()
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create ("Fetcher");
+  tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_fetcher_short_pages);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
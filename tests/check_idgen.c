@@ -0,0 +1,139 @@
+/* check_idgen.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <taningia/taningia.h>
+
+#define THREADS 4
+#define IDS_PER_THREAD 1000
+
+
+struct thread_ids {
+  ta_idgen_t *gen;
+  char (*ids)[TA_IDGEN_ID_SIZE];
+};
+
+static void *
+_generate (void *data)
+{
+  struct thread_ids *tids = (struct thread_ids *) data;
+  int i;
+  for (i = 0; i < IDS_PER_THREAD; i++)
+    ta_idgen_next (tids->gen, tids->ids[i]);
+  return NULL;
+}
+
+static int
+_compare (const void *a, const void *b)
+{
+  return strcmp ((const char *) a, (const char *) b);
+}
+
+
+START_TEST (test_idgen_next)
+{
+  /* Given that I have a new generator */
+  char id[TA_IDGEN_ID_SIZE], other[TA_IDGEN_ID_SIZE];
+  const char *prefix;
+  int len;
+  ta_idgen_t *gen = ta_idgen_new ();
+  prefix = ta_idgen_get_prefix (gen);
+
+  /* When I take two ids from it */
+  len = ta_idgen_next (gen, id);
+  ta_idgen_next (gen, other);
+
+  /* Then I see that both start with the prefix and are different */
+  fail_unless (strlen (prefix) == TA_IDGEN_PREFIX_SIZE + 1,
+               "Wrong prefix size");
+  fail_unless (len == (int) strlen (id), "Wrong length returned");
+  fail_unless (strncmp (id, prefix, strlen (prefix)) == 0,
+               "Id should start with the prefix");
+  fail_unless (strcmp (id, other) != 0, "Ids should be different");
+
+  ta_object_unref (gen);
+}
+END_TEST
+
+
+START_TEST (test_idgen_prefix)
+{
+  /* Given that I have two generators */
+  ta_idgen_t *gen1 = ta_idgen_new ();
+  ta_idgen_t *gen2 = ta_idgen_new ();
+
+  /* Then I see that their prefixes are different */
+  fail_unless (strcmp (ta_idgen_get_prefix (gen1),
+                       ta_idgen_get_prefix (gen2)) != 0,
+               "Generators should not share prefixes");
+
+  /* And that the default generator is always the same */
+  fail_unless (ta_idgen_get_default () == ta_idgen_get_default (),
+               "Default generator should be shared");
+
+  ta_object_unref (gen1);
+  ta_object_unref (gen2);
+}
+END_TEST
+
+
+START_TEST (test_idgen_threads)
+{
+  /* Given that I have a generator shared by many threads */
+  pthread_t threads[THREADS];
+  struct thread_ids tids[THREADS];
+  char (*ids)[TA_IDGEN_ID_SIZE];
+  ta_idgen_t *gen = ta_idgen_new ();
+  int i;
+  ids = malloc (TA_IDGEN_ID_SIZE * THREADS * IDS_PER_THREAD);
+
+  /* When all of them take ids at the same time */
+  for (i = 0; i < THREADS; i++)
+    {
+      tids[i].gen = gen;
+      tids[i].ids = ids + i * IDS_PER_THREAD;
+      pthread_create (&threads[i], NULL, _generate, &tids[i]);
+    }
+  for (i = 0; i < THREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Then I see that no id was repeated */
+  qsort (ids, THREADS * IDS_PER_THREAD, TA_IDGEN_ID_SIZE, _compare);
+  for (i = 1; i < THREADS * IDS_PER_THREAD; i++)
+    fail_unless (strcmp (ids[i - 1], ids[i]) != 0, "Repeated id");
+
+  free (ids);
+  ta_object_unref (gen);
+}
+END_TEST
+
+
+Suite *
+idgen_suite ()
+{
+  Suite *s = suite_create ("taningia::idgen");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_idgen_next);
+  tcase_add_test (tc_core, test_idgen_prefix);
+  tcase_add_test (tc_core, test_idgen_threads);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
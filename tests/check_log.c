@@ -0,0 +1,256 @@
+/* check_log.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <taningia/common.h>
+#include <taningia/log.h>
+#include <taningia/binlog.h>
+
+struct captured {
+  int calls;
+  ta_log_level_t level;
+  char message[2048];
+};
+
+static int
+_capture_handler (ta_log_t *TA_UNUSED(logger), ta_log_level_t level,
+                  const char *message, void *data)
+{
+  struct captured *captured = (struct captured *) data;
+  captured->calls++;
+  captured->level = level;
+  strncpy (captured->message, message, sizeof (captured->message) - 1);
+  return 1;
+}
+
+struct nested {
+  ta_log_t *inner;
+  int intact;
+};
+
+static int
+_nested_handler (ta_log_t *TA_UNUSED(logger), ta_log_level_t TA_UNUSED(level),
+                 const char *message, void *data)
+{
+  struct nested *nested = (struct nested *) data;
+  ta_log_warn (nested->inner, "inner %d", 42);
+
+  /* The outer message must survive the nested call */
+  nested->intact = strcmp (message, "[][outer] outer 1") == 0;
+  return 1;
+}
+
+/* Decodes a binary log and returns the lines, the caller frees them */
+static char *
+_decode (ta_binlog_t *binlog, int *count)
+{
+  FILE *dump = tmpfile (), *out = tmpfile ();
+  char *data, *text;
+  long size;
+
+  *count = -1;
+  ta_binlog_dump (binlog, fileno (dump));
+  size = lseek (fileno (dump), 0, SEEK_END);
+  data = malloc (size);
+  if (pread (fileno (dump), data, size, 0) == size)
+    *count = ta_binlog_decode (data, size, out);
+  free (data);
+
+  size = ftell (out);
+  text = calloc (1, size + 1);
+  rewind (out);
+  if (fread (text, 1, size, out) != (size_t) size)
+    text[0] = '\0';
+  fclose (dump);
+  fclose (out);
+  return text;
+}
+
+static int
+_expensive (int *evaluated)
+{
+  (*evaluated)++;
+  return 0;
+}
+
+
+START_TEST (test_log_handler)
+{
+  /* Given that I have a log with a handler and no date */
+  struct captured captured;
+  ta_log_t *log = ta_log_new ("test");
+  memset (&captured, 0, sizeof (captured));
+  ta_log_set_handler (log, _capture_handler, &captured);
+  ta_log_set_date_format (log, "");
+
+  /* When I log messages above and below the level of the log */
+  ta_log_debug (log, "hidden %d", 1);
+  ta_log_warn (log, "shown %d", 2);
+
+  /* Then I see that only the enabled one reaches the handler */
+  fail_unless (captured.calls == 1, "Debug message should be filtered");
+  fail_unless (captured.level == TA_LOG_WARN, "Wrong level");
+  fail_unless (strcmp (captured.message, "[][test] shown 2") == 0,
+               "Wrong message format");
+
+  ta_object_unref (log);
+}
+END_TEST
+
+
+START_TEST (test_log_long_message)
+{
+  /* Given that I have a log with a handler */
+  struct captured captured;
+  char big[1500];
+  ta_log_t *log = ta_log_new ("test");
+  memset (&captured, 0, sizeof (captured));
+  memset (big, 'a', sizeof (big) - 1);
+  big[sizeof (big) - 1] = '\0';
+  ta_log_set_handler (log, _capture_handler, &captured);
+  ta_log_set_date_format (log, "");
+
+  /* When I log a message bigger than the initial buffer twice */
+  ta_log_write (log, TA_LOG_ERROR, "%s", big);
+  ta_log_write (log, TA_LOG_ERROR, "%s!", big);
+
+  /* Then I see that it was not truncated */
+  fail_unless (captured.calls == 2, "Handler should be called twice");
+  fail_unless (strlen (captured.message) == strlen ("[][test] ") +
+               sizeof (big), "Message truncated");
+  fail_unless (captured.message[strlen (captured.message) - 1] == '!',
+               "Wrong message end");
+
+  ta_object_unref (log);
+}
+END_TEST
+
+
+START_TEST (test_log_nested)
+{
+  /* Given that I have a log whose handler logs to another one */
+  struct captured captured;
+  struct nested nested;
+  ta_log_t *outer = ta_log_new ("outer");
+  ta_log_t *inner = ta_log_new ("inner");
+  memset (&captured, 0, sizeof (captured));
+  nested.inner = inner;
+  nested.intact = 0;
+  ta_log_set_date_format (outer, "");
+  ta_log_set_date_format (inner, "");
+  ta_log_set_handler (outer, _nested_handler, &nested);
+  ta_log_set_handler (inner, _capture_handler, &captured);
+
+  /* When I log a message in the outer log */
+  ta_log_error (outer, "outer %d", 1);
+
+  /* Then I see that both messages were formatted */
+  fail_unless (nested.intact, "Outer message overwritten by the inner one");
+  fail_unless (captured.calls == 1, "Inner handler not called");
+  fail_unless (strcmp (captured.message, "[][inner] inner 42") == 0,
+               "Wrong inner message");
+
+  ta_object_unref (outer);
+  ta_object_unref (inner);
+}
+END_TEST
+
+
+START_TEST (test_log_macro)
+{
+  /* Given that I have a log that only shows errors */
+  struct captured captured;
+  int evaluated = 0;
+  ta_log_t *log = ta_log_new ("test");
+  memset (&captured, 0, sizeof (captured));
+  ta_log_set_handler (log, _capture_handler, &captured);
+  ta_log_set_level (log, TA_LOG_ERROR);
+
+  /* When I use the macro with a disabled level */
+  TA_LOG (log, TA_LOG_INFO, "%d", _expensive (&evaluated));
+
+  /* Then I see that the arguments were not evaluated */
+  fail_unless (evaluated == 0, "Arguments evaluated for a disabled level");
+  fail_unless (captured.calls == 0, "Handler should not be called");
+
+  /* When I use it with an enabled level */
+  TA_LOG (log, TA_LOG_ERROR, "%d", _expensive (&evaluated));
+
+  /* Then I see the message */
+  fail_unless (evaluated == 1, "Arguments should be evaluated");
+  fail_unless (captured.calls == 1, "Handler should be called");
+
+  ta_object_unref (log);
+}
+END_TEST
+
+
+START_TEST (test_log_binlog)
+{
+  /* Given that I have a log with a small binary log */
+  ta_binlog_t *binlog = ta_binlog_new (2);
+  ta_log_t *log = ta_log_new ("test");
+  struct captured captured;
+  char *text;
+  int count;
+  memset (&captured, 0, sizeof (captured));
+  ta_log_set_handler (log, _capture_handler, &captured);
+  ta_log_set_binlog (log, binlog);
+
+  /* When I log more messages than it holds */
+  ta_log_warn (log, "first");
+  ta_log_warn (log, "%s has %d items (%.1f%%)", "alice", 3, 42.5);
+  ta_log_error (log, "%-6s|%5.2s|%x|%c", "ab", "xyz", 255, 'z');
+
+  /* Then I see that the handler was not called and that only the
+   * last ones can be decoded */
+  fail_unless (captured.calls == 0, "Handler should not be called");
+  fail_unless (ta_binlog_get_written (binlog) == 3, "Wrong written count");
+  text = _decode (binlog, &count);
+  fail_unless (count == 2, "Wrong number of records");
+  fail_unless (strstr (text, "first") == NULL, "Old record not overwritten");
+  fail_unless (strstr (text, "[  WARN ] [ ") == text, "Wrong level label");
+  fail_unless (strstr (text, "[ test ] alice has 3 items (42.5%)\n") != NULL,
+               "Wrong rendering");
+  fail_unless (strstr (text, "[ test ] ab    |   xy|ff|z\n") != NULL,
+               "Wrong rendering of flags and precision");
+
+  free (text);
+  ta_object_unref (log);
+  ta_object_unref (binlog);
+}
+END_TEST
+
+
+Suite *
+log_suite ()
+{
+  Suite *s = suite_create ("taningia::log");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_log_handler);
+  tcase_add_test (tc_core, test_log_long_message);
+  tcase_add_test (tc_core, test_log_nested);
+  tcase_add_test (tc_core, test_log_macro);
+  tcase_add_test (tc_core, test_log_binlog);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
@@ -0,0 +1,202 @@
+/* check_logsink.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <taningia/error.h>
+#include <taningia/logsink.h>
+
+#define LOGGERS 4
+#define MESSAGES_PER_LOGGER 500
+
+static void *
+_logger (void *data)
+{
+  ta_log_t *log = (ta_log_t *) data;
+  int i;
+  for (i = 0; i < MESSAGES_PER_LOGGER; i++)
+    ta_log_warn (log, "message %d", i);
+  return NULL;
+}
+
+static int
+_count_lines (FILE *file)
+{
+  int lines = 0, c;
+  rewind (file);
+  while ((c = fgetc (file)) != EOF)
+    if (c == '\n')
+      lines++;
+  return lines;
+}
+
+
+START_TEST (test_logsink_drop)
+{
+  /* Given that I have a small dropping sink that is not running */
+  ta_log_sink_stats_t stats;
+  ta_log_sink_t *sink;
+  ta_log_t *log = ta_log_new ("test");
+  FILE *file = tmpfile ();
+  char line[64];
+  int i;
+  sink = ta_log_sink_new (fileno (file), 2, TA_LOG_SINK_DROP);
+  ta_log_set_date_format (log, "");
+  ta_log_sink_attach (sink, log);
+
+  /* When I log more messages than the ring holds */
+  for (i = 0; i < 5; i++)
+    ta_log_error (log, "message %d", i);
+
+  /* Then I see that the extra ones were dropped */
+  ta_log_sink_get_stats (sink, &stats);
+  fail_unless (stats.accepted == 2, "Wrong accepted counter");
+  fail_unless (stats.dropped == 3, "Wrong dropped counter");
+  fail_unless (stats.written == 0, "Nothing should be written yet");
+
+  /* When I start and stop the sink */
+  fail_unless (ta_log_sink_start (sink) == TA_OK, "Sink should start");
+  ta_log_sink_stop (sink);
+
+  /* Then I see that the oldest messages were written */
+  ta_log_sink_get_stats (sink, &stats);
+  fail_unless (stats.written == 2, "Wrong written counter");
+  rewind (file);
+  fail_unless (fgets (line, sizeof (line), file) != NULL, "Missing line");
+  fail_unless (strcmp (line, "[ ERROR ] [][test] message 0\n") == 0,
+               "Wrong line");
+
+  ta_object_unref (log);
+  ta_object_unref (sink);
+  fclose (file);
+}
+END_TEST
+
+
+START_TEST (test_logsink_write_error)
+{
+  /* Given that I have a sink writing to a descriptor that can't be
+   * written */
+  ta_log_sink_stats_t stats;
+  ta_log_sink_t *sink;
+  ta_log_t *log = ta_log_new ("test");
+  int fd, i;
+  fd = open ("/dev/null", O_RDONLY);
+  fail_unless (fd >= 0, "Could not open /dev/null");
+  sink = ta_log_sink_new (fd, 8, TA_LOG_SINK_DROP);
+  ta_log_sink_attach (sink, log);
+
+  /* When I log some messages and let the sink write them */
+  for (i = 0; i < 3; i++)
+    ta_log_error (log, "message %d", i);
+  fail_unless (ta_log_sink_start (sink) == TA_OK, "Sink should start");
+  ta_log_sink_stop (sink);
+
+  /* Then I see that they are counted as failed, not as written */
+  ta_log_sink_get_stats (sink, &stats);
+  fail_unless (stats.written == 0, "Nothing was written");
+  fail_unless (stats.failed == 3, "Wrong failed counter");
+
+  ta_object_unref (log);
+  ta_object_unref (sink);
+  close (fd);
+}
+END_TEST
+
+
+START_TEST (test_logsink_block)
+{
+  /* Given that I have a small blocking sink shared by many threads */
+  pthread_t threads[LOGGERS];
+  ta_log_sink_stats_t stats;
+  ta_log_sink_t *sink;
+  ta_log_t *log = ta_log_new ("test");
+  FILE *file = tmpfile ();
+  int i;
+  sink = ta_log_sink_new (fileno (file), 8, TA_LOG_SINK_BLOCK);
+  ta_log_sink_attach (sink, log);
+  ta_log_sink_start (sink);
+
+  /* When they all log at the same time */
+  for (i = 0; i < LOGGERS; i++)
+    pthread_create (&threads[i], NULL, _logger, log);
+  for (i = 0; i < LOGGERS; i++)
+    pthread_join (threads[i], NULL);
+  ta_log_sink_stop (sink);
+
+  /* Then I see that no message was lost */
+  ta_log_sink_get_stats (sink, &stats);
+  fail_unless (stats.dropped == 0, "Blocking sink should not drop");
+  fail_unless (stats.written == LOGGERS * MESSAGES_PER_LOGGER,
+               "Wrong written counter");
+  fail_unless (_count_lines (file) == LOGGERS * MESSAGES_PER_LOGGER,
+               "Wrong number of lines");
+
+  ta_object_unref (log);
+  ta_object_unref (sink);
+  fclose (file);
+}
+END_TEST
+
+
+START_TEST (test_logsink_sample)
+{
+  /* Given that I have a sampling sink that is not running */
+  ta_log_sink_stats_t stats;
+  ta_log_sink_t *sink;
+  ta_log_t *log = ta_log_new ("test");
+  FILE *file = tmpfile ();
+  int i;
+  sink = ta_log_sink_new (fileno (file), 16, TA_LOG_SINK_SAMPLE);
+  ta_log_sink_set_sample_rate (sink, 2);
+  ta_log_sink_attach (sink, log);
+
+  /* When I log enough to fill three quarters of the ring and more */
+  for (i = 0; i < 20; i++)
+    ta_log_error (log, "message %d", i);
+
+  /* Then I see that every message was kept until the ring got full
+   * enough and only half of them after that */
+  ta_log_sink_get_stats (sink, &stats);
+  fail_unless (stats.accepted == 16, "Wrong accepted counter");
+  fail_unless (stats.dropped == 4, "Wrong dropped counter");
+
+  ta_object_unref (log);
+  ta_object_unref (sink);
+  fclose (file);
+}
+END_TEST
+
+
+Suite *
+logsink_suite ()
+{
+  Suite *s = suite_create ("taningia::logsink");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_logsink_drop);
+  tcase_add_test (tc_core, test_logsink_write_error);
+  tcase_add_test (tc_core, test_logsink_block);
+  tcase_add_test (tc_core, test_logsink_sample);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
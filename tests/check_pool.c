@@ -0,0 +1,161 @@
+/* check_pool.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <taningia/error.h>
+#include <taningia/timer.h>
+#include <taningia/pool.h>
+#include <taningia/xmpp.h>
+#include "fixtures.h"
+
+START_TEST (test_pool_warm)
+{
+  /* Given that I have a pool keeping two connections to a server
+   * that only listens on IPv4 */
+  ta_xmpp_pool_stats_t stats;
+  ta_xmpp_pool_t *pool;
+  unsigned long deadline;
+  int server, port, fd;
+  server = fixture_listen (&port);
+  pool = ta_xmpp_pool_new ("localhost", 2);
+  ta_xmpp_pool_set_host (pool, "localhost", port);
+  ta_xmpp_pool_set_delay (pool, 50);
+  fail_unless (ta_xmpp_pool_start (pool) == TA_OK, "Pool should start");
+
+  /* When I take a connection */
+  fd = ta_xmpp_pool_take_wait (pool, 2000);
+
+  /* Then I see that it is connected to the server */
+  fail_unless (fd >= 0, "A connection should be ready");
+  fail_unless (write (fd, "<", 1) == 1, "The connection should work");
+
+  /* And that the pool replaces it */
+  deadline = ta_timer_now () + 2000;
+  while (ta_xmpp_pool_get_ready (pool) < 2 && ta_timer_now () < deadline)
+    usleep (1000);
+  ta_xmpp_pool_get_stats (pool, &stats);
+  fail_unless (ta_xmpp_pool_get_ready (pool) == 2, "Pool should be full");
+  fail_unless (stats.connected == 3, "Wrong connected counter");
+  fail_unless (stats.taken == 1, "Wrong taken counter");
+
+  close (fd);
+  ta_object_unref (pool);
+  close (server);
+}
+END_TEST
+
+START_TEST (test_pool_unreachable)
+{
+  /* Given that I have a pool pointing to a port nobody listens to */
+  ta_xmpp_pool_stats_t stats;
+  ta_xmpp_pool_t *pool;
+  unsigned long started;
+  int server, port;
+  server = fixture_listen (&port);
+  close (server);
+  pool = ta_xmpp_pool_new ("localhost", 1);
+  ta_xmpp_pool_set_host (pool, "127.0.0.1", port);
+  fail_unless (ta_xmpp_pool_start (pool) == TA_OK, "Pool should start");
+
+  /* When I take a connection */
+  started = ta_timer_now ();
+
+  /* Then I see that the pool doesn't wait for one */
+  fail_unless (ta_xmpp_pool_take (pool) == -1, "No connection expected");
+  fail_unless (ta_error_last_code () == TA_XMPP_POOL_ERROR,
+               "Wrong error code");
+  fail_unless (ta_timer_now () - started < 50, "Take should not block");
+
+  /* When I wait for a connection for a while */
+  fail_unless (ta_xmpp_pool_take_wait (pool, 100) == -1,
+               "No connection expected");
+
+  /* Then I see that the attempts failed */
+  ta_xmpp_pool_get_stats (pool, &stats);
+  fail_unless (stats.failed >= 1, "Wrong failed counter");
+  fail_unless (stats.connected == 0, "Wrong connected counter");
+
+  ta_object_unref (pool);
+}
+END_TEST
+
+START_TEST (test_pool_client_waits)
+{
+  /* Given that I have a client using a pool that has no connection
+   * ready yet */
+  ta_xmpp_client_t *client;
+  ta_xmpp_pool_t *pool;
+  unsigned long started;
+  int server, port, peer, sfd, i;
+  server = fixture_listen (&port);
+  pool = ta_xmpp_pool_new ("localhost", 1);
+  ta_xmpp_pool_set_host (pool, "127.0.0.1", port);
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  ta_xmpp_client_set_pool (client, pool);
+
+  /* When the connection of the client breaks */
+  close (peer);
+  started = ta_timer_now ();
+  ta_xmpp_client_process (client, 100);
+  ta_xmpp_client_process (client, 100);
+
+  /* Then I see that the client keeps running without a connection
+   * and that it didn't block waiting for the pool */
+  fail_unless (ta_xmpp_client_is_running (client) == TA_OK,
+               "The client should wait for the pool");
+  fail_unless (ta_xmpp_client_get_fd (client) < 0,
+               "No connection expected yet");
+  fail_unless (ta_timer_now () - started < 1000,
+               "The client should not block");
+
+  /* When the pool gets a connection ready */
+  fail_unless (ta_xmpp_pool_start (pool) == TA_OK, "Pool should start");
+  for (i = 0; i < 50 && ta_xmpp_client_get_fd (client) < 0; i++)
+    ta_xmpp_client_process (client, 100);
+
+  /* Then I see that the client took it */
+  fail_unless (ta_xmpp_client_get_fd (client) >= 0,
+               "The client should take the connection of the pool");
+  sfd = accept (server, NULL, NULL);
+  fail_unless (sfd >= 0, "The server should see the connection");
+
+  ta_object_unref (client);
+  ta_object_unref (pool);
+  close (sfd);
+  close (server);
+}
+END_TEST
+
+Suite *
+pool_suite ()
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create ("Pool");
+  tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_pool_warm);
+  tcase_add_test (tc_core, test_pool_unreachable);
+  tcase_add_test (tc_core, test_pool_client_waits);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
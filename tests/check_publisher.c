@@ -0,0 +1,310 @@
+/* check_publisher.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <taningia/error.h>
+#include <taningia/publisher.h>
+#include "fixtures.h"
+
+#define ANSWER_RESULT "<iq type='result' id='%s'/>"
+#define ANSWER_WAIT \
+  "<iq type='error' id='%s'><error type='wait'/></iq>"
+
+/* What the callbacks of the published items saw */
+struct results {
+  int ok;
+  int failed;
+};
+
+static void
+_done_cb (ta_pubsub_publisher_t *TA_UNUSED(publisher),
+          const char *TA_UNUSED(id), int status, iks *TA_UNUSED(answer),
+          void *data)
+{
+  struct results *results = (struct results *) data;
+  if (status == TA_OK)
+    results->ok++;
+  else
+    results->failed++;
+}
+
+/* Reads the requests written by the client and answers each one of
+ * them with `answer', a format receiving the id of the request.
+ * Returns how many requests were answered. */
+static int
+_server_answer (ta_xmpp_client_t *client, int fd, const char *answer)
+{
+  char buf[8192], reply[256], id[64], *iq, *start, *end;
+  int count = 0;
+
+  fixture_server_read (fd, buf, sizeof (buf));
+
+  for (iq = strstr (buf, "<iq "); iq; iq = strstr (iq + 1, "<iq "))
+    {
+      if ((start = strstr (iq, "id=")) == NULL)
+        break;
+      start += 4;
+      if ((end = strchr (start, start[-1])) == NULL ||
+          (size_t) (end - start) >= sizeof (id))
+        break;
+      memcpy (id, start, end - start);
+      id[end - start] = '\0';
+      snprintf (reply, sizeof (reply), answer, id);
+      if (write (fd, reply, strlen (reply)) < 0)
+        break;
+      count++;
+    }
+  ta_xmpp_client_process (client, 100);
+  return count;
+}
+
+static void
+_publish (ta_pubsub_publisher_t *publisher, int count,
+          struct results *results)
+{
+  int i;
+  for (i = 0; i < count; i++)
+    ta_pubsub_publisher_publish (publisher, "node", NULL,
+                                 iks_new ("entry"), _done_cb, results);
+}
+
+START_TEST (test_publisher_window)
+{
+  /* Given that I have a publisher with room for two requests */
+  ta_xmpp_client_t *client;
+  ta_pubsub_publisher_t *publisher;
+  struct results results = { 0, 0 };
+  int peer;
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  publisher = ta_pubsub_publisher_new (client, "lincoln@localhost",
+                                       "pubsub.localhost", 2);
+
+  /* When I publish five items */
+  _publish (publisher, 5, &results);
+
+  /* Then I see that only two of them were sent */
+  fail_unless (ta_pubsub_publisher_get_in_flight (publisher) == 2,
+               "Wrong number of requests in flight");
+  fail_unless (ta_pubsub_publisher_get_pending (publisher) == 3,
+               "Wrong number of pending items");
+
+  /* When the server accepts them */
+  fail_unless (_server_answer (client, peer, ANSWER_RESULT) == 2,
+               "Server should see two requests");
+
+  /* Then I see that their callbacks were called and that the next
+   * items took their places */
+  fail_unless (results.ok == 2 && results.failed == 0,
+               "Accepted items should be reported");
+  fail_unless (ta_pubsub_publisher_get_in_flight (publisher) == 2,
+               "Wrong number of requests in flight");
+  fail_unless (ta_pubsub_publisher_get_pending (publisher) == 1,
+               "Wrong number of pending items");
+
+  /* When the server accepts everything else */
+  while (ta_pubsub_publisher_get_in_flight (publisher) > 0)
+    fail_unless (_server_answer (client, peer, ANSWER_RESULT) > 0,
+                 "Server should see the remaining requests");
+
+  /* Then I see that the publisher was drained */
+  fail_unless (results.ok == 5 && results.failed == 0,
+               "All the items should be accepted");
+  fail_unless (ta_pubsub_publisher_get_pending (publisher) == 0,
+               "No item should be left");
+
+  ta_object_unref (publisher);
+  ta_xmpp_client_disconnect (client);
+  ta_object_unref (client);
+  close (peer);
+}
+END_TEST
+
+START_TEST (test_publisher_retry_wait)
+{
+  /* Given that I have a publisher that tries each item twice */
+  ta_xmpp_client_t *client;
+  ta_pubsub_publisher_t *publisher;
+  struct results results = { 0, 0 };
+  int peer;
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  publisher = ta_pubsub_publisher_new (client, "lincoln@localhost",
+                                       "pubsub.localhost", 1);
+  ta_pubsub_publisher_set_max_retries (publisher, 1);
+  _publish (publisher, 1, &results);
+
+  /* When the server asks to wait */
+  fail_unless (_server_answer (client, peer, ANSWER_WAIT) == 1,
+               "Server should see the request");
+
+  /* Then I see that the item is sent again without being reported */
+  fail_unless (results.ok == 0 && results.failed == 0,
+               "Item should not be reported yet");
+  fail_unless (ta_pubsub_publisher_get_in_flight (publisher) == 1,
+               "Item should be sent again");
+
+  /* When the server asks to wait once more */
+  fail_unless (_server_answer (client, peer, ANSWER_WAIT) == 1,
+               "Server should see the request again");
+
+  /* Then I see that the publisher gave up */
+  fail_unless (results.ok == 0 && results.failed == 1,
+               "Item should fail");
+  fail_unless (ta_error_last_code () == TA_PUBSUB_PUBLISH_ERROR,
+               "Wrong error code");
+  fail_unless (ta_pubsub_publisher_get_in_flight (publisher) == 0,
+               "Nothing should be in flight");
+
+  ta_object_unref (publisher);
+  ta_xmpp_client_disconnect (client);
+  ta_object_unref (client);
+  close (peer);
+}
+END_TEST
+
+START_TEST (test_publisher_retry_timeout)
+{
+  /* Given that I have a publisher using a client with a short request
+   * timeout */
+  ta_xmpp_client_t *client;
+  ta_pubsub_publisher_t *publisher;
+  struct results results = { 0, 0 };
+  int peer;
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  ta_xmpp_client_set_request_timeout (client, 50);
+  publisher = ta_pubsub_publisher_new (client, "lincoln@localhost",
+                                       "pubsub.localhost", 1);
+  _publish (publisher, 1, &results);
+
+  /* When the request is not answered in time */
+  ta_xmpp_client_process (client, -1);
+
+  /* Then I see that the item was sent again */
+  fail_unless (results.ok == 0 && results.failed == 0,
+               "Item should not be reported yet");
+  fail_unless (ta_pubsub_publisher_get_in_flight (publisher) == 1,
+               "Item should be sent again");
+
+  /* When the server accepts it */
+  fail_unless (_server_answer (client, peer, ANSWER_RESULT) == 2,
+               "Server should see the request twice");
+
+  /* Then I see that the item is reported only once */
+  fail_unless (results.ok == 1 && results.failed == 0,
+               "Item should be accepted");
+
+  ta_object_unref (publisher);
+  ta_xmpp_client_disconnect (client);
+  ta_object_unref (client);
+  close (peer);
+}
+END_TEST
+
+START_TEST (test_publisher_close)
+{
+  /* Given that I have a publisher using a client without request
+   * timeouts, with an item waiting for an answer and another one
+   * waiting for room */
+  ta_xmpp_client_t *client;
+  ta_pubsub_publisher_t *publisher;
+  struct results results = { 0, 0 };
+  int peer;
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  publisher = ta_pubsub_publisher_new (client, "lincoln@localhost",
+                                       "pubsub.localhost", 1);
+  _publish (publisher, 2, &results);
+  fail_unless (TA_CAST_OBJECT (client)->refcount == 2,
+               "Publisher should hold the client");
+
+  /* When I close and release the publisher */
+  ta_pubsub_publisher_close (publisher);
+  ta_object_unref (publisher);
+
+  /* Then I see that both items failed and that the publisher let the
+   * client go */
+  fail_unless (results.ok == 0 && results.failed == 2,
+               "Both items should fail");
+  fail_unless (TA_CAST_OBJECT (client)->refcount == 1,
+               "Publisher should be released");
+
+  /* And that the late answer is ignored */
+  fail_unless (_server_answer (client, peer, ANSWER_RESULT) == 1,
+               "Server should see the request");
+  fail_unless (results.ok == 0 && results.failed == 2,
+               "Late answer should not be reported");
+
+  ta_xmpp_client_disconnect (client);
+  ta_object_unref (client);
+  close (peer);
+}
+END_TEST
+
+START_TEST (test_publisher_closed)
+{
+  /* Given that I have a closed publisher */
+  ta_xmpp_client_t *client;
+  ta_pubsub_publisher_t *publisher;
+  struct results results = { 0, 0 };
+  int peer;
+  client = fixture_client_new (&peer);
+  fail_unless (peer >= 0, "Could not connect the client");
+  publisher = ta_pubsub_publisher_new (client, "lincoln@localhost",
+                                       "pubsub.localhost", 1);
+  ta_pubsub_publisher_close (publisher);
+
+  /* When I publish an item */
+  fail_unless (ta_pubsub_publisher_publish (publisher, "node", NULL,
+                                            iks_new ("entry"), _done_cb,
+                                            &results) == TA_ERROR,
+               "Closed publishers should refuse items");
+
+  /* Then I see that nothing was sent */
+  fail_unless (ta_pubsub_publisher_get_in_flight (publisher) == 0,
+               "Nothing should be sent");
+  fail_unless (results.ok == 0 && results.failed == 0,
+               "Refused items are not reported");
+
+  ta_object_unref (publisher);
+  ta_xmpp_client_disconnect (client);
+  ta_object_unref (client);
+  close (peer);
+}
+END_TEST
+
+Suite *
+publisher_suite ()
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create ("Publisher");
+  tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_publisher_window);
+  tcase_add_test (tc_core, test_publisher_retry_wait);
+  tcase_add_test (tc_core, test_publisher_retry_timeout);
+  tcase_add_test (tc_core, test_publisher_close);
+  tcase_add_test (tc_core, test_publisher_closed);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
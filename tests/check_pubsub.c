@@ -0,0 +1,496 @@
+/* check_pubsub.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <taningia/taningia.h>
+
+
+/* Returns the `<publish/>' element of a publish stanza */
+static iks *
+_find_publish (iks *iq)
+{
+  return iks_find (iks_find (iq, "pubsub"), "publish");
+}
+
+/* Collects parsed events, keeping the titles of parsed entries */
+struct parsed {
+  ta_pubsub_event_t copies[8];
+  char *titles[8];
+  int count;
+};
+
+static int
+_collect_event (const ta_pubsub_event_t *event, void *data)
+{
+  struct parsed *parsed = (struct parsed *) data;
+  parsed->copies[parsed->count] = *event;
+  /* Entries are released after the callback */
+  parsed->titles[parsed->count] =
+    event->entry ? strdup (ta_atom_entry_get_title (event->entry)) : NULL;
+  parsed->copies[parsed->count].entry = NULL;
+  parsed->count++;
+  return 0;
+}
+
+static int
+_stop_subscription (const ta_pubsub_subscription_t *subscription,
+                    void *data)
+{
+  *((const char **) data) = subscription->jid;
+  return 1;
+}
+
+/* Builds an atom entry node with the given id and title */
+static iks *
+_make_entry (iks *parent, const char *id, const char *title)
+{
+  iks *entry = iks_insert (parent, "entry");
+  iks_insert_attrib (entry, "xmlns", TA_ATOM_NS);
+  iks_insert_cdata (iks_insert (entry, "id"), id, 0);
+  iks_insert_cdata (iks_insert (entry, "title"), title, 0);
+  return entry;
+}
+
+
+START_TEST (test_pubsub_publish_items)
+{
+  /* Given that I have some items, one without id and one without
+   * payload */
+  iks *iq, *item, *payloads[2];
+  ta_pubsub_item_t items[3];
+  payloads[0] = iks_new ("first");
+  payloads[1] = iks_new ("second");
+  items[0].id = "a";
+  items[0].payload = payloads[0];
+  items[1].id = NULL;
+  items[1].payload = payloads[1];
+  items[2].id = "c";
+  items[2].payload = NULL;
+
+  /* When I build a batch publish stanza */
+  iq = ta_pubsub_node_publish_items ("me@localhost", "pubsub.localhost",
+                                     "/node", items, 3);
+
+  /* Then I see a single publish element with all the items in order */
+  fail_unless (strcmp (iks_find_attrib (_find_publish (iq), "node"),
+                       "/node") == 0, "Wrong node name");
+  item = iks_first_tag (_find_publish (iq));
+  fail_unless (strcmp (iks_find_attrib (item, "id"), "a") == 0,
+               "Wrong id in the first item");
+  fail_unless (strcmp (iks_name (iks_first_tag (item)), "first") == 0,
+               "Wrong payload in the first item");
+  item = iks_next_tag (item);
+  fail_unless (iks_find_attrib (item, "id") == NULL,
+               "Second item should not have an id");
+  fail_unless (strcmp (iks_name (iks_first_tag (item)), "second") == 0,
+               "Wrong payload in the second item");
+  item = iks_next_tag (item);
+  fail_unless (strcmp (iks_find_attrib (item, "id"), "c") == 0,
+               "Wrong id in the third item");
+  fail_unless (iks_first_tag (item) == NULL,
+               "Third item should not have a payload");
+  fail_unless (iks_next_tag (item) == NULL, "Too many items");
+
+  iks_delete (iq);
+  iks_delete (payloads[0]);
+  iks_delete (payloads[1]);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_publish_feed)
+{
+  /* Given that I have a feed with two entries, but only one of them
+   * has an id */
+  iks *iq, *item;
+  ta_iri_t *iri;
+  ta_atom_entry_t *entry;
+  ta_atom_feed_t *feed = ta_atom_feed_new ("My feed");
+  iri = ta_iri_new ();
+  ta_iri_set_from_string (iri, "http://localhost/entry/1");
+  entry = ta_atom_entry_new ("First");
+  ta_atom_entry_set_id (entry, iri);
+  ta_object_unref (iri);
+  ta_atom_feed_add_entry (feed, entry);
+  ta_object_unref (entry);
+  entry = ta_atom_entry_new ("Without id");
+  ta_atom_feed_add_entry (feed, entry);
+  ta_object_unref (entry);
+
+  /* When I build a publish stanza for the feed */
+  iq = ta_pubsub_node_publish_feed ("me@localhost", "pubsub.localhost",
+                                    "/node", feed);
+  ta_object_unref (feed);
+
+  /* Then I see one item, identified by the entry id, holding the
+   * entry */
+  item = iks_first_tag (_find_publish (iq));
+  fail_unless (strcmp (iks_find_attrib (item, "id"),
+                       "http://localhost/entry/1") == 0,
+               "Item id should be the entry id");
+  fail_unless (strcmp (iks_name (iks_first_tag (item)), "entry") == 0,
+               "Item should hold the entry");
+  fail_unless (strcmp (iks_find_cdata (iks_first_tag (item), "title"),
+                       "First") == 0, "Wrong entry in the item");
+  fail_unless (iks_next_tag (item) == NULL,
+               "Entries without id should be skipped");
+
+  iks_delete (iq);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_publish_text_buf)
+{
+  /* Given that I have an empty buffer */
+  ta_buf_t b = TA_BUF_INIT;
+  ta_buf_alloc (&b, 0);
+
+  /* When I write a publish stanza with chars that must be escaped */
+  ta_pubsub_node_publish_text_buf (&b, "ps1", "me@localhost",
+                                   "pubsub.localhost", "/node", "it&1",
+                                   "<b>bold</b>", 0);
+
+  /* Then I see the whole stanza in the buffer */
+  fail_unless (strcmp (ta_buf_cstr (&b),
+                       "<iq type='set' from='me@localhost' "
+                       "to='pubsub.localhost' id='ps1'>"
+                       "<pubsub xmlns='" TA_PUBSUB_NS "'>"
+                       "<publish node='/node'><item id='it&amp;1'>"
+                       "&lt;b&gt;bold&lt;/b&gt;"
+                       "</item></publish></pubsub></iq>") == 0,
+               "Wrong stanza written in the buffer");
+  ta_buf_dealloc (&b);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_publish_xml_buf)
+{
+  /* Given that I have a buffer that was already used */
+  ta_buf_t b = TA_BUF_INIT;
+  ta_buf_alloc (&b, 0);
+  ta_buf_cat (&b, "garbage");
+  ta_buf_reset (&b);
+
+  /* When I write a publish stanza without item id and with a
+   * serialized payload */
+  ta_pubsub_node_publish_xml_buf (&b, "ps2", "me@localhost",
+                                  "pubsub.localhost", "/node", NULL,
+                                  "<entry xmlns='atom'/>", 0);
+
+  /* Then I see that the payload was not escaped */
+  fail_unless (strcmp (ta_buf_cstr (&b),
+                       "<iq type='set' from='me@localhost' "
+                       "to='pubsub.localhost' id='ps2'>"
+                       "<pubsub xmlns='" TA_PUBSUB_NS "'>"
+                       "<publish node='/node'><item>"
+                       "<entry xmlns='atom'/>"
+                       "</item></publish></pubsub></iq>") == 0,
+               "Wrong stanza written in the buffer");
+  ta_buf_dealloc (&b);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_parse_items)
+{
+  /* Given that I have an items answer with an atom entry and another
+   * payload */
+  struct parsed parsed;
+  iks *answer, *items, *item;
+  answer = iks_new ("iq");
+  iks_insert_attrib (answer, "type", "result");
+  items = iks_insert (iks_insert (answer, "pubsub"), "items");
+  iks_insert_attrib (items, "node", "/node");
+  item = iks_insert (items, "item");
+  iks_insert_attrib (item, "id", "1");
+  _make_entry (item, "http://localhost/entry/1", "Parsed");
+  item = iks_insert (items, "item");
+  iks_insert_attrib (item, "id", "2");
+  iks_insert (item, "other");
+  parsed.count = 0;
+
+  /* When I parse it asking for atom entries */
+  fail_unless (ta_pubsub_parse_items (answer, TA_PUBSUB_PARSE_ENTRIES,
+                                      _collect_event, &parsed) == 2,
+               "Wrong number of items");
+
+  /* Then I see both items and the entry of the first one */
+  fail_unless (strcmp (parsed.copies[0].node, "/node") == 0,
+               "Items should have the node name");
+  fail_unless (strcmp (parsed.copies[0].id, "1") == 0, "Wrong first id");
+  fail_unless (strcmp (parsed.titles[0], "Parsed") == 0,
+               "The entry should be parsed");
+  fail_unless (strcmp (parsed.copies[1].id, "2") == 0, "Wrong second id");
+  fail_unless (strcmp (iks_name (parsed.copies[1].payload), "other") == 0,
+               "Wrong payload in the second item");
+  fail_unless (parsed.titles[1] == NULL,
+               "Only atom entries should be parsed");
+
+  free (parsed.titles[0]);
+  iks_delete (answer);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_parse_event)
+{
+  /* Given that I have a notification with a retracted item and a
+   * purged node */
+  struct parsed parsed;
+  iks *message, *event, *items;
+  message = iks_new ("message");
+  iks_insert (message, "delay");
+  event = iks_insert (message, "event");
+  iks_insert_attrib (event, "xmlns", TA_PUBSUB_EVENT_NS);
+  items = iks_insert (event, "items");
+  iks_insert_attrib (items, "node", "/node");
+  iks_insert_attrib (iks_insert (items, "retract"), "id", "old");
+  iks_insert_attrib (iks_insert (event, "purge"), "node", "/other");
+  parsed.count = 0;
+
+  /* When I parse it */
+  fail_unless (ta_pubsub_parse_event (message, 0, _collect_event,
+                                      &parsed) == 2,
+               "Wrong number of events");
+
+  /* Then I see both events in order */
+  fail_unless (parsed.copies[0].type == TA_PUBSUB_ITEM_RETRACTED,
+               "First event should be a retraction");
+  fail_unless (strcmp (parsed.copies[0].id, "old") == 0,
+               "Wrong retracted id");
+  fail_unless (parsed.copies[1].type == TA_PUBSUB_NODE_PURGED,
+               "Second event should be a purge");
+  fail_unless (strcmp (parsed.copies[1].node, "/other") == 0,
+               "Wrong purged node");
+
+  iks_delete (message);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_parse_subscriptions)
+{
+  /* Given that I have a subscriptions answer of a node */
+  const char *jid = NULL;
+  const ta_error_t *error;
+  iks *answer, *subscriptions, *sub;
+  answer = iks_new ("iq");
+  iks_insert_attrib (answer, "type", "result");
+  subscriptions = iks_insert (iks_insert (answer, "pubsub"),
+                              "subscriptions");
+  iks_insert_attrib (subscriptions, "node", "/node");
+  sub = iks_insert (subscriptions, "subscription");
+  iks_insert_attrib (sub, "jid", "first@localhost");
+  iks_insert_attrib (sub, "subscription", "subscribed");
+  sub = iks_insert (subscriptions, "subscription");
+  iks_insert_attrib (sub, "jid", "second@localhost");
+
+  /* When I parse it stopping in the first subscription */
+  fail_unless (ta_pubsub_parse_subscriptions (answer, _stop_subscription,
+                                              &jid) == 1,
+               "Parser should stop when the callback asks");
+
+  /* Then I see only the first one */
+  fail_unless (strcmp (jid, "first@localhost") == 0,
+               "Wrong subscription reported");
+  iks_delete (answer);
+
+  /* When I parse an error answer */
+  answer = iks_new ("iq");
+  iks_insert_attrib (answer, "type", "error");
+  iks_insert (iks_insert (answer, "error"), "item-not-found");
+
+  /* Then I see the error condition */
+  fail_unless (ta_pubsub_parse_subscriptions (answer, _stop_subscription,
+                                              &jid) == TA_ERROR,
+               "Error answers should not be parsed");
+  error = ta_error_last ();
+  fail_unless (error->code == TA_PUBSUB_PARSING_ERROR, "Wrong error code");
+  fail_unless (strstr (error->message, "item-not-found") != NULL,
+               "Error should hold the condition");
+  ta_error_clear ();
+  iks_delete (answer);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_items_page)
+{
+  /* Given that I ask for the second page of a node */
+  const char *last;
+  int count;
+  iks *iq, *set;
+  iq = ta_pubsub_node_items_page ("me@localhost", "pubsub.localhost",
+                                  "/node", 10, "item9");
+
+  /* Then I see the result set next to the items element */
+  set = iks_find (iks_find (iq, "pubsub"), "set");
+  fail_unless (strcmp (iks_find_attrib (set, "xmlns"), TA_RSM_NS) == 0,
+               "Wrong result set namespace");
+  fail_unless (strcmp (iks_find_cdata (set, "max"), "10") == 0,
+               "Wrong page size");
+  fail_unless (strcmp (iks_find_cdata (set, "after"), "item9") == 0,
+               "Wrong page start");
+
+  /* When I read an answer without a result set */
+  iks_delete (iq);
+  iq = iks_new ("iq");
+  iks_insert (iks_insert (iq, "pubsub"), "items");
+
+  /* Then I see that it can't be paged */
+  fail_unless (ta_pubsub_parse_page (iq, &last, &count) == TA_ERROR,
+               "Answers without result set should not be paged");
+  fail_unless (last == NULL && count == -1, "Nothing should be found");
+
+  /* When the answer has a result set */
+  set = iks_insert (iks_find (iq, "pubsub"), "set");
+  iks_insert_cdata (iks_insert (set, "last"), "item19", 0);
+  iks_insert_cdata (iks_insert (set, "count"), "42", 0);
+
+  /* Then I see where the next page starts */
+  fail_unless (ta_pubsub_parse_page (iq, &last, &count) == TA_OK,
+               "Result set should be found");
+  fail_unless (strcmp (last, "item19") == 0, "Wrong last item");
+  fail_unless (count == 42, "Wrong item count");
+  iks_delete (iq);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_node_config)
+{
+  /* Given that I have a configuration with two fields */
+  const char *params[] = { "max_items", "10", "persist_items", "1", NULL };
+  const char *bad[] = { "title", NULL };
+  const ta_error_t *error;
+  iks *iq, *form, *field;
+  ta_pubsub_node_config_t *config = ta_pubsub_node_config_new ();
+  fail_unless (ta_pubsub_node_config_add_params (config, params) == TA_OK,
+               "Params should be accepted");
+
+  /* When I add a name without value */
+  fail_unless (ta_pubsub_node_config_add_params (config, bad) == TA_ERROR,
+               "Names without value should be refused");
+
+  /* Then I see the error and that nothing was added */
+  error = ta_error_last ();
+  fail_unless (error->code == TA_PUBSUB_CONFIG_ERROR, "Wrong error code");
+  ta_error_clear ();
+  fail_unless (ta_pubsub_node_config_get_size (config) == 2,
+               "Wrong number of fields");
+
+  /* When I create a node with it and release the configuration */
+  iq = ta_pubsub_node_create_with_config ("me@localhost",
+                                          "pubsub.localhost", "/node",
+                                          config);
+  ta_object_unref (config);
+
+  /* Then I see the form in the stanza */
+  form = iks_find (iks_find (iks_find (iq, "pubsub"), "configure"), "x");
+  field = iks_next_tag (iks_first_tag (form));
+  fail_unless (strcmp (iks_find_attrib (field, "var"),
+                       "pubsub#max_items") == 0, "Wrong first field");
+  fail_unless (strcmp (iks_find_cdata (field, "value"), "10") == 0,
+               "Wrong first value");
+  field = iks_next_tag (field);
+  fail_unless (strcmp (iks_find_attrib (field, "var"),
+                       "pubsub#persist_items") == 0, "Wrong second field");
+  iks_delete (iq);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_node_createv)
+{
+  /* Given that I have configuration params */
+  const char *params[] = { "type", "leaf", NULL };
+  iks *iq, *field;
+
+  /* When I create a node with them */
+  iq = ta_pubsub_node_createv ("me@localhost", "pubsub.localhost", "/node",
+                               params);
+
+  /* Then I see that the value was added to its field */
+  field = iks_find (iks_find (iks_find (iq, "pubsub"), "configure"), "x");
+  field = iks_next_tag (iks_first_tag (field));
+  fail_unless (strcmp (iks_find_attrib (field, "var"), "pubsub#type") == 0,
+               "Wrong field name");
+  fail_unless (iks_find_cdata (field, "value") != NULL &&
+               strcmp (iks_find_cdata (field, "value"), "leaf") == 0,
+               "Field should hold its value");
+  iks_delete (iq);
+}
+END_TEST
+
+
+START_TEST (test_pubsub_node_create_invalid)
+{
+  /* Given that I have a field without value and a field with a name
+   * that doesn't fit */
+  const char *missing[] = { "type", "leaf", "max_items", NULL, NULL };
+  const char *invalid[3];
+  char name[512];
+  memset (name, 'a', sizeof (name) - 1);
+  name[sizeof (name) - 1] = '\0';
+  invalid[0] = name;
+  invalid[1] = "1";
+  invalid[2] = NULL;
+
+  /* When I create nodes with them */
+  /* Then I see that no stanza is built and that the error is set */
+  fail_unless (ta_pubsub_node_createv ("me@localhost", "pubsub.localhost",
+                                       "/node", missing) == NULL,
+               "Fields without values should be refused");
+  fail_unless (ta_error_last_code () == TA_PUBSUB_CONFIG_ERROR,
+               "Wrong error code");
+  fail_unless (ta_pubsub_node_createv ("me@localhost", "pubsub.localhost",
+                                       "/node", invalid) == NULL,
+               "Long field names should be refused");
+  fail_unless (ta_pubsub_node_create ("me@localhost", "pubsub.localhost",
+                                      "/node", "type", "leaf", name, "1",
+                                      NULL) == NULL,
+               "Long field names should be refused");
+  fail_unless (ta_error_last_code () == TA_PUBSUB_CONFIG_ERROR,
+               "Wrong error code");
+}
+END_TEST
+
+
+Suite *
+pubsub_suite ()
+{
+  Suite *s = suite_create ("taningia::pubsub");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_pubsub_publish_items);
+  tcase_add_test (tc_core, test_pubsub_publish_feed);
+  tcase_add_test (tc_core, test_pubsub_publish_text_buf);
+  tcase_add_test (tc_core, test_pubsub_publish_xml_buf);
+  tcase_add_test (tc_core, test_pubsub_parse_items);
+  tcase_add_test (tc_core, test_pubsub_parse_event);
+  tcase_add_test (tc_core, test_pubsub_parse_subscriptions);
+  tcase_add_test (tc_core, test_pubsub_items_page);
+  tcase_add_test (tc_core, test_pubsub_node_config);
+  tcase_add_test (tc_core, test_pubsub_node_createv);
+  tcase_add_test (tc_core, test_pubsub_node_create_invalid);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
@@ -0,0 +1,171 @@
+/* check_reactor.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <taningia/error.h>
+#include <taningia/timer.h>
+#include <taningia/reactor.h>
+#include "fixtures.h"
+
+#define MESSAGE "<message from='a@localhost'><body>hi</body></message>"
+
+/* What a hook needs to remove another client. Hooks wait a bit for
+ * each other, so both loops are dispatching at the same time. */
+struct remover {
+  ta_xmpp_reactor_t *reactor;
+  ta_xmpp_client_t *victim;
+  int *entered;
+  int done;
+};
+
+static int
+_remove_other (ta_xmpp_client_t *TA_UNUSED(client), void *TA_UNUSED(data),
+               void *user_data)
+{
+  struct remover *remover = (struct remover *) user_data;
+  unsigned long start = ta_timer_now ();
+  __atomic_add_fetch (remover->entered, 1, __ATOMIC_ACQ_REL);
+  while (__atomic_load_n (remover->entered, __ATOMIC_ACQUIRE) < 2 &&
+         ta_timer_now () - start < 500)
+    usleep (1000);
+  ta_xmpp_reactor_remove (remover->reactor, remover->victim);
+  __atomic_store_n (&remover->done, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static void *
+_run (void *data)
+{
+  ta_xmpp_reactor_run ((ta_xmpp_reactor_t *) data);
+  return NULL;
+}
+
+START_TEST (test_reactor_add_remove)
+{
+  /* Given that I have a reactor with two loops */
+  ta_xmpp_reactor_t *reactor;
+  ta_xmpp_client_t *offline, *a, *b;
+  int pa, pb;
+  reactor = ta_xmpp_reactor_new (2);
+  offline = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  a = fixture_client_new (&pa);
+  b = fixture_client_new (&pb);
+  fail_unless (pa >= 0 && pb >= 0, "Could not connect the clients");
+
+  /* When I add clients to it */
+  fail_unless (ta_xmpp_reactor_add (reactor, offline) == TA_ERROR,
+               "Clients that are not connected should be refused");
+  fail_unless (ta_xmpp_reactor_add (reactor, a) == TA_OK, "Can't add");
+  fail_unless (ta_xmpp_reactor_add (reactor, b) == TA_OK, "Can't add");
+
+  /* Then I see that they are counted, only once */
+  fail_unless (ta_xmpp_reactor_get_count (reactor) == 2, "Wrong count");
+  fail_unless (ta_xmpp_reactor_add (reactor, a) == TA_ERROR,
+               "Clients should not be registered twice");
+  fail_unless (ta_xmpp_reactor_get_count (reactor) == 2, "Wrong count");
+
+  /* When I remove one of them */
+  fail_unless (ta_xmpp_reactor_remove (reactor, a) == TA_OK,
+               "Can't remove");
+
+  /* Then I see that it is not driven anymore */
+  fail_unless (ta_xmpp_reactor_get_count (reactor) == 1, "Wrong count");
+  fail_unless (ta_xmpp_reactor_remove (reactor, a) == TA_ERROR,
+               "Client should not be registered anymore");
+  fail_unless (ta_error_last_code () == TA_XMPP_REACTOR_ERROR,
+               "Wrong error code");
+
+  /* And that it can be added again */
+  fail_unless (ta_xmpp_reactor_add (reactor, a) == TA_OK, "Can't add");
+  fail_unless (ta_xmpp_reactor_get_count (reactor) == 2, "Wrong count");
+
+  ta_object_unref (reactor);
+  ta_object_unref (offline);
+  ta_object_unref (a);
+  ta_object_unref (b);
+  close (pa);
+  close (pb);
+}
+END_TEST
+
+START_TEST (test_reactor_remove_from_hook)
+{
+  /* Given that I have two clients driven by different loops, each one
+   * with a hook that removes the other */
+  ta_xmpp_reactor_t *reactor;
+  ta_xmpp_client_t *a, *b;
+  struct remover ra, rb;
+  unsigned long start;
+  pthread_t thread;
+  int pa, pb, entered = 0;
+  reactor = ta_xmpp_reactor_new (2);
+  a = fixture_client_new (&pa);
+  b = fixture_client_new (&pb);
+  fail_unless (pa >= 0 && pb >= 0, "Could not connect the clients");
+  ra.reactor = rb.reactor = reactor;
+  ra.victim = b;
+  rb.victim = a;
+  ra.entered = rb.entered = &entered;
+  ra.done = rb.done = 0;
+  ta_xmpp_client_event_connect (a, "message-received", _remove_other, &ra);
+  ta_xmpp_client_event_connect (b, "message-received", _remove_other, &rb);
+  ta_xmpp_reactor_add (reactor, a);
+  ta_xmpp_reactor_add (reactor, b);
+  pthread_create (&thread, NULL, _run, reactor);
+
+  /* When both receive a message at the same time */
+  fail_unless (write (pa, MESSAGE, strlen (MESSAGE)) > 0, "Can't write");
+  fail_unless (write (pb, MESSAGE, strlen (MESSAGE)) > 0, "Can't write");
+
+  /* Then I see that the hooks return instead of waiting for each
+   * other's loop and that both clients are removed */
+  start = ta_timer_now ();
+  while (!__atomic_load_n (&ra.done, __ATOMIC_ACQUIRE) ||
+         !__atomic_load_n (&rb.done, __ATOMIC_ACQUIRE) ||
+         ta_xmpp_reactor_get_count (reactor) > 0)
+    {
+      fail_unless (ta_timer_now () - start < 2000, "Loops got stuck");
+      usleep (1000);
+    }
+
+  ta_xmpp_reactor_stop (reactor);
+  pthread_join (thread, NULL);
+  ta_object_unref (reactor);
+  ta_object_unref (a);
+  ta_object_unref (b);
+  close (pa);
+  close (pb);
+}
+END_TEST
+
+Suite *
+reactor_suite ()
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create ("Reactor");
+  tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_reactor_add_remove);
+  tcase_add_test (tc_core, test_reactor_remove_from_hook);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
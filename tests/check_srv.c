@@ -0,0 +1,523 @@
+/* check_srv.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <taningia/common.h>
+#include <taningia/error.h>
+#include <taningia/srv.h>
+
+/* A name server that answers every SRV query with the same canned
+ * targets. It runs in its own thread and listens on UDP and TCP. */
+struct stub
+{
+  int udp;
+  int tcp;
+  int port;
+  int running;
+  int truncate;                 /* Answers over UDP are truncated */
+  unsigned int ttl;
+  int udp_queries;
+  int tcp_queries;
+  pthread_t thread;
+  pthread_mutex_t lock;
+};
+
+static const struct
+{
+  int priority;
+  int weight;
+  int port;
+  const char *host;
+} _targets[] = {
+  { 20, 0, 5222, "backup.example.com" },
+  { 10, 30, 5222, "one.example.com" },
+  { 10, 70, 5223, "two.example.com" }
+};
+
+#define TARGETS (sizeof (_targets) / sizeof (_targets[0]))
+
+static unsigned char *
+_put_short (unsigned char *p, int value)
+{
+  *p++ = (value >> 8) & 0xff;
+  *p++ = value & 0xff;
+  return p;
+}
+
+static unsigned char *
+_put_name (unsigned char *p, const char *name)
+{
+  const char *dot;
+  size_t len;
+  while (*name)
+    {
+      dot = strchr (name, '.');
+      len = dot ? (size_t) (dot - name) : strlen (name);
+      *p++ = len;
+      memcpy (p, name, len);
+      p += len;
+      name += len + (dot ? 1 : 0);
+    }
+  *p++ = 0;
+  return p;
+}
+
+/* Builds the answer of `query' in `answer' and returns its size */
+static int
+_stub_answer (struct stub *stub, const unsigned char *query, int len,
+              unsigned char *answer, int truncated)
+{
+  unsigned char *p, *rdlength;
+  const unsigned char *q = query + 12;
+  unsigned int i;
+
+  /* Header and question are copied from the query */
+  while (q < query + len && *q)
+    q += *q + 1;
+  q += 5;
+  memcpy (answer, query, q - query);
+  answer[2] = 0x80 | (query[2] & 0x01) | (truncated ? 0x02 : 0);
+  answer[3] = 0x80;
+  p = _put_short (answer + 4, 1);
+  p = _put_short (p, truncated ? 0 : TARGETS);
+  p = _put_short (p, 0);
+  p = _put_short (p, 0);
+  p = answer + (q - query);
+  if (truncated)
+    return p - answer;
+
+  for (i = 0; i < TARGETS; i++)
+    {
+      p = _put_short (p, 0xc00c);
+      p = _put_short (p, 33);
+      p = _put_short (p, 1);
+      p = _put_short (p, stub->ttl >> 16);
+      p = _put_short (p, stub->ttl & 0xffff);
+      rdlength = p;
+      p = _put_short (p, 0);
+      p = _put_short (p, _targets[i].priority);
+      p = _put_short (p, _targets[i].weight);
+      p = _put_short (p, _targets[i].port);
+      p = _put_name (p, _targets[i].host);
+      _put_short (rdlength, p - rdlength - 2);
+    }
+  return p - answer;
+}
+
+static void
+_stub_serve_tcp (struct stub *stub)
+{
+  unsigned char query[512], answer[1024], size[2];
+  int fd, len;
+
+  if ((fd = accept (stub->tcp, NULL, NULL)) < 0)
+    return;
+  if (recv (fd, size, 2, MSG_WAITALL) == 2)
+    {
+      len = (size[0] << 8) | size[1];
+      if (recv (fd, query, len, MSG_WAITALL) == len)
+        {
+          len = _stub_answer (stub, query, len, answer + 2, 0);
+          _put_short (answer, len);
+          pthread_mutex_lock (&stub->lock);
+          stub->tcp_queries++;
+          pthread_mutex_unlock (&stub->lock);
+          send (fd, answer, len + 2, 0);
+        }
+    }
+  close (fd);
+}
+
+static void *
+_stub_run (void *data)
+{
+  struct stub *stub = (struct stub *) data;
+  unsigned char query[512], answer[1024];
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  struct pollfd fds[2];
+  int len, running = 1;
+
+  fds[0].fd = stub->udp;
+  fds[1].fd = stub->tcp;
+  fds[0].events = fds[1].events = POLLIN;
+  while (running)
+    {
+      if (poll (fds, 2, 20) > 0)
+        {
+          if (fds[0].revents & POLLIN)
+            {
+              fromlen = sizeof (from);
+              len = recvfrom (stub->udp, query, sizeof (query), 0,
+                              (struct sockaddr *) &from, &fromlen);
+              len = _stub_answer (stub, query, len, answer, stub->truncate);
+              pthread_mutex_lock (&stub->lock);
+              stub->udp_queries++;
+              pthread_mutex_unlock (&stub->lock);
+              sendto (stub->udp, answer, len, 0,
+                      (struct sockaddr *) &from, fromlen);
+            }
+          if (fds[1].revents & POLLIN)
+            _stub_serve_tcp (stub);
+        }
+      pthread_mutex_lock (&stub->lock);
+      running = stub->running;
+      pthread_mutex_unlock (&stub->lock);
+    }
+  return NULL;
+}
+
+static void
+_stub_start (struct stub *stub, unsigned int ttl, int truncate)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof (addr);
+  int one = 1;
+
+  memset (stub, 0, sizeof (struct stub));
+  stub->ttl = ttl;
+  stub->truncate = truncate;
+  stub->running = 1;
+  pthread_mutex_init (&stub->lock, NULL);
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  stub->udp = socket (AF_INET, SOCK_DGRAM, 0);
+  bind (stub->udp, (struct sockaddr *) &addr, sizeof (addr));
+  getsockname (stub->udp, (struct sockaddr *) &addr, &len);
+  stub->port = ntohs (addr.sin_port);
+
+  /* The TCP fallback asks the same address */
+  stub->tcp = socket (AF_INET, SOCK_STREAM, 0);
+  setsockopt (stub->tcp, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  bind (stub->tcp, (struct sockaddr *) &addr, sizeof (addr));
+  listen (stub->tcp, 4);
+
+  pthread_create (&stub->thread, NULL, _stub_run, stub);
+}
+
+static void
+_stub_stop (struct stub *stub)
+{
+  pthread_mutex_lock (&stub->lock);
+  stub->running = 0;
+  pthread_mutex_unlock (&stub->lock);
+  pthread_join (stub->thread, NULL);
+  close (stub->udp);
+  close (stub->tcp);
+  pthread_mutex_destroy (&stub->lock);
+}
+
+static int
+_stub_queries (struct stub *stub, int tcp)
+{
+  int count;
+  pthread_mutex_lock (&stub->lock);
+  count = tcp ? stub->tcp_queries : stub->udp_queries;
+  pthread_mutex_unlock (&stub->lock);
+  return count;
+}
+
+static ta_srv_resolver_t *
+_resolver_new (struct stub *stub)
+{
+  ta_srv_resolver_t *resolver = ta_srv_resolver_new ();
+  ta_srv_resolver_set_nameserver (resolver, "127.0.0.1", stub->port);
+  ta_srv_resolver_set_timeout (resolver, 500, 2);
+  return resolver;
+}
+
+static int
+_targets_ordered (ta_list_t *targets)
+{
+  ta_list_t *t;
+  int count = 0, last = 0, priority;
+  for (t = targets; t; t = t->next, count++)
+    {
+      priority = ta_srv_target_get_priority ((ta_srv_target_t *) t->data);
+      if (priority < last)
+        return 0;
+      last = priority;
+    }
+  return count == TARGETS
+    && strcmp (ta_srv_target_get_host (ta_list_last (targets)->data),
+               "backup.example.com") == 0;
+}
+
+static void
+_targets_free (ta_list_t *targets)
+{
+  ta_list_t *t;
+  for (t = targets; t; t = t->next)
+    ta_object_unref (t->data);
+  ta_list_free (targets);
+}
+
+static void
+_answered (ta_srv_resolver_t *TA_UNUSED(resolver), int error,
+           ta_list_t *targets, void *data)
+{
+  int *answers = (int *) data;
+  if (error == TA_OK && _targets_ordered (targets))
+    (*answers)++;
+  _targets_free (targets);
+}
+
+
+START_TEST (test_srv_cache)
+{
+  /* Given that I have a resolver asking a server that answers with a
+   * one minute ttl */
+  struct stub stub;
+  ta_srv_resolver_t *resolver;
+  ta_list_t *first, *second;
+  _stub_start (&stub, 60, 0);
+  resolver = _resolver_new (&stub);
+
+  /* When I ask for the same service twice */
+  first = ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                 "example.com");
+  second = ta_srv_resolver_query (resolver, "_XMPP-client._tcp",
+                                  "Example.com");
+
+  /* Then I see that the server was asked only once and that both
+   * answers are sorted by priority */
+  fail_unless (_targets_ordered (first), "Wrong first answer");
+  fail_unless (_targets_ordered (second), "Wrong cached answer");
+  fail_unless (_stub_queries (&stub, 0) == 1, "The answer should be cached");
+
+  /* When I ask again after clearing the cache */
+  ta_srv_resolver_clear_cache (resolver);
+  _targets_free (ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                        "example.com"));
+
+  /* Then I see that the server was asked again */
+  fail_unless (_stub_queries (&stub, 0) == 2, "The cache should be empty");
+
+  _targets_free (first);
+  _targets_free (second);
+  ta_object_unref (resolver);
+  _stub_stop (&stub);
+}
+END_TEST
+
+START_TEST (test_srv_ttl)
+{
+  /* Given that I have a resolver asking a server that answers with
+   * records that must not be cached */
+  struct stub stub;
+  ta_srv_resolver_t *resolver;
+  _stub_start (&stub, 0, 0);
+  resolver = _resolver_new (&stub);
+
+  /* When I ask for the same service twice */
+  _targets_free (ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                        "example.com"));
+  _targets_free (ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                        "example.com"));
+
+  /* Then I see that the server was asked twice */
+  fail_unless (_stub_queries (&stub, 0) == 2,
+               "Records without ttl were cached");
+
+  ta_object_unref (resolver);
+  _stub_stop (&stub);
+}
+END_TEST
+
+START_TEST (test_srv_tcp_fallback)
+{
+  /* Given that I have a resolver asking a server whose answers don't
+   * fit in a datagram */
+  struct stub stub;
+  ta_srv_resolver_t *resolver;
+  ta_list_t *targets;
+  _stub_start (&stub, 60, 1);
+  resolver = _resolver_new (&stub);
+
+  /* When I ask for a service */
+  targets = ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                   "example.com");
+
+  /* Then I see that the answer was read over TCP */
+  fail_unless (_stub_queries (&stub, 0) == 1, "The query should go over UDP");
+  fail_unless (_stub_queries (&stub, 1) == 1,
+               "The answer should come over TCP");
+  fail_unless (_targets_ordered (targets), "Wrong answer");
+
+  _targets_free (targets);
+  ta_object_unref (resolver);
+  _stub_stop (&stub);
+}
+END_TEST
+
+START_TEST (test_srv_async)
+{
+  /* Given that I have a resolver driven by an event loop */
+  struct stub stub;
+  ta_srv_resolver_t *resolver;
+  struct pollfd pfd;
+  int answers = 0;
+  _stub_start (&stub, 60, 0);
+  resolver = _resolver_new (&stub);
+
+  /* When many clients ask for the same service at once */
+  ta_srv_resolver_query_async (resolver, "_xmpp-client._tcp", "example.com",
+                               _answered, &answers);
+  ta_srv_resolver_query_async (resolver, "_xmpp-client._tcp", "example.com",
+                               _answered, &answers);
+  ta_srv_resolver_query_async (resolver, "_xmpp-client._tcp", "example.com",
+                               _answered, &answers);
+
+  /* Then I see that nobody was answered yet */
+  fail_unless (answers == 0, "Nothing should be answered yet");
+  fail_unless (ta_srv_resolver_get_pending (resolver) == 1,
+               "Queries should be merged");
+
+  /* When the loop processes the answer */
+  while (ta_srv_resolver_get_pending (resolver))
+    {
+      pfd.fd = ta_srv_resolver_get_fd (resolver);
+      pfd.events = POLLIN;
+      poll (&pfd, 1, ta_srv_resolver_next_timeout (resolver));
+      ta_srv_resolver_process (resolver);
+    }
+
+  /* Then I see that everybody got the answer of a single query */
+  fail_unless (answers == 3, "All clients should be answered");
+  fail_unless (_stub_queries (&stub, 0) == 1, "Only one query should be sent");
+
+  ta_object_unref (resolver);
+  _stub_stop (&stub);
+}
+END_TEST
+
+START_TEST (test_srv_failover)
+{
+  /* Given that I have a resolver whose first name server never
+   * answers */
+  struct stub stub;
+  struct sockaddr_in addr;
+  socklen_t len = sizeof (addr);
+  ta_srv_resolver_t *resolver;
+  ta_list_t *targets;
+  char buf[512];
+  int dead;
+  _stub_start (&stub, 60, 0);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  dead = socket (AF_INET, SOCK_DGRAM, 0);
+  bind (dead, (struct sockaddr *) &addr, sizeof (addr));
+  getsockname (dead, (struct sockaddr *) &addr, &len);
+  resolver = ta_srv_resolver_new ();
+  ta_srv_resolver_set_nameserver (resolver, "127.0.0.1",
+                                  ntohs (addr.sin_port));
+  fail_unless (ta_srv_resolver_add_nameserver (resolver, "::ffff:127.0.0.1",
+                                               stub.port) == TA_OK,
+               "IPv6 addresses should be accepted");
+  ta_srv_resolver_set_timeout (resolver, 100, 1);
+
+  /* When I ask for a service */
+  targets = ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                   "example.com");
+
+  /* Then I see that the first server was asked and that the answer
+   * came from the second one */
+  fail_unless (recv (dead, buf, sizeof (buf), MSG_DONTWAIT) > 0,
+               "The first server should be asked");
+  fail_unless (_stub_queries (&stub, 0) == 1,
+               "The second server should be asked");
+  fail_unless (_targets_ordered (targets), "Wrong answer");
+
+  _targets_free (targets);
+  ta_object_unref (resolver);
+  close (dead);
+  _stub_stop (&stub);
+}
+END_TEST
+
+START_TEST (test_srv_target_set)
+{
+  /* Given that I have a set with the targets of a service */
+  struct stub stub;
+  ta_srv_resolver_t *resolver;
+  ta_srv_target_set_t *set;
+  ta_list_t *targets;
+  const char *host;
+  int i, two_first = 0;
+  _stub_start (&stub, 60, 0);
+  resolver = _resolver_new (&stub);
+  targets = ta_srv_resolver_query (resolver, "_xmpp-client._tcp",
+                                   "example.com");
+  set = ta_srv_target_set_new (targets);
+  ta_srv_target_set_set_seed (set, 42);
+  _targets_free (targets);
+
+  /* When I shuffle it many times */
+  for (i = 0; i < 1000; i++)
+    {
+      ta_srv_target_set_shuffle (set);
+      host = ta_srv_target_get_host (ta_srv_target_set_get (set, 0));
+      if (strcmp (host, "two.example.com") == 0)
+        two_first++;
+      host = ta_srv_target_get_host (ta_srv_target_set_get (set, 2));
+      fail_unless (strcmp (host, "backup.example.com") == 0,
+                   "Lower priorities should always come last");
+    }
+
+  /* Then I see that the targets were picked by their weight without
+   * asking the server again */
+  fail_unless (ta_srv_target_set_get_size (set) == 3, "Wrong size");
+  fail_unless (ta_srv_target_set_get (set, 3) == NULL, "Out of bounds");
+  fail_unless (two_first > 600 && two_first < 800,
+               "The heavier target should be first 70%% of the times");
+  fail_unless (_stub_queries (&stub, 0) == 1, "Only one query expected");
+
+  ta_object_unref (set);
+  ta_object_unref (resolver);
+  _stub_stop (&stub);
+}
+END_TEST
+
+Suite *
+srv_suite ()
+{
+  Suite *s;
+  TCase *tc_core;
+
+  s = suite_create ("SRV");
+  tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_srv_cache);
+  tcase_add_test (tc_core, test_srv_ttl);
+  tcase_add_test (tc_core, test_srv_tcp_fallback);
+  tcase_add_test (tc_core, test_srv_async);
+  tcase_add_test (tc_core, test_srv_failover);
+  tcase_add_test (tc_core, test_srv_target_set);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
@@ -0,0 +1,179 @@
+/* check_timer.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <taningia/timer.h>
+
+
+static void
+_count_cb (ta_timer_t *timer, void *data)
+{
+  int *counter = (int *) data;
+  (*counter)++;
+  timer->data = NULL;
+}
+
+
+START_TEST (test_timer_fires_at_deadline)
+{
+  /* Given that I have a wheel and a timer scheduled to 10ms */
+  int counter = 0;
+  ta_timer_t timer;
+  ta_timer_wheel_t *wheel = ta_timer_wheel_new (1000);
+  ta_timer_init (&timer, _count_cb, &counter);
+  ta_timer_wheel_add (wheel, &timer, 1010);
+
+  /* When I advance the clock to a time before the deadline */
+  ta_timer_wheel_advance (wheel, 1009);
+
+  /* Then I see that nothing happened */
+  fail_unless (counter == 0, "Timer fired before its deadline");
+  fail_unless (ta_timer_is_pending (&timer), "Timer should be pending");
+
+  /* When I reach the deadline */
+  fail_unless (ta_timer_wheel_advance (wheel, 1010) == 1,
+               "Advance should report one fired timer");
+
+  /* Then I see that the callback was called and the timer is gone */
+  fail_unless (counter == 1, "Timer did not fire at its deadline");
+  fail_if (ta_timer_is_pending (&timer), "Timer should not be pending");
+  fail_unless (ta_timer_wheel_get_count (wheel) == 0, "Wheel should be empty");
+
+  ta_object_unref (wheel);
+}
+END_TEST
+
+
+START_TEST (test_timer_cascade)
+{
+  /* Given that I have timers in all levels of the wheel */
+  int counter = 0, i;
+  unsigned long deadlines[] = { 300, 20000, 2000000, 100000000 };
+  ta_timer_t timers[4];
+  ta_timer_wheel_t *wheel = ta_timer_wheel_new (0);
+  for (i = 0; i < 4; i++)
+    {
+      ta_timer_init (&timers[i], _count_cb, &counter);
+      ta_timer_wheel_add (wheel, &timers[i], deadlines[i]);
+    }
+
+  /* When I advance the clock to each deadline, Then I see that only
+   * the expected timer is fired and never before its time. */
+  for (i = 0; i < 4; i++)
+    {
+      ta_timer_wheel_advance (wheel, deadlines[i] - 1);
+      fail_unless (counter == i, "Timer fired too early");
+      ta_timer_wheel_advance (wheel, deadlines[i]);
+      fail_unless (counter == i + 1, "Timer did not fire at its deadline");
+    }
+
+  ta_object_unref (wheel);
+}
+END_TEST
+
+
+START_TEST (test_timer_cancel)
+{
+  /* Given that I have a scheduled timer */
+  int counter = 0;
+  ta_timer_t timer;
+  ta_timer_wheel_t *wheel = ta_timer_wheel_new (0);
+  ta_timer_init (&timer, _count_cb, &counter);
+  ta_timer_wheel_add (wheel, &timer, 5000);
+
+  /* When I cancel it and advance the clock past its deadline */
+  ta_timer_wheel_cancel (wheel, &timer);
+  ta_timer_wheel_advance (wheel, 10000);
+
+  /* Then I see that it was never called */
+  fail_unless (counter == 0, "Cancelled timer was fired");
+  fail_unless (ta_timer_wheel_next_timeout (wheel, 10000) == -1,
+               "Empty wheel should not have a timeout");
+
+  ta_object_unref (wheel);
+}
+END_TEST
+
+
+START_TEST (test_timer_next_timeout)
+{
+  /* Given that I have two timers in different levels */
+  int counter = 0;
+  ta_timer_t near, far;
+  ta_timer_wheel_t *wheel = ta_timer_wheel_new (0);
+  ta_timer_init (&near, _count_cb, &counter);
+  ta_timer_init (&far, _count_cb, &counter);
+  ta_timer_wheel_add (wheel, &far, 1000);
+  ta_timer_wheel_add (wheel, &near, 100);
+
+  /* When I ask for the next timeout */
+  /* Then I see the exact time of the nearest timer */
+  fail_unless (ta_timer_wheel_next_timeout (wheel, 40) == 60,
+               "Wrong timeout for the root level");
+
+  /* When only the far timer is left */
+  ta_timer_wheel_advance (wheel, 100);
+
+  /* Then I never see a timeout beyond its deadline */
+  fail_unless (ta_timer_wheel_next_timeout (wheel, 100) <= 900,
+               "Timeout is after the real deadline");
+  fail_unless (ta_timer_wheel_next_timeout (wheel, 2000) == 0,
+               "Expired timers should have a 0 timeout");
+
+  ta_object_unref (wheel);
+}
+END_TEST
+
+
+START_TEST (test_timer_flush)
+{
+  /* Given that I have timers far away in the future */
+  int counter = 0;
+  ta_timer_t a, b;
+  ta_timer_wheel_t *wheel = ta_timer_wheel_new (0);
+  ta_timer_init (&a, _count_cb, &counter);
+  ta_timer_init (&b, _count_cb, &counter);
+  ta_timer_wheel_add (wheel, &a, 10);
+  ta_timer_wheel_add (wheel, &b, 1000000);
+
+  /* When I flush the wheel */
+  ta_timer_wheel_flush (wheel);
+
+  /* Then I see that all of them were fired */
+  fail_unless (counter == 2, "Flush did not fire all timers");
+  fail_unless (ta_timer_wheel_get_count (wheel) == 0, "Wheel should be empty");
+
+  ta_object_unref (wheel);
+}
+END_TEST
+
+
+Suite *
+timer_suite ()
+{
+  Suite *s = suite_create ("taningia::timer");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_timer_fires_at_deadline);
+  tcase_add_test (tc_core, test_timer_cascade);
+  tcase_add_test (tc_core, test_timer_cancel);
+  tcase_add_test (tc_core, test_timer_next_timeout);
+  tcase_add_test (tc_core, test_timer_flush);
+  suite_add_tcase (s, tc_core);
+  return s;
+}
@@ -0,0 +1,817 @@
+/* check_xmpp.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <taningia/timer.h>
+#include <taningia/xmpp.h>
+#include "fixtures.h"
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#define PRODUCERS 4
+#define STANZAS_PER_PRODUCER 1000
+
+/* What the fake server says to the clients */
+#define STREAM_START                                                    \
+  "<stream:stream xmlns:stream='http://etherx.jabber.org/streams' "     \
+  "xmlns='jabber:client' from='localhost' id='1' version='1.0'>"
+#define SASL_FEATURES                                                   \
+  "<stream:features><mechanisms "                                      \
+  "xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>"                           \
+  "<mechanism>PLAIN</mechanism></mechanisms></stream:features>"
+#define SASL_SUCCESS "<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>"
+#define SM_FEATURES                                                     \
+  "<stream:features><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"   \
+  "<sm xmlns='urn:xmpp:sm:3'/></stream:features>"
+#define COMPRESS_FEATURES                                               \
+  "<stream:features><compression "                                      \
+  "xmlns='http://jabber.org/features/compress'>"                        \
+  "<method>zlib</method></compression>"                                 \
+  "<bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/></stream:features>"
+#define COMPRESSED "<compressed xmlns='http://jabber.org/protocol/compress'/>"
+
+
+static void
+_notify_cb (ta_xmpp_client_t *TA_UNUSED(client), void *data)
+{
+  int *counter = (int *) data;
+  (*counter)++;
+}
+
+static void *
+_producer (void *data)
+{
+  ta_xmpp_client_t *client = (ta_xmpp_client_t *) data;
+  iks *node;
+  int i;
+  for (i = 0; i < STANZAS_PER_PRODUCER; i++)
+    {
+      node = iks_make_msg (IKS_TYPE_CHAT, "someone@localhost", "Hi");
+      ta_xmpp_client_enqueue (client, node);
+      iks_delete (node);
+    }
+  return NULL;
+}
+
+
+static int
+_resumed_cb (ta_xmpp_client_t *TA_UNUSED(client), void *TA_UNUSED(data),
+             void *user_data)
+{
+  (*(int *) user_data)++;
+  return 0;
+}
+
+/* Stores -1 when the request times out, 1 when it is answered */
+static void
+_answer_cb (ta_xmpp_client_t *TA_UNUSED(client), iks *node, void *data)
+{
+  *(int *) data = node ? 1 : -1;
+}
+
+/* Same as `_resumed_cb', but a different hook */
+static int
+_counter_cb (ta_xmpp_client_t *client, void *data, void *user_data)
+{
+  return _resumed_cb (client, data, user_data);
+}
+
+/* Counts its call and disconnects itself */
+static int
+_once_cb (ta_xmpp_client_t *client, void *TA_UNUSED(data), void *user_data)
+{
+  (*(int *) user_data)++;
+  ta_xmpp_client_event_disconnect_id (client, TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                      _once_cb);
+  return 0;
+}
+
+static int
+_acked_cb (ta_xmpp_client_t *TA_UNUSED(client), void *data, void *user_data)
+{
+  *(unsigned long *) user_data = *(unsigned long *) data;
+  return 0;
+}
+
+/* Writes `xml' to the client, lets it process what was received and
+ * then reads its answer to `out' */
+static void
+_server_say (ta_xmpp_client_t *client, int fd, const char *xml,
+             char *out, size_t size)
+{
+  if (write (fd, xml, strlen (xml)) < 0)
+    return;
+  ta_xmpp_client_process (client, 1000);
+  fixture_server_read (fd, out, size);
+}
+
+/* Opens a stream and authenticates the client, the last answer is the
+ * binding or the resumption of the stream */
+static void
+_server_open (ta_xmpp_client_t *client, int fd, char *out, size_t size)
+{
+  _server_say (client, fd, STREAM_START SASL_FEATURES, out, size);
+  _server_say (client, fd, SASL_SUCCESS, out, size);
+  _server_say (client, fd, STREAM_START SM_FEATURES, out, size);
+}
+
+#ifdef HAVE_ZLIB
+
+/* Like `_server_say' and `fixture_server_read' but for a compressed stream */
+static void
+_server_zsay (ta_xmpp_client_t *client, int fd, z_stream *deflater,
+              const char *xml)
+{
+  unsigned char data[2048];
+  deflater->next_in = (unsigned char *) xml;
+  deflater->avail_in = strlen (xml);
+  deflater->next_out = data;
+  deflater->avail_out = sizeof (data);
+  deflate (deflater, Z_SYNC_FLUSH);
+  if (write (fd, data, sizeof (data) - deflater->avail_out) < 0)
+    return;
+  ta_xmpp_client_process (client, 1000);
+}
+
+static void
+_server_zread (int fd, z_stream *inflater, char *out, size_t size)
+{
+  unsigned char data[2048];
+  struct pollfd pfd;
+  ssize_t n;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  inflater->next_out = (unsigned char *) out;
+  inflater->avail_out = size - 1;
+  while (poll (&pfd, 1, 50) > 0 && (n = read (fd, data, sizeof (data))) > 0)
+    {
+      inflater->next_in = data;
+      inflater->avail_in = n;
+      inflate (inflater, Z_SYNC_FLUSH);
+    }
+  out[size - 1 - inflater->avail_out] = '\0';
+}
+
+#endif
+
+START_TEST (test_xmpp_queue_enqueue)
+{
+  /* Given that I have a client with a custom queue notifier */
+  int notified = 0, i;
+  iks *node;
+  ta_xmpp_client_queue_stats_t stats;
+  ta_xmpp_client_t *client;
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  ta_xmpp_client_set_queue_notify (client, _notify_cb, &notified);
+
+  /* When I enqueue some stanzas */
+  node = iks_make_msg (IKS_TYPE_CHAT, "someone@localhost", "Hi");
+  for (i = 0; i < 3; i++)
+    fail_unless (ta_xmpp_client_enqueue (client, node) == TA_OK,
+                 "Stanza should be accepted");
+  iks_delete (node);
+
+  /* Then I see that they are waiting in the queue and that the
+   * notifier was only called for the first one */
+  ta_xmpp_client_get_queue_stats (client, &stats);
+  fail_unless (stats.depth == 3, "Wrong queue depth");
+  fail_unless (stats.max_depth == 3, "Wrong max queue depth");
+  fail_unless (stats.enqueued == 3, "Wrong enqueued counter");
+  fail_unless (stats.written == 0, "Nothing should be written");
+  fail_unless (notified == 1, "Notifier should be called once");
+
+  /* When I disconnect the client */
+  ta_xmpp_client_disconnect (client);
+
+  /* Then I see that the queue was dropped */
+  ta_xmpp_client_get_queue_stats (client, &stats);
+  fail_unless (stats.depth == 0, "Queue should be empty after disconnect");
+
+  ta_object_unref (client);
+}
+END_TEST
+
+
+START_TEST (test_xmpp_queue_limit)
+{
+  /* Given that I have a client with a small queue */
+  const ta_error_t *error;
+  iks *node;
+  ta_xmpp_client_queue_stats_t stats;
+  ta_xmpp_client_t *client;
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  ta_xmpp_client_set_queue_limit (client, 2);
+  node = iks_make_msg (IKS_TYPE_CHAT, "someone@localhost", "Hi");
+
+  /* When I enqueue more stanzas than the queue can hold */
+  ta_xmpp_client_enqueue (client, node);
+  ta_xmpp_client_enqueue (client, node);
+
+  /* Then I see that the last one is refused */
+  fail_unless (ta_xmpp_client_enqueue (client, node) == TA_ERROR,
+               "Full queue should refuse stanzas");
+  error = ta_error_last ();
+  fail_unless (error->code == TA_XMPP_QUEUE_FULL_ERROR, "Wrong error code");
+  ta_xmpp_client_get_queue_stats (client, &stats);
+  fail_unless (stats.depth == 2, "Refused stanza should not be queued");
+  fail_unless (stats.rejected == 1, "Wrong rejected counter");
+
+  iks_delete (node);
+  ta_object_unref (client);
+}
+END_TEST
+
+
+START_TEST (test_xmpp_queue_many_producers)
+{
+  /* Given that I have a client without a queue limit */
+  pthread_t threads[PRODUCERS];
+  ta_xmpp_client_queue_stats_t stats;
+  ta_xmpp_client_t *client;
+  int i;
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  ta_xmpp_client_set_queue_limit (client, 0);
+
+  /* When many threads enqueue stanzas at the same time */
+  for (i = 0; i < PRODUCERS; i++)
+    pthread_create (&threads[i], NULL, _producer, client);
+  for (i = 0; i < PRODUCERS; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Then I see that no stanza was lost */
+  ta_xmpp_client_get_queue_stats (client, &stats);
+  fail_unless (stats.depth == PRODUCERS * STANZAS_PER_PRODUCER,
+               "Wrong queue depth");
+  fail_unless (stats.enqueued == PRODUCERS * STANZAS_PER_PRODUCER,
+               "Wrong enqueued counter");
+
+  ta_object_unref (client);
+}
+END_TEST
+
+
+START_TEST (test_xmpp_queue_full_while_flushing)
+{
+  /* Given that I have a connected client with a small queue */
+  pthread_t threads[PRODUCERS];
+  ta_xmpp_client_queue_stats_t stats;
+  ta_xmpp_client_t *client;
+  char buf[4096];
+  int fds[2], i;
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  ta_xmpp_client_set_queue_limit (client, 8);
+  fail_unless (ta_xmpp_client_connect_fd (client, fds[0]) == TA_OK,
+               "Client should accept the socket");
+
+  /* When many threads fill the queue while it is being flushed */
+  for (i = 0; i < PRODUCERS; i++)
+    pthread_create (&threads[i], NULL, _producer, client);
+  do
+    {
+      ta_xmpp_client_flush (client);
+      fixture_server_read (fds[1], buf, sizeof (buf));
+      ta_xmpp_client_get_queue_stats (client, &stats);
+    }
+  while (stats.enqueued + stats.rejected < PRODUCERS * STANZAS_PER_PRODUCER
+         || stats.depth > 0);
+  for (i = 0; i < PRODUCERS; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Then I see that the flush never waited for rejected stanzas and
+   * that the limit was respected */
+  fail_unless (stats.written == stats.enqueued, "Stanzas were lost");
+  fail_unless (stats.max_depth <= 8, "Wrong max depth: %d",
+               stats.max_depth);
+  fail_unless (stats.rejected > 0, "Some stanzas should be refused");
+
+  ta_xmpp_client_disconnect (client);
+  close (fds[1]);
+  ta_object_unref (client);
+}
+END_TEST
+
+
+START_TEST (test_xmpp_connect_fd)
+{
+  /* Given that I have a client connected through a socket of mine */
+  ta_xmpp_client_t *client;
+  char buf[256];
+  int fds[2];
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  fail_unless (ta_xmpp_client_connect_fd (client, fds[0]) == TA_OK,
+               "Client should accept the socket");
+  fail_unless (ta_xmpp_client_get_fd (client) == fds[0], "Wrong fd");
+
+  /* When I disconnect the client */
+  ta_xmpp_client_disconnect (client);
+
+  /* Then I see that the socket was closed */
+  while (read (fds[1], buf, sizeof (buf)) > 0);
+  fail_unless (read (fds[1], buf, sizeof (buf)) == 0,
+               "The socket should be closed");
+
+  close (fds[1]);
+  ta_object_unref (client);
+}
+END_TEST
+
+START_TEST (test_xmpp_process)
+{
+  /* Given that I have a client driven by hand through a socket of
+   * mine, with a short request timeout */
+  ta_xmpp_client_t *client;
+  unsigned long start;
+  iks *node;
+  const char *msg = "<message from='a@localhost'><body>hi</body></message>";
+  int fds[2], received = 0, answered = 0;
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  ta_xmpp_client_set_request_timeout (client, 50);
+  ta_xmpp_client_event_connect (client, "message-received", _resumed_cb,
+                                &received);
+  fail_unless (ta_xmpp_client_connect_fd (client, fds[0]) == TA_OK,
+               "Client should accept the socket");
+  fail_unless (ta_xmpp_client_get_fd (client) == fds[0], "Wrong fd");
+  fail_unless (ta_xmpp_client_get_timeout (client) == -1,
+               "There should be no deadline");
+
+  /* When nothing arrives */
+  start = ta_timer_now ();
+  fail_unless (ta_xmpp_client_process (client, 0) == TA_OK, "Step failed");
+
+  /* Then I see that a step without timeout doesn't wait */
+  fail_unless (ta_timer_now () - start < 50, "Should not wait");
+  fail_unless (received == 0, "Nothing was received");
+
+  /* And that a step with a timeout waits for it */
+  start = ta_timer_now ();
+  ta_xmpp_client_process (client, 100);
+  fail_unless (ta_timer_now () - start >= 90, "Should wait");
+
+  /* When a message arrives */
+  fail_unless (write (fds[1], msg, strlen (msg)) > 0, "Could not write");
+  ta_xmpp_client_process (client, 0);
+
+  /* Then I see that it was parsed */
+  fail_unless (received == 1, "Message should be received");
+
+  /* When I send a request that is never answered */
+  node = iks_make_iq (IKS_TYPE_GET, "jabber:iq:version");
+  ta_xmpp_client_send_and_filter (client, node, _answer_cb, &answered,
+                                  NULL);
+  iks_delete (node);
+
+  /* Then I see that the deadline is reported and that the step
+   * wakes up to expire the request */
+  fail_unless (ta_xmpp_client_get_timeout (client) >= 0 &&
+               ta_xmpp_client_get_timeout (client) <= 50,
+               "Wrong deadline");
+  ta_xmpp_client_process (client, -1);
+  fail_unless (answered == -1, "Request should time out");
+  fail_unless (ta_xmpp_client_get_timeout (client) == -1,
+               "There should be no deadline left");
+
+  ta_xmpp_client_disconnect (client);
+  close (fds[1]);
+  ta_object_unref (client);
+}
+END_TEST
+
+START_TEST (test_xmpp_event_ids)
+{
+  /* Given that I have a client with hooks connected by name and by
+   * id to the same event */
+  ta_xmpp_client_t *client;
+  int fds[2], by_name = 0, by_id = 0;
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  fail_unless (ta_xmpp_client_event_lookup ("connected") ==
+               TA_XMPP_CLIENT_EVENT_CONNECTED, "Wrong id");
+  fail_unless (ta_xmpp_client_event_lookup ("acked") ==
+               TA_XMPP_CLIENT_EVENT_ACKED, "Wrong id");
+  fail_unless (ta_xmpp_client_event_lookup ("nothing") == -1,
+               "Unknown events should not be found");
+  fail_unless (ta_xmpp_client_event_connect (client, "nothing",
+                                             _resumed_cb, NULL) == 0,
+               "Unknown events should be refused");
+  ta_xmpp_client_event_connect (client, "connected", _resumed_cb, &by_name);
+  ta_xmpp_client_event_connect_id (client, TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                   _counter_cb, &by_id);
+
+  /* When the client connects */
+  fail_unless (ta_xmpp_client_connect_fd (client, fds[0]) == TA_OK,
+               "Client should accept the socket");
+
+  /* Then I see that both hooks were called */
+  fail_unless (by_name == 1 && by_id == 1, "Hooks should be called");
+
+  /* When I disconnect the hook by name and connect again */
+  ta_xmpp_client_disconnect (client);
+  ta_xmpp_client_event_disconnect (client, "connected", _resumed_cb);
+  close (fds[1]);
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  ta_xmpp_client_connect_fd (client, fds[0]);
+
+  /* Then I see that only the other hook was called */
+  fail_unless (by_name == 1, "Disconnected hook should not be called");
+  fail_unless (by_id == 2, "Hook should be called again");
+
+  ta_xmpp_client_disconnect (client);
+  close (fds[1]);
+  ta_object_unref (client);
+}
+END_TEST
+
+START_TEST (test_xmpp_event_disconnect_from_hook)
+{
+  /* Given that I have a client with two hooks connected to the same
+   * event, the first one disconnecting itself */
+  ta_xmpp_client_t *client;
+  int fds[2], once = 0, always = 0;
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  ta_xmpp_client_event_connect_id (client, TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                   _once_cb, &once);
+  ta_xmpp_client_event_connect_id (client, TA_XMPP_CLIENT_EVENT_CONNECTED,
+                                   _counter_cb, &always);
+
+  /* When the client connects */
+  ta_xmpp_client_connect_fd (client, fds[0]);
+
+  /* Then I see that the hook after the disconnected one was called */
+  fail_unless (once == 1, "First hook should be called");
+  fail_unless (always == 1, "Second hook should not be skipped");
+
+  /* When the client connects again */
+  ta_xmpp_client_disconnect (client);
+  close (fds[1]);
+  fail_unless (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0,
+               "Could not create sockets");
+  ta_xmpp_client_connect_fd (client, fds[0]);
+
+  /* Then I see that only the remaining hook was called */
+  fail_unless (once == 1, "Disconnected hook should not be called");
+  fail_unless (always == 2, "Hook should be called again");
+
+  ta_xmpp_client_disconnect (client);
+  close (fds[1]);
+  ta_object_unref (client);
+}
+END_TEST
+
+START_TEST (test_xmpp_stream_resume)
+{
+  /* Given that I have a client with stream management enabled in a
+   * stream that can be resumed */
+  ta_xmpp_client_t *client;
+  iks *node;
+  char buf[2048];
+  int lfd, sfd, port, i, resumed = 0;
+  lfd = fixture_listen (&port);
+  fail_unless (lfd >= 0, "Could not listen");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd",
+                               "127.0.0.1", port);
+  ta_xmpp_client_set_reconnect (client, 10, 100, 3);
+  ta_xmpp_client_set_stream_management (client, 1);
+  ta_xmpp_client_event_connect (client, "resumed", _resumed_cb, &resumed);
+  fail_unless (ta_xmpp_client_connect (client) == TA_OK, "Can't connect");
+  sfd = accept (lfd, NULL, NULL);
+
+  _server_open (client, sfd, buf, sizeof (buf));
+  fail_unless (strstr (buf, "id='bind'") != NULL, "Should bind");
+  _server_say (client, sfd, "<iq type='result' id='bind'/>",
+               buf, sizeof (buf));
+  fail_unless (strstr (buf, "<enable") != NULL, "Should enable SM");
+  _server_say (client, sfd,
+               "<enabled xmlns='urn:xmpp:sm:3' id='s1' resume='true'/>",
+               buf, sizeof (buf));
+
+  /* When I send two stanzas and the server acknowledges the first
+   * one */
+  ta_xmpp_client_send_raw (client, "<message><body>1</body></message>");
+  ta_xmpp_client_send_raw (client, "<message><body>2</body></message>");
+  fail_unless (ta_xmpp_client_get_unacked (client) == 2,
+               "Two stanzas should be waiting for acks");
+  _server_say (client, sfd,
+               "<message from='a@localhost'/>"
+               "<a xmlns='urn:xmpp:sm:3' h='1'/><r xmlns='urn:xmpp:sm:3'/>",
+               buf, sizeof (buf));
+
+  /* Then I see that the client forgot the first one and acknowledged
+   * the message it received */
+  fail_unless (ta_xmpp_client_get_unacked (client) == 1,
+               "The acked stanza should be forgotten");
+  fail_unless (strstr (buf, "h='1'") != NULL, "Wrong ack: %s", buf);
+
+  /* When the connection breaks */
+  close (sfd);
+  ta_xmpp_client_process (client, 1000);
+
+  /* Then I see that the client keeps running and connects again */
+  fail_unless (ta_xmpp_client_is_running (client) == TA_OK,
+               "The client should still be running");
+  for (i = 0; i < 10 && ta_xmpp_client_get_fd (client) < 0; i++)
+    ta_xmpp_client_process (client, 100);
+  fail_unless (ta_xmpp_client_get_fd (client) >= 0, "Should reconnect");
+  sfd = accept (lfd, NULL, NULL);
+
+  /* And that it resumes the stream instead of binding a new
+   * resource */
+  _server_open (client, sfd, buf, sizeof (buf));
+  fail_unless (strstr (buf, "<resume") != NULL, "Should resume: %s", buf);
+  fail_unless (strstr (buf, "previd='s1'") != NULL, "Wrong id: %s", buf);
+  fail_unless (strstr (buf, "id='bind'") == NULL, "Should not bind");
+
+  /* When I enqueue a stanza while the stream is being resumed */
+  node = iks_make_msg (IKS_TYPE_CHAT, "someone@localhost", "3");
+  ta_xmpp_client_enqueue (client, node);
+  iks_delete (node);
+
+  /* Then I see that the client doesn't ask to write it yet */
+  fail_unless (ta_xmpp_client_get_io_events (client) ==
+               TA_XMPP_CLIENT_WANT_READ, "Nothing should be written yet");
+
+  /* And that only the stanza that was not acknowledged is sent
+   * again */
+  _server_say (client, sfd,
+               "<resumed xmlns='urn:xmpp:sm:3' h='1' previd='s1'/>",
+               buf, sizeof (buf));
+  fail_unless (strstr (buf, "<body>2</body>") != NULL,
+               "The stanza should be sent again: %s", buf);
+  fail_unless (strstr (buf, "<body>1</body>") == NULL,
+               "The acked stanza should not be sent again");
+  fail_unless (strstr (buf, "<body>3</body>") != NULL,
+               "The queue should be written after resuming: %s", buf);
+  fail_unless (resumed == 1, "The resumed event should be called");
+
+  ta_object_unref (client);
+  close (sfd);
+  close (lfd);
+}
+END_TEST
+
+/* Starts a connection to the local `port' without waiting for it */
+static int
+_connect_later (int port)
+{
+  struct sockaddr_in addr;
+  int fd;
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (port);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  connect (fd, (struct sockaddr *) &addr, sizeof (addr));
+  return fd;
+}
+
+START_TEST (test_xmpp_reconnect_background)
+{
+  /* Given that I have a connected client that reconnects by itself
+   * to a server whose accept queue is full, so connecting to it
+   * blocks */
+  ta_xmpp_client_t *client;
+  unsigned long started;
+  int lfd, sfd, port, filler[2], i;
+  lfd = fixture_listen (&port);
+  fail_unless (lfd >= 0, "Could not listen");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd",
+                               "127.0.0.1", port);
+  ta_xmpp_client_set_reconnect (client, 10, 10, 0);
+  fail_unless (ta_xmpp_client_connect (client) == TA_OK, "Can't connect");
+  sfd = accept (lfd, NULL, NULL);
+  listen (lfd, 0);
+  filler[0] = _connect_later (port);
+  filler[1] = _connect_later (port);
+
+  /* When the connection breaks and the client tries to reconnect */
+  close (sfd);
+  started = ta_timer_now ();
+  for (i = 0; i < 5; i++)
+    ta_xmpp_client_process (client, 50);
+
+  /* Then I see that processing the client never waited for the
+   * connection */
+  fail_unless (ta_timer_now () - started < 1000,
+               "Reconnecting should not block the client");
+  fail_unless (ta_xmpp_client_is_running (client) == TA_OK,
+               "The client should still be running");
+  fail_unless (ta_xmpp_client_get_fd (client) < 0,
+               "The server did not accept the connection yet");
+
+  /* When the server accepts connections again */
+  close (accept (lfd, NULL, NULL));
+  close (filler[0]);
+  close (filler[1]);
+  for (i = 0; i < 100 && ta_xmpp_client_get_fd (client) < 0; i++)
+    ta_xmpp_client_process (client, 100);
+
+  /* Then I see that the client adopted the new connection */
+  fail_unless (ta_xmpp_client_get_fd (client) >= 0, "Should reconnect");
+
+  ta_object_unref (client);
+  close (lfd);
+}
+END_TEST
+
+START_TEST (test_xmpp_ack_batch)
+{
+  /* Given that I have a client that asks for acknowledgements every
+   * two stanzas or 50ms and keeps only four stanzas */
+  ta_xmpp_client_t *client;
+  ta_xmpp_client_sm_stats_t stats;
+  unsigned long acked = 0;
+  char buf[2048];
+  int lfd, sfd, port, i;
+  lfd = fixture_listen (&port);
+  fail_unless (lfd >= 0, "Could not listen");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd",
+                               "127.0.0.1", port);
+  ta_xmpp_client_set_stream_management (client, 1);
+  ta_xmpp_client_set_ack_batch (client, 2, 50);
+  ta_xmpp_client_set_replay_limit (client, 4);
+  ta_xmpp_client_event_connect (client, "acked", _acked_cb, &acked);
+  fail_unless (ta_xmpp_client_connect (client) == TA_OK, "Can't connect");
+  sfd = accept (lfd, NULL, NULL);
+  _server_open (client, sfd, buf, sizeof (buf));
+  _server_say (client, sfd, "<iq type='result' id='bind'/>",
+               buf, sizeof (buf));
+  _server_say (client, sfd, "<enabled xmlns='urn:xmpp:sm:3'/>",
+               buf, sizeof (buf));
+
+  /* When I send a single stanza */
+  ta_xmpp_client_send_raw (client, "<message/>");
+
+  /* Then I see that the ack is only requested when the batch times
+   * out */
+  fixture_server_read (sfd, buf, sizeof (buf));
+  fail_unless (strstr (buf, "<r ") == NULL, "Too early: %s", buf);
+  ta_xmpp_client_process (client, 1000);
+  fixture_server_read (sfd, buf, sizeof (buf));
+  fail_unless (strstr (buf, "<r ") != NULL, "Should ask for an ack");
+
+  /* When I send two more stanzas */
+  ta_xmpp_client_send_raw (client, "<message/>");
+  ta_xmpp_client_send_raw (client, "<message/>");
+
+  /* Then I see that the complete batch is requested right away */
+  fixture_server_read (sfd, buf, sizeof (buf));
+  fail_unless (strstr (buf, "<r ") != NULL, "Should ask for an ack");
+
+  /* When I send more stanzas than the replay buffer holds */
+  for (i = 0; i < 3; i++)
+    ta_xmpp_client_send_raw (client, "<message/>");
+
+  /* Then I see that the oldest ones were dropped */
+  ta_xmpp_client_get_sm_stats (client, &stats);
+  fail_unless (stats.sent == 6, "Wrong sent count: %lu", stats.sent);
+  fail_unless (stats.unacked == 6, "Wrong unacked: %lu", stats.unacked);
+  fail_unless (stats.kept == 4, "Wrong kept count: %lu", stats.kept);
+  fail_unless (stats.overwritten == 2, "Wrong overwritten count");
+  fail_unless (stats.requests == 3, "Wrong requests: %lu", stats.requests);
+
+  /* When the server acknowledges everything */
+  _server_say (client, sfd, "<a xmlns='urn:xmpp:sm:3' h='6'/>",
+               buf, sizeof (buf));
+
+  /* Then I see that the buffer is empty and the hook was called */
+  ta_xmpp_client_get_sm_stats (client, &stats);
+  fail_unless (stats.unacked == 0 && stats.kept == 0,
+               "Nothing should be waiting");
+  fail_unless (acked == 6, "Wrong acked count: %lu", acked);
+
+  ta_object_unref (client);
+  close (sfd);
+  close (lfd);
+}
+END_TEST
+
+#ifdef HAVE_ZLIB
+
+START_TEST (test_xmpp_compression)
+{
+  /* Given that I have a client that asks for compression and a server
+   * that offers it after the authentication */
+  ta_xmpp_client_t *client;
+  ta_xmpp_client_compress_stats_t stats;
+  z_stream deflater, inflater;
+  char buf[2048];
+  int lfd, sfd, port;
+  lfd = fixture_listen (&port);
+  fail_unless (lfd >= 0, "Could not listen");
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd",
+                               "127.0.0.1", port);
+  fail_unless (ta_xmpp_client_set_compression
+               (client, 6, TA_XMPP_COMPRESS_FLUSH_SYNC) == TA_OK,
+               "Compression should be supported");
+  fail_unless (ta_xmpp_client_connect (client) == TA_OK, "Can't connect");
+  sfd = accept (lfd, NULL, NULL);
+  fail_unless (ta_xmpp_client_get_fd (client) >= 0, "Should have a fd");
+  _server_say (client, sfd, STREAM_START SASL_FEATURES, buf, sizeof (buf));
+  _server_say (client, sfd, SASL_SUCCESS, buf, sizeof (buf));
+
+  /* When the server offers compression */
+  _server_say (client, sfd, STREAM_START COMPRESS_FEATURES,
+               buf, sizeof (buf));
+
+  /* Then I see that the client asks for it instead of binding */
+  fail_unless (strstr (buf, "<compress") != NULL, "Should compress: %s",
+               buf);
+  fail_unless (strstr (buf, "<method>zlib</method>") != NULL,
+               "Wrong method: %s", buf);
+  fail_unless (strstr (buf, "id='bind'") == NULL, "Should not bind yet");
+
+  /* When the server accepts it */
+  memset (&deflater, 0, sizeof (deflater));
+  memset (&inflater, 0, sizeof (inflater));
+  deflateInit (&deflater, Z_DEFAULT_COMPRESSION);
+  inflateInit (&inflater);
+  fail_unless (write (sfd, COMPRESSED, strlen (COMPRESSED)) > 0,
+               "Could not write");
+  ta_xmpp_client_process (client, 1000);
+
+  /* Then I see that the client restarts the stream compressed */
+  _server_zread (sfd, &inflater, buf, sizeof (buf));
+  fail_unless (strstr (buf, "<stream:stream") != NULL,
+               "Should restart the stream: %s", buf);
+
+  /* And that it binds the resource in the compressed stream */
+  _server_zsay (client, sfd, &deflater, STREAM_START SM_FEATURES);
+  _server_zread (sfd, &inflater, buf, sizeof (buf));
+  fail_unless (strstr (buf, "id='bind'") != NULL, "Should bind: %s", buf);
+
+  /* And that the compressed bytes were counted */
+  ta_xmpp_client_get_compress_stats (client, &stats);
+  fail_unless (stats.raw_out > 0 && stats.compressed_out > 0,
+               "Output should be counted");
+  fail_unless (stats.raw_in == strlen (STREAM_START SM_FEATURES),
+               "Wrong raw input: %lu", stats.raw_in);
+  fail_unless (stats.compressed_in > 0, "Input should be counted");
+
+  deflateEnd (&deflater);
+  inflateEnd (&inflater);
+  ta_object_unref (client);
+  close (sfd);
+  close (lfd);
+}
+END_TEST
+
+#endif
+
+Suite *
+xmpp_suite ()
+{
+  Suite *s = suite_create ("taningia::xmpp");
+  TCase *tc_core = tcase_create ("Core");
+  tcase_add_test (tc_core, test_xmpp_queue_enqueue);
+  tcase_add_test (tc_core, test_xmpp_queue_limit);
+  tcase_add_test (tc_core, test_xmpp_queue_many_producers);
+  tcase_add_test (tc_core, test_xmpp_queue_full_while_flushing);
+  tcase_add_test (tc_core, test_xmpp_connect_fd);
+  tcase_add_test (tc_core, test_xmpp_process);
+  tcase_add_test (tc_core, test_xmpp_event_ids);
+  tcase_add_test (tc_core, test_xmpp_event_disconnect_from_hook);
+  tcase_add_test (tc_core, test_xmpp_stream_resume);
+  tcase_add_test (tc_core, test_xmpp_reconnect_background);
+  tcase_add_test (tc_core, test_xmpp_ack_batch);
+#ifdef HAVE_ZLIB
+  tcase_add_test (tc_core, test_xmpp_compression);
+#endif
+  suite_add_tcase (s, tc_core);
+  return s;
+}
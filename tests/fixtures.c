@@ -0,0 +1,82 @@
+/* fixtures.c - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <taningia/error.h>
+#include "fixtures.h"
+
+int
+fixture_listen (int *port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof (addr);
+  int fd;
+
+  if ((fd = socket (AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) != 0
+      || listen (fd, 8) != 0
+      || getsockname (fd, (struct sockaddr *) &addr, &len) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+  *port = ntohs (addr.sin_port);
+  return fd;
+}
+
+ta_xmpp_client_t *
+fixture_client_new (int *peer)
+{
+  ta_xmpp_client_t *client;
+  int fds[2];
+  client = ta_xmpp_client_new ("lincoln@localhost", "passwd", NULL, 0);
+  *peer = -1;
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    return client;
+  if (ta_xmpp_client_connect_fd (client, fds[0]) == TA_OK)
+    *peer = fds[1];
+  else
+    {
+      close (fds[0]);
+      close (fds[1]);
+    }
+  return client;
+}
+
+void
+fixture_server_read (int fd, char *out, size_t size)
+{
+  struct pollfd pfd;
+  ssize_t n, len = 0;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while ((size_t) len < size - 1 && poll (&pfd, 1, 50) > 0 &&
+         (n = read (fd, out + len, size - len - 1)) > 0)
+    len += n;
+  out[len] = '\0';
+}
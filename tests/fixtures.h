@@ -0,0 +1,41 @@
+/* fixtures.h - This file is part of the taningia library
+ *
+ * Copyright (C) 2012  Lincoln de Sousa <lincoln@comum.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TANINGIA_CHECK_FIXTURES_H_
+#define _TANINGIA_CHECK_FIXTURES_H_
+
+#include <stddef.h>
+#include <taningia/xmpp.h>
+
+/* Socket fixtures shared by the suites that talk to clients. They
+ * don't assert anything, failures are reported through the return
+ * values so each test decides what to check. */
+
+/* Returns a socket listening on a free port of the loopback and
+ * stores the port in `port', or -1 on error */
+int fixture_listen (int *port);
+
+/* Creates a client connected through one end of a socket pair, the
+ * other end is stored in `peer' (-1 if the connection failed) */
+ta_xmpp_client_t *fixture_client_new (int *peer);
+
+/* Reads what the client wrote to `out', waiting a bit for more data
+ * after each read. `out' is always NUL terminated. */
+void fixture_server_read (int fd, char *out, size_t size);
+
+#endif  /* _TANINGIA_CHECK_FIXTURES_H_ */